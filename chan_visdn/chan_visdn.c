@@ -4529,14 +4529,6 @@ static void visdn_q931_connect_channel(
 		goto err_pipeline_rx_connect;
 	}
 
-	err = ks_pipeline_create(visdn_chan->pipeline_rx, ks_conn);
-	if (err < 0) {
-		ast_log(LOG_ERROR,
-			"Cannot create RX pipeline: %s\n",
-			strerror(-err));
-		goto err_pipeline_rx_create;
-	}
-
 	err = visdn_pipeline_set_octet_reverser(visdn_chan->pipeline_rx, TRUE);
 	if (err < 0) {
 		ast_log(LOG_ERROR,
@@ -4544,11 +4536,16 @@ static void visdn_q931_connect_channel(
 		goto err_pipeline_rx_octet_reverser_enable;
 	}
 
-	err = ks_pipeline_update_chans(visdn_chan->pipeline_rx, ks_conn);
+	/* Create and start RX pipeline in a single request */
+	visdn_chan->pipeline_rx->status = KS_PIPELINE_STATUS_FLOWING;
+	visdn_chan->pipeline_rx->non_persistent = TRUE;
+
+	err = ks_pipeline_setup(visdn_chan->pipeline_rx, ks_conn);
 	if (err < 0) {
 		ast_log(LOG_ERROR,
-			"Cannot update pipeline's channels\n");
-		goto err_pipeline_rx_update_chans;
+			"Cannot create RX pipeline: %s\n",
+			strerror(-err));
+		goto err_pipeline_rx_setup;
 	}
 
 	/* Create TX pipeline */
@@ -4571,20 +4568,6 @@ static void visdn_q931_connect_channel(
 		goto err_pipeline_tx_connect;
 	}
 
-	err = ks_pipeline_create(visdn_chan->pipeline_tx, ks_conn);
-	if (err < 0) {
-		ast_log(LOG_ERROR,
-			"Cannot create pipeline: %s\n",
-			strerror(-err));
-		goto err_pipeline_tx_create;
-	}
-
-	err = ks_conn_remote_topology_unlock(ks_conn);
-	if (err < 0) {
-		ast_log(LOG_ERROR,
-			"Error unlocking kstreamer's topology\n");
-	}
-
 	err = visdn_pipeline_set_octet_reverser(visdn_chan->pipeline_tx, TRUE);
 	if (err < 0) {
 		ast_log(LOG_ERROR,
@@ -4592,31 +4575,22 @@ static void visdn_q931_connect_channel(
 		goto err_pipeline_tx_octet_reverser_enable;
 	}
 
-	err = ks_pipeline_update_chans(visdn_chan->pipeline_tx, ks_conn);
-	if (err < 0) {
-		ast_log(LOG_ERROR,
-			"Cannot update TX pipeline's channels\n");
-		goto err_pipeline_tx_update_chans;
-	}
-
-	/* Start RX pipelines */
-	visdn_chan->pipeline_rx->status = KS_PIPELINE_STATUS_FLOWING;
+	/* Create and start TX pipeline in a single request */
+	visdn_chan->pipeline_tx->status = KS_PIPELINE_STATUS_FLOWING;
+	visdn_chan->pipeline_tx->non_persistent = TRUE;
 
-	err = ks_pipeline_update(visdn_chan->pipeline_rx, ks_conn);
+	err = ks_pipeline_setup(visdn_chan->pipeline_tx, ks_conn);
 	if (err < 0) {
 		ast_log(LOG_ERROR,
-			"Cannot start RX pipeline\n");
-		goto err_pipeline_rx_update;
+			"Cannot create TX pipeline: %s\n",
+			strerror(-err));
+		goto err_pipeline_tx_setup;
 	}
 
-	/* Start TX pipelines */
-	visdn_chan->pipeline_tx->status = KS_PIPELINE_STATUS_FLOWING;
-
-	err = ks_pipeline_update(visdn_chan->pipeline_tx, ks_conn);
+	err = ks_conn_remote_topology_unlock(ks_conn);
 	if (err < 0) {
 		ast_log(LOG_ERROR,
-			"Cannot start TX pipeline\n");
-		goto err_pipeline_tx_update;
+			"Error unlocking kstreamer's topology\n");
 	}
 
 		/* FIXME TODO FIXME XXX Handle return value */
@@ -4629,18 +4603,15 @@ static void visdn_q931_connect_channel(
 
 	return;
 
-err_pipeline_tx_update:
-err_pipeline_rx_update:
-err_pipeline_tx_update_chans:
+err_pipeline_tx_setup:
 err_pipeline_tx_octet_reverser_enable:
-err_pipeline_tx_create:
 err_pipeline_tx_connect:
 	ks_pipeline_put(visdn_chan->pipeline_tx);
 	visdn_chan->pipeline_tx = NULL;
 err_pipeline_tx_alloc:
-err_pipeline_rx_update_chans:
+	ks_pipeline_destroy(visdn_chan->pipeline_rx, ks_conn);
+err_pipeline_rx_setup:
 err_pipeline_rx_octet_reverser_enable:
-err_pipeline_rx_create:
 err_pipeline_rx_connect:
 	ks_pipeline_put(visdn_chan->pipeline_rx);
 	visdn_chan->pipeline_rx = NULL;
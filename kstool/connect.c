@@ -273,20 +273,12 @@ static int do_connect(const char *pipeline_descr)
 
 	pipeline->status = KS_PIPELINE_STATUS_CONNECTED;
 
-	err = ks_pipeline_create(pipeline, glob.conn);
+	err = ks_pipeline_setup(pipeline, glob.conn);
 	if (err < 0) {
 		fprintf(stderr,
 			"Cannot create pipeline: %s\n",
 				strerror(-err));
-		goto err_pipeline_create;
-	}
-
-	err = ks_pipeline_update_chans(pipeline, glob.conn);
-	if (err < 0) {
-		fprintf(stderr,
-			"Cannot update pipeline's channels: %s\n",
-				strerror(-err));
-		goto err_pipeline_update_chans;
+		goto err_pipeline_setup;
 	}
 
 	printf("pipeline: %06x\n", pipeline->id);
@@ -299,9 +291,7 @@ static int do_connect(const char *pipeline_descr)
 
 	return 0;
 
-err_pipeline_update_chans:
-	ks_pipeline_destroy(pipeline, glob.conn);
-err_pipeline_create:
+err_pipeline_setup:
 err_chan_get_by_token:
 err_apply_parameters:
 err_pipeline_autoroute:
@@ -40,6 +40,7 @@
 #include "pipeline_close.h"
 #include "monitor.h"
 #include "dump.h"
+#include "stats.h"
 
 struct global_state glob;
 
@@ -113,6 +114,7 @@ int main(int argc, char *argv[])
 	list_add_tail(&module_pipeline_stop.node, &glob.modules);
 	list_add_tail(&module_monitor.node, &glob.modules);
 	list_add_tail(&module_dump.node, &glob.modules);
+	list_add_tail(&module_stats.node, &glob.modules);
 
 	glob.conn = ks_conn_create();
 	if (!glob.conn) {
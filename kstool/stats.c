@@ -0,0 +1,149 @@
+/*
+ * kstreamer's controlling program
+ *
+ * Copyright (C) 2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <list.h>
+
+#include <libkstreamer/libkstreamer.h>
+
+#include "kstool.h"
+#include "stats.h"
+
+static void print_chan_stats(struct ks_chan *chan)
+{
+	struct ks_chan_stats stats;
+	int err;
+	int i;
+
+	err = ks_chan_get_stats(chan, glob.conn, &stats);
+	if (err < 0) {
+		fprintf(stderr, "Cannot get stats of chan %s: %s\n",
+			chan->path, strerror(-err));
+		return;
+	}
+
+	printf("%s (0x%08x)\n", chan->path, chan->id);
+	printf("  Frames      : %llu\n", (unsigned long long)stats.frames);
+	printf("  Bytes       : %llu\n", (unsigned long long)stats.bytes);
+	printf("  Drops       : %llu\n", (unsigned long long)stats.drops);
+	printf("  Push errors : %llu\n",
+				(unsigned long long)stats.push_errors);
+
+	if (stats.pressure_samples)
+		printf("  Pressure    : %d - %d\n",
+			stats.pressure_min, stats.pressure_max);
+
+	printf("  Latency     :");
+
+	for (i=0; i<KS_CHAN_STATS_LATENCY_BUCKETS; i++) {
+		if (!stats.latency[i])
+			continue;
+
+		if (i == KS_CHAN_STATS_LATENCY_BUCKETS - 1)
+			printf(" >=%dus:%u", 1 << (i - 1), stats.latency[i]);
+		else
+			printf(" <%dus:%u", 1 << i, stats.latency[i]);
+	}
+
+	printf("\n");
+}
+
+static int handle_stats(int optind)
+{
+	int err;
+
+	err = ks_update_topology(glob.conn);
+	if (err < 0) {
+		fprintf(stderr, "Cannot update topology: %s\n",
+			strerror(-err));
+		return 1;
+	}
+
+	if (glob.argc > optind + 1) {
+		struct ks_chan *chan;
+
+		chan = ks_chan_get_by_path(glob.conn, glob.argv[optind + 1]);
+		if (!chan) {
+			fprintf(stderr, "Cannot find chan '%s'\n",
+				glob.argv[optind + 1]);
+			return 1;
+		}
+
+		print_chan_stats(chan);
+		ks_chan_put(chan);
+
+		return 0;
+	}
+
+	/* Requests cannot be issued holding the topology lock, collect
+	 * the chans first.
+	 */
+	struct ks_chan **chans = NULL;
+	int chans_cnt = 0;
+	int i;
+
+	pthread_rwlock_rdlock(&glob.conn->topology_lock);
+
+	for(i=0; i<ARRAY_SIZE(glob.conn->chans_hash); i++) {
+		struct hlist_node *t;
+		struct ks_chan *chan;
+
+		hlist_for_each_entry(chan, t, &glob.conn->chans_hash[i],
+								node) {
+			chans = realloc(chans,
+				sizeof(*chans) * (chans_cnt + 1));
+			if (!chans) {
+				pthread_rwlock_unlock(
+					&glob.conn->topology_lock);
+
+				fprintf(stderr, "Cannot allocate memory\n");
+				return 1;
+			}
+
+			chans[chans_cnt++] = ks_chan_get(chan);
+		}
+	}
+
+	pthread_rwlock_unlock(&glob.conn->topology_lock);
+
+	for (i=0; i<chans_cnt; i++) {
+		print_chan_stats(chans[i]);
+		ks_chan_put(chans[i]);
+	}
+
+	free(chans);
+
+	return 0;
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"  stats [<chan>]\n"
+		"\n"
+		"    Shows data path counters of a chan, of all chans if\n"
+		"    none is specified.\n");
+}
+
+struct module module_stats =
+{
+	.cmd	= "stats",
+	.do_it	= handle_stats,
+	.usage	= usage,
+};
@@ -0,0 +1,18 @@
+/*
+ * kstreamer's controlling program
+ *
+ * Copyright (C) 2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+extern struct module module_stats;
+
+#endif
@@ -302,6 +302,7 @@ static void ks_chan_update_from_nlmsg(
 		case KS_CHANATTR_PATH:
 		case KS_CHANATTR_FROM:
 		case KS_CHANATTR_TO:
+		case KS_CHANATTR_STATS:
 			/* Are updates to these allowed? */
 		break;
 
@@ -368,6 +369,9 @@ static struct ks_chan *ks_chan_create_from_nlmsg(
 					*(__u32 *)KS_ATTR_DATA(attr));
 		break;
 
+		case KS_CHANATTR_STATS:
+		break;
+
 		default: {
 			struct ks_feature *feature;
 			feature = _ks_feature_get_by_id(conn, attr->type);
@@ -492,6 +496,11 @@ void ks_chan_nlmsg_dump(
 				*(__u32 *)KS_ATTR_DATA(attr));
 		break;
 
+		case KS_CHANATTR_STATS:
+			report_conn(conn, LOG_DEBUG,
+				"%s  Stats\n", prefix);
+		break;
+
 		default:
 		report_conn(conn, LOG_DEBUG,
 			"%s  Feature: %d\n", prefix,
@@ -595,3 +604,82 @@ err_req_alloc:
 
 	return err;
 }
+
+int ks_chan_get_stats(
+	struct ks_chan *chan,
+	struct ks_conn *conn,
+	struct ks_chan_stats *stats)
+{
+	int err;
+
+	struct ks_req *req;
+	req = ks_req_alloc(conn);
+	if (!req) {
+		err = -ENOMEM;
+		goto err_req_alloc;
+	}
+
+	req->type = KS_NETLINK_CHAN_GET;
+	req->flags = NLM_F_REQUEST;
+
+	req->skb = alloc_skb(4096, GFP_KERNEL);
+	if (!req->skb) {
+		err = -ENOMEM;
+		goto err_skb_alloc;
+	}
+
+	err = ks_netlink_put_attr(req->skb, KS_CHANATTR_ID,
+			&chan->id,
+			sizeof(chan->id));
+	if (err < 0)
+		goto err_put_attr_id;
+
+	ks_conn_queue_request(conn, req);
+	ks_conn_flush_requests(conn);
+
+	ks_req_wait(req);
+	if (req->err < 0) {
+		err = req->err;
+		ks_req_put(req);
+
+		goto err_request_failed;
+	}
+
+	err = -ENOENT;
+
+	struct nlmsghdr *nlh;
+	int len_left = req->response_payload_size;
+
+	for (nlh = req->response_payload;
+	     NLMSG_OK(nlh, len_left);
+	     nlh = NLMSG_NEXT(nlh, len_left)) {
+
+		struct ks_attr *attr;
+		int attrs_len = KS_PAYLOAD(nlh);
+
+		for (attr = KS_ATTRS(nlh);
+		     KS_ATTR_OK(attr, attrs_len);
+		     attr = KS_ATTR_NEXT(attr, attrs_len)) {
+
+			if (attr->type == KS_CHANATTR_STATS &&
+			    KS_ATTR_PAYLOAD(attr) >= sizeof(*stats)) {
+				memcpy(stats, KS_ATTR_DATA(attr),
+						sizeof(*stats));
+				err = 0;
+			}
+		}
+	}
+
+	ks_req_put(req);
+
+	return err;
+
+err_request_failed:
+err_put_attr_id:
+	/* skb is freed in req_put */
+err_skb_alloc:
+	ks_req_put(req);
+err_req_alloc:
+
+	return err;
+}
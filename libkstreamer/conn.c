@@ -118,6 +118,8 @@ static const char *ks_conn_message_type_to_string(
 		return "PIPELINE_DEL";
 	case KS_NETLINK_PIPELINE_SET:
 		return "PIPELINE_SET";
+	case KS_NETLINK_PIPELINE_SETUP:
+		return "PIPELINE_SETUP";
 	}
 
 	return "*INVALID*";
@@ -542,6 +544,7 @@ static void ks_conn_nlmsg_dump(
 	case KS_NETLINK_PIPELINE_NEW:
 	case KS_NETLINK_PIPELINE_DEL:
 	case KS_NETLINK_PIPELINE_SET:
+	case KS_NETLINK_PIPELINE_SETUP:
 		ks_pipeline_nlmsg_dump(conn, nlh, prefix);
 	break;
 	}
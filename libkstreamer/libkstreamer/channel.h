@@ -74,6 +74,11 @@ void ks_chan_dump(
 	struct ks_conn *conn,
 	int level);
 
+int ks_chan_get_stats(
+	struct ks_chan *chan,
+	struct ks_conn *conn,
+	struct ks_chan_stats *stats);
+
 #ifdef _LIBKSTREAMER_PRIVATE_
 
 void ks_chan_add(struct ks_chan *chan, struct ks_conn *conn);
@@ -41,6 +41,9 @@ struct ks_pipeline
 
 	enum ks_pipeline_status status;
 
+	/* Destroyed by the kernel when the connection is closed */
+	KSBOOL non_persistent;
+
 	struct ks_chan *chans[32];
 	int chans_cnt;
 };
@@ -65,6 +68,7 @@ void ks_pipeline_dump(
 	int level);
 
 int ks_pipeline_create(struct ks_pipeline *pipeline, struct ks_conn *conn);
+int ks_pipeline_setup(struct ks_pipeline *pipeline, struct ks_conn *conn);
 int ks_pipeline_update(struct ks_pipeline *pipeline, struct ks_conn *conn);
 int ks_pipeline_restart(struct ks_pipeline *pipeline, struct ks_conn *conn);
 int ks_pipeline_destroy(struct ks_pipeline *pipeline, struct ks_conn *conn);
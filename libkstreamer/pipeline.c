@@ -202,6 +202,8 @@ const char *ks_netlink_pipeline_attr_to_string(
 		return "Status";
 	case KS_PIPELINEATTR_CHAN_ID:
 		return "Chan ID";
+	case KS_PIPELINEATTR_NON_PERSISTENT:
+		return "Non persistent";
 	}
 
 	return "UNKNOWN";
@@ -299,6 +301,11 @@ static struct ks_pipeline *ks_pipeline_create_from_nlmsg(
 			        *(__u32 *)KS_ATTR_DATA(attr);
 		break;
 
+		case KS_PIPELINEATTR_NON_PERSISTENT:
+			pipeline->non_persistent =
+				!!*(__u32 *)KS_ATTR_DATA(attr);
+		break;
+
 		case KS_PIPELINEATTR_PATH:
 			pipeline->path = strndup(KS_ATTR_DATA(attr),
 					KS_ATTR_PAYLOAD(attr));
@@ -359,6 +366,11 @@ static void ks_pipeline_update_from_nlmsg(
 			        *(__u32 *)KS_ATTR_DATA(attr);
 		break;
 
+		case KS_PIPELINEATTR_NON_PERSISTENT:
+			pipeline->non_persistent =
+				!!*(__u32 *)KS_ATTR_DATA(attr);
+		break;
+
 		case KS_PIPELINEATTR_PATH:
 			if (pipeline->path)
 				free(pipeline->path);
@@ -520,6 +532,12 @@ void ks_pipeline_nlmsg_dump(
 				*(__u32 *)KS_ATTR_DATA(attr));
 		break;
 
+		case KS_PIPELINEATTR_NON_PERSISTENT:
+			report_conn(conn, LOG_DEBUG,
+				"%s  Non persistent: %d\n", prefix,
+				*(__u32 *)KS_ATTR_DATA(attr));
+		break;
+
 		default:
 			report_conn(conn, LOG_ERR,
 				"%s  Attribute '%s'\n", prefix,
@@ -584,6 +602,17 @@ int ks_pipeline_create(struct ks_pipeline *pipeline, struct ks_conn *conn)
 	if (err < 0)
 		goto err_put_attr_status;
 
+	if (pipeline->non_persistent) {
+		__u32 non_persistent = 1;
+
+		err = ks_netlink_put_attr(req->skb,
+				KS_PIPELINEATTR_NON_PERSISTENT,
+				&non_persistent,
+				sizeof(non_persistent));
+		if (err < 0)
+			goto err_put_attr_non_persistent;
+	}
+
 	int i;
 	for(i=0; i<pipeline->chans_cnt; i++) {
 		err = ks_netlink_put_attr(req->skb, KS_PIPELINEATTR_CHAN_ID,
@@ -615,6 +644,102 @@ int ks_pipeline_create(struct ks_pipeline *pipeline, struct ks_conn *conn)
 	ks_pipeline_del(pipeline);
 err_request_failed:
 err_put_attr_chan_id:
+err_put_attr_non_persistent:
+err_put_attr_status:
+	/* skb is freed in req_put */
+err_skb_alloc:
+	ks_req_put(req);
+err_req_alloc:
+
+	return err;
+}
+
+/*
+ * Creates the pipeline, sets the chans' feature values and brings it to
+ * pipeline->status with a single request.
+ */
+int ks_pipeline_setup(struct ks_pipeline *pipeline, struct ks_conn *conn)
+{
+	int err;
+
+	struct ks_req *req;
+	req = ks_req_alloc(conn);
+	if (!req) {
+		err = -ENOMEM;
+		goto err_req_alloc;
+	}
+
+	req->type = KS_NETLINK_PIPELINE_SETUP;
+	req->flags = NLM_F_REQUEST;
+
+	req->skb = alloc_skb(4096, GFP_KERNEL);
+	if (!req->skb) {
+		err = -ENOMEM;
+		goto err_skb_alloc;
+	}
+
+	err = ks_netlink_put_attr(req->skb, KS_PIPELINEATTR_STATUS,
+			&pipeline->status,
+			sizeof(pipeline->status));
+	if (err < 0)
+		goto err_put_attr_status;
+
+	if (pipeline->non_persistent) {
+		__u32 non_persistent = 1;
+
+		err = ks_netlink_put_attr(req->skb,
+				KS_PIPELINEATTR_NON_PERSISTENT,
+				&non_persistent,
+				sizeof(non_persistent));
+		if (err < 0)
+			goto err_put_attr_non_persistent;
+	}
+
+	int i;
+	for(i=0; i<pipeline->chans_cnt; i++) {
+		struct ks_chan *chan = pipeline->chans[i];
+
+		err = ks_netlink_put_attr(req->skb, KS_PIPELINEATTR_CHAN_ID,
+				&chan->id,
+				sizeof(chan->id));
+		if (err < 0)
+			goto err_put_attr_chan_id;
+
+		struct ks_feature_value *featval;
+		list_for_each_entry(featval, &chan->features, node) {
+
+			err = ks_netlink_put_attr(req->skb,
+					featval->feature->id,
+					featval->payload,
+					featval->len);
+			if (err < 0)
+				goto err_put_attr_features;
+		}
+	}
+
+	ks_conn_queue_request(conn, req);
+	ks_conn_flush_requests(conn);
+
+	ks_req_wait(req);
+	if (req->err < 0) {
+		err = req->err;
+		goto err_request_failed;
+	}
+
+	ks_pipeline_update_from_nlmsg(pipeline, conn, req->response_payload);
+
+	pthread_rwlock_wrlock(&conn->topology_lock);
+	ks_pipeline_add(pipeline, conn);
+	pthread_rwlock_unlock(&conn->topology_lock);
+
+	ks_req_put(req);
+
+	return 0;
+
+err_request_failed:
+err_put_attr_features:
+err_put_attr_chan_id:
+err_put_attr_non_persistent:
 err_put_attr_status:
 	/* skb is freed in req_put */
 err_skb_alloc:
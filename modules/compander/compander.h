@@ -0,0 +1,101 @@
+/*
+ * Kstreamer software A-law/u-law compander
+ *
+ * Copyright (C) 2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#ifndef _KSAMU_COMPANDER_H
+#define _KSAMU_COMPANDER_H
+
+#ifdef __KERNEL__
+
+#include <linux/spinlock.h>
+
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+
+/* On x86-64 SSE2 is always present and is used to encode whole frames,
+ * the FPU state has to be taken around each batch.
+ */
+#ifdef __x86_64__
+#define KSAMU_SSE2
+
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,2,0)
+#include <asm/i387.h>
+#else
+#include <asm/fpu/api.h>
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,36)
+#include <linux/hardirq.h>
+#define irq_fpu_usable() (!in_interrupt())
+#endif
+#endif
+
+#define ksamu_MODULE_NAME "ks-compander"
+#define ksamu_MODULE_PREFIX ksamu_MODULE_NAME ": "
+#define ksamu_MODULE_DESCR "kstreamer A-law/u-law compander"
+
+/* Below this many samples taking the FPU costs more than it saves */
+#define KSAMU_SIMD_MIN 32
+
+struct ksamu_amu
+{
+	struct list_head node;
+
+	struct ks_node ks_node;
+
+	/* Linear samples in, companded samples out */
+	struct ks_chan ks_chan_compander_in;
+	struct ks_chan ks_chan_compander_out;
+
+	/* Companded samples in, linear samples out */
+	struct ks_chan ks_chan_decompander_in;
+	struct ks_chan ks_chan_decompander_out;
+
+	int id;
+
+	int compander_enabled;
+	int compander_mu_mode;
+
+	/* A frame with an odd length leaves half a sample to the next one */
+	spinlock_t compander_lock;
+	int compander_odd_valid;
+	u8 compander_odd;
+
+	int decompander_enabled;
+	int decompander_mu_mode;
+};
+
+#if defined(DEBUG_CODE) && defined(DEBUG_DEFAULTS)
+#define ksamu_debug(dbglevel, format, arg...)			\
+	if (debug_level >= dbglevel)				\
+		printk(KERN_DEBUG ksamu_MODULE_PREFIX		\
+			format,					\
+			## arg)
+#else
+#define ksamu_debug(format, arg...) do {} while (0)
+#endif
+
+#define ksamu_msg(level, format, arg...)			\
+	printk(level ksamu_MODULE_PREFIX			\
+		format,						\
+		## arg)
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#endif
+
+#endif
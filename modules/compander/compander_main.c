@@ -0,0 +1,851 @@
+/*
+ * Kstreamer software A-law/u-law compander
+ *
+ * Copyright (C) 2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+/* Each instance is a node with two independent paths: compander_in ->
+ * compander_out turns native-endian 16 bit linear samples into A-law or
+ * u-law, decompander_in -> decompander_out does the opposite. They
+ * provide the "amu_compander" and "amu_decompander" features for
+ * channels without a hardware compander, while disabled they pass data
+ * through untouched.
+ *
+ * Decoding is a lookup in a 256 entries table. Encoding would need a
+ * table too large to stay in cache, so it computes the segment, on
+ * x86-64 eight samples at a time with SSE2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/bitops.h>
+
+#include <linux/kstreamer/kstreamer.h>
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+#include <linux/kstreamer/pipeline.h>
+#include <linux/kstreamer/streamframe.h>
+#include <linux/kstreamer/softswitch.h>
+#include <linux/kstreamer/feature.h>
+#include <linux/kstreamer/amu_compander.h>
+
+#include "compander.h"
+
+#ifdef DEBUG_CODE
+#ifdef DEBUG_DEFAULTS
+int debug_level = 3;
+#else
+int debug_level = 0;
+#endif
+#endif
+
+static int instances = 32;
+
+static struct list_head ksamu_amus_list = LIST_HEAD_INIT(ksamu_amus_list);
+static DECLARE_RWSEM(ksamu_amus_list_sem);
+
+static struct ks_feature *ksamu_compander_feature;
+static struct ks_feature *ksamu_decompander_feature;
+
+static s16 ksamu_alaw_table[256];
+static s16 ksamu_ulaw_table[256];
+
+static struct ksamu_amu *ksamu_amu_get(struct ksamu_amu *amu)
+{
+	if (ks_node_get(&amu->ks_node))
+		return amu;
+	else
+		return NULL;
+}
+
+static void ksamu_amu_put(struct ksamu_amu *amu)
+{
+	ks_node_put(&amu->ks_node);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Magnitudes are saturated so that -32768 does not overflow a segment */
+static inline u8 ksamu_linear_to_alaw(s16 linear)
+{
+	int sign = linear >> 15;
+	int mag = min((linear ^ sign) - sign, 32767);
+	int seg = fls(mag | 0xff) - 8;
+
+	return ((seg << 4) | ((mag >> (seg ? seg + 3 : 4)) & 0x0f)) ^
+		(sign ? 0x55 : 0xd5);
+}
+
+static inline u8 ksamu_linear_to_ulaw(s16 linear)
+{
+	int sign = linear >> 15;
+	int mag = min((linear ^ sign) - sign, 32635) + 0x84;
+	int seg = fls(mag | 0xff) - 8;
+
+	return ((seg << 4) | ((mag >> (seg + 3)) & 0x0f)) ^
+		(sign ? 0x7f : 0xff);
+}
+
+static void ksamu_tables_init(void)
+{
+	int i;
+
+	for (i=0; i<256; i++) {
+		u8 alaw = i ^ 0x55;
+		u8 ulaw = ~i;
+		int seg;
+		int t;
+
+		seg = (alaw & 0x70) >> 4;
+		t = (alaw & 0x0f) << 4;
+
+		if (seg)
+			t = (t + 0x108) << (seg - 1);
+		else
+			t += 8;
+
+		ksamu_alaw_table[i] = (alaw & 0x80) ? t : -t;
+
+		t = (((ulaw & 0x0f) << 3) + 0x84) << ((ulaw & 0x70) >> 4);
+
+		ksamu_ulaw_table[i] = (ulaw & 0x80) ? 0x84 - t : t - 0x84;
+	}
+}
+
+#ifdef KSAMU_SSE2
+#define KSAMU_VEC(x) { x, x, x, x, x, x, x, x }
+
+/* Offsets are hardcoded in the assembly below */
+static const s16 ksamu_sse2_consts[][8] __attribute__((aligned(16))) = {
+	/* 0: segment thresholds */
+	KSAMU_VEC(0x00ff),
+	KSAMU_VEC(0x01ff),
+	KSAMU_VEC(0x03ff),
+	KSAMU_VEC(0x07ff),
+	KSAMU_VEC(0x0fff),
+	KSAMU_VEC(0x1fff),
+	KSAMU_VEC(0x3fff),
+	/* 112 */ KSAMU_VEC(0x000f),
+	/* 128 */ KSAMU_VEC(0x0080),
+	/* 144 */ KSAMU_VEC(0x00d5),
+	/* 160 */ KSAMU_VEC(0x00ff),
+	/* 176 */ KSAMU_VEC(0x1000),
+	/* 192 */ KSAMU_VEC(0x2000),
+	/* 208 */ KSAMU_VEC(32635),
+	/* 224 */ KSAMU_VEC(0x0084),
+};
+
+/*
+ * xmm1 holds the magnitudes, xmm2 the multipliers. For each segment
+ * threshold passed the segment in xmm3 is incremented and the multiplier
+ * halved, so that pmulhuw shifts the magnitude right by the segment's
+ * amount. A-law segments 0 and 1 share the same shift, so the first
+ * threshold does not halve it.
+ */
+#define KSAMU_SSE2_SEG(off)					\
+		"movdqa %%xmm1, %%xmm4;\n"			\
+		"pcmpgtw " #off "(%[k]), %%xmm4;\n"		\
+		"psubw %%xmm4, %%xmm3;\n"
+
+#define KSAMU_SSE2_SEG_HALVE(off)				\
+		KSAMU_SSE2_SEG(off)				\
+		"movdqa %%xmm2, %%xmm5;\n"			\
+		"psrlw $1, %%xmm5;\n"				\
+		"pand %%xmm4, %%xmm5;\n"			\
+		"psubw %%xmm5, %%xmm2;\n"
+
+#define KSAMU_SSE2_SEGMENTS(first)				\
+		"pxor %%xmm3, %%xmm3;\n"			\
+		first(0)					\
+		KSAMU_SSE2_SEG_HALVE(16)			\
+		KSAMU_SSE2_SEG_HALVE(32)			\
+		KSAMU_SSE2_SEG_HALVE(48)			\
+		KSAMU_SSE2_SEG_HALVE(64)			\
+		KSAMU_SSE2_SEG_HALVE(80)			\
+		KSAMU_SSE2_SEG_HALVE(96)			\
+		"pmulhuw %%xmm2, %%xmm1;\n"			\
+		"pand 112(%[k]), %%xmm1;\n"			\
+		"psllw $4, %%xmm3;\n"				\
+		"por %%xmm1, %%xmm3;\n"
+
+/* The caller must own the FPU state, len is a multiple of 8 */
+static void ksamu_sse2_linear_to_alaw(u8 *dst, const s16 *src, int len)
+{
+	__asm__ __volatile__ (
+		"1:"
+		"movdqu (%[src]), %%xmm1;\n"
+		"movdqa %%xmm1, %%xmm0;\n"
+		"psraw $15, %%xmm0;\n"
+		"pxor %%xmm0, %%xmm1;\n"
+		"psubsw %%xmm0, %%xmm1;\n"
+		"movdqa 176(%[k]), %%xmm2;\n"
+		KSAMU_SSE2_SEGMENTS(KSAMU_SSE2_SEG)
+		"pand 128(%[k]), %%xmm0;\n"
+		"pxor 144(%[k]), %%xmm0;\n"
+		"pxor %%xmm0, %%xmm3;\n"
+		"packuswb %%xmm3, %%xmm3;\n"
+		"movq %%xmm3, (%[dst]);\n"
+		"add $16, %[src];\n"
+		"add $8, %[dst];\n"
+		"sub $8, %[len];\n"
+		"jnz 1b;\n"
+		: [dst] "+r" (dst), [src] "+r" (src), [len] "+r" (len)
+		: [k] "r" (ksamu_sse2_consts)
+		: "memory", "cc",
+		  "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5");
+}
+
+static void ksamu_sse2_linear_to_ulaw(u8 *dst, const s16 *src, int len)
+{
+	__asm__ __volatile__ (
+		"1:"
+		"movdqu (%[src]), %%xmm1;\n"
+		"movdqa %%xmm1, %%xmm0;\n"
+		"psraw $15, %%xmm0;\n"
+		"pxor %%xmm0, %%xmm1;\n"
+		"psubsw %%xmm0, %%xmm1;\n"
+		"pminsw 208(%[k]), %%xmm1;\n"
+		"paddw 224(%[k]), %%xmm1;\n"
+		"movdqa 192(%[k]), %%xmm2;\n"
+		KSAMU_SSE2_SEGMENTS(KSAMU_SSE2_SEG_HALVE)
+		"pand 128(%[k]), %%xmm0;\n"
+		"pxor 160(%[k]), %%xmm0;\n"
+		"pxor %%xmm0, %%xmm3;\n"
+		"packuswb %%xmm3, %%xmm3;\n"
+		"movq %%xmm3, (%[dst]);\n"
+		"add $16, %[src];\n"
+		"add $8, %[dst];\n"
+		"sub $8, %[len];\n"
+		"jnz 1b;\n"
+		: [dst] "+r" (dst), [src] "+r" (src), [len] "+r" (len)
+		: [k] "r" (ksamu_sse2_consts)
+		: "memory", "cc",
+		  "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5");
+}
+#endif
+
+static void ksamu_encode(u8 *dst, const s16 *src, int len, int mu_mode)
+{
+	int i = 0;
+
+#ifdef KSAMU_SSE2
+	/* In an interrupt over a user FPU context the scalar code is used */
+	if (len >= KSAMU_SIMD_MIN && irq_fpu_usable()) {
+		i = len & ~7;
+
+		kernel_fpu_begin();
+
+		if (mu_mode)
+			ksamu_sse2_linear_to_ulaw(dst, src, i);
+		else
+			ksamu_sse2_linear_to_alaw(dst, src, i);
+
+		kernel_fpu_end();
+	}
+#endif
+
+	if (mu_mode) {
+		for (; i<len; i++)
+			dst[i] = ksamu_linear_to_ulaw(src[i]);
+	} else {
+		for (; i<len; i++)
+			dst[i] = ksamu_linear_to_alaw(src[i]);
+	}
+}
+
+static void ksamu_decode(s16 *dst, const u8 *src, int len, int mu_mode)
+{
+	const s16 *table = mu_mode ? ksamu_ulaw_table : ksamu_alaw_table;
+	int i;
+
+	for (i=0; i<len; i++)
+		dst[i] = table[src[i]];
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void ksamu_node_release(struct ks_node *ks_node)
+{
+	struct ksamu_amu *amu = container_of(ks_node,
+					struct ksamu_amu, ks_node);
+
+	ksamu_debug(3, "ksamu_node_release()\n");
+
+	kfree(amu);
+}
+
+static struct ks_node_ops ksamu_node_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksamu_node_release,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void ksamu_compander_in_chan_release(struct ks_chan *ks_chan)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_compander_in);
+
+	ksamu_debug(3, "ksamu_compander_in_chan_release()\n");
+
+	ksamu_amu_put(amu);
+}
+
+static struct ks_chan_ops ksamu_compander_in_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksamu_compander_in_chan_release,
+};
+
+static int ksamu_compander_in_chan_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_compander_in);
+	struct ks_streamframe *out_sf;
+	const u8 *data = sf->data;
+	int len = sf->len;
+	int samples;
+	int err;
+	u8 *out;
+
+	if (!amu->compander_enabled)
+		return kss_chan_push_raw(&amu->ks_chan_compander_out, sf);
+
+	out_sf = ks_sf_alloc((len + 1) / sizeof(s16));
+	if (!out_sf)
+		return -ENOMEM;
+
+	out = out_sf->data;
+
+	spin_lock_bh(&amu->compander_lock);
+	if (amu->compander_odd_valid && len) {
+		s16 sample;
+
+		((u8 *)&sample)[0] = amu->compander_odd;
+		((u8 *)&sample)[1] = *data;
+
+		ksamu_encode(out, &sample, 1, amu->compander_mu_mode);
+		amu->compander_odd_valid = FALSE;
+
+		data++;
+		len--;
+		out++;
+	}
+
+	samples = len / sizeof(s16);
+
+	ksamu_encode(out, (s16 *)data, samples, amu->compander_mu_mode);
+
+	if (len & 1) {
+		amu->compander_odd = data[len - 1];
+		amu->compander_odd_valid = TRUE;
+	}
+	spin_unlock_bh(&amu->compander_lock);
+
+	out_sf->len = out - out_sf->data + samples;
+
+	if (!out_sf->len) {
+		ks_sf_put(out_sf);
+		return 0;
+	}
+
+	err = kss_chan_push_raw(&amu->ks_chan_compander_out, out_sf);
+
+	ks_sf_put(out_sf);
+
+	return err;
+}
+
+static int ksamu_compander_in_chan_push_frame(
+	struct ks_chan *ks_chan,
+	struct sk_buff *skb)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_compander_in);
+	int res;
+
+	res = kss_chan_push_frame(&amu->ks_chan_compander_out, skb);
+	if (res < 0) {
+		kfree_skb(skb);
+		return KSS_TX_OK;
+	}
+
+	return res;
+}
+
+static struct kss_chan_from_ops ksamu_compander_in_chan_from_ops =
+{
+	.push_raw	= ksamu_compander_in_chan_push_raw,
+	.push_frame	= ksamu_compander_in_chan_push_frame,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void ksamu_compander_out_chan_release(struct ks_chan *ks_chan)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_compander_out);
+
+	ksamu_debug(3, "ksamu_compander_out_chan_release()\n");
+
+	ksamu_amu_put(amu);
+}
+
+static int ksamu_compander_out_chan_get_attr_count(struct ks_chan *ks_chan)
+{
+	return 1;
+}
+
+static int ksamu_compander_out_chan_get_attr(
+	struct ks_chan *ks_chan,
+	int index,
+	__u16 *type,
+	void *buf,
+	int *len)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_compander_out);
+	struct ks_amu_compander_descr *descr = buf;
+
+	if (index != 0)
+		return -EINVAL;
+
+	if (*len < sizeof(*descr))
+		return -ENOSPC;
+
+	*type = ksamu_compander_feature->id;
+	*len = sizeof(*descr);
+
+	memset(descr, 0, sizeof(*descr));
+	descr->hardware = 0;
+	descr->enabled = amu->compander_enabled;
+	descr->mu_mode = amu->compander_mu_mode;
+
+	return 0;
+}
+
+static int ksamu_compander_out_chan_set_attr(
+	struct ks_chan *ks_chan,
+	__u16 type,
+	void *buf,
+	int len)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_compander_out);
+	struct ks_amu_compander_descr *descr = buf;
+
+	if (type != ksamu_compander_feature->id)
+		return -ENOENT;
+
+	if (len < sizeof(*descr))
+		return -EINVAL;
+
+	spin_lock_bh(&amu->compander_lock);
+	amu->compander_enabled = descr->enabled;
+	amu->compander_mu_mode = descr->mu_mode;
+	amu->compander_odd_valid = FALSE;
+	spin_unlock_bh(&amu->compander_lock);
+
+	return 0;
+}
+
+static struct ks_chan_ops ksamu_compander_out_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksamu_compander_out_chan_release,
+	.get_attr_count	= ksamu_compander_out_chan_get_attr_count,
+	.get_attr	= ksamu_compander_out_chan_get_attr,
+	.set_attr	= ksamu_compander_out_chan_set_attr,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void ksamu_decompander_in_chan_release(struct ks_chan *ks_chan)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_decompander_in);
+
+	ksamu_debug(3, "ksamu_decompander_in_chan_release()\n");
+
+	ksamu_amu_put(amu);
+}
+
+static int ksamu_decompander_in_chan_get_attr_count(struct ks_chan *ks_chan)
+{
+	return 1;
+}
+
+static int ksamu_decompander_in_chan_get_attr(
+	struct ks_chan *ks_chan,
+	int index,
+	__u16 *type,
+	void *buf,
+	int *len)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_decompander_in);
+	struct ks_amu_decompander_descr *descr = buf;
+
+	if (index != 0)
+		return -EINVAL;
+
+	if (*len < sizeof(*descr))
+		return -ENOSPC;
+
+	*type = ksamu_decompander_feature->id;
+	*len = sizeof(*descr);
+
+	memset(descr, 0, sizeof(*descr));
+	descr->hardware = 0;
+	descr->enabled = amu->decompander_enabled;
+	descr->mu_mode = amu->decompander_mu_mode;
+
+	return 0;
+}
+
+static int ksamu_decompander_in_chan_set_attr(
+	struct ks_chan *ks_chan,
+	__u16 type,
+	void *buf,
+	int len)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_decompander_in);
+	struct ks_amu_decompander_descr *descr = buf;
+
+	if (type != ksamu_decompander_feature->id)
+		return -ENOENT;
+
+	if (len < sizeof(*descr))
+		return -EINVAL;
+
+	amu->decompander_enabled = descr->enabled;
+	amu->decompander_mu_mode = descr->mu_mode;
+
+	return 0;
+}
+
+static struct ks_chan_ops ksamu_decompander_in_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksamu_decompander_in_chan_release,
+	.get_attr_count	= ksamu_decompander_in_chan_get_attr_count,
+	.get_attr	= ksamu_decompander_in_chan_get_attr,
+	.set_attr	= ksamu_decompander_in_chan_set_attr,
+};
+
+static int ksamu_decompander_in_chan_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_decompander_in);
+	struct ks_streamframe *out_sf;
+	int off;
+	int len;
+	int err;
+
+	if (!amu->decompander_enabled)
+		return kss_chan_push_raw(&amu->ks_chan_decompander_out, sf);
+
+	/* Decoding doubles the length, which may not fit in the biggest
+	 * streamframe class, in which case more frames are pushed.
+	 */
+	for (off=0; off<sf->len; off+=len) {
+		out_sf = ks_sf_alloc((sf->len - off) * sizeof(s16));
+		if (!out_sf)
+			return -ENOMEM;
+
+		len = min_t(int, sf->len - off, out_sf->size / sizeof(s16));
+
+		ksamu_decode((s16 *)out_sf->data, sf->data + off, len,
+				amu->decompander_mu_mode);
+		out_sf->len = len * sizeof(s16);
+
+		err = kss_chan_push_raw(&amu->ks_chan_decompander_out, out_sf);
+
+		ks_sf_put(out_sf);
+
+		/* Next hops may return the octets they took */
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int ksamu_decompander_in_chan_push_frame(
+	struct ks_chan *ks_chan,
+	struct sk_buff *skb)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_decompander_in);
+	int res;
+
+	res = kss_chan_push_frame(&amu->ks_chan_decompander_out, skb);
+	if (res < 0) {
+		kfree_skb(skb);
+		return KSS_TX_OK;
+	}
+
+	return res;
+}
+
+static struct kss_chan_from_ops ksamu_decompander_in_chan_from_ops =
+{
+	.push_raw	= ksamu_decompander_in_chan_push_raw,
+	.push_frame	= ksamu_decompander_in_chan_push_frame,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void ksamu_decompander_out_chan_release(struct ks_chan *ks_chan)
+{
+	struct ksamu_amu *amu = container_of(ks_chan,
+				struct ksamu_amu, ks_chan_decompander_out);
+
+	ksamu_debug(3, "ksamu_decompander_out_chan_release()\n");
+
+	ksamu_amu_put(amu);
+}
+
+static struct ks_chan_ops ksamu_decompander_out_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksamu_decompander_out_chan_release,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static struct ksamu_amu *ksamu_amu_create(int id)
+{
+	struct ksamu_amu *amu;
+	char name[16];
+
+	amu = kmalloc(sizeof(*amu), GFP_KERNEL);
+	if (!amu)
+		return NULL;
+
+	memset(amu, 0, sizeof(*amu));
+
+	amu->id = id;
+
+	spin_lock_init(&amu->compander_lock);
+
+	snprintf(name, sizeof(name), "amu%d", id);
+
+	ks_node_create(&amu->ks_node, &ksamu_node_ops, name,
+			&ks_system_device.kobj);
+
+	ks_chan_create(&amu->ks_chan_compander_in,
+			&ksamu_compander_in_chan_ops,
+			"compander_in", NULL,
+			&amu->ks_node.kobj,
+			&kss_softswitch.ks_node,
+			&amu->ks_node);
+	amu->ks_chan_compander_in.from_ops =
+			&ksamu_compander_in_chan_from_ops;
+
+	ks_chan_create(&amu->ks_chan_compander_out,
+			&ksamu_compander_out_chan_ops,
+			"compander_out", NULL,
+			&amu->ks_node.kobj,
+			&amu->ks_node,
+			&kss_softswitch.ks_node);
+
+	ks_chan_create(&amu->ks_chan_decompander_in,
+			&ksamu_decompander_in_chan_ops,
+			"decompander_in", NULL,
+			&amu->ks_node.kobj,
+			&kss_softswitch.ks_node,
+			&amu->ks_node);
+	amu->ks_chan_decompander_in.from_ops =
+			&ksamu_decompander_in_chan_from_ops;
+
+	ks_chan_create(&amu->ks_chan_decompander_out,
+			&ksamu_decompander_out_chan_ops,
+			"decompander_out", NULL,
+			&amu->ks_node.kobj,
+			&amu->ks_node,
+			&kss_softswitch.ks_node);
+
+	return amu;
+}
+
+static int ksamu_amu_register(struct ksamu_amu *amu)
+{
+	int err;
+
+	err = ks_node_register(&amu->ks_node);
+	if (err < 0)
+		goto err_node_register;
+
+	ksamu_amu_get(amu);
+	err = ks_chan_register(&amu->ks_chan_compander_in);
+	if (err < 0)
+		goto err_chan_compander_in_register;
+
+	ksamu_amu_get(amu);
+	err = ks_chan_register(&amu->ks_chan_compander_out);
+	if (err < 0)
+		goto err_chan_compander_out_register;
+
+	ksamu_amu_get(amu);
+	err = ks_chan_register(&amu->ks_chan_decompander_in);
+	if (err < 0)
+		goto err_chan_decompander_in_register;
+
+	ksamu_amu_get(amu);
+	err = ks_chan_register(&amu->ks_chan_decompander_out);
+	if (err < 0)
+		goto err_chan_decompander_out_register;
+
+	down_write(&ksamu_amus_list_sem);
+	list_add_tail(&ksamu_amu_get(amu)->node, &ksamu_amus_list);
+	up_write(&ksamu_amus_list_sem);
+
+	return 0;
+
+err_chan_decompander_out_register:
+	ksamu_amu_put(amu);
+	ks_chan_unregister(&amu->ks_chan_decompander_in);
+err_chan_decompander_in_register:
+	ksamu_amu_put(amu);
+	ks_chan_unregister(&amu->ks_chan_compander_out);
+err_chan_compander_out_register:
+	ksamu_amu_put(amu);
+	ks_chan_unregister(&amu->ks_chan_compander_in);
+err_chan_compander_in_register:
+	ksamu_amu_put(amu);
+	ks_node_unregister(&amu->ks_node);
+err_node_register:
+
+	return err;
+}
+
+static void ksamu_amu_unregister(struct ksamu_amu *amu)
+{
+	down_write(&ksamu_amus_list_sem);
+	list_del(&amu->node);
+	up_write(&ksamu_amus_list_sem);
+	ksamu_amu_put(amu);
+
+	ks_chan_unregister(&amu->ks_chan_decompander_out);
+	ks_chan_unregister(&amu->ks_chan_decompander_in);
+	ks_chan_unregister(&amu->ks_chan_compander_out);
+	ks_chan_unregister(&amu->ks_chan_compander_in);
+	ks_node_unregister(&amu->ks_node);
+}
+
+static void ksamu_amus_destroy(void)
+{
+	struct ksamu_amu *amu;
+
+	for (;;) {
+		down_read(&ksamu_amus_list_sem);
+		if (list_empty(&ksamu_amus_list)) {
+			up_read(&ksamu_amus_list_sem);
+			break;
+		}
+
+		amu = ksamu_amu_get(list_entry(ksamu_amus_list.next,
+					struct ksamu_amu, node));
+		up_read(&ksamu_amus_list_sem);
+
+		ksamu_amu_unregister(amu);
+		ksamu_amu_put(amu);
+	}
+}
+
+/******************************************
+ * Module stuff
+ ******************************************/
+
+static int __init ksamu_init_module(void)
+{
+	struct ksamu_amu *amu;
+	int err;
+	int i;
+
+	ksamu_msg(KERN_INFO, ksamu_MODULE_DESCR " loading\n");
+
+	ksamu_tables_init();
+
+	ksamu_compander_feature = ks_feature_register("amu_compander");
+	if (!ksamu_compander_feature) {
+		err = -ENOMEM;
+		goto err_compander_feature_register;
+	}
+
+	ksamu_decompander_feature = ks_feature_register("amu_decompander");
+	if (!ksamu_decompander_feature) {
+		err = -ENOMEM;
+		goto err_decompander_feature_register;
+	}
+
+	for (i=0; i<instances; i++) {
+		amu = ksamu_amu_create(i);
+		if (!amu) {
+			err = -ENOMEM;
+			goto err_amu_create;
+		}
+
+		err = ksamu_amu_register(amu);
+		if (err < 0) {
+			ksamu_amu_put(amu);
+			goto err_amu_register;
+		}
+
+		/* The list holds its own reference */
+		ksamu_amu_put(amu);
+	}
+
+	ksamu_msg(KERN_INFO, ksamu_MODULE_DESCR " loaded successfully\n");
+
+	return 0;
+
+err_amu_register:
+err_amu_create:
+	ksamu_amus_destroy();
+	ks_feature_unregister(ksamu_decompander_feature);
+err_decompander_feature_register:
+	ks_feature_unregister(ksamu_compander_feature);
+err_compander_feature_register:
+
+	return err;
+}
+
+module_init(ksamu_init_module);
+
+static void __exit ksamu_module_exit(void)
+{
+	ksamu_amus_destroy();
+	ks_feature_unregister(ksamu_decompander_feature);
+	ks_feature_unregister(ksamu_compander_feature);
+
+	ksamu_msg(KERN_INFO, ksamu_MODULE_DESCR " unloaded\n");
+}
+
+module_exit(ksamu_module_exit);
+
+MODULE_DESCRIPTION(ksamu_MODULE_DESCR);
+MODULE_AUTHOR("Daniele (Vihai) Orlandi <daniele@orlandi.com>");
+MODULE_LICENSE("GPL");
+
+module_param(instances, int, 0444);
+MODULE_PARM_DESC(instances, "Number of compander/decompander pairs");
+
+#ifdef DEBUG_CODE
+module_param(debug_level, int, 0444);
+MODULE_PARM_DESC(debug_level, "Initial debug level");
+#endif
@@ -6,6 +6,47 @@
  *
  */
 
+/*
+ * On x86-64 SSE2 is always present and CONVOLVE2_SIMD can use it. Kernel
+ * callers have to bracket a batch of calls with ARITH_SIMD_BEGIN/END, which
+ * is expensive enough to be done once per frame rather than per sample.
+ * ARITH_SIMD_BEGIN() returns zero when the FPU cannot be taken in the
+ * current context, the value is then passed to CONVOLVE2_SIMD, which falls
+ * back to the scalar code, and to ARITH_SIMD_END().
+ */
+#if defined(__x86_64__) && !defined(CONFIG_ZAPTEL_MMX)
+#define ARITH_SSE2
+#endif
+
+#if defined(ARITH_SSE2) && defined(__KERNEL__)
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,2,0)
+#include <asm/i387.h>
+#else
+#include <asm/fpu/api.h>
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,36)
+#include <linux/hardirq.h>
+#define irq_fpu_usable() (!in_interrupt())
+#endif
+static inline int ARITH_SIMD_BEGIN(void)
+{
+	if (!irq_fpu_usable())
+		return 0;
+
+	kernel_fpu_begin();
+
+	return 1;
+}
+#define ARITH_SIMD_END(simd) do { if (simd) kernel_fpu_end(); } while (0)
+#elif defined(ARITH_SSE2)
+#define ARITH_SIMD_BEGIN() 1
+#define ARITH_SIMD_END(simd) do {} while (0)
+#else
+#define ARITH_SIMD_BEGIN() 0
+#define ARITH_SIMD_END(simd) do {} while (0)
+#endif
+
 #ifdef CONFIG_ZAPTEL_MMX
 #ifdef ZT_CHUNKSIZE
 static inline void __ACSS(volatile short *dst, const short *src)
@@ -239,6 +280,9 @@ static inline int CONVOLVE2(const short *coeffs, const short *hist, int len)
 		
 	return sum;
 }
+
+#define CONVOLVE2_SIMD(simd, coeffs, hist, len) CONVOLVE2(coeffs, hist, len)
+
 static inline short MAX16(const short *y, int len, int *pos)
 {
 	int k;
@@ -298,15 +342,76 @@ static inline int CONVOLVE(const int *coeffs, const short *hist, int len)
 	return sum;
 }
 
+/* Four independent accumulators let the compiler use packed multiplies */
 static inline int CONVOLVE2(const short *coeffs, const short *hist, int len)
 {
 	int x;
+	int sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+
+	for (x=0;x + 3<len;x+=4) {
+		sum0 += coeffs[x] * hist[x];
+		sum1 += coeffs[x + 1] * hist[x + 1];
+		sum2 += coeffs[x + 2] * hist[x + 2];
+		sum3 += coeffs[x + 3] * hist[x + 3];
+	}
+
+	for (;x<len;x++)
+		sum0 += coeffs[x] * hist[x];
+
+	return sum0 + sum1 + sum2 + sum3;
+}
+
+#ifdef ARITH_SSE2
+/* The caller must own the FPU state */
+static inline int CONVOLVE2_SSE2(const short *coeffs, const short *hist, int len)
+{
 	int sum = 0;
-	for (x=0;x<len;x++)
+	int blocks = len & ~15;
+	int x;
+
+	for (x=blocks;x<len;x++)
 		sum += coeffs[x] * hist[x];
-	return sum;
+
+	if (!blocks)
+		return sum;
+
+	__asm__ (
+		"pxor %%xmm0, %%xmm0;\n"
+		"pxor %%xmm3, %%xmm3;\n"
+		"1:"
+			"movdqu  0(%1), %%xmm1;\n"
+			"movdqu  0(%2), %%xmm2;\n"
+			"pmaddwd %%xmm2, %%xmm1;\n"
+			"paddd %%xmm1, %%xmm0;\n"
+			"movdqu 16(%1), %%xmm1;\n"
+			"movdqu 16(%2), %%xmm2;\n"
+			"pmaddwd %%xmm2, %%xmm1;\n"
+			"paddd %%xmm1, %%xmm3;\n"
+			"add $32, %1;\n"
+			"add $32, %2;\n"
+			"sub $16, %3;\n"
+		"jnz 1b;\n"
+		"paddd %%xmm3, %%xmm0;\n"
+		"pshufd $0x4e, %%xmm0, %%xmm1;\n"
+		"paddd %%xmm1, %%xmm0;\n"
+		"pshufd $0xb1, %%xmm0, %%xmm1;\n"
+		"paddd %%xmm1, %%xmm0;\n"
+		"movd %%xmm0, %0;\n"
+		: "=r" (x), "+r" (coeffs), "+r" (hist), "+r" (blocks)
+		:
+		: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3"
+	);
+
+	return sum + x;
 }
 
+#define CONVOLVE2_SIMD(simd, coeffs, hist, len)			\
+	((simd) ? CONVOLVE2_SSE2(coeffs, hist, len) :		\
+		  CONVOLVE2(coeffs, hist, len))
+#else
+#define CONVOLVE2_SIMD(simd, coeffs, hist, len) CONVOLVE2(coeffs, hist, len)
+#endif
+
 static inline void UPDATE(int *taps, const short *history, const int nsuppr, const int ntaps)
 {
 	int i;
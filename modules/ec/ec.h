@@ -1,7 +1,7 @@
 /*
- * vISDN echo canceller module
+ * Kstreamer echo canceller
  *
- * Copyright (C) 2005-2006 Daniele Orlandi
+ * Copyright (C) 2005-2007 Daniele Orlandi
  *
  * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
  *
@@ -13,20 +13,35 @@
 #ifndef _VEC_EC_H
 #define _VEC_EC_H
 
-/* See core.h for IOC allocation */
-#define VEC_GET_FAREND_CHANID	_IOR(0xd0, 0x50, unsigned int)
-#define VEC_GET_NEAREND_CHANID	_IOR(0xd0, 0x51, unsigned int)
-#define VEC_START		_IOR(0xd0, 0x52, unsigned int)
-#define VEC_STOP		_IOR(0xd0, 0x53, unsigned int)
+#include <linux/types.h>
+
+enum vec_state
+{
+	VEC_OFF,
+	VEC_PRE_TRAINING,
+	VEC_TRAINING,
+	VEC_ACTIVE,
+};
+
+/* Descriptor of the "echo_canceller" feature, exposed by the near_end_out
+ * chan. Setting a state other than VEC_OFF (re)starts training, taps are
+ * samples of echo tail and are rounded up to a multiple of 16.
+ */
+struct ks_ec_descr
+{
+	__u32 taps;
+	__u32 state;
+};
 
 #ifdef __KERNEL__
 
-#include <linux/kfifo.h>
+#include <linux/spinlock.h>
 
-#include <linux/visdn/core.h>
-#include <linux/visdn/chan.h>
-#include <linux/visdn/leg.h>
-#include <linux/visdn/port.h>
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+#include <linux/kstreamer/streamframe.h>
+
+#include "mg2ec.h"
 
 #if defined(DEBUG_CODE) && defined(DEBUG_DEFAULTS)
 #define vec_debug(dbglevel, format, arg...)			\
@@ -51,52 +66,57 @@
 #define FALSE 0
 #endif
 
-#define vec_MODULE_NAME "visdn-ec-kb"
+#define vec_MODULE_NAME "ks-ec"
 #define vec_MODULE_PREFIX vec_MODULE_NAME ": "
-#define vec_MODULE_DESCR " echo canceller module for vISDN"
+#define vec_MODULE_DESCR "kstreamer echo canceller"
 
-#define to_vec_ec(vport) \
-		container_of((vport), struct vec_ec, visdn_port)
-#define ne_to_vec_ec(vchan) \
-		container_of((vchan), struct vec_ec, visdn_chan_ne)
-#define fe_to_vec_ec(vchan) \
-		container_of((vchan), struct vec_ec, visdn_chan_fe)
+#define VEC_DEFAULT_TAPS 128
+#define VEC_MAX_TAPS 1024
 
-enum vec_state
-{
-	VEC_OFF,
-	VEC_PRE_TRAINING,
-	VEC_TRAINING,
-	VEC_ACTIVE,
-};
+/* Far-end samples waiting for the near-end ones, must be a power of 2 */
+#define VEC_REF_SIZE 2048
 
-enum vec_flags
+/* Buffers are pooled in classes of VEC_POOL_MIN_TAPS, twice as much, and
+ * so on up to VEC_MAX_TAPS
+ */
+#define VEC_POOL_MIN_TAPS 128
+#define VEC_POOL_CLASSES 4
+
+/* State of a running canceller, the can's memory follows */
+struct vec_ec_buf
 {
-	VEC_FE_NE_CYCLE,
+	struct list_head node;
+	int class;
+
+	echo_can_state_t *ec;
+
+	u8 ref_buf[VEC_REF_SIZE];
+	u32 ref_in;
+	u32 ref_out;
 };
 
 struct vec_ec
 {
-	struct visdn_port visdn_port;
-	struct visdn_chan visdn_chan_ne;
-	struct visdn_chan visdn_chan_fe;
-
 	struct list_head node;
 	int id;
 
-	enum vec_state ec_state;
-	unsigned long flags;
+	struct ks_node ks_node;
 
-	echo_can_state_t *ec;
+	/* Far-end audio going to the line, used as reference */
+	struct ks_chan ks_chan_fe_in;
+	struct ks_chan ks_chan_fe_out;
+
+	/* Near-end audio coming from the line, echo is removed from it */
+	struct ks_chan ks_chan_ne_in;
+	struct ks_chan ks_chan_ne_out;
 
-	struct kfifo *fe_w_fifo;
-	spinlock_t fe_w_fifo_lock;
+	spinlock_t lock;
 
-	struct kfifo *fe_r_fifo;
-	spinlock_t fe_r_fifo_lock;
+	enum vec_state ec_state;
+	int taps;
 
-	struct kfifo *ne_r_fifo;
-	spinlock_t ne_r_fifo_lock;
+	/* Taken from the pool while not VEC_OFF */
+	struct vec_ec_buf *buf;
 
 	int training_pos;
 	int pre_training_timer;
@@ -1,7 +1,7 @@
 /*
- * vISDN echo canceller module, based on kb1ec.h by Kris Boutilier
+ * Kstreamer echo canceller, based on mg2ec.h by Michael Gernoth
  *
- * Copyright (C) 2005-2006 Daniele Orlandi
+ * Copyright (C) 2005-2007 Daniele Orlandi
  *
  * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
  *
@@ -10,26 +10,27 @@
  *
  */
 
+/* Each echo canceller is a node with two paths. The far-end path carries
+ * the audio going to the line, the near-end path the audio coming from it.
+ *
+ * Far-end samples are queued until the same number of near-end samples
+ * arrive. They are then forwarded to the line and used as reference to
+ * cancel the echo from the near-end frame, so both directions are clocked
+ * by the line and stay aligned.
+ */
+
 #include <linux/kernel.h>
 #include <linux/module.h>
-#include <linux/delay.h>
-#include <linux/fs.h>
-#include <linux/poll.h>
-#include <linux/fs.h>
-#include <linux/cdev.h>
-#include <linux/kdev_t.h>
-#include <linux/device.h>
 #include <linux/list.h>
+#include <linux/percpu.h>
 
-#include <linux/visdn/softcxc.h>
-#include <linux/visdn/leg.h>
-#include <linux/visdn/port.h>
-#include <linux/visdn/pipeline.h>
-
-#include "kb1ec.h"
-//#define AGGRESSIVE_SUPPRESSOR
-//#include "mec2.h"
-//#include "mg2ec.h"
+#include <linux/kstreamer/kstreamer.h>
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+#include <linux/kstreamer/pipeline.h>
+#include <linux/kstreamer/streamframe.h>
+#include <linux/kstreamer/softswitch.h>
+#include <linux/kstreamer/feature.h>
 
 #include "ec.h"
 #include "xlaw.h"
@@ -42,870 +43,669 @@ int debug_level = 0;
 #endif
 #endif
 
-static dev_t vec_first_dev;
-static struct cdev vec_cdev;
-static struct class_device vec_class_dev;
+static int instances = 32;
+static int taps = VEC_DEFAULT_TAPS;
+static int pool_max = 16;
 
 static struct list_head vec_ec_list = LIST_HEAD_INIT(vec_ec_list);
-static spinlock_t vec_ec_list_lock = SPIN_LOCK_UNLOCKED;
+static DECLARE_RWSEM(vec_ec_list_sem);
 
-/* ----------------------------- NEAR end ----------------------------------*/
+static struct ks_feature *vec_feature;
+
+static struct list_head vec_pool[VEC_POOL_CLASSES];
+static int vec_pool_count[VEC_POOL_CLASSES];
+static DEFINE_SPINLOCK(vec_pool_lock);
 
-static void vec_chan_ne_release(struct visdn_chan *visdn_chan)
+/* Linear samples of the frame being processed */
+struct vec_scratch
 {
-	vec_debug(3, "vec_chan_ne_release()\n");
-}
+	s16 ref[KS_SF_SIZE_DEFAULT];
+	s16 sig[KS_SF_SIZE_DEFAULT];
+} ____cacheline_aligned;
+
+static DEFINE_PER_CPU(struct vec_scratch, vec_scratch);
 
-static int vec_chan_ne_open(struct visdn_chan *visdn_chan)
+static struct vec_ec *vec_ec_get(struct vec_ec *ec)
 {
-	vec_debug(3, "vec_chan_ne_open()\n");
+	if (ks_node_get(&ec->ks_node))
+		return ec;
+	else
+		return NULL;
+}
 
-	return 0;
+static void vec_ec_put(struct vec_ec *ec)
+{
+	ks_node_put(&ec->ks_node);
 }
 
-static int vec_chan_ne_close(struct visdn_chan *visdn_chan)
+/*---------------------------------------------------------------------------*/
+
+static int vec_pool_class(int taps)
 {
-	vec_debug(3, "vec_chan_ne_close()\n");
+	int class = 0;
 
-	return 0;
+	while ((VEC_POOL_MIN_TAPS << class) < taps)
+		class++;
+
+	return class;
 }
 
-static ssize_t vec_chan_ne_read(
-	struct visdn_leg *visdn_leg,
-	void *buf, size_t count)
+/* Idle buffers of the right class are reused, cans are rebuilt anyway */
+static struct vec_ec_buf *vec_buf_get(int taps)
 {
-	struct vec_ec *ec = ne_to_vec_ec(visdn_leg->chan);
+	struct vec_ec_buf *buf = NULL;
+	int class = vec_pool_class(taps);
+
+	spin_lock(&vec_pool_lock);
+	if (!list_empty(&vec_pool[class])) {
+		buf = list_entry(vec_pool[class].next,
+				struct vec_ec_buf, node);
+		list_del(&buf->node);
+		vec_pool_count[class]--;
+	}
+	spin_unlock(&vec_pool_lock);
+
+	if (!buf) {
+		buf = kmalloc(sizeof(*buf) +
+			echo_can_size(VEC_POOL_MIN_TAPS << class), GFP_KERNEL);
+		if (!buf)
+			return NULL;
+
+		buf->class = class;
+	}
 
-	int nread = __kfifo_get(ec->ne_r_fifo, buf, count);
+	buf->ec = echo_can_init(buf + 1, taps);
+	buf->ref_in = 0;
+	buf->ref_out = 0;
 
-	return nread;
+	return buf;
 }
 
-unsigned int __kfifo_drop(struct kfifo *fifo, unsigned int len)
+static void vec_buf_put(struct vec_ec_buf *buf)
 {
-	fifo->out += min(len, fifo->in - fifo->out);
+	spin_lock(&vec_pool_lock);
+	if (vec_pool_count[buf->class] < pool_max) {
+		list_add(&buf->node, &vec_pool[buf->class]);
+		vec_pool_count[buf->class]++;
+		buf = NULL;
+	}
+	spin_unlock(&vec_pool_lock);
 
-	return len;
+	kfree(buf);
 }
 
-unsigned int __kfifo_putbyte(struct kfifo *fifo,
-			 unsigned char byte, unsigned int len)
+static void vec_pool_init(void)
 {
-	unsigned int l;
-
-	len = min(len, fifo->size - fifo->in + fifo->out);
+	int i;
 
-	/* first put the data starting from fifo->in to buffer end */
-	l = min(len, fifo->size - (fifo->in & (fifo->size - 1)));
-	memset(fifo->buffer + (fifo->in & (fifo->size - 1)), byte, l);
+	for (i=0; i<VEC_POOL_CLASSES; i++) {
+		INIT_LIST_HEAD(&vec_pool[i]);
+		vec_pool_count[i] = 0;
+	}
+}
 
-	/* then put the rest (if any) at the beginning of the buffer */
-	memset(fifo->buffer, byte, len - l);
+static void vec_pool_destroy(void)
+{
+	struct vec_ec_buf *buf, *t;
+	int i;
 
-	fifo->in += len;
+	for (i=0; i<VEC_POOL_CLASSES; i++) {
+		list_for_each_entry_safe(buf, t, &vec_pool[i], node) {
+			list_del(&buf->node);
+			kfree(buf);
+		}
 
-	return len;
+		vec_pool_count[i] = 0;
+	}
 }
 
-static ssize_t vec_chan_ne_write(
-	struct visdn_leg *visdn_leg,
-	const void *buf, size_t count)
+/*---------------------------------------------------------------------------*/
+
+static void vec_ref_put(struct vec_ec_buf *buf, const u8 *data, int len)
 {
-	struct vec_ec *ec = ne_to_vec_ec(visdn_leg->chan);
-	int nwrote = 0;
-	int nref;
-	int i;
-	u8 ref[512];
+	u32 off;
+	int l;
 
-	memset(ref, 0, sizeof(ref));
+	len = min_t(u32, len, VEC_REF_SIZE - (buf->ref_in - buf->ref_out));
 
-	nref = __kfifo_get(ec->fe_w_fifo, ref, count);
-	if (nref == count) {
-		/* Right number samples in other direction */
-	} else if (nref < count) {
-		/* Too few samples in other direction */
+	off = buf->ref_in & (VEC_REF_SIZE - 1);
+	l = min_t(u32, len, VEC_REF_SIZE - off);
 
-//		printk(KERN_DEBUG "Detected %d slips\n",
-//			(int)(nref - count));
+	memcpy(buf->ref_buf + off, data, l);
+	memcpy(buf->ref_buf, data + l, len - l);
 
-		// FIXME :) (filled with undetermined samples)
-		nref = count;
-	}
+	buf->ref_in += len;
+}
 
-#if 0
-	if (kfifo_len(ec->fe_w_fifo)) {
+/* Missing far-end samples are replaced with silence */
+static void vec_ref_get(struct vec_ec_buf *buf, u8 *data, int len)
+{
+	int avail = min_t(u32, len, buf->ref_in - buf->ref_out);
+	u32 off = buf->ref_out & (VEC_REF_SIZE - 1);
+	int l = min_t(u32, avail, VEC_REF_SIZE - off);
 
-		/* Too many samples in other direction */
+	memcpy(data, buf->ref_buf + off, l);
+	memcpy(data + l, buf->ref_buf, avail - l);
+	memset(data + avail, linear_to_alaw(0), len - avail);
 
-		
+	buf->ref_out += avail;
+}
 
-		printk(KERN_DEBUG "Detected %d slips\n",
-			kfifo_len(ec->fe_w_fifo));
-	}
-#endif
-	for (i=0; i<count; i++) {
-		u8 octet;
-		s16 sample = alaw_to_linear(((u8 *)buf)[i]);
+/*
+ * Cancels the echo of ref from sig into out. While training the far-end
+ * is replaced with an impulse and both directions are muted.
+ *
+ * Must be called with ec->lock held and ec->buf set.
+ */
+static void vec_process(
+	struct vec_ec *ec,
+	u8 *ref,
+	const u8 *sig,
+	u8 *out,
+	int len)
+{
+	struct vec_scratch *scratch;
+	int start;
+	int i;
+
+	for (i=0; i<len && ec->ec_state != VEC_ACTIVE; i++) {
 
 		switch (ec->ec_state) {
 		case VEC_OFF:
-		break;
+			memcpy(out + i, sig + i, len - i);
+			return;
 
 		case VEC_PRE_TRAINING:
-			// Mute NE output
 			ref[i] = linear_to_alaw(0);
+			out[i] = linear_to_alaw(0);
 
-			// Mute FE output
-			sample = 0;
-
-			ec->pre_training_timer++;
-
-			if (ec->pre_training_timer > 3200) {
+			if (++ec->pre_training_timer > 3200) {
 				ec->training_pos = 0;
 				ec->ec_state = VEC_TRAINING;
-printk(KERN_DEBUG "Echo canceller started training\n");
+
+				vec_debug(2, "Echo canceller %d started training\n",
+					ec->id);
 			}
 		break;
 
 		case VEC_TRAINING:
-			if (ec->training_pos == 0)
-				ref[i] = linear_to_alaw(16384);
-			else
-				ref[i] = linear_to_alaw(0);
-
-			// Train from NE->FE
-			if (echo_can_traintap(ec->ec,
-					ec->training_pos,
-					sample)) {
+			ref[i] = linear_to_alaw(ec->training_pos ? 0 : 16384);
+			out[i] = linear_to_alaw(0);
+
+			if (echo_can_traintap(ec->buf->ec, ec->training_pos,
+					alaw_to_linear(sig[i]))) {
 				ec->ec_state = VEC_ACTIVE;
 
-printk(KERN_DEBUG "Echo canceller active\n");
-{
-int i;
-printk(KERN_DEBUG "Training complete: a_s = ");
-for(i=0; i<ec->ec->N_d; i++) {
-	printk("%d ", ec->ec->a_s[i]);
-}
-printk("\n");}
+				vec_debug(2, "Echo canceller %d active\n",
+					ec->id);
 			}
 
-			// Mute FE output
-			sample = 0;
-
 			ec->training_pos++;
 		break;
 
 		case VEC_ACTIVE:
-			sample = echo_can_update(ec->ec,
-					alaw_to_linear(ref[i]),
-					sample);
 		break;
 		}
-
-		octet = linear_to_alaw(sample);
-		__kfifo_put(ec->fe_r_fifo, &octet, sizeof(octet));
 	}
 
-	nwrote = __kfifo_put(ec->ne_r_fifo, ref, count);
+	if (i == len)
+		return;
 
-	return nwrote;
-}
+	/* The lock keeps us on this CPU */
+	scratch = &per_cpu(vec_scratch, smp_processor_id());
+	start = i;
 
-static int vec_chan_ne_connect(
-	struct visdn_leg *visdn_leg1,
-	struct visdn_leg *visdn_leg2)
-{
-	vec_debug(2, "Echo canceller near end %06d connected to %06d\n",
-		visdn_leg1->chan->id,
-		visdn_leg2->chan->id);
+	for (; i<len; i++) {
+		scratch->ref[i] = alaw_to_linear(ref[i]);
+		scratch->sig[i] = alaw_to_linear(sig[i]);
+	}
 
-	return 0;
-}
+	echo_can_update_frame(ec->buf->ec, scratch->ref + start,
+		scratch->sig + start, len - start);
 
-static void vec_chan_ne_disconnect(
-	struct visdn_leg *visdn_leg1,
-	struct visdn_leg *visdn_leg2)
-{
-	vec_debug(2, "Echo canceller near end %06d disconnected from %06d\n",
-		visdn_leg1->chan->id,
-		visdn_leg2->chan->id);
+	for (i=start; i<len; i++)
+		out[i] = linear_to_alaw(scratch->sig[i]);
 }
 
-static struct visdn_chan_ops vec_chan_ne_ops = {
-	.owner		= THIS_MODULE,
-
-	.release	= vec_chan_ne_release,
-	.open		= vec_chan_ne_open,
-	.close		= vec_chan_ne_close,
-};
-
-static struct visdn_leg_ops vec_leg_ne_ops = {
-	.owner		= THIS_MODULE,
+static int vec_start(struct vec_ec *ec, int new_taps)
+{
+	struct vec_ec_buf *new_buf;
+	struct vec_ec_buf *old_buf;
 
-	.connect	= vec_chan_ne_connect,
-	.disconnect	= vec_chan_ne_disconnect,
+	new_taps = ALIGN(min(max(new_taps, 16), VEC_MAX_TAPS), 16);
 
-	.read		= vec_chan_ne_read,
-	.write		= vec_chan_ne_write,
-};
+	new_buf = vec_buf_get(new_taps);
+	if (!new_buf)
+		return -ENOMEM;
 
-/* ------------------------------ FAR end ----------------------------------*/
+	spin_lock_bh(&ec->lock);
+	old_buf = ec->buf;
+	ec->buf = new_buf;
+	ec->taps = new_taps;
+	ec->ec_state = VEC_PRE_TRAINING;
+	ec->pre_training_timer = 0;
+	spin_unlock_bh(&ec->lock);
 
-static void vec_chan_fe_release(struct visdn_chan *visdn_chan)
-{
-	vec_debug(3, "vec_chan_fe_release()\n");
-}
+	if (old_buf)
+		vec_buf_put(old_buf);
 
-static int vec_chan_fe_open(struct visdn_chan *visdn_chan)
-{
-	vec_debug(3, "vec_chan_fe_open()\n");
+	vec_debug(2, "Echo canceller %d start pre-training, %d taps\n",
+		ec->id, new_taps);
 
 	return 0;
 }
 
-static int vec_chan_fe_close(struct visdn_chan *visdn_chan)
+static void vec_stop(struct vec_ec *ec)
 {
-	vec_debug(3, "vec_chan_fe_close()\n");
-
-	return 0;
-}
+	struct vec_ec_buf *buf;
 
-static ssize_t vec_chan_fe_read(
-	struct visdn_leg *visdn_leg,
-	void *buf, size_t count)
-{
-	struct vec_ec *ec = fe_to_vec_ec(visdn_leg->chan);
+	spin_lock_bh(&ec->lock);
+	buf = ec->buf;
+	ec->buf = NULL;
+	ec->ec_state = VEC_OFF;
+	spin_unlock_bh(&ec->lock);
 
-	return __kfifo_get(ec->fe_r_fifo, buf, count);
+	if (buf)
+		vec_buf_put(buf);
 }
 
-static ssize_t vec_chan_fe_write(
-	struct visdn_leg *visdn_leg,
-	const void *buf, size_t count)
-
-{
-	struct vec_ec *ec = fe_to_vec_ec(visdn_leg->chan);
-
-	if (!count)
-		return 0;
-
-	return __kfifo_put(ec->fe_w_fifo, (void *)buf, count);
-}
+/*---------------------------------------------------------------------------*/
 
-static int vec_chan_fe_connect(
-	struct visdn_leg *visdn_leg1,
-	struct visdn_leg *visdn_leg2)
+static void vec_node_release(struct ks_node *ks_node)
 {
-	vec_debug(2, "Echo canceller far-end %06d connected to %06d\n",
-		visdn_leg1->chan->id,
-		visdn_leg2->chan->id);
+	struct vec_ec *ec = container_of(ks_node, struct vec_ec, ks_node);
 
-	return 0;
-}
+	vec_debug(3, "vec_node_release()\n");
 
-static void vec_chan_fe_disconnect(
-	struct visdn_leg *visdn_leg1,
-	struct visdn_leg *visdn_leg2)
-{
-	vec_debug(2, "Echo canceller far-end %06d disconnected from %06d\n",
-		visdn_leg1->chan->id,
-		visdn_leg2->chan->id);
+	kfree(ec->buf);
+	kfree(ec);
 }
 
-static struct visdn_chan_ops vec_chan_fe_ops = {
+static struct ks_node_ops vec_node_ops = {
 	.owner		= THIS_MODULE,
 
-	.release	= vec_chan_fe_release,
-	.open		= vec_chan_fe_open,
-	.close		= vec_chan_fe_close,
-};
-
-static struct visdn_leg_ops vec_leg_fe_ops = {
-	.owner		= THIS_MODULE,
-
-	.connect	= vec_chan_fe_connect,
-	.disconnect	= vec_chan_fe_disconnect,
-
-	.read		= vec_chan_fe_read,
-	.write		= vec_chan_fe_write,
-};
-
-/*---------------------------------------------------------------------------*/
-
-struct visdn_port_ops vec_port_ops = {
-	.owner	= THIS_MODULE,
+	.release	= vec_node_release,
 };
 
 /*---------------------------------------------------------------------------*/
 
-static ssize_t vec_show_fe_r_fifo_usage(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	char *buf)
+static void vec_chan_release(struct ks_chan *ks_chan)
 {
-	struct vec_ec *ec = to_vec_ec(visdn_port);
+	vec_debug(3, "vec_chan_release()\n");
 
-	return snprintf(buf, PAGE_SIZE, "%d\n",
-		kfifo_len(ec->fe_r_fifo));
+	ks_node_put(ks_chan->from == &kss_softswitch.ks_node ?
+			ks_chan->to : ks_chan->from);
 }
 
-static ssize_t vec_store_fe_r_fifo_usage(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	const char *buf,
-	size_t count)
-{
-	struct vec_ec *ec = to_vec_ec(visdn_port);
-
-	kfifo_reset(ec->fe_r_fifo);
-
-	return count;
-}
+static struct ks_chan_ops vec_chan_ops = {
+	.owner		= THIS_MODULE,
 
-static VISDN_PORT_ATTR(fe_r_fifo_usage, S_IRUGO | S_IWUSR,
-		vec_show_fe_r_fifo_usage,
-		vec_store_fe_r_fifo_usage);
+	.release	= vec_chan_release,
+};
 
-/*---------------------------------------------------------------------------*/
+/* ------------------------------ FAR end ----------------------------------*/
 
-static ssize_t vec_show_fe_w_fifo_usage(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	char *buf)
+static int vec_fe_in_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
 {
-	struct vec_ec *ec = to_vec_ec(visdn_port);
+	struct vec_ec *ec = container_of(ks_chan, struct vec_ec,
+						ks_chan_fe_in);
 
-	return snprintf(buf, PAGE_SIZE, "%d\n",
-		kfifo_len(ec->fe_w_fifo));
-}
+	spin_lock_bh(&ec->lock);
+	if (ec->buf) {
+		vec_ref_put(ec->buf, sf->data, sf->len);
+		spin_unlock_bh(&ec->lock);
 
-static ssize_t vec_store_fe_w_fifo_usage(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	const char *buf,
-	size_t count)
-{
-	struct vec_ec *ec = to_vec_ec(visdn_port);
+		return 0;
+	}
+	spin_unlock_bh(&ec->lock);
 
-	kfifo_reset(ec->fe_w_fifo);
+	/* Idle, there is nothing to align to */
+	kss_chan_push_raw(&ec->ks_chan_fe_out, sf);
 
-	return count;
+	return 0;
 }
 
-static VISDN_PORT_ATTR(fe_w_fifo_usage, S_IRUGO | S_IWUSR,
-		vec_show_fe_w_fifo_usage,
-		vec_store_fe_w_fifo_usage);
-
-/*---------------------------------------------------------------------------*/
-
-static ssize_t vec_show_ne_r_fifo_usage(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	char *buf)
+static struct kss_chan_from_ops vec_fe_in_from_ops =
 {
-	struct vec_ec *ec = to_vec_ec(visdn_port);
+	.push_raw	= vec_fe_in_push_raw,
+};
 
-	return snprintf(buf, PAGE_SIZE, "%d\n",
-		kfifo_len(ec->ne_r_fifo));
-}
+/* ----------------------------- NEAR end ----------------------------------*/
 
-static ssize_t vec_store_ne_r_fifo_usage(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	const char *buf,
-	size_t count)
-{
-	struct vec_ec *ec = to_vec_ec(visdn_port);
+static int vec_ne_in_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct vec_ec *ec = container_of(ks_chan, struct vec_ec,
+						ks_chan_ne_in);
+	struct ks_streamframe *fe_sf;
+	struct ks_streamframe *ne_sf;
+	int off;
+	int len;
+
+	if (!ec->buf)
+		goto pass_through;
+
+	/* The per-CPU scratch space limits vec_process() to
+	 * KS_SF_SIZE_DEFAULT samples, longer frames are split in blocks.
+	 * Returns the octets delivered when the frame has been pushed
+	 * only in part.
+	 */
+	for (off=0; off<sf->len; off+=len) {
+		len = min_t(int, sf->len - off, KS_SF_SIZE_DEFAULT);
+
+		fe_sf = ks_sf_alloc(len);
+		if (!fe_sf)
+			goto err_alloc_fe;
+
+		ne_sf = ks_sf_alloc(len);
+		if (!ne_sf)
+			goto err_alloc_ne;
+
+		spin_lock_bh(&ec->lock);
+		if (ec->buf) {
+			vec_ref_get(ec->buf, fe_sf->data, len);
+			vec_process(ec, fe_sf->data, sf->data + off,
+						ne_sf->data, len);
+			fe_sf->len = len;
+		} else {
+			/* Stopped meanwhile, the rest goes through */
+			memcpy(ne_sf->data, sf->data + off, len);
+		}
+		spin_unlock_bh(&ec->lock);
 
-	kfifo_reset(ec->ne_r_fifo);
+		ne_sf->len = len;
 
-	return count;
-}
+		if (fe_sf->len)
+			kss_chan_push_raw(&ec->ks_chan_fe_out, fe_sf);
 
-static VISDN_PORT_ATTR(ne_r_fifo_usage, S_IRUGO | S_IWUSR,
-		vec_show_ne_r_fifo_usage,
-		vec_store_ne_r_fifo_usage);
+		kss_chan_push_raw(&ec->ks_chan_ne_out, ne_sf);
 
-/*---------------------------------------------------------------------------*/
+		ks_sf_put(ne_sf);
+		ks_sf_put(fe_sf);
+	}
 
-static ssize_t vec_port_show_ec_state(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	char *buf)
-{
-	struct vec_ec *ec = to_vec_ec(visdn_port);
+	return 0;
 
-	return snprintf(buf, PAGE_SIZE, "%d\n", ec->ec_state);
-}
+pass_through:
+	kss_chan_push_raw(&ec->ks_chan_ne_out, sf);
 
-static void vec_start(struct vec_ec *ec)
-{
-	if (ec->ec)
-		echo_can_free(ec->ec);
+	return 0;
 
-	ec->ec = echo_can_create(128, 0);
-	ec->ec_state = VEC_PRE_TRAINING;
-	ec->pre_training_timer = 0;
+err_alloc_ne:
+	ks_sf_put(fe_sf);
+err_alloc_fe:
 
-	printk(KERN_DEBUG "Echo canceller start pre-training\n");
+	/* Blocks already pushed are delivered, report how many octets */
+	return off ? off : -ENOMEM;
 }
 
-static void vec_stop(struct vec_ec *ec)
+static struct kss_chan_from_ops vec_ne_in_from_ops =
 {
-	ec->ec_state = VEC_OFF;
-}
+	.push_raw	= vec_ne_in_push_raw,
+};
 
-static ssize_t vec_port_store_ec_state(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	const char *buf,
-	size_t count)
+static int vec_ne_out_get_attr_count(struct ks_chan *ks_chan)
 {
-	struct vec_ec *ec = to_vec_ec(visdn_port);
-	int value;
-
-	sscanf(buf, "%d", &value);
-
-	if (value) {
-		vec_start(ec);
-	} else {
-		vec_stop(ec);
-	}
-
-	return count;
+	return 1;
 }
 
-static VISDN_PORT_ATTR(ec_state, S_IRUGO | S_IWUSR,
-		vec_port_show_ec_state,
-		vec_port_store_ec_state);
-
-//----------------------------------------------------------------------------
-
-static ssize_t vec_port_show_ec_coeffs(
-	struct visdn_port *visdn_port,
-	struct visdn_port_attribute *attr,
-	char *buf)
+static int vec_ne_out_get_attr(
+	struct ks_chan *ks_chan,
+	int index,
+	__u16 *type,
+	void *buf,
+	int *len)
 {
-	struct vec_ec *ec = to_vec_ec(visdn_port);
-	int len = 0;
-	int i;
+	struct vec_ec *ec = container_of(ks_chan, struct vec_ec,
+						ks_chan_ne_out);
+	struct ks_ec_descr *descr = buf;
 
-	if (!ec->ec)
-		return 0;
+	if (index != 0)
+		return -ENOENT;
 
-	for (i=0; i<ec->ec->N_d; i++) {
-		len += snprintf(buf + len, PAGE_SIZE - len,
-			"%d\n",
-			ec->ec->a_s[i]);
-	}
+	if (*len < sizeof(struct ks_ec_descr))
+		return -ENOSPC;
+
+	*type = vec_feature->id;
+	*len = sizeof(struct ks_ec_descr);
 
-	len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+	spin_lock_bh(&ec->lock);
+	descr->taps = ec->taps;
+	descr->state = ec->ec_state;
+	spin_unlock_bh(&ec->lock);
 
-	return len;
+	return 0;
 }
 
-static VISDN_PORT_ATTR(ec_coeffs, S_IRUGO,
-		vec_port_show_ec_coeffs,
-		NULL);
+static int vec_ne_out_set_attr(
+	struct ks_chan *ks_chan,
+	__u16 type,
+	void *buf,
+	int len)
+{
+	struct vec_ec *ec = container_of(ks_chan, struct vec_ec,
+						ks_chan_ne_out);
+	struct ks_ec_descr *descr = buf;
+
+	if (type != vec_feature->id)
+		return -ENOENT;
 
-//----------------------------------------------------------------------------
+	if (len < sizeof(struct ks_ec_descr))
+		return -EINVAL;
 
-static struct vec_ec *_vec_ec_search_by_id(int id)
-{
-	struct vec_ec *ec;
+	if (descr->taps > VEC_MAX_TAPS)
+		return -EINVAL;
 
-	list_for_each_entry(ec, &vec_ec_list, node) {
-		if (ec->id == id)
-			return ec;
+	if (descr->state == VEC_OFF) {
+		vec_stop(ec);
+		return 0;
 	}
 
-	return NULL;
+	return vec_start(ec, descr->taps ? descr->taps : ec->taps);
 }
 
-static int _vec_ec_alloc_id(void)
-{
-	struct vec_ec *ec;
-	static int id;
-
-retry:
-	id++;
+static struct ks_chan_ops vec_ne_out_chan_ops = {
+	.owner		= THIS_MODULE,
 
-	list_for_each_entry(ec, &vec_ec_list, node) {
-		if (ec->id == id)
-			goto retry;
-	}
+	.release	= vec_chan_release,
+	.get_attr_count	= vec_ne_out_get_attr_count,
+	.get_attr	= vec_ne_out_get_attr,
+	.set_attr	= vec_ne_out_set_attr,
+};
 
-	return id;
-}
+/*---------------------------------------------------------------------------*/
 
-static int vec_cdev_open(
-	struct inode *inode,
-	struct file *file)
+static struct vec_ec *vec_ec_create(int id)
 {
-	int err;
 	struct vec_ec *ec;
-
-	nonseekable_open(inode, file);
+	char name[16];
 
 	ec = kmalloc(sizeof(*ec), GFP_KERNEL);
-	if (!ec) {
-		err = -EFAULT;
-		goto err_kmalloc;
-	}
+	if (!ec)
+		return NULL;
 
 	memset(ec, 0, sizeof(*ec));
 
-	spin_lock(&vec_ec_list_lock);
-	ec->id = _vec_ec_alloc_id();
-	list_add_tail(&ec->node, &vec_ec_list);
-	spin_unlock(&vec_ec_list_lock);
+	ec->id = id;
+	ec->taps = taps;
+	ec->ec_state = VEC_OFF;
 
-	file->private_data = ec;
+	spin_lock_init(&ec->lock);
 
-	ec->ec = NULL;
+	snprintf(name, sizeof(name), "ec%d", id);
 
-	spin_lock_init(&ec->fe_r_fifo_lock);
-	ec->fe_r_fifo = kfifo_alloc(1024, GFP_KERNEL, &ec->fe_r_fifo_lock);
-	if (!ec->fe_r_fifo) {
-		err = -EFAULT;
-		goto err_fifo_fe_r_alloc;
-	}
+	ks_node_create(&ec->ks_node, &vec_node_ops, name,
+			&ks_system_device.kobj);
 
-	spin_lock_init(&ec->fe_w_fifo_lock);
-	ec->fe_w_fifo = kfifo_alloc(1024, GFP_KERNEL, &ec->fe_w_fifo_lock);
-	if (!ec->fe_w_fifo) {
-		err = -EFAULT;
-		goto err_fifo_fe_w_alloc;
-	}
+	ks_chan_create(&ec->ks_chan_fe_in, &vec_chan_ops,
+			"far_end_in", NULL,
+			&ec->ks_node.kobj,
+			&kss_softswitch.ks_node,
+			&ec->ks_node);
+	ec->ks_chan_fe_in.from_ops = &vec_fe_in_from_ops;
 
-	spin_lock_init(&ec->ne_r_fifo_lock);
-	ec->ne_r_fifo = kfifo_alloc(1024, GFP_KERNEL, &ec->ne_r_fifo_lock);
-	if (!ec->ne_r_fifo) {
-		err = -EFAULT;
-		goto err_fifo_ne_r_alloc;
-	}
+	ks_chan_create(&ec->ks_chan_fe_out, &vec_chan_ops,
+			"far_end_out", NULL,
+			&ec->ks_node.kobj,
+			&ec->ks_node,
+			&kss_softswitch.ks_node);
 
-	visdn_port_init(&ec->visdn_port);
-	ec->visdn_port.ops = &vec_port_ops;
-	ec->visdn_port.device = &visdn_system_device;
-	snprintf(ec->visdn_port.name, sizeof(ec->visdn_port.name),
-		"%d", ec->id);
+	ks_chan_create(&ec->ks_chan_ne_in, &vec_chan_ops,
+			"near_end_in", NULL,
+			&ec->ks_node.kobj,
+			&kss_softswitch.ks_node,
+			&ec->ks_node);
+	ec->ks_chan_ne_in.from_ops = &vec_ne_in_from_ops;
 
-	err = visdn_port_register(&ec->visdn_port);
-	if (err < 0)
-		goto err_port_register;
+	ks_chan_create(&ec->ks_chan_ne_out, &vec_ne_out_chan_ops,
+			"near_end_out", NULL,
+			&ec->ks_node.kobj,
+			&ec->ks_node,
+			&kss_softswitch.ks_node);
 
-	err = visdn_port_create_file(&ec->visdn_port,
-					&visdn_port_attr_fe_r_fifo_usage);
-	if (err < 0)
-		goto err_create_file_fe_r_fifo;
+	return ec;
+}
 
-	err = visdn_port_create_file(&ec->visdn_port,
-					&visdn_port_attr_fe_w_fifo_usage);
-	if (err < 0)
-		goto err_create_file_fe_w_fifo;
+static int vec_ec_register(struct vec_ec *ec)
+{
+	int err;
 
-	err = visdn_port_create_file(&ec->visdn_port,
-					&visdn_port_attr_ne_r_fifo_usage);
+	err = ks_node_register(&ec->ks_node);
 	if (err < 0)
-		goto err_create_file_ne_r_fifo;
+		goto err_node_register;
 
-	err = visdn_port_create_file(&ec->visdn_port,
-					&visdn_port_attr_ec_state);
+	vec_ec_get(ec);
+	err = ks_chan_register(&ec->ks_chan_fe_in);
 	if (err < 0)
-		goto err_create_file_ec_state;
+		goto err_chan_fe_in_register;
 
-	err = visdn_port_create_file(&ec->visdn_port,
-					&visdn_port_attr_ec_coeffs);
+	vec_ec_get(ec);
+	err = ks_chan_register(&ec->ks_chan_fe_out);
 	if (err < 0)
-		goto err_create_file_ec_coeffs;
+		goto err_chan_fe_out_register;
 
-	/* ----------- NEAR END ------------- */
-
-	visdn_chan_init(&ec->visdn_chan_ne);
-
-	ec->visdn_chan_ne.ops = &vec_chan_ne_ops;
-	ec->visdn_chan_ne.chan_class = NULL;
-	ec->visdn_chan_ne.port = &ec->visdn_port;
-	ec->visdn_chan_ne.write_priority = 100;
-
-	ec->visdn_chan_ne.leg_a.ops = &vec_leg_ne_ops;
-	ec->visdn_chan_ne.leg_a.cxc = &vsc_softcxc.cxc;
-	ec->visdn_chan_ne.leg_a.framing = VISDN_LEG_FRAMING_NONE;
-	ec->visdn_chan_ne.leg_a.framing_avail = VISDN_LEG_FRAMING_NONE;
-	ec->visdn_chan_ne.leg_a.mtu = -1;
-
-	ec->visdn_chan_ne.leg_b.ops = NULL;
-	ec->visdn_chan_ne.leg_b.cxc = NULL;
-	ec->visdn_chan_ne.leg_b.framing = VISDN_LEG_FRAMING_NONE;
-	ec->visdn_chan_ne.leg_b.framing_avail = VISDN_LEG_FRAMING_NONE;
-	ec->visdn_chan_ne.leg_b.mtu = -1;
-
-	strcpy(ec->visdn_chan_ne.name, "near_end");
-
-	ec->visdn_chan_fe.driver_data = ec;
-
-	err = visdn_chan_register(&ec->visdn_chan_ne);
+	vec_ec_get(ec);
+	err = ks_chan_register(&ec->ks_chan_ne_in);
 	if (err < 0)
-		goto err_chan_register_ne;
-
-	/* ----------- FAR END ------------- */
+		goto err_chan_ne_in_register;
 
-	visdn_chan_init(&ec->visdn_chan_fe);
-
-	ec->visdn_chan_fe.ops = &vec_chan_fe_ops;
-	ec->visdn_chan_fe.chan_class = NULL;
-	ec->visdn_chan_fe.port = &ec->visdn_port;
-	ec->visdn_chan_fe.write_priority = 100;
-
-	ec->visdn_chan_fe.leg_a.ops = &vec_leg_fe_ops;
-	ec->visdn_chan_fe.leg_a.cxc = &vsc_softcxc.cxc;
-	ec->visdn_chan_fe.leg_a.framing = VISDN_LEG_FRAMING_NONE;
-	ec->visdn_chan_fe.leg_a.framing_avail = VISDN_LEG_FRAMING_NONE;
-	ec->visdn_chan_fe.leg_a.mtu = -1;
-
-	ec->visdn_chan_fe.leg_b.ops = NULL;
-	ec->visdn_chan_fe.leg_b.cxc = NULL;
-	ec->visdn_chan_fe.leg_b.framing = VISDN_LEG_FRAMING_NONE;
-	ec->visdn_chan_fe.leg_b.framing_avail = VISDN_LEG_FRAMING_NONE;
-	ec->visdn_chan_fe.leg_b.mtu = -1;
-
-	strcpy(ec->visdn_chan_fe.name, "far_end");
-
-	ec->visdn_chan_fe.driver_data = ec;
-
-	err = visdn_chan_register(&ec->visdn_chan_fe);
+	vec_ec_get(ec);
+	err = ks_chan_register(&ec->ks_chan_ne_out);
 	if (err < 0)
-		goto err_chan_register_fe;
-
-	/* ------------------------------- */
+		goto err_chan_ne_out_register;
 
-	vec_debug(2, "Echo canceller opened\n");
+	down_write(&vec_ec_list_sem);
+	list_add_tail(&vec_ec_get(ec)->node, &vec_ec_list);
+	up_write(&vec_ec_list_sem);
 
 	return 0;
 
-	visdn_chan_unregister(&ec->visdn_chan_fe);
-err_chan_register_fe:
-	visdn_chan_unregister(&ec->visdn_chan_ne);
-err_chan_register_ne:
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_ec_coeffs);
-err_create_file_ec_coeffs:
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_ec_state);
-err_create_file_ec_state:
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_ne_r_fifo_usage);
-err_create_file_ne_r_fifo:
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_fe_w_fifo_usage);
-err_create_file_fe_w_fifo:
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_fe_r_fifo_usage);
-err_create_file_fe_r_fifo:
-	visdn_port_unregister(&ec->visdn_port);
-err_port_register:
-	kfifo_free(ec->ne_r_fifo);
-err_fifo_ne_r_alloc:
-	kfifo_free(ec->fe_w_fifo);
-err_fifo_fe_w_alloc:
-	kfifo_free(ec->fe_r_fifo);
-err_fifo_fe_r_alloc:
-	spin_lock(&vec_ec_list_lock);
-	list_del(&ec->node);
-	spin_unlock(&vec_ec_list_lock);
-
-	kfree(ec);
-err_kmalloc:
+err_chan_ne_out_register:
+	vec_ec_put(ec);
+	ks_chan_unregister(&ec->ks_chan_ne_in);
+err_chan_ne_in_register:
+	vec_ec_put(ec);
+	ks_chan_unregister(&ec->ks_chan_fe_out);
+err_chan_fe_out_register:
+	vec_ec_put(ec);
+	ks_chan_unregister(&ec->ks_chan_fe_in);
+err_chan_fe_in_register:
+	vec_ec_put(ec);
+	ks_node_unregister(&ec->ks_node);
+err_node_register:
 
 	return err;
 }
 
-static int vec_cdev_release(
-	struct inode *inode, struct file *file)
+static void vec_ec_unregister(struct vec_ec *ec)
 {
-	struct vec_ec *ec = file->private_data;
-	struct visdn_pipeline *pipeline;
-
-	vec_debug(3, "vec_cdev_release()\n");
-
-	pipeline = visdn_pipeline_get_by_endpoint(&ec->visdn_chan_ne);
-	if (pipeline)  {
-		visdn_pipeline_disconnect(pipeline);
-		visdn_pipeline_put(pipeline);
-	}
-
-	pipeline = visdn_pipeline_get_by_endpoint(&ec->visdn_chan_fe);
-	if (pipeline) {
-		visdn_pipeline_disconnect(pipeline);
-		visdn_pipeline_put(pipeline);
-	}
+	vec_stop(ec);
 
-	visdn_chan_unregister(&ec->visdn_chan_fe);
-	visdn_chan_unregister(&ec->visdn_chan_ne);
-
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_ec_coeffs);
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_ec_state);
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_ne_r_fifo_usage);
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_fe_w_fifo_usage);
-	visdn_port_remove_file(&ec->visdn_port,
-				&visdn_port_attr_fe_r_fifo_usage);
-	visdn_port_unregister(&ec->visdn_port);
-
-	kfifo_free(ec->ne_r_fifo);
-	kfifo_free(ec->fe_w_fifo);
-	kfifo_free(ec->fe_r_fifo);
-
-	spin_lock(&vec_ec_list_lock);
+	down_write(&vec_ec_list_sem);
 	list_del(&ec->node);
-	spin_unlock(&vec_ec_list_lock);
+	up_write(&vec_ec_list_sem);
+	vec_ec_put(ec);
 
-	if (ec->ec)
-		echo_can_free(ec->ec);
-
-	kfree(ec);
-
-	return 0;
+	ks_chan_unregister(&ec->ks_chan_ne_out);
+	ks_chan_unregister(&ec->ks_chan_ne_in);
+	ks_chan_unregister(&ec->ks_chan_fe_out);
+	ks_chan_unregister(&ec->ks_chan_fe_in);
+	ks_node_unregister(&ec->ks_node);
 }
 
-static int vec_cdev_ioctl(
-	struct inode *inode,
-	struct file *file,
-	unsigned int cmd,
-	unsigned long arg)
+static void vec_ecs_destroy(void)
 {
-	struct vec_ec *ec = file->private_data;
-
-	switch(cmd) {
-	case VEC_GET_FAREND_CHANID:
-		return put_user(ec->visdn_chan_fe.id, (unsigned int *)arg);
-	break;
-
-	case VEC_GET_NEAREND_CHANID:
-		return put_user(ec->visdn_chan_ne.id, (unsigned int *)arg);
-	break;
+	struct vec_ec *ec;
 
-	case VEC_START:
-		vec_start(ec);
-		return 0;
-	break;
+	for (;;) {
+		down_read(&vec_ec_list_sem);
+		if (list_empty(&vec_ec_list)) {
+			up_read(&vec_ec_list_sem);
+			break;
+		}
 
-	case VEC_STOP:
-		vec_stop(ec);
-		return 0;
-	break;
+		ec = vec_ec_get(list_entry(vec_ec_list.next,
+					struct vec_ec, node));
+		up_read(&vec_ec_list_sem);
 
+		vec_ec_unregister(ec);
+		vec_ec_put(ec);
 	}
-
-	return -EOPNOTSUPP;
-}
-
-static struct file_operations vec_fops =
-{
-	.owner		= THIS_MODULE,
-	.read		= NULL,
-	.write		= NULL,
-	.ioctl		= vec_cdev_ioctl,
-	.open		= vec_cdev_open,
-	.release	= vec_cdev_release,
-	.llseek		= no_llseek,
-};
-
-#ifndef HAVE_CLASS_DEV_DEVT
-static ssize_t show_dev(struct class_device *class_dev, char *buf)
-{
-	return print_dev_t(buf, vec_first_dev);
-}
-static CLASS_DEVICE_ATTR(dev, S_IRUGO, show_dev, NULL);
-#endif
-
-#ifdef DEBUG_CODE
-static ssize_t vec_show_debug_level(
-	struct visdn_port *port,
-	struct visdn_port_attribute *attr,
-	char *buf)
-{
-	return snprintf(buf, PAGE_SIZE, "%d\n", debug_level);
-}
-
-static ssize_t vec_store_debug_level(
-	struct visdn_port *port,
-	struct visdn_port_attribute *attr,
-	const char *buf,
-	size_t count)
-{
-	unsigned int value;
-	if (sscanf(buf, "%01x", &value) < 1)
-		return -EINVAL;
-
-	debug_level = value;
-
-	vec_msg(KERN_INFO, "Debug level set to '%d'\n", debug_level);
-
-	return count;
 }
 
-VISDN_PORT_ATTR(debug_level, S_IRUGO | S_IWUSR,
-	vec_show_debug_level,
-	vec_store_debug_level);
-#endif
+/******************************************
+ * Module stuff
+ ******************************************/
 
 static int __init vec_init_module(void)
 {
+	struct vec_ec *ec;
 	int err;
+	int i;
 
 	vec_msg(KERN_INFO, vec_MODULE_DESCR " loading\n");
 
-	err = alloc_chrdev_region(&vec_first_dev, 0, 1, vec_MODULE_NAME);
-	if (err < 0)
-		goto err_register_chrdev;
+	if (taps <= 0 || taps > VEC_MAX_TAPS)
+		taps = VEC_DEFAULT_TAPS;
 
-	cdev_init(&vec_cdev, &vec_fops);
-	vec_cdev.owner = THIS_MODULE;
+	vec_pool_init();
 
-	err = cdev_add(&vec_cdev, vec_first_dev, 1);
-	if (err < 0)
-		goto err_cdev_add;
-
-	snprintf(vec_class_dev.class_id,
-		sizeof(vec_class_dev.class_id),
-		"ec-control");
-	vec_class_dev.class = &visdn_system_class;
-	vec_class_dev.dev = NULL;
-#ifdef HAVE_CLASS_DEV_DEVT
-	vec_class_dev.devt = vec_first_dev;
-#endif
+	vec_feature = ks_feature_register("echo_canceller");
+	if (!vec_feature) {
+		err = -ENOMEM;
+		goto err_feature_register;
+	}
 
-	err = class_device_register(&vec_class_dev);
-	if (err < 0)
-		goto err_class_device_register;
+	for (i=0; i<instances; i++) {
+		ec = vec_ec_create(i);
+		if (!ec) {
+			err = -ENOMEM;
+			goto err_ec_create;
+		}
 
-#ifndef HAVE_CLASS_DEV_DEVT
-	err = class_device_create_file(
-		&vec_class_dev,
-		&class_device_attr_dev);
-	if (err < 0)
-		goto err_class_device_create_file;
-#endif
+		err = vec_ec_register(ec);
+		if (err < 0) {
+			vec_ec_put(ec);
+			goto err_ec_register;
+		}
+
+		/* The list holds its own reference */
+		vec_ec_put(ec);
+	}
+
+	vec_msg(KERN_INFO, vec_MODULE_DESCR " loaded successfully\n");
 
 	return 0;
 
-	class_device_unregister(&vec_class_dev);
-err_class_device_register:
-#ifndef HAVE_CLASS_DEV_DEVT
-	class_device_remove_file(
-		&vec_class_dev,
-		&class_device_attr_dev);
-err_class_device_create_file:
-#endif
-	cdev_del(&vec_cdev);
-err_cdev_add:
-	unregister_chrdev_region(vec_first_dev, 1);
-err_register_chrdev:
+err_ec_register:
+err_ec_create:
+	vec_ecs_destroy();
+	ks_feature_unregister(vec_feature);
+err_feature_register:
+	vec_pool_destroy();
 
 	return err;
 }
@@ -914,18 +714,9 @@ module_init(vec_init_module);
 
 static void __exit vec_module_exit(void)
 {
-	// We should free all channels, here!
-
-#ifndef HAVE_CLASS_DEV_DEVT
-	class_device_remove_file(
-		&vec_class_dev,
-		&class_device_attr_dev);
-#endif
-
-	class_device_unregister(&vec_class_dev);
-
-	cdev_del(&vec_cdev);
-	unregister_chrdev_region(vec_first_dev, 1);
+	vec_ecs_destroy();
+	ks_feature_unregister(vec_feature);
+	vec_pool_destroy();
 
 	vec_msg(KERN_INFO, vec_MODULE_DESCR " unloaded\n");
 }
@@ -936,6 +727,15 @@ MODULE_DESCRIPTION(vec_MODULE_DESCR);
 MODULE_AUTHOR("Daniele (Vihai) Orlandi <daniele@orlandi.com>");
 MODULE_LICENSE("GPL");
 
+module_param(instances, int, 0444);
+MODULE_PARM_DESC(instances, "Number of echo cancellers");
+
+module_param(taps, int, 0444);
+MODULE_PARM_DESC(taps, "Default echo tail length, in samples");
+
+module_param(pool_max, int, 0644);
+MODULE_PARM_DESC(pool_max, "Idle echo canceller buffers kept per size class");
+
 #ifdef DEBUG_CODE
 module_param(debug_level, int, 0444);
 MODULE_PARM_DESC(debug_level, "Initial debug level");
@@ -65,6 +65,11 @@
 #define TRUE (!FALSE)
 #endif
 
+/* Coefficients and sample buffers start on a cache line of their own */
+#define MG2_ALIGN 64
+#define MG2_ALIGN_PTR(p) \
+	((void *)(((unsigned long)(p) + MG2_ALIGN - 1) & ~(MG2_ALIGN - 1UL)))
+
 /* Generic circular buffer definition */
 typedef struct {
 	/* Pointer to the relative 'start' of the buffer */
@@ -77,6 +82,9 @@ typedef struct {
 
 /* Echo canceller definition */
 typedef struct  {
+	/* The memory block holding this state, as allocated */
+	void *mem;
+
 	/* an arbitrary ID for this echo can - this really should be settable from the calling channel... */
 	int id;
 
@@ -140,8 +148,12 @@ typedef struct  {
 	int avg_Lu_i_toolow; 
 	int avg_Lu_i_ok;
 #endif 
-	short lastsig[256];
-	int lastpos;
+	/* Last near-end sample and how many times in a row it was seen */
+	short lastsig;
+	int lastsig_run;
+
+	/* Set by echo_can_update_frame() while it owns the FPU */
+	int simd;
 
 } echo_can_state_t;
 
@@ -175,13 +187,8 @@ static inline void init_cc(echo_can_state_t *ec, int N, int maxy, int maxu)
 {
 
 	void *ptr = ec;
-	unsigned long tmp;
-	/* Double-word align past end of state */
-	ptr += sizeof(echo_can_state_t);
-	tmp = (unsigned long)ptr;
-	tmp += 3;
-	tmp &= ~3L;
-	ptr = (void *)tmp;
+
+	ptr = MG2_ALIGN_PTR(ptr + sizeof(echo_can_state_t));
 
 	/* Reset parameters */
 	ec->N_d = N;
@@ -189,20 +196,20 @@ static inline void init_cc(echo_can_state_t *ec, int N, int maxy, int maxu)
   
 	/* Allocate coefficient memory */
 	ec->a_i = ptr;
-	ptr += (sizeof(int) * ec->N_d);
+	ptr = MG2_ALIGN_PTR(ptr + sizeof(int) * ec->N_d);
 	ec->a_s = ptr;
-	ptr += (sizeof(short) * ec->N_d);
+	ptr = MG2_ALIGN_PTR(ptr + sizeof(short) * ec->N_d);
 
 	/* Reset Y circular buffer (short version) */
 	init_cb_s(&ec->y_s, maxy, ptr);
-	ptr += (sizeof(short) * (maxy) * 2);
+	ptr = MG2_ALIGN_PTR(ptr + sizeof(short) * (maxy) * 2);
   
 	/* Reset Sigma circular buffer (short version for FIR filter) */
 	init_cb_s(&ec->s_s, (1 << DEFAULT_ALPHA_ST_I), ptr);
-	ptr += (sizeof(short) * (1 << DEFAULT_ALPHA_ST_I) * 2);
+	ptr = MG2_ALIGN_PTR(ptr + sizeof(short) * (1 << DEFAULT_ALPHA_ST_I) * 2);
 
 	init_cb_s(&ec->u_s, maxu, ptr);
-	ptr += (sizeof(short) * maxu * 2);
+	ptr = MG2_ALIGN_PTR(ptr + sizeof(short) * maxu * 2);
 
 	/* Allocate a buffer for the reference signal power computation */
 	init_cb_s(&ec->y_tilde_s, ec->N_d, ptr);
@@ -238,7 +245,7 @@ static inline void init_cc(echo_can_state_t *ec, int N, int maxy, int maxu)
 
 static inline void echo_can_free(echo_can_state_t *ec)
 {
-	FREE(ec);
+	FREE(ec->mem);
 }
 
 static inline short echo_can_update(echo_can_state_t *ec, short iref, short isig) 
@@ -279,23 +286,23 @@ static inline short echo_can_update(echo_can_state_t *ec, short iref, short isig
  
 
 	/* eq. (2): compute r in fixed-point */
-	rs = CONVOLVE2(ec->a_s, 
+	rs = CONVOLVE2_SIMD(ec->simd, ec->a_s, 
   			ec->y_s.buf_d + ec->y_s.idx_d, 
   			ec->N_d);
 	rs >>= 15;
 
-	ec->lastsig[ec->lastpos++] = isig;
-	if (ec->lastpos >= 256)
-		ec->lastpos = 0;
-
-	for (k=0; k < 256; k++) {
-		if (isig != ec->lastsig[k])
-			break;
+	/* A near-end signal stuck for 256 samples is passed through */
+	if (isig == ec->lastsig) {
+		if (ec->lastsig_run < 256)
+			ec->lastsig_run++;
+	} else {
+		ec->lastsig = isig;
+		ec->lastsig_run = 1;
 	}
 
 	if (isig == 0) {
 		u = 0;
-	} else if (k == 256) {
+	} else if (ec->lastsig_run == 256) {
 		u = isig;
 	} else {
 		if (rs < -32768) {
@@ -447,7 +454,8 @@ static inline short echo_can_update(echo_can_state_t *ec, short iref, short isig
 				for (k=0; k < ec->N_d; k++) {
 					/* eq. (7): compute an expectation over M_d samples */
 					int grad2;
-					grad2 = CONVOLVE2(ec->u_s.buf_d + ec->u_s.idx_d,
+					grad2 = CONVOLVE2_SIMD(ec->simd,
+							  ec->u_s.buf_d + ec->u_s.idx_d,
 							  ec->y_s.buf_d + ec->y_s.idx_d + k,
 							  DEFAULT_M);
 					/* eq. (7): update the coefficient */
@@ -556,41 +564,80 @@ static inline short echo_can_update(echo_can_state_t *ec, short iref, short isig
 	return u;
 }
 
-static inline echo_can_state_t *echo_can_create(int len, int adaption_mode)
+/* Cancels the echo of ref[] from sig[], in place, a whole frame at a time */
+static inline void echo_can_update_frame(echo_can_state_t *ec,
+	const short *ref, short *sig, int len)
+{
+	int i;
+
+	ec->simd = ARITH_SIMD_BEGIN();
+
+	for (i=0; i<len; i++)
+		sig[i] = echo_can_update(ec, ref[i], sig[i]);
+
+	ARITH_SIMD_END(ec->simd);
+	ec->simd = 0;
+}
+
+static inline void echo_can_dims(int len, int *maxy, int *maxu)
+{
+	*maxy = len + DEFAULT_M;
+	*maxu = DEFAULT_M;
+	if (*maxy < (1 << DEFAULT_ALPHA_YT_I))
+		*maxy = (1 << DEFAULT_ALPHA_YT_I);
+	if (*maxy < (1 << DEFAULT_SIGMA_LY_I))
+		*maxy = (1 << DEFAULT_SIGMA_LY_I);
+	if (*maxu < (1 << DEFAULT_SIGMA_LU_I))
+		*maxu = (1 << DEFAULT_SIGMA_LU_I);
+}
+
+/* Bytes of memory needed by a can of len taps, alignment slack included */
+static inline int echo_can_size(int len)
+{
+	int maxy;
+	int maxu;
+
+	echo_can_dims(len, &maxy, &maxu);
+
+	return	MG2_ALIGN * 7 +
+		sizeof(echo_can_state_t) +
+		sizeof(int) * len +			/* a_i */
+		sizeof(short) * len + 			/* a_s */
+		2 * sizeof(short) * (maxy) +		/* y_s */
+		2 * sizeof(short) * (1 << DEFAULT_ALPHA_ST_I) + /* s_s */
+		2 * sizeof(short) * (maxu) +		/* u_s */
+		2 * sizeof(short) * len;		/* y_tilde_s */
+}
+
+/* Builds a can in mem, which must be at least echo_can_size(len) bytes */
+static inline echo_can_state_t *echo_can_init(void *mem, int len)
 {
 	echo_can_state_t *ec;
 	int maxy;
 	int maxu;
-	maxy = len + DEFAULT_M;
-	maxu = DEFAULT_M;
-	if (maxy < (1 << DEFAULT_ALPHA_YT_I))
-		maxy = (1 << DEFAULT_ALPHA_YT_I);
-	if (maxy < (1 << DEFAULT_SIGMA_LY_I))
-		maxy = (1 << DEFAULT_SIGMA_LY_I);
-	if (maxu < (1 << DEFAULT_SIGMA_LU_I))
-		maxu = (1 << DEFAULT_SIGMA_LU_I);
-	ec = (echo_can_state_t *)MALLOC(sizeof(echo_can_state_t) +
-									4 + 						/* align */
-									sizeof(int) * len +			/* a_i */
-									sizeof(short) * len + 		/* a_s */
-									2 * sizeof(short) * (maxy) +	/* y_s */
-									2 * sizeof(short) * (1 << DEFAULT_ALPHA_ST_I) + /* s_s */
-									2 * sizeof(short) * (maxu) +		/* u_s */
-									2 * sizeof(short) * len);			/* y_tilde_s */
-	if (ec) {
-		memset(ec, 0, sizeof(echo_can_state_t) +
-									4 + 						/* align */
-									sizeof(int) * len +			/* a_i */
-									sizeof(short) * len + 		/* a_s */
-									2 * sizeof(short) * (maxy) +	/* y_s */
-									2 * sizeof(short) * (1 << DEFAULT_ALPHA_ST_I) + /* s_s */
-									2 * sizeof(short) * (maxu) +		/* u_s */
-									2 * sizeof(short) * len);			/* y_tilde_s */
-	  init_cc(ec, len, maxy, maxu);
-	}
+
+	echo_can_dims(len, &maxy, &maxu);
+
+	memset(mem, 0, echo_can_size(len));
+
+	ec = MG2_ALIGN_PTR(mem);
+	ec->mem = mem;
+	init_cc(ec, len, maxy, maxu);
+
 	return ec;
 }
 
+static inline echo_can_state_t *echo_can_create(int len, int adaption_mode)
+{
+	void *mem;
+
+	mem = MALLOC(echo_can_size(len));
+	if (!mem)
+		return NULL;
+
+	return echo_can_init(mem, len);
+}
+
 static inline int echo_can_traintap(echo_can_state_t *ec, int pos, short val)
 {
 	/* Set the hangover counter to the length of the can to 
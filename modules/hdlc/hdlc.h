@@ -0,0 +1,152 @@
+/*
+ * Kstreamer software HDLC framer/deframer
+ *
+ * Copyright (C) 2006-2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#ifndef _KSHDLC_HDLC_H
+#define _KSHDLC_HDLC_H
+
+#ifdef __KERNEL__
+
+#include <linux/spinlock.h>
+#include <linux/skbuff.h>
+
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+
+#define kshdlc_MODULE_NAME "ks-hdlc"
+#define kshdlc_MODULE_PREFIX kshdlc_MODULE_NAME ": "
+#define kshdlc_MODULE_DESCR "kstreamer software HDLC framer/deframer"
+
+#define KSHDLC_FLAG 0x7e
+
+/* Frames waiting to be transmitted before push_frame reports FIFO full */
+#define KSHDLC_TX_QUEUE_LEN 16
+
+#define KSHDLC_DEFAULT_MRU 1600
+
+/* Minimum frame, FCS included */
+#define KSHDLC_MIN_FRAME 4
+
+/* FCS-16 computed over a frame followed by its FCS */
+#define KSHDLC_FCS_GOOD 0xf0b8
+
+/* One byte bit-stuffed, starting after "ones" consecutive 1 bits */
+struct kshdlc_stuff_entry
+{
+	u16 bits;
+	u8 nbits;
+	u8 ones;
+};
+
+/* One byte destuffed, starting after "ones" consecutive 1 bits.
+ * Bytes containing six consecutive 1 bits, flags or aborts, are
+ * marked special and decoded a bit at a time.
+ */
+struct kshdlc_unstuff_entry
+{
+	u8 bits;
+	u8 nbits;
+	u8 ones;
+	u8 special;
+};
+
+struct kshdlc_framer
+{
+	spinlock_t lock;
+
+	int enabled;
+
+	struct sk_buff_head queue;
+
+	/* Frame being transmitted and position in it */
+	struct sk_buff *skb;
+	int pos;
+	u16 fcs;
+
+	/* Bits yet to be transmitted, LSB first */
+	u32 acc;
+	int nbits;
+	int ones;
+
+	/* The last bits transmitted are a flag */
+	int flagged;
+
+	u64 last_out;
+	u32 out_rem;
+};
+
+struct kshdlc_deframer
+{
+	spinlock_t lock;
+
+	int enabled;
+
+	/* Frame being received */
+	struct sk_buff *skb;
+	u16 fcs;
+
+	/* Destuffed bits, at least the last six are kept as they may
+	 * turn out to be part of a flag
+	 */
+	u32 acc;
+	int nbits;
+	int ones;
+
+	/* Discard bits until the next flag */
+	int hunt;
+};
+
+struct kshdlc_hdlc
+{
+	struct list_head node;
+
+	struct ks_node ks_node;
+
+	/* Frames to be framed into a bitstream */
+	struct ks_chan ks_chan_framer_in;
+	struct ks_chan ks_chan_framer_out;
+
+	/* Bitstream to be deframed into frames */
+	struct ks_chan ks_chan_deframer_in;
+	struct ks_chan ks_chan_deframer_out;
+
+	int id;
+
+	struct kshdlc_framer framer;
+	struct kshdlc_deframer deframer;
+};
+
+#if defined(DEBUG_CODE) && defined(DEBUG_DEFAULTS)
+#define kshdlc_debug(dbglevel, format, arg...)			\
+	if (debug_level >= dbglevel)				\
+		printk(KERN_DEBUG kshdlc_MODULE_PREFIX		\
+			format,					\
+			## arg)
+#else
+#define kshdlc_debug(format, arg...) do {} while (0)
+#endif
+
+#define kshdlc_msg(level, format, arg...)			\
+	printk(level kshdlc_MODULE_PREFIX			\
+		format,						\
+		## arg)
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,1098 @@
+/*
+ * Kstreamer software HDLC framer/deframer
+ *
+ * Copyright (C) 2006-2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+/* Each instance is a node with two independent paths, framer_in ->
+ * framer_out turns frames into a bit-stuffed bitstream played out at
+ * each tick of the pipeline, deframer_in -> deframer_out turns a
+ * bitstream back into frames. They provide the "hdlc_framer" and
+ * "hdlc_deframer" features for channels without hardware HDLC.
+ *
+ * As with hardware framers, frames carry two trailing FCS octets: the
+ * framer replaces them with the computed FCS and the deframer leaves
+ * the received, verified, FCS in place.
+ *
+ * Bit stuffing and destuffing are done a byte at a time by lookup
+ * tables indexed by the count of preceding 1 bits, only bytes
+ * containing flags or aborts are decoded bit by bit.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/ktime.h>
+#include <linux/skbuff.h>
+#include <asm/div64.h>
+
+#include <linux/kstreamer/kstreamer.h>
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+#include <linux/kstreamer/pipeline.h>
+#include <linux/kstreamer/streamframe.h>
+#include <linux/kstreamer/softswitch.h>
+#include <linux/kstreamer/feature.h>
+#include <linux/kstreamer/hdlc_framer.h>
+
+#include "hdlc.h"
+
+#ifdef DEBUG_CODE
+#ifdef DEBUG_DEFAULTS
+int debug_level = 3;
+#else
+int debug_level = 0;
+#endif
+#endif
+
+static int instances = 32;
+static int mru = KSHDLC_DEFAULT_MRU;
+
+static struct list_head kshdlc_hdlcs_list = LIST_HEAD_INIT(kshdlc_hdlcs_list);
+static DECLARE_RWSEM(kshdlc_hdlcs_list_sem);
+
+static struct ks_feature *kshdlc_framer_feature;
+static struct ks_feature *kshdlc_deframer_feature;
+
+static u16 kshdlc_fcs_table[256];
+static struct kshdlc_stuff_entry kshdlc_stuff_table[5][256];
+static struct kshdlc_unstuff_entry kshdlc_unstuff_table[6][256];
+
+static struct kshdlc_hdlc *kshdlc_hdlc_get(struct kshdlc_hdlc *hdlc)
+{
+	if (ks_node_get(&hdlc->ks_node))
+		return hdlc;
+	else
+		return NULL;
+}
+
+static void kshdlc_hdlc_put(struct kshdlc_hdlc *hdlc)
+{
+	ks_node_put(&hdlc->ks_node);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void kshdlc_tables_init(void)
+{
+	int ones;
+	int byte;
+	int i;
+
+	/* FCS-16, x^16 + x^12 + x^5 + 1, reflected */
+	for (byte=0; byte<256; byte++) {
+		u16 fcs = byte;
+
+		for (i=0; i<8; i++)
+			fcs = (fcs & 1) ? (fcs >> 1) ^ 0x8408 : fcs >> 1;
+
+		kshdlc_fcs_table[byte] = fcs;
+	}
+
+	/* A 0 is inserted after five consecutive 1 bits */
+	for (ones=0; ones<5; ones++) {
+		for (byte=0; byte<256; byte++) {
+			struct kshdlc_stuff_entry *e =
+				&kshdlc_stuff_table[ones][byte];
+			int o = ones;
+
+			e->bits = 0;
+			e->nbits = 0;
+
+			for (i=0; i<8; i++) {
+				if (byte & (1 << i)) {
+					e->bits |= 1 << e->nbits++;
+
+					if (++o == 5) {
+						e->nbits++;
+						o = 0;
+					}
+				} else {
+					e->nbits++;
+					o = 0;
+				}
+			}
+
+			e->ones = o;
+		}
+	}
+
+	/* The 0 following five consecutive 1 bits is removed */
+	for (ones=0; ones<6; ones++) {
+		for (byte=0; byte<256; byte++) {
+			struct kshdlc_unstuff_entry *e =
+				&kshdlc_unstuff_table[ones][byte];
+			int o = ones;
+
+			e->bits = 0;
+			e->nbits = 0;
+			e->special = FALSE;
+
+			for (i=0; i<8; i++) {
+				if (byte & (1 << i)) {
+					if (++o == 6) {
+						e->special = TRUE;
+						break;
+					}
+
+					e->bits |= 1 << e->nbits++;
+				} else {
+					if (o != 5)
+						e->nbits++;
+
+					o = 0;
+				}
+			}
+
+			e->ones = o;
+		}
+	}
+}
+
+static inline u16 kshdlc_fcs_update(u16 fcs, u8 byte)
+{
+	return (fcs >> 8) ^ kshdlc_fcs_table[(fcs ^ byte) & 0xff];
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void kshdlc_framer_reset(struct kshdlc_framer *fr)
+{
+	if (fr->skb) {
+		kfree_skb(fr->skb);
+		fr->skb = NULL;
+	}
+
+	skb_queue_purge(&fr->queue);
+
+	fr->acc = 0;
+	fr->nbits = 0;
+	fr->ones = 0;
+	fr->flagged = FALSE;
+	fr->last_out = 0;
+	fr->out_rem = 0;
+}
+
+static inline void kshdlc_framer_put_byte(
+	struct kshdlc_framer *fr,
+	u8 byte)
+{
+	const struct kshdlc_stuff_entry *e =
+		&kshdlc_stuff_table[fr->ones][byte];
+
+	fr->acc |= (u32)e->bits << fr->nbits;
+	fr->nbits += e->nbits;
+	fr->ones = e->ones;
+}
+
+static inline void kshdlc_framer_put_flag(struct kshdlc_framer *fr)
+{
+	fr->acc |= KSHDLC_FLAG << fr->nbits;
+	fr->nbits += 8;
+	fr->ones = 0;
+	fr->flagged = TRUE;
+}
+
+/* Frame boundaries, FCS and idle flags */
+static void kshdlc_framer_next(struct kshdlc_framer *fr)
+{
+	struct sk_buff *skb = fr->skb;
+
+	if (!skb) {
+		/* Consecutive frames share the flag */
+		if (fr->flagged)
+			skb = skb_dequeue(&fr->queue);
+
+		if (!skb) {
+			kshdlc_framer_put_flag(fr);
+			return;
+		}
+
+		fr->skb = skb;
+		fr->pos = 0;
+		fr->fcs = 0xffff;
+	}
+
+	if (fr->pos == skb->len - 2) {
+		fr->fcs ^= 0xffff;
+		kshdlc_framer_put_byte(fr, fr->fcs & 0xff);
+	} else if (fr->pos == skb->len - 1) {
+		kshdlc_framer_put_byte(fr, fr->fcs >> 8);
+	} else if (fr->pos == skb->len) {
+		kshdlc_framer_put_flag(fr);
+
+		kfree_skb(skb);
+		fr->skb = NULL;
+
+		return;
+	} else {
+		u8 byte = skb->data[fr->pos];
+
+		fr->fcs = kshdlc_fcs_update(fr->fcs, byte);
+		kshdlc_framer_put_byte(fr, byte);
+	}
+
+	fr->pos++;
+	fr->flagged = FALSE;
+}
+
+static void kshdlc_framer_fill(
+	struct kshdlc_framer *fr,
+	u8 *out,
+	int n)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		while (fr->nbits < 8) {
+			struct sk_buff *skb = fr->skb;
+
+			if (likely(skb && fr->pos < (int)skb->len - 2)) {
+				u8 byte = skb->data[fr->pos++];
+
+				fr->fcs = kshdlc_fcs_update(fr->fcs, byte);
+				kshdlc_framer_put_byte(fr, byte);
+			} else
+				kshdlc_framer_next(fr);
+		}
+
+		out[i] = fr->acc;
+		fr->acc >>= 8;
+		fr->nbits -= 8;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void kshdlc_deframer_reset(struct kshdlc_deframer *df)
+{
+	if (df->skb) {
+		kfree_skb(df->skb);
+		df->skb = NULL;
+	}
+
+	df->fcs = 0xffff;
+	df->acc = 0;
+	df->nbits = 0;
+	df->ones = 0;
+	df->hunt = TRUE;
+}
+
+static void kshdlc_deframer_discard(struct kshdlc_deframer *df)
+{
+	if (df->skb) {
+		kfree_skb(df->skb);
+		df->skb = NULL;
+	}
+
+	df->fcs = 0xffff;
+	df->acc = 0;
+	df->nbits = 0;
+}
+
+static void kshdlc_deframer_push_byte(struct kshdlc_deframer *df)
+{
+	u8 byte = df->acc;
+
+	if (!df->skb) {
+		df->skb = alloc_skb(mru, GFP_ATOMIC);
+		if (!df->skb) {
+			kshdlc_debug(2, "cannot allocate skb: frame dropped\n");
+			goto err_alloc_skb;
+		}
+	}
+
+	if (df->skb->len >= mru) {
+		kshdlc_debug(3, "frame longer than MRU: dropped\n");
+		goto err_too_long;
+	}
+
+	*(u8 *)skb_put(df->skb, 1) = byte;
+	df->fcs = kshdlc_fcs_update(df->fcs, byte);
+
+	df->acc >>= 8;
+	df->nbits -= 8;
+
+	return;
+
+err_too_long:
+err_alloc_skb:
+	kshdlc_deframer_discard(df);
+	df->hunt = TRUE;
+}
+
+static inline void kshdlc_deframer_put(
+	struct kshdlc_deframer *df,
+	u32 bits,
+	int nbits)
+{
+	if (df->hunt)
+		return;
+
+	df->acc |= bits << df->nbits;
+	df->nbits += nbits;
+
+	/* Keep the six bits which may be the start of a flag */
+	if (df->nbits >= 8 + 6)
+		kshdlc_deframer_push_byte(df);
+}
+
+static void kshdlc_deframer_flag(
+	struct kshdlc_deframer *df,
+	struct sk_buff_head *frames)
+{
+	struct sk_buff *skb;
+
+	/* The flag's leading 0 and five 1s have been taken as data */
+	if (df->hunt || df->nbits < 6)
+		goto done;
+
+	df->nbits -= 6;
+
+	if (df->nbits & 7) {
+		kshdlc_debug(3, "frame not octet aligned: dropped\n");
+		goto done;
+	}
+
+	while (df->nbits && !df->hunt)
+		kshdlc_deframer_push_byte(df);
+
+	skb = df->skb;
+	if (!skb)
+		goto done;
+
+	if (skb->len < KSHDLC_MIN_FRAME) {
+		kshdlc_debug(3, "frame too short (%d): dropped\n", skb->len);
+		goto done;
+	}
+
+	if (df->fcs != KSHDLC_FCS_GOOD) {
+		kshdlc_debug(3, "frame with wrong FCS: dropped\n");
+		goto done;
+	}
+
+	__skb_queue_tail(frames, skb);
+	df->skb = NULL;
+
+done:
+	kshdlc_deframer_discard(df);
+	df->hunt = FALSE;
+}
+
+static void kshdlc_deframer_bit(
+	struct kshdlc_deframer *df,
+	int bit,
+	struct sk_buff_head *frames)
+{
+	if (bit) {
+		if (++df->ones < 6)
+			kshdlc_deframer_put(df, 1, 1);
+		else if (df->ones >= 7) {
+			if (df->ones == 7 && !df->hunt) {
+				kshdlc_debug(3, "frame aborted\n");
+
+				kshdlc_deframer_discard(df);
+				df->hunt = TRUE;
+			}
+
+			df->ones = 7;
+		}
+	} else {
+		if (df->ones == 6)
+			kshdlc_deframer_flag(df, frames);
+		else if (df->ones < 5)
+			kshdlc_deframer_put(df, 0, 1);
+
+		df->ones = 0;
+	}
+}
+
+static void kshdlc_deframer_decode(
+	struct kshdlc_deframer *df,
+	const u8 *data,
+	int len,
+	struct sk_buff_head *frames)
+{
+	int i;
+	int b;
+
+	for (i=0; i<len; i++) {
+		u8 byte = data[i];
+
+		if (likely(df->ones < 6)) {
+			const struct kshdlc_unstuff_entry *e =
+				&kshdlc_unstuff_table[df->ones][byte];
+
+			if (likely(!e->special)) {
+				df->ones = e->ones;
+				kshdlc_deframer_put(df, e->bits, e->nbits);
+
+				continue;
+			}
+		}
+
+		for (b=0; b<8; b++)
+			kshdlc_deframer_bit(df, (byte >> b) & 1, frames);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void kshdlc_node_release(struct ks_node *ks_node)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_node,
+					struct kshdlc_hdlc, ks_node);
+
+	kshdlc_debug(3, "kshdlc_node_release()\n");
+
+	kshdlc_framer_reset(&hdlc->framer);
+	kshdlc_deframer_reset(&hdlc->deframer);
+
+	kfree(hdlc);
+}
+
+static struct ks_node_ops kshdlc_node_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= kshdlc_node_release,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void kshdlc_framer_in_chan_release(struct ks_chan *ks_chan)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_in);
+
+	kshdlc_debug(3, "kshdlc_framer_in_chan_release()\n");
+
+	kshdlc_hdlc_put(hdlc);
+}
+
+static int kshdlc_framer_in_chan_get_attr_count(struct ks_chan *ks_chan)
+{
+	return 1;
+}
+
+static int kshdlc_framer_in_chan_get_attr(
+	struct ks_chan *ks_chan,
+	int index,
+	__u16 *type,
+	void *buf,
+	int *len)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_in);
+	struct ks_hdlc_framer_descr *descr = buf;
+
+	if (index != 0)
+		return -EINVAL;
+
+	if (*len < sizeof(struct ks_hdlc_framer_descr))
+		return -ENOSPC;
+
+	*type = kshdlc_framer_feature->id;
+	*len = sizeof(struct ks_hdlc_framer_descr);
+
+	memset(descr, 0, sizeof(*descr));
+	descr->hardware = 0;
+	descr->enabled = hdlc->framer.enabled ? 1 : 0;
+
+	return 0;
+}
+
+static int kshdlc_framer_in_chan_set_attr(
+	struct ks_chan *ks_chan,
+	__u16 type,
+	void *buf,
+	int len)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_in);
+	struct ks_hdlc_framer_descr *descr = buf;
+
+	if (type != kshdlc_framer_feature->id)
+		return -ENOENT;
+
+	if (len < sizeof(struct ks_hdlc_framer_descr))
+		return -EINVAL;
+
+	spin_lock_bh(&hdlc->framer.lock);
+	if (hdlc->framer.enabled != descr->enabled) {
+		kshdlc_framer_reset(&hdlc->framer);
+		hdlc->framer.enabled = descr->enabled;
+	}
+	spin_unlock_bh(&hdlc->framer.lock);
+
+	return 0;
+}
+
+static struct ks_chan_ops kshdlc_framer_in_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= kshdlc_framer_in_chan_release,
+	.get_attr_count	= kshdlc_framer_in_chan_get_attr_count,
+	.get_attr	= kshdlc_framer_in_chan_get_attr,
+	.set_attr	= kshdlc_framer_in_chan_set_attr,
+};
+
+static int kshdlc_framer_in_chan_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_in);
+
+	/* Raw data is passed through only while the framer is disabled */
+	if (!hdlc->framer.enabled)
+		return kss_chan_push_raw(&hdlc->ks_chan_framer_out, sf);
+
+	return 0;
+}
+
+static int kshdlc_framer_in_chan_push_frame(
+	struct ks_chan *ks_chan,
+	struct sk_buff *skb)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_in);
+	struct kshdlc_framer *fr = &hdlc->framer;
+	unsigned long flags;
+	int res;
+
+	if (!fr->enabled) {
+		res = kss_chan_push_frame(&hdlc->ks_chan_framer_out, skb);
+		if (res < 0) {
+			kfree_skb(skb);
+			return KSS_TX_OK;
+		}
+
+		return res;
+	}
+
+	/* Room for the FCS is required */
+	if (skb->len < 2) {
+		kfree_skb(skb);
+		return KSS_TX_OK;
+	}
+
+	/* Check and enqueue atomically, pushers may run concurrently */
+	spin_lock_irqsave(&fr->queue.lock, flags);
+	if (skb_queue_len(&fr->queue) >= KSHDLC_TX_QUEUE_LEN) {
+		spin_unlock_irqrestore(&fr->queue.lock, flags);
+		return KSS_TX_FULL;
+	}
+
+	__skb_queue_tail(&fr->queue, skb);
+	spin_unlock_irqrestore(&fr->queue.lock, flags);
+
+	return KSS_TX_OK;
+}
+
+static struct kss_chan_from_ops kshdlc_framer_in_chan_from_ops =
+{
+	.push_raw	= kshdlc_framer_in_chan_push_raw,
+	.push_frame	= kshdlc_framer_in_chan_push_frame,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void kshdlc_framer_out_chan_release(struct ks_chan *ks_chan)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_out);
+
+	kshdlc_debug(3, "kshdlc_framer_out_chan_release()\n");
+
+	kshdlc_hdlc_put(hdlc);
+}
+
+static int kshdlc_framer_out_chan_start(struct ks_chan *ks_chan)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_out);
+
+	spin_lock_bh(&hdlc->framer.lock);
+	kshdlc_framer_reset(&hdlc->framer);
+	spin_unlock_bh(&hdlc->framer.lock);
+
+	return 0;
+}
+
+static void kshdlc_framer_out_chan_stop(struct ks_chan *ks_chan)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_out);
+
+	spin_lock_bh(&hdlc->framer.lock);
+	kshdlc_framer_reset(&hdlc->framer);
+	spin_unlock_bh(&hdlc->framer.lock);
+}
+
+static void kshdlc_framer_out_chan_stimulus(struct ks_chan *ks_chan)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+					struct kshdlc_hdlc, ks_chan_framer_out);
+	struct kshdlc_framer *fr = &hdlc->framer;
+	struct ks_streamframe *sf;
+	u64 now = ktime_to_ns(ktime_get());
+	u64 elapsed;
+	int n;
+
+	if (!fr->enabled)
+		return;
+
+	/* As many octets as the time elapsed since the last tick */
+	spin_lock_bh(&fr->lock);
+
+	if (!fr->last_out) {
+		fr->last_out = now;
+		spin_unlock_bh(&fr->lock);
+		return;
+	}
+
+	elapsed = now - fr->last_out + fr->out_rem;
+	fr->last_out = now;
+	fr->out_rem = do_div(elapsed, 125000);
+
+	spin_unlock_bh(&fr->lock);
+
+	n = min_t(u64, elapsed, KS_SF_SIZE_DEFAULT);
+	if (!n)
+		return;
+
+	sf = ks_sf_alloc(n);
+	if (!sf)
+		return;
+
+	spin_lock_bh(&fr->lock);
+	kshdlc_framer_fill(fr, sf->data, n);
+	spin_unlock_bh(&fr->lock);
+
+	sf->len = n;
+
+	kss_chan_push_raw(ks_chan, sf);
+
+	ks_sf_put(sf);
+}
+
+static struct ks_chan_ops kshdlc_framer_out_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= kshdlc_framer_out_chan_release,
+	.start		= kshdlc_framer_out_chan_start,
+	.stop		= kshdlc_framer_out_chan_stop,
+	.stimulus	= kshdlc_framer_out_chan_stimulus,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void kshdlc_deframer_in_chan_release(struct ks_chan *ks_chan)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+				struct kshdlc_hdlc, ks_chan_deframer_in);
+
+	kshdlc_debug(3, "kshdlc_deframer_in_chan_release()\n");
+
+	kshdlc_hdlc_put(hdlc);
+}
+
+static struct ks_chan_ops kshdlc_deframer_in_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= kshdlc_deframer_in_chan_release,
+};
+
+static int kshdlc_deframer_in_chan_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+				struct kshdlc_hdlc, ks_chan_deframer_in);
+	struct kshdlc_deframer *df = &hdlc->deframer;
+	struct sk_buff_head frames;
+	struct sk_buff *skb;
+
+	if (!df->enabled)
+		return kss_chan_push_raw(&hdlc->ks_chan_deframer_out, sf);
+
+	skb_queue_head_init(&frames);
+
+	spin_lock_bh(&df->lock);
+	kshdlc_deframer_decode(df, sf->data, sf->len, &frames);
+	spin_unlock_bh(&df->lock);
+
+	while ((skb = __skb_dequeue(&frames))) {
+		if (kss_chan_push_frame(&hdlc->ks_chan_deframer_out, skb) !=
+								KSS_TX_OK)
+			kfree_skb(skb);
+	}
+
+	return 0;
+}
+
+static int kshdlc_deframer_in_chan_push_frame(
+	struct ks_chan *ks_chan,
+	struct sk_buff *skb)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+				struct kshdlc_hdlc, ks_chan_deframer_in);
+	int res;
+
+	/* Frames are passed through only while the deframer is disabled */
+	if (hdlc->deframer.enabled) {
+		kfree_skb(skb);
+		return KSS_TX_OK;
+	}
+
+	res = kss_chan_push_frame(&hdlc->ks_chan_deframer_out, skb);
+	if (res < 0) {
+		kfree_skb(skb);
+		return KSS_TX_OK;
+	}
+
+	return res;
+}
+
+static struct kss_chan_from_ops kshdlc_deframer_in_chan_from_ops =
+{
+	.push_raw	= kshdlc_deframer_in_chan_push_raw,
+	.push_frame	= kshdlc_deframer_in_chan_push_frame,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void kshdlc_deframer_out_chan_release(struct ks_chan *ks_chan)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+				struct kshdlc_hdlc, ks_chan_deframer_out);
+
+	kshdlc_debug(3, "kshdlc_deframer_out_chan_release()\n");
+
+	kshdlc_hdlc_put(hdlc);
+}
+
+static int kshdlc_deframer_out_chan_start(struct ks_chan *ks_chan)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+				struct kshdlc_hdlc, ks_chan_deframer_out);
+
+	spin_lock_bh(&hdlc->deframer.lock);
+	kshdlc_deframer_reset(&hdlc->deframer);
+	spin_unlock_bh(&hdlc->deframer.lock);
+
+	return 0;
+}
+
+static int kshdlc_deframer_out_chan_get_attr_count(struct ks_chan *ks_chan)
+{
+	return 1;
+}
+
+static int kshdlc_deframer_out_chan_get_attr(
+	struct ks_chan *ks_chan,
+	int index,
+	__u16 *type,
+	void *buf,
+	int *len)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+				struct kshdlc_hdlc, ks_chan_deframer_out);
+	struct ks_hdlc_deframer_descr *descr = buf;
+
+	if (index != 0)
+		return -EINVAL;
+
+	if (*len < sizeof(struct ks_hdlc_deframer_descr))
+		return -ENOSPC;
+
+	*type = kshdlc_deframer_feature->id;
+	*len = sizeof(struct ks_hdlc_deframer_descr);
+
+	memset(descr, 0, sizeof(*descr));
+	descr->hardware = 0;
+	descr->enabled = hdlc->deframer.enabled ? 1 : 0;
+
+	return 0;
+}
+
+static int kshdlc_deframer_out_chan_set_attr(
+	struct ks_chan *ks_chan,
+	__u16 type,
+	void *buf,
+	int len)
+{
+	struct kshdlc_hdlc *hdlc = container_of(ks_chan,
+				struct kshdlc_hdlc, ks_chan_deframer_out);
+	struct ks_hdlc_deframer_descr *descr = buf;
+
+	if (type != kshdlc_deframer_feature->id)
+		return -ENOENT;
+
+	if (len < sizeof(struct ks_hdlc_deframer_descr))
+		return -EINVAL;
+
+	spin_lock_bh(&hdlc->deframer.lock);
+	if (hdlc->deframer.enabled != descr->enabled) {
+		kshdlc_deframer_reset(&hdlc->deframer);
+		hdlc->deframer.enabled = descr->enabled;
+	}
+	spin_unlock_bh(&hdlc->deframer.lock);
+
+	return 0;
+}
+
+static struct ks_chan_ops kshdlc_deframer_out_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= kshdlc_deframer_out_chan_release,
+	.start		= kshdlc_deframer_out_chan_start,
+	.get_attr_count	= kshdlc_deframer_out_chan_get_attr_count,
+	.get_attr	= kshdlc_deframer_out_chan_get_attr,
+	.set_attr	= kshdlc_deframer_out_chan_set_attr,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static struct kshdlc_hdlc *kshdlc_hdlc_create(int id)
+{
+	struct kshdlc_hdlc *hdlc;
+	char name[16];
+
+	hdlc = kmalloc(sizeof(*hdlc), GFP_KERNEL);
+	if (!hdlc)
+		return NULL;
+
+	memset(hdlc, 0, sizeof(*hdlc));
+
+	hdlc->id = id;
+
+	spin_lock_init(&hdlc->framer.lock);
+	skb_queue_head_init(&hdlc->framer.queue);
+	hdlc->framer.enabled = TRUE;
+	kshdlc_framer_reset(&hdlc->framer);
+
+	spin_lock_init(&hdlc->deframer.lock);
+	hdlc->deframer.enabled = TRUE;
+	kshdlc_deframer_reset(&hdlc->deframer);
+
+	snprintf(name, sizeof(name), "hdlc%d", id);
+
+	ks_node_create(&hdlc->ks_node, &kshdlc_node_ops, name,
+			&ks_system_device.kobj);
+
+	ks_chan_create(&hdlc->ks_chan_framer_in, &kshdlc_framer_in_chan_ops,
+			"framer_in", NULL,
+			&hdlc->ks_node.kobj,
+			&kss_softswitch.ks_node,
+			&hdlc->ks_node);
+	hdlc->ks_chan_framer_in.from_ops = &kshdlc_framer_in_chan_from_ops;
+
+	ks_chan_create(&hdlc->ks_chan_framer_out, &kshdlc_framer_out_chan_ops,
+			"framer_out", NULL,
+			&hdlc->ks_node.kobj,
+			&hdlc->ks_node,
+			&kss_softswitch.ks_node);
+	hdlc->ks_chan_framer_out.needs_tick = TRUE;
+
+	ks_chan_create(&hdlc->ks_chan_deframer_in,
+			&kshdlc_deframer_in_chan_ops,
+			"deframer_in", NULL,
+			&hdlc->ks_node.kobj,
+			&kss_softswitch.ks_node,
+			&hdlc->ks_node);
+	hdlc->ks_chan_deframer_in.from_ops =
+			&kshdlc_deframer_in_chan_from_ops;
+
+	ks_chan_create(&hdlc->ks_chan_deframer_out,
+			&kshdlc_deframer_out_chan_ops,
+			"deframer_out", NULL,
+			&hdlc->ks_node.kobj,
+			&hdlc->ks_node,
+			&kss_softswitch.ks_node);
+
+	return hdlc;
+}
+
+static int kshdlc_hdlc_register(struct kshdlc_hdlc *hdlc)
+{
+	int err;
+
+	err = ks_node_register(&hdlc->ks_node);
+	if (err < 0)
+		goto err_node_register;
+
+	kshdlc_hdlc_get(hdlc);
+	err = ks_chan_register(&hdlc->ks_chan_framer_in);
+	if (err < 0)
+		goto err_chan_framer_in_register;
+
+	kshdlc_hdlc_get(hdlc);
+	err = ks_chan_register(&hdlc->ks_chan_framer_out);
+	if (err < 0)
+		goto err_chan_framer_out_register;
+
+	kshdlc_hdlc_get(hdlc);
+	err = ks_chan_register(&hdlc->ks_chan_deframer_in);
+	if (err < 0)
+		goto err_chan_deframer_in_register;
+
+	kshdlc_hdlc_get(hdlc);
+	err = ks_chan_register(&hdlc->ks_chan_deframer_out);
+	if (err < 0)
+		goto err_chan_deframer_out_register;
+
+	down_write(&kshdlc_hdlcs_list_sem);
+	list_add_tail(&kshdlc_hdlc_get(hdlc)->node, &kshdlc_hdlcs_list);
+	up_write(&kshdlc_hdlcs_list_sem);
+
+	return 0;
+
+err_chan_deframer_out_register:
+	kshdlc_hdlc_put(hdlc);
+	ks_chan_unregister(&hdlc->ks_chan_deframer_in);
+err_chan_deframer_in_register:
+	kshdlc_hdlc_put(hdlc);
+	ks_chan_unregister(&hdlc->ks_chan_framer_out);
+err_chan_framer_out_register:
+	kshdlc_hdlc_put(hdlc);
+	ks_chan_unregister(&hdlc->ks_chan_framer_in);
+err_chan_framer_in_register:
+	kshdlc_hdlc_put(hdlc);
+	ks_node_unregister(&hdlc->ks_node);
+err_node_register:
+
+	return err;
+}
+
+static void kshdlc_hdlc_unregister(struct kshdlc_hdlc *hdlc)
+{
+	down_write(&kshdlc_hdlcs_list_sem);
+	list_del(&hdlc->node);
+	up_write(&kshdlc_hdlcs_list_sem);
+	kshdlc_hdlc_put(hdlc);
+
+	ks_chan_unregister(&hdlc->ks_chan_deframer_out);
+	ks_chan_unregister(&hdlc->ks_chan_deframer_in);
+	ks_chan_unregister(&hdlc->ks_chan_framer_out);
+	ks_chan_unregister(&hdlc->ks_chan_framer_in);
+	ks_node_unregister(&hdlc->ks_node);
+}
+
+static void kshdlc_hdlcs_destroy(void)
+{
+	struct kshdlc_hdlc *hdlc;
+
+	for (;;) {
+		down_read(&kshdlc_hdlcs_list_sem);
+		if (list_empty(&kshdlc_hdlcs_list)) {
+			up_read(&kshdlc_hdlcs_list_sem);
+			break;
+		}
+
+		hdlc = kshdlc_hdlc_get(list_entry(kshdlc_hdlcs_list.next,
+					struct kshdlc_hdlc, node));
+		up_read(&kshdlc_hdlcs_list_sem);
+
+		kshdlc_hdlc_unregister(hdlc);
+		kshdlc_hdlc_put(hdlc);
+	}
+}
+
+/******************************************
+ * Module stuff
+ ******************************************/
+
+static int __init kshdlc_init_module(void)
+{
+	struct kshdlc_hdlc *hdlc;
+	int err;
+	int i;
+
+	kshdlc_msg(KERN_INFO, kshdlc_MODULE_DESCR " loading\n");
+
+	if (mru < KSHDLC_MIN_FRAME) {
+		err = -EINVAL;
+		goto err_invalid_mru;
+	}
+
+	kshdlc_tables_init();
+
+	kshdlc_framer_feature = ks_feature_register("hdlc_framer");
+	if (!kshdlc_framer_feature) {
+		err = -ENOMEM;
+		goto err_framer_feature_register;
+	}
+
+	kshdlc_deframer_feature = ks_feature_register("hdlc_deframer");
+	if (!kshdlc_deframer_feature) {
+		err = -ENOMEM;
+		goto err_deframer_feature_register;
+	}
+
+	for (i=0; i<instances; i++) {
+		hdlc = kshdlc_hdlc_create(i);
+		if (!hdlc) {
+			err = -ENOMEM;
+			goto err_hdlc_create;
+		}
+
+		err = kshdlc_hdlc_register(hdlc);
+		if (err < 0) {
+			kshdlc_hdlc_put(hdlc);
+			goto err_hdlc_register;
+		}
+
+		/* The list holds its own reference */
+		kshdlc_hdlc_put(hdlc);
+	}
+
+	kshdlc_msg(KERN_INFO, kshdlc_MODULE_DESCR " loaded successfully\n");
+
+	return 0;
+
+err_hdlc_register:
+err_hdlc_create:
+	kshdlc_hdlcs_destroy();
+	ks_feature_unregister(kshdlc_deframer_feature);
+err_deframer_feature_register:
+	ks_feature_unregister(kshdlc_framer_feature);
+err_framer_feature_register:
+err_invalid_mru:
+
+	return err;
+}
+
+module_init(kshdlc_init_module);
+
+static void __exit kshdlc_module_exit(void)
+{
+	kshdlc_hdlcs_destroy();
+	ks_feature_unregister(kshdlc_deframer_feature);
+	ks_feature_unregister(kshdlc_framer_feature);
+
+	kshdlc_msg(KERN_INFO, kshdlc_MODULE_DESCR " unloaded\n");
+}
+
+module_exit(kshdlc_module_exit);
+
+MODULE_DESCRIPTION(kshdlc_MODULE_DESCR);
+MODULE_AUTHOR("Daniele (Vihai) Orlandi <daniele@orlandi.com>");
+MODULE_LICENSE("GPL");
+
+module_param(instances, int, 0444);
+MODULE_PARM_DESC(instances, "Number of HDLC framer/deframer pairs");
+
+module_param(mru, int, 0444);
+MODULE_PARM_DESC(mru, "Maximum received frame size, FCS included");
+
+#ifdef DEBUG_CODE
+module_param(debug_level, int, 0444);
+MODULE_PARM_DESC(debug_level, "Initial debug level");
+#endif
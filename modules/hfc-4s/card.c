@@ -19,6 +19,9 @@
 #include <linux/version.h>
 #include <linux/delay.h>
 #include <linux/workqueue.h>
+#include <linux/jiffies.h>
+
+#include <asm/div64.h>
 
 #include <linux/kstreamer/kstreamer.h>
 #include <linux/kstreamer/softswitch.h>
@@ -517,6 +520,54 @@ static DEVICE_ATTR(dip_switches, S_IRUGO,
 		hfc_show_dip_switches,
 		NULL);
 
+//----------------------------------------------------------------------------
+
+static ssize_t hfc_show_pci_accesses(
+	struct device *device,
+	DEVICE_ATTR_COMPAT
+	char *buf)
+{
+	struct pci_dev *pci_dev = to_pci_dev(device);
+	struct hfc_card *card = pci_get_drvdata(pci_dev);
+
+	return snprintf(buf, PAGE_SIZE, "%lu\n", card->pci_accesses);
+}
+
+static DEVICE_ATTR(pci_accesses, S_IRUGO,
+		hfc_show_pci_accesses,
+		NULL);
+
+//----------------------------------------------------------------------------
+
+/* Rate since the previous read, or since the card was probed */
+static ssize_t hfc_show_pci_accesses_rate(
+	struct device *device,
+	DEVICE_ATTR_COMPAT
+	char *buf)
+{
+	struct pci_dev *pci_dev = to_pci_dev(device);
+	struct hfc_card *card = pci_get_drvdata(pci_dev);
+	unsigned long accesses = card->pci_accesses;
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - card->pci_accesses_last_jiffies;
+	unsigned long long rate = 0;
+
+	if (elapsed) {
+		rate = (unsigned long long)
+			(accesses - card->pci_accesses_last) * HZ;
+		do_div(rate, elapsed);
+	}
+
+	card->pci_accesses_last = accesses;
+	card->pci_accesses_last_jiffies = now;
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n", rate);
+}
+
+static DEVICE_ATTR(pci_accesses_rate, S_IRUGO,
+		hfc_show_pci_accesses_rate,
+		NULL);
+
 static struct device_attribute *hfc_card_attributes[] =
 {
 	&dev_attr_double_clock,
@@ -533,6 +584,8 @@ static struct device_attribute *hfc_card_attributes[] =
 	&dev_attr_bert_cnt,
 	&dev_attr_pwm0,
 	&dev_attr_pwm1,
+	&dev_attr_pci_accesses,
+	&dev_attr_pci_accesses_rate,
 	NULL
 };
 
@@ -641,6 +694,18 @@ void hfc_card_update_r_ram_misc(struct hfc_card *card)
 	hfc_outb(card, hfc_R_RAM_MISC, ram_misc);
 }
 
+/*
+ * FIFO interrupts are disabled by the interrupt handler when it flags a
+ * FIFO and re-enabled by the FIFO tasklet once all the FIFOs are empty.
+ */
+void hfc_card_update_r_irq_ctrl(struct hfc_card *card, int fifo_irq)
+{
+	hfc_outb(card, hfc_R_IRQ_CTRL,
+		(fifo_irq ? hfc_R_IRQ_CTRL_V_FIFO_IRQ : 0) |
+		hfc_R_IRQ_CTRL_V_GLOB_IRQ_EN |
+		hfc_R_IRQ_CTRL_V_IRQ_POL_LOW);
+}
+
 static void hfc_card_initialize_hw_nonsoft(struct hfc_card *card)
 {
 	// FIFO RAM configuration
@@ -728,9 +793,12 @@ void hfc_card_initialize_hw(struct hfc_card *card)
 	hfc_outb(card, hfc_R_PWM1, card->pwm1);
 
 	// Timer setup
-	hfc_outb(card, hfc_R_TI_WD,
-		hfc_R_TI_WD_V_EV_TS_8_192_S);
-//		hfc_R_TI_WD_V_EV_TS_1_MS);
+	if (card->tick_source_registered)
+		hfc_outb(card, hfc_R_TI_WD,
+			hfc_R_TI_WD_V_EV_TS_1_MS);
+	else
+		hfc_outb(card, hfc_R_TI_WD,
+			hfc_R_TI_WD_V_EV_TS_8_192_S);
 
 	hfc_card_update_pcm_md0(card, 0);
 	hfc_card_update_pcm_md1(card);
@@ -786,30 +854,31 @@ void hfc_card_initialize_hw(struct hfc_card *card)
 	}
 
 	/* Enable interrupts */
-	hfc_outb(card, hfc_R_IRQ_CTRL,
-		hfc_R_IRQ_CTRL_V_FIFO_IRQ|
-		hfc_R_IRQ_CTRL_V_GLOB_IRQ_EN|
-		hfc_R_IRQ_CTRL_V_IRQ_POL_LOW);
+	hfc_card_update_r_irq_ctrl(card, TRUE);
 }
 
 /******************************************
  * Interrupt Handler
  ******************************************/
 
-static inline void hfc_handle_fifo_tx_interrupt(struct hfc_sys_chan *chan)
+static inline void hfc_handle_fifo_tx_interrupt(
+	struct hfc_card *card, int index)
 {
 	if (test_and_clear_bit(HFC_SYS_CHAN_TX_STATUS_STOPPED,
-					&chan->tx.status))
-		tasklet_schedule(&chan->tx.wake_tasklet);
+				&card->sys_port.chans[index].tx.status))
+		set_bit(index, &card->fifo_tx_pending);
 }
 
-static inline void hfc_handle_fifo_rx_interrupt(struct hfc_sys_chan *chan)
+static inline void hfc_handle_fifo_rx_interrupt(
+	struct hfc_card *card, int index)
 {
-	tasklet_schedule(&chan->rx.tasklet);
+	set_bit(index, &card->fifo_rx_pending);
 }
 
 static inline void hfc_handle_timer_interrupt(struct hfc_card *card)
 {
+	if (card->tick_source_registered)
+		ks_tick_source_fire(&card->ks_tick_source);
 }
 
 static inline void hfc_handle_state_interrupt(struct hfc_st_port *port)
@@ -822,38 +891,15 @@ static inline void hfc_handle_fifo_block_interrupt(
 {
 	u8 fifo_irq = hfc_inb(card,
 		hfc_R_IRQ_FIFO_BL0 + block);
+	int i;
 
-	if (fifo_irq & (1 << 0))
-		hfc_handle_fifo_tx_interrupt(
-			&card->sys_port.chans[block * 4 + 0]);
-
-	if (fifo_irq & (1 << 1))
-		hfc_handle_fifo_rx_interrupt(
-			&card->sys_port.chans[block * 4 + 0]);
-
-	if (fifo_irq & (1 << 2))
-		hfc_handle_fifo_tx_interrupt(
-			&card->sys_port.chans[block * 4 + 1]);
-
-	if (fifo_irq & (1 << 3))
-		hfc_handle_fifo_rx_interrupt(
-			&card->sys_port.chans[block * 4 + 1]);
-
-	if (fifo_irq & (1 << 4))
-		hfc_handle_fifo_tx_interrupt(
-			&card->sys_port.chans[block * 4 + 2]);
-
-	if (fifo_irq & (1 << 5))
-		hfc_handle_fifo_rx_interrupt(
-			&card->sys_port.chans[block * 4 + 2]);
-
-	if (fifo_irq & (1 << 6))
-		hfc_handle_fifo_tx_interrupt(
-			&card->sys_port.chans[block * 4 + 3]);
+	for (i=0; i<4; i++) {
+		if (fifo_irq & (1 << (i * 2)))
+			hfc_handle_fifo_tx_interrupt(card, block * 4 + i);
 
-	if (fifo_irq & (1 << 7))
-		hfc_handle_fifo_rx_interrupt(
-			&card->sys_port.chans[block * 4 + 3]);
+		if (fifo_irq & (1 << (i * 2 + 1)))
+			hfc_handle_fifo_rx_interrupt(card, block * 4 + i);
+	}
 }
 
 /*
@@ -900,6 +946,11 @@ static irqreturn_t hfc_interrupt(int irq, void *dev_id)
 				hfc_handle_fifo_block_interrupt(card, i);
 			}
 		}
+
+		if (card->fifo_rx_pending || card->fifo_tx_pending) {
+			hfc_card_update_r_irq_ctrl(card, FALSE);
+			tasklet_schedule(&card->fifo_tasklet);
+		}
 	}
 
 	if (irq_sci) {
@@ -936,10 +987,16 @@ struct hfc_card *hfc_card_create(
 
 	spin_lock_init(&card->lock);
 
+	tasklet_init(&card->fifo_tasklet,
+		hfc_sys_chan_fifo_tasklet,
+		(unsigned long)card);
+
 	card->pci_dev = pci_dev;
 
 	card->config = card_config;
 
+	card->pci_accesses_last_jiffies = jiffies;
+
 	card->double_clock = card->config->double_clock;
 	card->quartz_49 = card->config->quartz_49;
 	card->ram_size = card->config->ram_size;
@@ -1143,6 +1200,14 @@ int hfc_card_probe(struct hfc_card *card)
 			card->quartz_49 ? 49 : 24,
 			card->double_clock ? 1 : 0);
 
+	if (tick_source) {
+		card->ks_tick_source.name = hfc_DRIVER_NAME;
+		card->ks_tick_source.period = 1000;
+
+		if (ks_tick_source_register(&card->ks_tick_source) >= 0)
+			card->tick_source_registered = TRUE;
+	}
+
 	// Initialize all the card's components
 
 	hfc_card_lock(card);
@@ -1163,6 +1228,7 @@ err_unsupported_revision:
 err_st_port_create:
 err_unknown_chip:
 	free_irq(card->pci_dev->irq, card);
+	tasklet_kill(&card->fifo_tasklet);
 err_request_irq:
 	iounmap(card->io_mem);
 err_ioremap:
@@ -1197,8 +1263,14 @@ void hfc_card_remove(struct hfc_card *card)
 
 	/* There should be no interrupt from here on */
 
+	if (card->tick_source_registered) {
+		ks_tick_source_unregister(&card->ks_tick_source);
+		card->tick_source_registered = FALSE;
+	}
+
 	pci_write_config_word(card->pci_dev, PCI_COMMAND, 0);
 	free_irq(card->pci_dev->irq, card);
+	tasklet_kill(&card->fifo_tasklet);
 	iounmap(card->io_mem);
 	pci_release_regions(card->pci_dev);
 	pci_disable_device(card->pci_dev);
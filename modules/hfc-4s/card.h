@@ -18,6 +18,7 @@
 
 #include <linux/kstreamer/kstreamer.h>
 #include <linux/kstreamer/node.h>
+#include <linux/kstreamer/tick.h>
 
 #include "module.h"
 #include "st_port.h"
@@ -104,6 +105,27 @@ struct hfc_card
 	unsigned long io_bus_mem;
 	void __iomem *io_mem;
 
+	/* FIFOs flagged by the interrupt handler, one bit per sys chan,
+	 * served by fifo_tasklet under a single card lock
+	 */
+	unsigned long fifo_rx_pending;
+	unsigned long fifo_tx_pending;
+	struct tasklet_struct fifo_tasklet;
+
+	/* RX FIFOs left with frames after rx_budget frames, polled by
+	 * fifo_tasklet with FIFO interrupts disabled
+	 */
+	unsigned long fifo_rx_polling;
+
+	/* Timer interrupt clocking the kstreamer tick engine */
+	struct ks_tick_source ks_tick_source;
+	int tick_source_registered;
+
+	/* Register accesses, not atomic so only approximate */
+	unsigned long pci_accesses;
+	unsigned long pci_accesses_last;
+	unsigned long pci_accesses_last_jiffies;
+
 	int clock_source;
 	int ram_size;
 	int bert_mode;
@@ -136,6 +158,7 @@ void hfc_card_update_bert_wd_md(struct hfc_card *card, u8 otherbits);
 void hfc_card_update_r_ctrl(struct hfc_card *card);
 void hfc_card_update_r_brg_pcm_cfg(struct hfc_card *card);
 void hfc_card_update_r_ram_misc(struct hfc_card *card);
+void hfc_card_update_r_irq_ctrl(struct hfc_card *card, int fifo_irq);
 
 
 
@@ -156,31 +179,43 @@ static inline void hfc_card_unlock(struct hfc_card *card)
 
 static inline u8 hfc_inb(struct hfc_card *card, int offset)
 {
+	card->pci_accesses++;
+
 	return ioread8(card->io_mem + offset);
 }
 
 static inline void hfc_outb(struct hfc_card *card, int offset, u8 value)
 {
+	card->pci_accesses++;
+
 	iowrite8(value, card->io_mem + offset);
 }
 
 static inline u16 hfc_inw(struct hfc_card *card, int offset)
 {
+	card->pci_accesses++;
+
 	return ioread16(card->io_mem + offset);
 }
 
 static inline void hfc_outw(struct hfc_card *card, int offset, u16 value)
 {
+	card->pci_accesses++;
+
 	iowrite16(value, card->io_mem + offset);
 }
 
 static inline u32 hfc_inl(struct hfc_card *card, int offset)
 {
+	card->pci_accesses++;
+
 	return ioread32(card->io_mem + offset);
 }
 
 static inline void hfc_outl(struct hfc_card *card, int offset, u32 value)
 {
+	card->pci_accesses++;
+
 	iowrite32(value, card->io_mem + offset);
 }
 
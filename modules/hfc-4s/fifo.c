@@ -101,7 +101,7 @@ void hfc_fifo_configure(
 //		if (fifo->connect_to == HFC_FIFO_CONNECT_TO_ST)
 			con_hdlc |= hfc_A_CON_HDCL_V_DATA_FLOW_FIFO_to_ST_FIFO_to_PCM;
 //		else
-//			con_hdlc |= hfc_A_CON_HDCL_V_DATA_FLOW_ST_to_PCM;
+//			con_hdlc |= hfc_A_CON_HDCL_V_DATA_FLOW_PCM_to_ST;
 	}
 
 	hfc_outb(card, hfc_A_CON_HDLC, con_hdlc);
@@ -13,8 +13,13 @@
 #ifndef _HFC_FIFO_INLINE_H
 #define _HFC_FIFO_INLINE_H
 
+#include <asm/uaccess.h>
+
 #include "card.h"
 
+/* Bounce buffer used for unaligned and user space transfers, on stack */
+#define HFC_FIFO_BOUNCE_SIZE 64
+
 static inline void hfc_fifo_next_frame(struct hfc_fifo *fifo)
 {
 	struct hfc_card *card = fifo->card;
@@ -163,33 +168,66 @@ static inline void hfc_fifo_reset(struct hfc_fifo *fifo)
 	hfc_wait_busy(card);
 }
 
-static inline int hfc_fifo_mem_read(
+/*
+ * Whole dwords are moved through A_FIFO_DATA2 with a single 32 bit access
+ * each, when burst_io is enabled with the string I/O primitives on the
+ * memory mapped registers.
+ */
+static inline void hfc_fifo_burst_read(
 	struct hfc_fifo *fifo,
-	void *data, int size)
+	u32 *buf, int count)
 {
 	struct hfc_card *card = fifo->card;
+	int i;
 
-#if 0
+	if (burst_io) {
+		ioread32_rep(card->io_mem + hfc_A_FIFO_DATA2, buf, count);
+		card->pci_accesses += count;
+	} else {
+		for (i=0; i<count; i++)
+			buf[i] = hfc_inl(card, hfc_A_FIFO_DATA2);
+	}
+}
+
+static inline void hfc_fifo_burst_write(
+	struct hfc_fifo *fifo,
+	const u32 *buf, int count)
+{
+	struct hfc_card *card = fifo->card;
 	int i;
-	for (i=0; i<size; i++) {
-		((u8 *)data)[i] = hfc_inb(card, hfc_A_FIFO_DATA0);
+
+	if (burst_io) {
+		iowrite32_rep(card->io_mem + hfc_A_FIFO_DATA2, buf, count);
+		card->pci_accesses += count;
+	} else {
+		for (i=0; i<count; i++)
+			hfc_outl(card, hfc_A_FIFO_DATA2, buf[i]);
 	}
-#endif
+}
+
+static inline int hfc_fifo_mem_read(
+	struct hfc_fifo *fifo,
+	void *data, int size)
+{
+	struct hfc_card *card = fifo->card;
+	int dwords = size / 4;
+	int pos;
+
+	if (!((unsigned long)data & 3))
+		hfc_fifo_burst_read(fifo, data, dwords);
+	else {
+		u32 bounce[HFC_FIFO_BOUNCE_SIZE / 4];
 
-	union { u32 l; u8 b[4]; } word;
+		for (pos=0; pos<dwords; pos += HFC_FIFO_BOUNCE_SIZE / 4) {
+			int count = min(dwords - pos, HFC_FIFO_BOUNCE_SIZE / 4);
 
-	// Would unaligned write be better?
-	int pos = 0;
-	while (pos < size - 3) {
-		word.l = hfc_inl(card, hfc_A_FIFO_DATA2);
-		memcpy(data + pos, word.b, 4);
-		pos += 4;
+			hfc_fifo_burst_read(fifo, bounce, count);
+			memcpy(data + pos * 4, bounce, count * 4);
+		}
 	}
 
-	while (pos < size) {
+	for (pos=dwords * 4; pos<size; pos++)
 		*((u8 *)(data + pos)) = hfc_inb(card, hfc_A_FIFO_DATA0);
-		pos++;
-	}
 
 	return size;
 }
@@ -198,35 +236,23 @@ static inline int hfc_fifo_mem_read_dword(
 	struct hfc_fifo *fifo,
 	void *data, int size)
 {
-	struct hfc_card *card = fifo->card;
-
-	union { u32 l; u8 b[4]; } word;
-
-	// Would unaligned write be better?
-	int pos = 0;
-	while (pos < size - 3) {
-		word.l = hfc_inl(card, hfc_A_FIFO_DATA2);
-		memcpy(data + pos, word.b, 4);
-		pos += 4;
-	}
-
-	return pos;
+	return hfc_fifo_mem_read(fifo, data, size & ~3);
 }
 
 static inline int hfc_fifo_mem_read_to_user(
 	struct hfc_fifo *fifo,
 	void __user *data, int size)
 {
-	struct hfc_card *card = fifo->card;
-	int err;
+	u32 bounce[HFC_FIFO_BOUNCE_SIZE / 4];
+	int pos;
 
-	int i;
-	for (i=0; i<size; i++) {
-		err = put_user(hfc_inb(card, hfc_A_FIFO_DATA0),
-				(u8 *)(data + i));
+	for (pos=0; pos<size; pos += HFC_FIFO_BOUNCE_SIZE) {
+		int len = min(size - pos, HFC_FIFO_BOUNCE_SIZE);
+
+		hfc_fifo_mem_read(fifo, bounce, len);
 
-		if (err < 0)
-			return err;
+		if (copy_to_user(data + pos, bounce, len))
+			return -EFAULT;
 	}
 
 	return size;
@@ -237,48 +263,53 @@ static inline void hfc_fifo_mem_write(
 	const void *data, int size)
 {
 	struct hfc_card *card = fifo->card;
+	int dwords;
+	int pos;
 
-#if 1
-	int i;
-	for (i=0; i<size; i++) {
-		hfc_outb(card,
-			hfc_A_FIFO_DATA0,
-			((u8 *)data)[i]);
+	/* Byte writes only, as it has always been done */
+	if (!burst_io) {
+		for (pos=0; pos<size; pos++)
+			hfc_outb(card, hfc_A_FIFO_DATA0, ((u8 *)data)[pos]);
+
+		return;
 	}
 
-#else
+	dwords = size / 4;
 
-	union { u32 l; u8 b[4]; } word;
+	if (!((unsigned long)data & 3))
+		hfc_fifo_burst_write(fifo, data, dwords);
+	else {
+		u32 bounce[HFC_FIFO_BOUNCE_SIZE / 4];
 
-	int pos = 0;
-	while (pos < size - 3) {
-		memcpy(word.b, data + pos, 4);
-		hfc_outl(card, hfc_A_FIFO_DATA2, word.l);
-		pos += 4;
-	}
+		for (pos=0; pos<dwords; pos += HFC_FIFO_BOUNCE_SIZE / 4) {
+			int count = min(dwords - pos, HFC_FIFO_BOUNCE_SIZE / 4);
 
-	while (pos < size) {
-		hfc_outb(card, hfc_A_FIFO_DATA0, *((u8 *)data + pos));
-		pos++;
+			memcpy(bounce, data + pos * 4, count * 4);
+			hfc_fifo_burst_write(fifo, bounce, count);
+		}
 	}
-#endif
+
+	for (pos=dwords * 4; pos<size; pos++)
+		hfc_outb(card, hfc_A_FIFO_DATA0, ((u8 *)data)[pos]);
 }
 
-static inline void hfc_fifo_mem_write_from_user(
+static inline int hfc_fifo_mem_write_from_user(
 	struct hfc_fifo *fifo,
 	const void __user *data, int size)
 {
-	struct hfc_card *card = fifo->card;
+	u32 bounce[HFC_FIFO_BOUNCE_SIZE / 4];
+	int pos;
 
-	int i;
-	for (i=0; i<size; i++) {
-		u8 val;
-		get_user(val, (u8 *)(data + i));
+	for (pos=0; pos<size; pos += HFC_FIFO_BOUNCE_SIZE) {
+		int len = min(size - pos, HFC_FIFO_BOUNCE_SIZE);
+
+		if (copy_from_user(bounce, data + pos, len))
+			return -EFAULT;
 
-		hfc_outb(card,
-			hfc_A_FIFO_DATA0,
-			val);
+		hfc_fifo_mem_write(fifo, bounce, len);
 	}
+
+	return size;
 }
 
 #endif
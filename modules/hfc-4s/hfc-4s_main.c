@@ -33,6 +33,10 @@ int debug_level = 0;
 #endif
 #endif
 
+int tick_source = 0;
+int rx_budget = 8;
+int burst_io = 1;
+
 #ifndef PCI_DEVICE_ID_CCD_HFC_4S
 #define PCI_DEVICE_ID_CCD_HFC_4S	0x08b4
 #endif
@@ -300,6 +304,9 @@ static int __init hfc_init_module(void)
 
 	atomic_set(&module_refcnt, 0);
 
+	if (rx_budget < 1)
+		rx_budget = 1;
+
 	hfc_hdlc_framer_class = ks_feature_register("hdlc_framer");
 	if (!hfc_hdlc_framer_class) {
 		err = -ENOMEM;
@@ -376,6 +383,18 @@ MODULE_DESCRIPTION(hfc_DRIVER_DESCR);
 MODULE_AUTHOR("Daniele (Vihai) Orlandi <daniele@orlandi.com>");
 MODULE_LICENSE("GPL");
 
+module_param(tick_source, int, 0444);
+MODULE_PARM_DESC(tick_source,
+	"Clock the kstreamer tick engine from the card's timer interrupt");
+
+module_param(rx_budget, int, 0444);
+MODULE_PARM_DESC(rx_budget,
+	"Frames received from each FIFO per FIFO tasklet run");
+
+module_param(burst_io, int, 0444);
+MODULE_PARM_DESC(burst_io,
+	"Transfer FIFO data as 32 bit string I/O, 0 for the legacy paths");
+
 #ifdef DEBUG_CODE
 module_param(debug_level, int, 0444);
 MODULE_PARM_DESC(debug_level, "Initial debug level");
@@ -18,5 +18,8 @@
 #define hfc_DRIVER_DESCR "HFC-4S HFC-8S Driver"
 
 extern atomic_t module_refcnt;
+extern int tick_source;
+extern int rx_budget;
+extern int burst_io;
 
 #endif
@@ -18,6 +18,10 @@
 
 #include "switch.h"
 #include "card.h"
+#include "st_chan.h"
+#include "sys_chan.h"
+#include "fifo_inline.h"
+#include "pcm_port_inline.h"
 
 static void hfc_switch_release(struct ks_node *ks_node)
 {
@@ -29,67 +33,307 @@ static void hfc_switch_release(struct ks_node *ks_node)
 	hfc_card_put(hfcswitch->card);
 }
 
+/* Must be called with card lock held */
+static struct hfc_sys_chan *hfc_switch_find_fifo_chan(
+	struct hfc_switch *hfcswitch)
+{
+	struct hfc_sys_port *port = &hfcswitch->card->sys_port;
+	int i;
+
+	/* Lent FIFOs are taken from the top */
+	for (i=port->num_chans - 1; i>=0; i--) {
+		struct hfc_sys_chan *chan = &port->chans[i];
+
+		if (!chan->switch_conn &&
+		    !chan->rx.ks_chan.pipeline &&
+		    !chan->tx.ks_chan.pipeline)
+			return chan;
+	}
+
+	return NULL;
+}
+
+/* Must be called with card lock held */
+static void hfc_switch_conn_setup_fifos(struct hfc_switch_conn *conn)
+{
+	struct hfc_sys_chan *fifo_chan = conn->fifo_chan;
+	struct hfc_card *card = fifo_chan->port->card;
+
+	fifo_chan->switch_conn = conn;
+
+	fifo_chan->rx.fifo.subchannel_bit_start =
+		conn->from->subchannel_bit_start;
+	fifo_chan->rx.fifo.subchannel_bit_count =
+		conn->from->subchannel_bit_count;
+
+	fifo_chan->tx.fifo.subchannel_bit_start =
+		conn->to->subchannel_bit_start;
+	fifo_chan->tx.fifo.subchannel_bit_count =
+		conn->to->subchannel_bit_count;
+
+	/* The received data goes to the slot too, the FIFO fills up
+	 * and is never read, no interrupt is generated.
+	 */
+	hfc_fifo_select(&fifo_chan->rx.fifo);
+	hfc_fifo_reset(&fifo_chan->rx.fifo);
+	hfc_outb(card, hfc_A_CON_HDLC,
+		hfc_A_CON_HDCL_V_HDLC_TRP_TRP |
+		hfc_A_CON_HDCL_V_TRP_IRQ_DISABLED |
+		hfc_A_CON_HDCL_V_DATA_FLOW_FIFO_from_ST_ST_from_PCM);
+	hfc_outb(card, hfc_A_IRQ_MSK, 0);
+
+	/* The line is fed by the slot */
+	hfc_fifo_select(&fifo_chan->tx.fifo);
+	hfc_fifo_reset(&fifo_chan->tx.fifo);
+	hfc_outb(card, hfc_A_CON_HDLC,
+		hfc_A_CON_HDCL_V_HDLC_TRP_TRP |
+		hfc_A_CON_HDCL_V_TRP_IRQ_DISABLED |
+		hfc_A_CON_HDCL_V_DATA_FLOW_PCM_to_ST);
+	hfc_outb(card, hfc_A_IRQ_MSK, 0);
+}
+
+/* Must be called with card lock held */
+static void hfc_switch_conn_release_fifos(struct hfc_switch_conn *conn)
+{
+	struct hfc_sys_chan *fifo_chan = conn->fifo_chan;
+
+	hfc_fifo_select(&fifo_chan->rx.fifo);
+	hfc_fifo_reset(&fifo_chan->rx.fifo);
+	hfc_fifo_configure(&fifo_chan->rx.fifo);
+
+	hfc_fifo_select(&fifo_chan->tx.fifo);
+	hfc_fifo_reset(&fifo_chan->tx.fifo);
+	hfc_fifo_configure(&fifo_chan->tx.fifo);
+
+	fifo_chan->switch_conn = NULL;
+}
+
+/* Must be called with card lock held */
+static void hfc_switch_conn_setup_slot(struct hfc_switch_conn *conn)
+{
+	struct hfc_card *card = conn->fifo_chan->port->card;
+
+	hfc_pcm_port_select_slot(card,
+		hfc_R_SLOT_V_SL_NUM(conn->slot) |
+		hfc_R_SLOT_V_SL_DIR_TX);
+	hfc_outb(card, hfc_A_SL_CFG,
+		hfc_A_SL_CFG_V_CH_SDIR_RX |
+		hfc_A_SL_CFG_V_CH_NUM(conn->from->hw_index) |
+		hfc_A_SL_CFG_V_ROUT_OUT_INTERNAL);
+
+	hfc_pcm_port_select_slot(card,
+		hfc_R_SLOT_V_SL_NUM(conn->slot) |
+		hfc_R_SLOT_V_SL_DIR_RX);
+	hfc_outb(card, hfc_A_SL_CFG,
+		hfc_A_SL_CFG_V_CH_SDIR_TX |
+		hfc_A_SL_CFG_V_CH_NUM(conn->to->hw_index) |
+		hfc_A_SL_CFG_V_ROUT_IN_LOOP);
+}
+
+/* Must be called with card lock held */
+static void hfc_switch_conn_release_slot(struct hfc_switch_conn *conn)
+{
+	struct hfc_card *card = conn->fifo_chan->port->card;
+
+	hfc_pcm_port_select_slot(card,
+		hfc_R_SLOT_V_SL_NUM(conn->slot) |
+		hfc_R_SLOT_V_SL_DIR_TX);
+	hfc_outb(card, hfc_A_SL_CFG, hfc_A_SL_CFG_V_ROUT_OUT_OFF);
+
+	hfc_pcm_port_select_slot(card,
+		hfc_R_SLOT_V_SL_NUM(conn->slot) |
+		hfc_R_SLOT_V_SL_DIR_RX);
+	hfc_outb(card, hfc_A_SL_CFG, hfc_A_SL_CFG_V_ROUT_IN_IGNORE);
+}
+
+/*
+ * Must be called with card lock held. The sys chan lending its FIFOs is
+ * being opened in a pipeline of its own, the connection moves to another
+ * idle sys chan.
+ */
+int hfc_switch_conn_move_fifos(struct hfc_switch_conn *conn)
+{
+	struct hfc_card *card = conn->fifo_chan->port->card;
+	struct hfc_sys_chan *fifo_chan;
+
+	fifo_chan = hfc_switch_find_fifo_chan(&card->hfcswitch);
+	if (!fifo_chan)
+		return -EBUSY;
+
+	hfc_switch_conn_release_fifos(conn);
+
+	conn->fifo_chan = fifo_chan;
+	hfc_switch_conn_setup_fifos(conn);
+
+	hfc_debug_card(card, 2, "Switch connection moved to FIFO %d\n",
+		fifo_chan->id);
+
+	return 0;
+}
+
+/* Must be called with card lock held */
+static struct hfc_switch_conn *hfc_switch_conn_search(
+	struct hfc_switch *hfcswitch,
+	struct hfc_st_chan *from,
+	struct hfc_st_chan *to)
+{
+	int i;
+
+	for (i=0; i<ARRAY_SIZE(hfcswitch->conns); i++) {
+		if (hfcswitch->conns[i].from == from &&
+		    hfcswitch->conns[i].to == to)
+			return &hfcswitch->conns[i];
+	}
+
+	return NULL;
+}
+
+/* Chans coming into the switch are prev_chan, chans going out are chan */
+static int hfc_switch_is_st_to_st(
+	struct ks_chan *chan,
+	struct ks_chan *prev_chan)
+{
+	return chan && prev_chan &&
+		prev_chan->ops == &hfc_st_chan_rx_chan_ops &&
+		chan->ops == &hfc_st_chan_tx_chan_ops;
+}
+
+/*
+ * Pipelines between an S/T chan and a sys chan are handled by the FIFO
+ * sequence when the sys chan is opened, only S/T to S/T B channels need
+ * the switch. Resources are allocated only when the pipeline is opened.
+ */
 static int hfc_switch_connect(
 	struct ks_node *ks_node,
-	struct ks_chan *from,
-	struct ks_chan *to)
+	struct ks_chan *chan,
+	struct ks_chan *prev_chan)
+{
+	struct hfc_st_chan *from;
+	struct hfc_st_chan *to;
+
+	if (!hfc_switch_is_st_to_st(chan, prev_chan))
+		return 0;
+
+	from = to_st_chan_rx(prev_chan)->chan;
+	to = to_st_chan_tx(chan)->chan;
+
+	if ((from->id != B1 && from->id != B2) ||
+	    (to->id != B1 && to->id != B2))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int hfc_switch_open(
+	struct ks_node *ks_node,
+	struct ks_chan *chan,
+	struct ks_chan *prev_chan)
 {
-//	struct hfc_switch *hfcswitch = to_hfc_switch(ks_node);
-//	struct hfc_card *card = hfcswitch->card;
+	struct hfc_switch *hfcswitch = to_hfc_switch(ks_node);
+	struct hfc_card *card = hfcswitch->card;
+	struct hfc_switch_conn *conn;
+	struct hfc_st_chan *from;
+	struct hfc_st_chan *to;
+	int slot;
+	int err;
+
+	if (!hfc_switch_is_st_to_st(chan, prev_chan))
+		return 0;
+
+	from = to_st_chan_rx(prev_chan)->chan;
+	to = to_st_chan_tx(chan)->chan;
 
-printk(KERN_CRIT "%s/%s connected %s/%s to %s/%s\n",
-	kobject_name(ks_node->kobj.parent),
-	kobject_name(&ks_node->kobj),
-	kobject_name(from->kobj.parent),
-	kobject_name(&from->kobj),
-	kobject_name(to->kobj.parent),
-	kobject_name(&to->kobj));
+	hfc_card_lock(card);
 
-/*	hfc_card_lock(card);
+	conn = hfc_switch_conn_search(hfcswitch, NULL, NULL);
+	if (!conn) {
+		err = -EBUSY;
+		goto err_no_conn;
+	}
 
-	if (from->ops == &hfc_st_chan_rx_chan_ops) {
-		struct hfc_st_rx_chan* chan_rx = to_st_chan_rx(from);
+	for (slot=HFC_SWITCH_SLOTS - 1; slot>=0; slot--) {
+		if (!test_bit(slot, &hfcswitch->slots_in_use))
+			break;
+	}
 
-		if (to->ops == &hfc_st_chan_tx_chan_ops) {
+	if (slot < 0) {
+		err = -EBUSY;
+		goto err_no_slot;
+	}
 
-		} else  if (to->ops == &hfc_pcm_chan_tx_chan_ops) {
-		} else  if (to->ops == &hfc_sys_chan_tx_chan_ops) {
-		}
+	conn->fifo_chan = hfc_switch_find_fifo_chan(hfcswitch);
+	if (!conn->fifo_chan) {
+		err = -EBUSY;
+		goto err_no_fifo_chan;
+	}
 
-	} else if (from->ops == &hfc_pcm_chan_rx_chan_ops) {
-		struct hfc_pcm_chan_rx* chan_rx = to_pcm_chan_rx(from);
+	set_bit(slot, &hfcswitch->slots_in_use);
 
-		if (to->ops == &hfc_st_chan_tx_chan_ops) {
-		} else  if (to->ops == &hfc_pcm_chan_tx_chan_ops) {
-		} else  if (to->ops == &hfc_sys_chan_tx_chan_ops) {
-		}
+	conn->from = from;
+	conn->to = to;
+	conn->slot = slot;
 
-	} else if (from->ops == &hfc_sys_chan_rx_chan_ops) {
-		struct hfc_sys_chan_rx* chan_rx = to_sys_chan_rx(from);
+	hfc_switch_conn_setup_fifos(conn);
+	hfc_switch_conn_setup_slot(conn);
 
-		if (to->ops == &hfc_st_chan_tx_chan_ops) {
-			chan_rx->
-		} else  if (to->ops == &hfc_pcm_chan_tx_chan_ops) {
-		} else  if (to->ops == &hfc_sys_chan_tx_chan_ops) {
-		}
+	hfc_sys_port_update_fsm(&card->sys_port);
 
-	} else
-		BUG();
+	hfc_card_unlock(card);
 
-	hfc_card_unlock(card);*/
+	hfc_debug_card(card, 1,
+		"Switched st%d/%s to st%d/%s through slot %d\n",
+		from->port->id, kobject_name(&from->ks_node.kobj),
+		to->port->id, kobject_name(&to->ks_node.kobj),
+		slot);
 
 	return 0;
 
-//	hfc_card_unlock(card);
+err_no_fifo_chan:
+err_no_slot:
+err_no_conn:
+	hfc_card_unlock(card);
 
-//	return err;
+	return err;
 }
 
-static void hfc_switch_disconnect(
-	struct ks_node *hfcswitch,
-	struct ks_chan *from,
-	struct ks_chan *to)
+static void hfc_switch_close(
+	struct ks_node *ks_node,
+	struct ks_chan *chan,
+	struct ks_chan *prev_chan)
 {
+	struct hfc_switch *hfcswitch = to_hfc_switch(ks_node);
+	struct hfc_card *card = hfcswitch->card;
+	struct hfc_switch_conn *conn;
+	int slot;
+
+	if (!hfc_switch_is_st_to_st(chan, prev_chan))
+		return;
+
+	hfc_card_lock(card);
+
+	conn = hfc_switch_conn_search(hfcswitch,
+			to_st_chan_rx(prev_chan)->chan,
+			to_st_chan_tx(chan)->chan);
+	if (!conn) {
+		hfc_card_unlock(card);
+		return;
+	}
+
+	hfc_switch_conn_release_slot(conn);
+	hfc_switch_conn_release_fifos(conn);
+
+	slot = conn->slot;
+	clear_bit(slot, &hfcswitch->slots_in_use);
+
+	conn->from = NULL;
+	conn->to = NULL;
+	conn->fifo_chan = NULL;
+
+	hfc_sys_port_update_fsm(&card->sys_port);
+
+	hfc_card_unlock(card);
+
+	hfc_debug_card(card, 1, "Switch slot %d released\n", slot);
 }
 
 static struct ks_node_ops hfc_switch_ops =
@@ -98,7 +342,8 @@ static struct ks_node_ops hfc_switch_ops =
 	.release	= hfc_switch_release,
 
 	.connect	= hfc_switch_connect,
-	.disconnect	= hfc_switch_disconnect,
+	.open		= hfc_switch_open,
+	.close		= hfc_switch_close,
 };
 
 struct hfc_switch *hfc_switch_create(
@@ -107,6 +352,9 @@ struct hfc_switch *hfc_switch_create(
 {
 	hfcswitch->card = card;
 
+	hfcswitch->slots_in_use = 0;
+	memset(hfcswitch->conns, 0, sizeof(hfcswitch->conns));
+
 	ks_node_create(&hfcswitch->ks_node, &hfc_switch_ops,
 			"hfc-switch",
 			&card->pci_dev->dev.kobj);
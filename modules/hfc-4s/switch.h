@@ -16,11 +16,48 @@
 #define to_hfc_switch(s)	\
 		container_of(s, struct hfc_switch, ks_node)
 
+/* PCM timeslots available at any PCM bitrate, allocated from the top */
+#define HFC_SWITCH_SLOTS 32
+
+/* One per direction of a call between two B channels, 8 ports * 2 B */
+#define HFC_SWITCH_MAX_CONNS 16
+
+struct hfc_st_chan;
+struct hfc_sys_chan;
+
+/*
+ * A pipeline going from an S/T B channel straight to another S/T B channel
+ * of the same card is carried by the HFC itself: the receiving HFC-channel
+ * is routed to a PCM timeslot which is looped back internally to the
+ * transmitting HFC-channel, no data goes through the host.
+ *
+ * Only pipelines built by hand between two B channels are offloaded, as
+ * chan_visdn routes each bearer to a userport. Nothing tears the direct
+ * path down by itself: inserting a software stage (EC, recording) means
+ * closing or deleting the direct pipeline first, which releases the slot
+ * and the FIFOs, then routing through the sys chans.
+ */
+struct hfc_switch_conn
+{
+	struct hfc_st_chan *from;
+	struct hfc_st_chan *to;
+
+	int slot;
+
+	/* Sys chan lending its FIFOs to the FIFO sequence, only the data
+	 * flow configuration is used, the FIFOs are never read or written.
+	 */
+	struct hfc_sys_chan *fifo_chan;
+};
+
 struct hfc_switch
 {
 	struct ks_node ks_node;
 
 	struct hfc_card *card;
+
+	unsigned long slots_in_use;
+	struct hfc_switch_conn conns[HFC_SWITCH_MAX_CONNS];
 };
 
 struct hfc_switch *hfc_switch_create(
@@ -30,4 +67,6 @@ struct hfc_switch *hfc_switch_create(
 int hfc_switch_register(struct hfc_switch *hfcswitch);
 void hfc_switch_unregister(struct hfc_switch *hfcswitch);
 
+int hfc_switch_conn_move_fifos(struct hfc_switch_conn *conn);
+
 #endif
@@ -12,6 +12,7 @@
 
 #include <linux/kernel.h>
 #include <linux/delay.h>
+#include <linux/percpu.h>
 
 #include <linux/kstreamer/channel.h>
 #include <linux/kstreamer/pipeline.h>
@@ -306,8 +307,33 @@ static VISDN_CHAN_ATTR(tx_subchannel_bit_count, S_IRUGO,
 /*---------------------------------------------------------------------------*/
 #endif
 
+static ssize_t hfc_show_rx_drain_hist(
+	struct ks_chan *ks_chan,
+	struct ks_chan_attribute *attr,
+	char *buf)
+{
+	struct hfc_sys_chan_rx *chan_rx = to_sys_chan_rx(ks_chan);
+	int len = 0;
+	int i;
+
+	for (i=0; i<HFC_SYS_CHAN_RX_DRAIN_BUCKETS; i++)
+		len += snprintf(buf + len, PAGE_SIZE - len, "%s%u",
+				i ? " " : "", chan_rx->drain_hist[i]);
+
+	len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+
+	return len;
+}
+
+static KS_CHAN_ATTR(drain_hist, S_IRUGO,
+		hfc_show_rx_drain_hist,
+		NULL);
+
+/*---------------------------------------------------------------------------*/
+
 static struct ks_chan_attribute *hfc_sys_chan_rx_attributes[] =
 {
+	&ks_chan_attr_drain_hist,
 /*
 	&ks_chan_attr_rx_fifo_size,
 	&ks_chan_attr_rx_fifo_used,
@@ -409,6 +435,12 @@ static int hfc_sys_chan_rx_chan_open(struct ks_chan *ks_chan)
 
 	hfc_card_lock(card);
 
+	if (chan->switch_conn) {
+		err = hfc_switch_conn_move_fifos(chan->switch_conn);
+		if (err < 0)
+			goto err_move_fifos;
+	}
+
 	chan_rx->fifo.subchannel_bit_start = 0;
 	chan_rx->fifo.subchannel_bit_count = 8;
 
@@ -440,6 +472,7 @@ static int hfc_sys_chan_rx_chan_open(struct ks_chan *ks_chan)
 
 	return 0;
 
+err_move_fifos:
 	hfc_card_unlock(card);
 
 	hfc_debug_sys_chan(chan, 1, "RX channel opening failed: %d\n", err);
@@ -469,6 +502,7 @@ static int hfc_sys_chan_rx_chan_start(struct ks_chan *ks_chan)
 	hfc_card_lock(card);
 
 	chan_rx->fifo.enabled = TRUE;
+	clear_bit(HFC_SYS_CHAN_RX_STATUS_BATCHED, &chan_rx->status);
 
 	hfc_fifo_select(&chan_rx->fifo);
 	hfc_fifo_reset(&chan_rx->fifo);
@@ -500,26 +534,23 @@ static void hfc_sys_chan_rx_chan_stop(struct ks_chan *ks_chan)
 	hfc_debug_sys_chan(chan, 1, "RX channel stopped\n");
 }
 
-static void hfc_sys_chan_rx_chan_stimulus(struct ks_chan *ks_chan)
+/* Must be called with card lock held */
+static struct ks_streamframe *__hfc_sys_chan_rx_read(
+	struct hfc_sys_chan_rx *chan_rx)
 {
-	struct hfc_sys_chan_rx *chan_rx = to_sys_chan_rx(ks_chan);
-	struct hfc_sys_chan *chan = chan_rx->chan;
-	struct hfc_card *card = chan->port->card;
 	int copied_octets;
 	int available_octets;
 
 	struct ks_streamframe *sf;
 
-	sf = ks_sf_alloc();
-	if (!sf)
-		return;
-
-	hfc_card_lock(card);
-
 	hfc_fifo_select(&chan_rx->fifo);
 
 	available_octets = hfc_fifo_used(&chan_rx->fifo);
 
+	sf = ks_sf_alloc(available_octets);
+	if (!sf)
+		return NULL;
+
 	copied_octets = available_octets < sf->size ?
 				available_octets : sf->size;
 
@@ -534,11 +565,73 @@ static void hfc_sys_chan_rx_chan_stimulus(struct ks_chan *ks_chan)
 	hfc_fifo_mem_read(&chan_rx->fifo, sf->data, copied_octets);
 	sf->len = copied_octets;
 
+	return sf;
+}
+
+struct hfc_sys_chan_rx_batch
+{
+	struct kss_push_req reqs[HFC_SYS_PORT_MAX_CHANS];
+};
+
+static DEFINE_PER_CPU(struct hfc_sys_chan_rx_batch, hfc_sys_chan_rx_batch);
+
+/*
+ * The first RX chan of a card stimulated in a tick reads all the card's
+ * transparent FIFOs under a single lock and pushes them together, so that
+ * next hops on the same card are written under a single lock too. The
+ * other chans find themselves marked as batched and have nothing to do.
+ *
+ * If two CPUs race the second one just reads what's been received in the
+ * meantime and a chan may skip its next tick, no octet is lost.
+ */
+static void hfc_sys_chan_rx_chan_stimulus(struct ks_chan *ks_chan)
+{
+	struct hfc_sys_chan_rx *chan_rx = to_sys_chan_rx(ks_chan);
+	struct hfc_sys_port *port = chan_rx->chan->port;
+	struct hfc_card *card = port->card;
+	struct hfc_sys_chan_rx_batch *batch;
+	int count = 0;
+	int i;
+
+	if (test_and_clear_bit(HFC_SYS_CHAN_RX_STATUS_BATCHED,
+						&chan_rx->status))
+		return;
+
+	/* Frames are delivered by the card's FIFO tasklet */
+	if (chan_rx->fifo.framer_enabled)
+		return;
+
+	batch = &get_cpu_var(hfc_sys_chan_rx_batch);
+
+	hfc_card_lock(card);
+
+	for (i=0; i<ARRAY_SIZE(port->chans); i++) {
+		struct hfc_sys_chan_rx *rx = &port->chans[i].rx;
+		struct ks_streamframe *sf;
+
+		if (!rx->fifo.enabled || rx->fifo.framer_enabled)
+			continue;
+
+		sf = __hfc_sys_chan_rx_read(rx);
+		if (!sf)
+			continue;
+
+		if (rx != chan_rx)
+			set_bit(HFC_SYS_CHAN_RX_STATUS_BATCHED, &rx->status);
+
+		batch->reqs[count].chan = &rx->ks_chan;
+		batch->reqs[count].sf = sf;
+		count++;
+	}
+
 	hfc_card_unlock(card);
 
-	kss_chan_push_raw(ks_chan, sf);
+	kss_chan_push_raw_batch(batch->reqs, count);
 
-	ks_sf_put(sf);
+	for (i=0; i<count; i++)
+		ks_sf_put(batch->reqs[i].sf);
+
+	put_cpu_var(hfc_sys_chan_rx_batch);
 }
 
 static int hfc_sys_chan_rx_chan_get_attr_count(struct ks_chan *chan)
@@ -690,6 +783,12 @@ static int hfc_sys_chan_tx_chan_open(struct ks_chan *ks_chan)
 
 	hfc_card_lock(card);
 
+	if (chan->switch_conn) {
+		err = hfc_switch_conn_move_fifos(chan->switch_conn);
+		if (err < 0)
+			goto err_move_fifos;
+	}
+
 	chan_tx->fifo.subchannel_bit_start = 0;
 	chan_tx->fifo.subchannel_bit_count = 8;
 
@@ -718,6 +817,7 @@ static int hfc_sys_chan_tx_chan_open(struct ks_chan *ks_chan)
 
 	return 0;
 
+err_move_fifos:
 	hfc_card_unlock(card);
 
 	hfc_debug_sys_chan(chan, 1, "TX channel opening failed: %d\n", err);
@@ -873,19 +973,15 @@ err_no_free_frames:
 	return KSS_TX_FULL;
 }
 
-static int hfc_sys_chan_tx_chan_push_raw(
-	struct ks_chan *ks_chan,
+/* Must be called with card lock held */
+static int __hfc_sys_chan_tx_chan_push_raw(
+	struct hfc_sys_chan_tx *chan_tx,
 	struct ks_streamframe *sf)
 {
-	struct hfc_sys_chan_tx *chan_tx = to_sys_chan_tx(ks_chan);
-	struct hfc_sys_chan *chan = chan_tx->chan;
 	struct hfc_fifo *fifo = &chan_tx->fifo;
-	struct hfc_card *card = chan->port->card;
 	int copied_octets;
 	int available_octets;
 
-	hfc_card_lock(card);
-
 	hfc_fifo_select(fifo);
 
 	available_octets = hfc_fifo_free_tx(fifo);
@@ -896,11 +992,73 @@ static int hfc_sys_chan_tx_chan_push_raw(
 	/* FIFO reselection is mandatory, otherwise Z1 is not updated */
 	hfc_fifo_select(fifo);
 
+	return copied_octets;
+}
+
+static int hfc_sys_chan_tx_chan_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct hfc_sys_chan_tx *chan_tx = to_sys_chan_tx(ks_chan);
+	struct hfc_sys_chan *chan = chan_tx->chan;
+	struct hfc_card *card = chan->port->card;
+	int copied_octets;
+
+	hfc_card_lock(card);
+	copied_octets = __hfc_sys_chan_tx_chan_push_raw(chan_tx, sf);
 	hfc_card_unlock(card);
 
 	return copied_octets;
 }
 
+static inline struct hfc_card *hfc_sys_chan_push_req_card(
+	struct kss_push_req *req)
+{
+	return to_sys_chan_tx(req->to_chan)->chan->port->card;
+}
+
+/*
+ * Requests for the same card are moved together, as the softswitch does
+ * for the destination kind, so that each card is locked only once per
+ * batch even when requests for different cards are interleaved.
+ */
+static void hfc_sys_chan_tx_chan_push_raw_batch(
+	struct kss_push_req *reqs,
+	int count)
+{
+	int i;
+	int j;
+
+	for (i=0; i<count; i++) {
+		struct hfc_card *card = hfc_sys_chan_push_req_card(&reqs[i]);
+		int n = 1;
+
+		for (j=i + 1; j<count; j++) {
+			if (hfc_sys_chan_push_req_card(&reqs[j]) == card) {
+
+				if (j != i + n) {
+					struct kss_push_req tmp = reqs[i + n];
+					reqs[i + n] = reqs[j];
+					reqs[j] = tmp;
+				}
+
+				n++;
+			}
+		}
+
+		hfc_card_lock(card);
+
+		for (j=i; j<i+n; j++)
+			reqs[j].res = __hfc_sys_chan_tx_chan_push_raw(
+					to_sys_chan_tx(reqs[j].to_chan),
+					reqs[j].sf);
+
+		hfc_card_unlock(card);
+
+		i += n - 1;
+	}
+}
+
 static int hfc_sys_chan_tx_chan_get_pressure(
 	struct ks_chan *ks_chan)
 {
@@ -1020,6 +1178,7 @@ struct kss_chan_from_ops hfc_sys_chan_tx_node_ops =
 	.push_frame	= hfc_sys_chan_tx_chan_push_frame,
 	.push_raw	= hfc_sys_chan_tx_chan_push_raw,
 	.get_pressure	= hfc_sys_chan_tx_chan_get_pressure,
+	.push_raw_batch	= hfc_sys_chan_tx_chan_push_raw_batch,
 };
 
 /*---------------------------------------------------------------------------*/
@@ -1038,24 +1197,24 @@ struct ks_duplex_ops hfc_sys_chan_duplex_ops =
 
 /*---------------------------------------------------------------------------*/
 
-static void hfc_sys_chan_rx_tasklet(unsigned long data)
+/*
+ * Must be called with card lock held. Received frames are queued in
+ * chan_rx->frames, returns FALSE when the FIFO has no more frames.
+ */
+static int __hfc_sys_chan_rx_frame(struct hfc_sys_chan_rx *chan_rx)
 {
-	struct hfc_sys_chan_rx *chan_rx = (struct hfc_sys_chan_rx *)data;
 	struct hfc_sys_chan *chan = chan_rx->chan;
-	struct hfc_card *card = chan->port->card;
-	struct hfc_fifo *fifo = &chan->rx.fifo;
+	struct hfc_fifo *fifo = &chan_rx->fifo;
 	int frame_size;
 	struct sk_buff *skb;
 	u8 stat;
 
-	hfc_card_lock(card);
-
 	// FIFO selection has to be done for each frame to clear
 	// internal buffer (see specs 4.4.4).
 	hfc_fifo_select(fifo);
 
 	if (!hfc_fifo_has_frames(fifo))
-		goto no_frames;
+		return FALSE;
 
 	// frame_size includes CRC+CRC+STAT
 	frame_size = hfc_fifo_get_frame_size(fifo);
@@ -1138,7 +1297,7 @@ static void hfc_sys_chan_rx_tasklet(unsigned long data)
 
 	hfc_fifo_next_frame(fifo);
 
-	kss_chan_push_frame(&chan_rx->ks_chan, skb);
+	__skb_queue_tail(&chan_rx->frames, skb);
 
 #if 0
 	if (chan->connected_st_chan) {
@@ -1163,15 +1322,84 @@ err_alloc_skb:
 err_empty_frame:
 err_invalid_frame:
 	hfc_fifo_drop_frame(fifo);
-no_frames:
 all_went_well:
 
-	hfc_fifo_refresh_fz_cache(fifo);
+	return TRUE;
+}
 
-	if (hfc_fifo_has_frames(fifo))
-		tasklet_schedule(&chan_rx->tasklet);
+/*
+ * Serves all the FIFOs flagged by the interrupt handler under a single
+ * card lock, frames are pushed and queues woken once it is released.
+ *
+ * At most rx_budget frames are received from each FIFO per run, FIFOs
+ * left with frames are polled by rescheduling the tasklet and FIFO
+ * interrupts are re-enabled only when all of them are empty.
+ */
+void hfc_sys_chan_fifo_tasklet(unsigned long data)
+{
+	struct hfc_card *card = (struct hfc_card *)data;
+	struct hfc_sys_port *port = &card->sys_port;
+	unsigned long rx_pending;
+	unsigned long tx_pending;
+	unsigned long tx_wake = 0;
+	int i;
+
+	rx_pending = xchg(&card->fifo_rx_pending, 0) | card->fifo_rx_polling;
+	tx_pending = xchg(&card->fifo_tx_pending, 0);
+
+	card->fifo_rx_polling = 0;
+
+	hfc_card_lock(card);
+
+	for (i=0; i<ARRAY_SIZE(port->chans); i++) {
+		if (test_bit(i, &rx_pending)) {
+			struct hfc_sys_chan_rx *chan_rx = &port->chans[i].rx;
+			int frames = 0;
+
+			while(frames < rx_budget &&
+			      __hfc_sys_chan_rx_frame(chan_rx))
+				frames++;
+
+			if (frames == rx_budget)
+				__set_bit(i, &card->fifo_rx_polling);
+
+			if (frames)
+				chan_rx->drain_hist[min(fls(frames - 1),
+					HFC_SYS_CHAN_RX_DRAIN_BUCKETS - 1)]++;
+		}
+
+		if (test_bit(i, &tx_pending)) {
+			struct hfc_fifo *fifo = &port->chans[i].tx.fifo;
+
+			hfc_fifo_select(fifo);
+
+			if (hfc_fifo_free_frames(fifo) &&
+			    hfc_fifo_free_tx(fifo) > 20)
+				__set_bit(i, &tx_wake);
+		}
+	}
+
+	if (!card->fifo_rx_polling)
+		hfc_card_update_r_irq_ctrl(card, TRUE);
 
 	hfc_card_unlock(card);
+
+	for (i=0; i<ARRAY_SIZE(port->chans); i++) {
+		struct hfc_sys_chan *chan = &port->chans[i];
+		struct sk_buff *skb;
+
+		while((skb = __skb_dequeue(&chan->rx.frames))) {
+			if (kss_chan_push_frame(&chan->rx.ks_chan, skb) !=
+								KSS_TX_OK)
+				kfree_skb(skb);
+		}
+
+		if (test_bit(i, &tx_wake))
+			kss_chan_wake_queue(&chan->tx.ks_chan);
+	}
+
+	if (card->fifo_rx_polling)
+		tasklet_schedule(&card->fifo_tasklet);
 }
 
 static void hfc_sys_chan_rx_create(
@@ -1194,26 +1422,7 @@ static void hfc_sys_chan_rx_create(
 
 	chan_rx->ks_chan.mtu = -1;
 
-	tasklet_init(&chan_rx->tasklet,
-		hfc_sys_chan_rx_tasklet,
-		(unsigned long)chan_rx);
-}
-
-static void hfc_sys_chan_tx_wake_tasklet(unsigned long data)
-{
-	struct hfc_sys_chan_tx *chan_tx = (struct hfc_sys_chan_tx *)data;
-	struct hfc_sys_chan *chan = chan_tx->chan;
-	struct hfc_card *card = chan->port->card;
-
-	hfc_card_lock(card);
-
-	hfc_fifo_select(&chan_tx->fifo);
-
-	if (hfc_fifo_free_frames(&chan_tx->fifo) &&
-	    hfc_fifo_free_tx(&chan_tx->fifo) > 20)
-		kss_chan_wake_queue(&chan_tx->ks_chan);
-
-	hfc_card_unlock(card);
+	skb_queue_head_init(&chan_rx->frames);
 }
 
 static void hfc_sys_chan_tx_create(
@@ -1237,10 +1446,6 @@ static void hfc_sys_chan_tx_create(
 	chan_tx->ks_chan.mtu = -1;
 
 	hfc_fifo_init(&chan_tx->fifo, chan->port->card, fifo_hwid, TX);
-
-	tasklet_init(&chan_tx->wake_tasklet,
-		hfc_sys_chan_tx_wake_tasklet,
-		(unsigned long)chan_tx);
 }
 
 struct hfc_sys_chan *hfc_sys_chan_create(
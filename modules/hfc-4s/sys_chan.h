@@ -14,6 +14,7 @@
 #define _HFC_SYS_CHAN_H
 
 #include <linux/interrupt.h>
+#include <linux/skbuff.h>
 
 #include <linux/kstreamer/kstreamer.h>
 #include <linux/kstreamer/channel.h>
@@ -59,6 +60,8 @@ struct hfc_octet_reverser
 	struct ks_octet_reverser_descr descr;
 };
 
+#define HFC_SYS_CHAN_RX_DRAIN_BUCKETS 6
+
 struct hfc_sys_chan_rx
 {
 	struct ks_chan ks_chan;
@@ -71,9 +74,18 @@ struct hfc_sys_chan_rx
 	struct hfc_fifo fifo;
 	int fifo_enabled;
 
-	struct tasklet_struct tasklet;
+	unsigned long status;
+
+	/* Frames received by the card's FIFO tasklet, to be pushed */
+	struct sk_buff_head frames;
+
+	/* Frames drained per FIFO tasklet run: 1, 2, 3-4, 5-8, 9-16, more */
+	unsigned int drain_hist[HFC_SYS_CHAN_RX_DRAIN_BUCKETS];
 };
 
+/* Already read and pushed by another chan's stimulus in this tick */
+#define HFC_SYS_CHAN_RX_STATUS_BATCHED 0
+
 #define HFC_SYS_CHAN_TX_STATUS_STOPPED (1 << 0)
 
 struct hfc_sys_chan_tx
@@ -94,11 +106,10 @@ struct hfc_sys_chan_tx
 	int fifo_cycles;
 	int fifo_min;
 	int fifo_max;
-
-	struct tasklet_struct wake_tasklet;
 };
 
 struct hfc_sys_port;
+struct hfc_switch_conn;
 struct hfc_sys_chan {
 	struct hfc_sys_port *port;
 
@@ -108,6 +119,9 @@ struct hfc_sys_chan {
 
 	struct hfc_sys_chan_rx rx;
 	struct hfc_sys_chan_tx tx;
+
+	/* Switch connection the FIFOs are lent to, if any */
+	struct hfc_switch_conn *switch_conn;
 };
 
 struct hfc_sys_chan *hfc_sys_chan_create(
@@ -129,6 +143,8 @@ static inline void hfc_sys_chan_put(struct hfc_sys_chan *chan)
 	ks_duplex_put(&chan->ks_duplex);
 }
 
+extern void hfc_sys_chan_fifo_tasklet(unsigned long data);
+
 extern int hfc_sys_chan_register(
 	struct hfc_sys_chan *chan);
 extern void hfc_sys_chan_unregister(
@@ -421,6 +421,24 @@ void hfc_sys_port_update_fsm(
 	}
 	
 	for (i=0; i<port->num_chans; i++) {
+		struct hfc_switch_conn *conn = port->chans[i].switch_conn;
+
+		if (conn) {
+			entries[nentries].fifo =
+					&port->chans[i].rx.fifo;
+			entries[nentries].hfc_chan_hwindex =
+					conn->from->hw_index;
+			nentries++;
+
+			entries[nentries].fifo =
+					&port->chans[i].tx.fifo;
+			entries[nentries].hfc_chan_hwindex =
+					conn->to->hw_index;
+			nentries++;
+
+			continue;
+		}
+
 		// If FIFO open! FIXME TODO
 		if (1) {
 			struct ks_chan *prev_chan;
@@ -21,12 +21,14 @@
 
 #define to_sys_port(port) container_of(port, struct hfc_sys_port, visdn_port)
 
+#define HFC_SYS_PORT_MAX_CHANS 32
+
 struct hfc_sys_port
 {
 	struct hfc_card *card;
 
 	int num_chans;
-	struct hfc_sys_chan chans[32];
+	struct hfc_sys_chan chans[HFC_SYS_PORT_MAX_CHANS];
 
 	struct visdn_port visdn_port;
 };
@@ -0,0 +1 @@
+../../../ec/ec.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../jitbuf/jitbuf.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../kstreamer/tick.h
\ No newline at end of file
@@ -0,0 +1,146 @@
+/*
+ * Kstreamer adaptive jitter buffer
+ *
+ * Copyright (C) 2006-2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#ifndef _KS_JITBUF_H
+#define _KS_JITBUF_H
+
+#include <linux/types.h>
+
+/* Descriptor of the "jitbuf" feature, exposed by the jitter buffer's out
+ * chan. Delays are in samples, statistics are read only.
+ */
+struct ks_jitbuf_descr
+{
+	__u32 min_delay;
+	__u32 max_delay;
+	__u8 silence;
+	__u8 pad[3];
+
+	__u32 delay;
+	__u32 target;
+	__u32 jitter;
+
+	__u64 samples_in;
+	__u64 samples_out;
+	__u64 late;
+	__u64 overflows;
+	__u64 compressed;
+	__u64 expanded;
+	__u64 concealed;
+	__u32 underruns;
+	__u32 pad2;
+};
+
+/* Frames pushed to the in chan carry the timestamp, in samples, of their
+ * first sample. Raw data is assumed to follow the previous one.
+ */
+struct ks_jitbuf_frame_hdr
+{
+	__u32 ts;
+};
+
+#ifdef __KERNEL__
+
+#include <linux/spinlock.h>
+
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+
+#define ksjb_MODULE_NAME "ks-jitbuf"
+#define ksjb_MODULE_PREFIX ksjb_MODULE_NAME ": "
+#define ksjb_MODULE_DESCR "kstreamer adaptive jitter buffer"
+
+/* Samples, must be a power of 2 */
+#define KSJB_BUF_SIZE 4096
+
+#define KSJB_DEFAULT_MIN_DELAY 160
+#define KSJB_DEFAULT_MAX_DELAY 1600
+#define KSJB_DEFAULT_SILENCE 0x2a
+
+/* Time stretching adds or removes one sample every KSJB_STRETCH_STEP */
+#define KSJB_STRETCH_STEP 64
+
+/* On underrun the last KSJB_CONCEAL_LEN samples are replayed once */
+#define KSJB_CONCEAL_LEN 80
+
+struct ksjb_jitbuf
+{
+	struct list_head node;
+
+	struct ks_node ks_node;
+	struct ks_chan ks_chan_in;
+	struct ks_chan ks_chan_out;
+
+	int id;
+
+	spinlock_t lock;
+
+	u8 buf[KSJB_BUF_SIZE];
+
+	/* Timestamps of the next sample to play and past the last received */
+	u32 tail;
+	u32 head;
+
+	int primed;
+	int playing;
+
+	u32 next_ts;
+	u32 last_ts;
+	u64 last_arrival;
+
+	/* Interarrival jitter, in samples << 4 */
+	u32 jitter;
+
+	u64 last_out;
+	u32 out_rem;
+
+	int stretch_count;
+
+	u8 history[KSJB_CONCEAL_LEN];
+	int history_pos;
+	int concealed;
+
+	struct ks_jitbuf_descr descr;
+};
+
+extern void ksjb_write(
+	struct ksjb_jitbuf *jb,
+	const u8 *data,
+	int len,
+	u32 ts);
+
+#if defined(DEBUG_CODE) && defined(DEBUG_DEFAULTS)
+#define ksjb_debug(dbglevel, format, arg...)			\
+	if (debug_level >= dbglevel)				\
+		printk(KERN_DEBUG ksjb_MODULE_PREFIX		\
+			format,					\
+			## arg)
+#else
+#define ksjb_debug(format, arg...) do {} while (0)
+#endif
+
+#define ksjb_msg(level, format, arg...)				\
+	printk(level ksjb_MODULE_PREFIX				\
+		format,						\
+		## arg)
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#endif
+
+#endif
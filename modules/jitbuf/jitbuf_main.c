@@ -0,0 +1,708 @@
+/*
+ * Kstreamer adaptive jitter buffer
+ *
+ * Copyright (C) 2006-2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+/* Each jitter buffer is a node with an "in" chan, receiving audio from a
+ * pipeline, and an "out" chan, from which the audio is played out at each
+ * tick of the pipeline it belongs to.
+ *
+ * The buffer keeps about twice the estimated interarrival jitter queued,
+ * within the configured limits, adding or removing one sample every
+ * KSJB_STRETCH_STEP to track the target. Underruns are concealed by
+ * replaying the last played samples once before falling back to silence
+ * and buffering again.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/ktime.h>
+#include <asm/div64.h>
+
+#include <linux/kstreamer/kstreamer.h>
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+#include <linux/kstreamer/pipeline.h>
+#include <linux/kstreamer/streamframe.h>
+#include <linux/kstreamer/softswitch.h>
+#include <linux/kstreamer/feature.h>
+
+#include "jitbuf.h"
+
+#ifdef DEBUG_CODE
+#ifdef DEBUG_DEFAULTS
+int debug_level = 3;
+#else
+int debug_level = 0;
+#endif
+#endif
+
+static int instances = 32;
+
+static struct list_head ksjb_jitbufs_list = LIST_HEAD_INIT(ksjb_jitbufs_list);
+static DECLARE_RWSEM(ksjb_jitbufs_list_sem);
+
+static struct ks_feature *ksjb_feature;
+
+static struct ksjb_jitbuf *ksjb_jitbuf_get(struct ksjb_jitbuf *jb)
+{
+	if (ks_node_get(&jb->ks_node))
+		return jb;
+	else
+		return NULL;
+}
+
+static void ksjb_jitbuf_put(struct ksjb_jitbuf *jb)
+{
+	ks_node_put(&jb->ks_node);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static inline u8 *ksjb_sample(struct ksjb_jitbuf *jb, u32 ts)
+{
+	return &jb->buf[ts & (KSJB_BUF_SIZE - 1)];
+}
+
+static void ksjb_fill(
+	struct ksjb_jitbuf *jb,
+	u32 ts,
+	const u8 *data,
+	int len)
+{
+	u32 off = ts & (KSJB_BUF_SIZE - 1);
+	int l = min_t(u32, len, KSJB_BUF_SIZE - off);
+
+	memcpy(jb->buf + off, data, l);
+	memcpy(jb->buf, data + l, len - l);
+}
+
+/* Lost samples are rebuilt repeating the ones preceding the gap */
+static void ksjb_conceal_gap(
+	struct ksjb_jitbuf *jb,
+	u32 ts,
+	int len)
+{
+	int i;
+
+	for (i=0; i<len; i++) {
+		*ksjb_sample(jb, ts + i) = i < KSJB_CONCEAL_LEN ?
+			*ksjb_sample(jb, ts - KSJB_CONCEAL_LEN + i) :
+			jb->descr.silence;
+	}
+
+	jb->descr.concealed += len;
+}
+
+static void ksjb_reset(struct ksjb_jitbuf *jb)
+{
+	jb->primed = FALSE;
+	jb->playing = FALSE;
+	jb->jitter = 0;
+	jb->last_out = 0;
+	jb->out_rem = 0;
+	jb->stretch_count = 0;
+	jb->concealed = 0;
+
+	memset(jb->history, jb->descr.silence, sizeof(jb->history));
+	jb->history_pos = 0;
+}
+
+/*
+ * Queues len samples, ts being the timestamp of the first one. Samples
+ * whose playout time has already passed are dropped.
+ *
+ * Must be called with jb->lock held.
+ */
+static void __ksjb_write(
+	struct ksjb_jitbuf *jb,
+	const u8 *data,
+	int len,
+	u32 ts,
+	u64 now)
+{
+	jb->descr.samples_in += len;
+
+	if (!jb->primed) {
+		jb->tail = ts;
+		jb->head = ts;
+		jb->primed = TRUE;
+	} else {
+		/* RFC 3550 interarrival jitter, 8 samples per msec */
+		u64 delta = now - jb->last_arrival;
+		s32 d;
+
+		do_div(delta, 125000);
+
+		d = (s32)delta - (s32)(ts - jb->last_ts);
+		if (d < 0)
+			d = -d;
+
+		jb->jitter += d - ((jb->jitter + 8) >> 4);
+	}
+
+	jb->last_arrival = now;
+	jb->last_ts = ts;
+	jb->next_ts = ts + len;
+
+	if ((s32)(ts - jb->tail) < 0) {
+		int late = min_t(u32, len, jb->tail - ts);
+
+		jb->descr.late += late;
+
+		data += late;
+		ts += late;
+		len -= late;
+	}
+
+	if (len > jb->descr.max_delay) {
+		int skip = len - jb->descr.max_delay;
+
+		jb->descr.overflows += skip;
+
+		data += skip;
+		ts += skip;
+		len -= skip;
+	}
+
+	if (!len)
+		return;
+
+	/* Make room dropping the oldest samples */
+	if (ts + len - jb->tail > jb->descr.max_delay) {
+		u32 new_tail = ts + len - jb->descr.max_delay;
+
+		jb->descr.overflows += new_tail - jb->tail;
+		jb->tail = new_tail;
+
+		if ((s32)(jb->head - new_tail) < 0)
+			jb->head = new_tail;
+	}
+
+	if ((s32)(ts - jb->head) > 0)
+		ksjb_conceal_gap(jb, jb->head, ts - jb->head);
+
+	ksjb_fill(jb, ts, data, len);
+
+	if ((s32)(ts + len - jb->head) > 0)
+		jb->head = ts + len;
+}
+
+void ksjb_write(
+	struct ksjb_jitbuf *jb,
+	const u8 *data,
+	int len,
+	u32 ts)
+{
+	u64 now = ktime_to_ns(ktime_get());
+
+	spin_lock_bh(&jb->lock);
+	__ksjb_write(jb, data, len, ts, now);
+	spin_unlock_bh(&jb->lock);
+}
+EXPORT_SYMBOL(ksjb_write);
+
+static void ksjb_play(
+	struct ksjb_jitbuf *jb,
+	u8 *out,
+	int n)
+{
+	u32 target;
+	u32 depth;
+	int i;
+
+	/* Twice the jitter plus one tick, within limits */
+	target = (jb->jitter >> 4) * 2 + n;
+	target = max(target, jb->descr.min_delay);
+	target = min(target, jb->descr.max_delay);
+
+	jb->descr.target = target;
+	jb->descr.jitter = jb->jitter >> 4;
+
+	if (!jb->playing && jb->primed && jb->head - jb->tail >= target)
+		jb->playing = TRUE;
+
+	for (i=0; i<n; i++) {
+		u8 sample;
+
+		/* Time goes on while the buffer is empty, samples arriving
+		 * for the elapsed positions are late and dropped, a gap is
+		 * not queued as a whole.
+		 */
+		if (jb->primed && jb->head == jb->tail) {
+			jb->tail++;
+			jb->head++;
+		}
+
+		if (!jb->playing) {
+			out[i] = jb->descr.silence;
+			continue;
+		}
+
+		if (jb->head == jb->tail) {
+			if (!jb->concealed)
+				jb->descr.underruns++;
+
+			out[i] = jb->history[(jb->history_pos + jb->concealed) %
+							KSJB_CONCEAL_LEN];
+
+			jb->descr.concealed++;
+
+			if (++jb->concealed >= KSJB_CONCEAL_LEN) {
+				/* Nothing more to replay, buffer again */
+				jb->playing = FALSE;
+				jb->concealed = 0;
+			}
+
+			continue;
+		}
+
+		jb->concealed = 0;
+
+		if (++jb->stretch_count >= KSJB_STRETCH_STEP) {
+			jb->stretch_count = 0;
+
+			depth = jb->head - jb->tail;
+
+			if (depth > target + n && depth > 1) {
+				jb->tail++;
+				jb->descr.compressed++;
+			} else if (depth + n < target) {
+				/* Play the sample twice */
+				sample = *ksjb_sample(jb, jb->tail);
+				jb->descr.expanded++;
+
+				goto emit;
+			}
+		}
+
+		sample = *ksjb_sample(jb, jb->tail++);
+
+emit:
+		jb->history[jb->history_pos] = sample;
+		jb->history_pos = (jb->history_pos + 1) % KSJB_CONCEAL_LEN;
+
+		out[i] = sample;
+	}
+
+	jb->descr.samples_out += n;
+	jb->descr.delay = jb->primed ? jb->head - jb->tail : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void ksjb_node_release(struct ks_node *ks_node)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_node,
+					struct ksjb_jitbuf, ks_node);
+
+	ksjb_debug(3, "ksjb_node_release()\n");
+
+	kfree(jb);
+}
+
+static struct ks_node_ops ksjb_node_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksjb_node_release,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void ksjb_in_chan_release(struct ks_chan *ks_chan)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_chan,
+					struct ksjb_jitbuf, ks_chan_in);
+
+	ksjb_debug(3, "ksjb_in_chan_release()\n");
+
+	ksjb_jitbuf_put(jb);
+}
+
+static struct ks_chan_ops ksjb_in_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksjb_in_chan_release,
+};
+
+static int ksjb_in_chan_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_chan,
+					struct ksjb_jitbuf, ks_chan_in);
+	u64 now = ktime_to_ns(ktime_get());
+	u32 ts;
+
+	spin_lock_bh(&jb->lock);
+
+	/* Raw data carries no timestamp, after an underrun it resumes at
+	 * the play position instead of being late
+	 */
+	ts = jb->next_ts;
+	if (jb->primed && (s32)(ts - jb->head) < 0)
+		ts = jb->head;
+
+	__ksjb_write(jb, sf->data, sf->len, ts, now);
+
+	spin_unlock_bh(&jb->lock);
+
+	return 0;
+}
+
+static int ksjb_in_chan_push_frame(
+	struct ks_chan *ks_chan,
+	struct sk_buff *skb)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_chan,
+					struct ksjb_jitbuf, ks_chan_in);
+	struct ks_jitbuf_frame_hdr *hdr;
+
+	if (skb->len < sizeof(*hdr)) {
+		kfree_skb(skb);
+		return KSS_TX_OK;
+	}
+
+	hdr = (struct ks_jitbuf_frame_hdr *)skb->data;
+
+	ksjb_write(jb, skb->data + sizeof(*hdr), skb->len - sizeof(*hdr),
+		hdr->ts);
+
+	kfree_skb(skb);
+
+	return KSS_TX_OK;
+}
+
+static struct kss_chan_from_ops ksjb_in_chan_from_ops =
+{
+	.push_raw	= ksjb_in_chan_push_raw,
+	.push_frame	= ksjb_in_chan_push_frame,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void ksjb_out_chan_release(struct ks_chan *ks_chan)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_chan,
+					struct ksjb_jitbuf, ks_chan_out);
+
+	ksjb_debug(3, "ksjb_out_chan_release()\n");
+
+	ksjb_jitbuf_put(jb);
+}
+
+static int ksjb_out_chan_start(struct ks_chan *ks_chan)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_chan,
+					struct ksjb_jitbuf, ks_chan_out);
+
+	spin_lock_bh(&jb->lock);
+	ksjb_reset(jb);
+	spin_unlock_bh(&jb->lock);
+
+	return 0;
+}
+
+static void ksjb_out_chan_stimulus(struct ks_chan *ks_chan)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_chan,
+					struct ksjb_jitbuf, ks_chan_out);
+	struct ks_streamframe *sf;
+	u64 now = ktime_to_ns(ktime_get());
+	u64 elapsed;
+	int n;
+
+	/* As many samples as the time elapsed since the last tick */
+	spin_lock_bh(&jb->lock);
+
+	if (!jb->last_out) {
+		jb->last_out = now;
+		spin_unlock_bh(&jb->lock);
+		return;
+	}
+
+	elapsed = now - jb->last_out + jb->out_rem;
+	jb->last_out = now;
+	jb->out_rem = do_div(elapsed, 125000);
+
+	spin_unlock_bh(&jb->lock);
+
+	n = min_t(u64, elapsed, KS_SF_SIZE_DEFAULT);
+	if (!n)
+		return;
+
+	sf = ks_sf_alloc(n);
+	if (!sf)
+		return;
+
+	spin_lock_bh(&jb->lock);
+	ksjb_play(jb, sf->data, n);
+	spin_unlock_bh(&jb->lock);
+
+	sf->len = n;
+
+	kss_chan_push_raw(ks_chan, sf);
+
+	ks_sf_put(sf);
+}
+
+static int ksjb_out_chan_get_attr_count(struct ks_chan *ks_chan)
+{
+	return 1;
+}
+
+static int ksjb_out_chan_get_attr(
+	struct ks_chan *ks_chan,
+	int index,
+	__u16 *type,
+	void *buf,
+	int *len)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_chan,
+					struct ksjb_jitbuf, ks_chan_out);
+
+	if (index != 0)
+		return -ENOENT;
+
+	if (*len < sizeof(struct ks_jitbuf_descr))
+		return -ENOSPC;
+
+	*type = ksjb_feature->id;
+	*len = sizeof(struct ks_jitbuf_descr);
+
+	spin_lock_bh(&jb->lock);
+	memcpy(buf, &jb->descr, sizeof(jb->descr));
+	spin_unlock_bh(&jb->lock);
+
+	return 0;
+}
+
+static int ksjb_out_chan_set_attr(
+	struct ks_chan *ks_chan,
+	__u16 type,
+	void *buf,
+	int len)
+{
+	struct ksjb_jitbuf *jb = container_of(ks_chan,
+					struct ksjb_jitbuf, ks_chan_out);
+	struct ks_jitbuf_descr *descr = buf;
+
+	if (type != ksjb_feature->id)
+		return -ENOENT;
+
+	if (len < sizeof(struct ks_jitbuf_descr))
+		return -EINVAL;
+
+	if (!descr->max_delay ||
+	    descr->max_delay > KSJB_BUF_SIZE ||
+	    descr->min_delay > descr->max_delay)
+		return -EINVAL;
+
+	spin_lock_bh(&jb->lock);
+	jb->descr.min_delay = descr->min_delay;
+	jb->descr.max_delay = descr->max_delay;
+	jb->descr.silence = descr->silence;
+	spin_unlock_bh(&jb->lock);
+
+	return 0;
+}
+
+static struct ks_chan_ops ksjb_out_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksjb_out_chan_release,
+	.start		= ksjb_out_chan_start,
+	.stimulus	= ksjb_out_chan_stimulus,
+	.get_attr_count	= ksjb_out_chan_get_attr_count,
+	.get_attr	= ksjb_out_chan_get_attr,
+	.set_attr	= ksjb_out_chan_set_attr,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static struct ksjb_jitbuf *ksjb_jitbuf_create(int id)
+{
+	struct ksjb_jitbuf *jb;
+	char name[16];
+
+	jb = kmalloc(sizeof(*jb), GFP_KERNEL);
+	if (!jb)
+		return NULL;
+
+	memset(jb, 0, sizeof(*jb));
+
+	jb->id = id;
+
+	spin_lock_init(&jb->lock);
+
+	jb->descr.min_delay = KSJB_DEFAULT_MIN_DELAY;
+	jb->descr.max_delay = KSJB_DEFAULT_MAX_DELAY;
+	jb->descr.silence = KSJB_DEFAULT_SILENCE;
+	ksjb_reset(jb);
+
+	snprintf(name, sizeof(name), "jitbuf%d", id);
+
+	ks_node_create(&jb->ks_node, &ksjb_node_ops, name,
+			&ks_system_device.kobj);
+
+	ks_chan_create(&jb->ks_chan_in, &ksjb_in_chan_ops, "in", NULL,
+			&jb->ks_node.kobj,
+			&kss_softswitch.ks_node,
+			&jb->ks_node);
+	jb->ks_chan_in.from_ops = &ksjb_in_chan_from_ops;
+
+	ks_chan_create(&jb->ks_chan_out, &ksjb_out_chan_ops, "out", NULL,
+			&jb->ks_node.kobj,
+			&jb->ks_node,
+			&kss_softswitch.ks_node);
+	jb->ks_chan_out.needs_tick = TRUE;
+
+	return jb;
+}
+
+static int ksjb_jitbuf_register(struct ksjb_jitbuf *jb)
+{
+	int err;
+
+	err = ks_node_register(&jb->ks_node);
+	if (err < 0)
+		goto err_node_register;
+
+	ksjb_jitbuf_get(jb);
+	err = ks_chan_register(&jb->ks_chan_in);
+	if (err < 0)
+		goto err_chan_in_register;
+
+	ksjb_jitbuf_get(jb);
+	err = ks_chan_register(&jb->ks_chan_out);
+	if (err < 0)
+		goto err_chan_out_register;
+
+	down_write(&ksjb_jitbufs_list_sem);
+	list_add_tail(&ksjb_jitbuf_get(jb)->node, &ksjb_jitbufs_list);
+	up_write(&ksjb_jitbufs_list_sem);
+
+	return 0;
+
+err_chan_out_register:
+	ksjb_jitbuf_put(jb);
+	ks_chan_unregister(&jb->ks_chan_in);
+err_chan_in_register:
+	ksjb_jitbuf_put(jb);
+	ks_node_unregister(&jb->ks_node);
+err_node_register:
+
+	return err;
+}
+
+static void ksjb_jitbuf_unregister(struct ksjb_jitbuf *jb)
+{
+	down_write(&ksjb_jitbufs_list_sem);
+	list_del(&jb->node);
+	up_write(&ksjb_jitbufs_list_sem);
+	ksjb_jitbuf_put(jb);
+
+	ks_chan_unregister(&jb->ks_chan_out);
+	ks_chan_unregister(&jb->ks_chan_in);
+	ks_node_unregister(&jb->ks_node);
+}
+
+static void ksjb_jitbufs_destroy(void)
+{
+	struct ksjb_jitbuf *jb;
+
+	for (;;) {
+		down_read(&ksjb_jitbufs_list_sem);
+		if (list_empty(&ksjb_jitbufs_list)) {
+			up_read(&ksjb_jitbufs_list_sem);
+			break;
+		}
+
+		jb = ksjb_jitbuf_get(list_entry(ksjb_jitbufs_list.next,
+					struct ksjb_jitbuf, node));
+		up_read(&ksjb_jitbufs_list_sem);
+
+		ksjb_jitbuf_unregister(jb);
+		ksjb_jitbuf_put(jb);
+	}
+}
+
+/******************************************
+ * Module stuff
+ ******************************************/
+
+static int __init ksjb_init_module(void)
+{
+	struct ksjb_jitbuf *jb;
+	int err;
+	int i;
+
+	ksjb_msg(KERN_INFO, ksjb_MODULE_DESCR " loading\n");
+
+	ksjb_feature = ks_feature_register("jitbuf");
+	if (!ksjb_feature) {
+		err = -ENOMEM;
+		goto err_feature_register;
+	}
+
+	for (i=0; i<instances; i++) {
+		jb = ksjb_jitbuf_create(i);
+		if (!jb) {
+			err = -ENOMEM;
+			goto err_jitbuf_create;
+		}
+
+		err = ksjb_jitbuf_register(jb);
+		if (err < 0) {
+			ksjb_jitbuf_put(jb);
+			goto err_jitbuf_register;
+		}
+
+		/* The list holds its own reference */
+		ksjb_jitbuf_put(jb);
+	}
+
+	ksjb_msg(KERN_INFO, ksjb_MODULE_DESCR " loaded successfully\n");
+
+	return 0;
+
+err_jitbuf_register:
+err_jitbuf_create:
+	ksjb_jitbufs_destroy();
+	ks_feature_unregister(ksjb_feature);
+err_feature_register:
+
+	return err;
+}
+
+module_init(ksjb_init_module);
+
+static void __exit ksjb_module_exit(void)
+{
+	ksjb_jitbufs_destroy();
+	ks_feature_unregister(ksjb_feature);
+
+	ksjb_msg(KERN_INFO, ksjb_MODULE_DESCR " unloaded\n");
+}
+
+module_exit(ksjb_module_exit);
+
+MODULE_DESCRIPTION(ksjb_MODULE_DESCR);
+MODULE_AUTHOR("Daniele (Vihai) Orlandi <daniele@orlandi.com>");
+MODULE_LICENSE("GPL");
+
+module_param(instances, int, 0444);
+MODULE_PARM_DESC(instances, "Number of jitter buffers");
+
+#ifdef DEBUG_CODE
+module_param(debug_level, int, 0444);
+MODULE_PARM_DESC(debug_level, "Initial debug level");
+#endif
@@ -0,0 +1,67 @@
+/*
+ * KStreamer softswitch microbenchmark
+ *
+ * Copyright (C) 2006-2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#ifndef _KSBENCH_H
+#define _KSBENCH_H
+
+#ifdef __KERNEL__
+
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+
+#define ksb_MODULE_NAME "ks-bench"
+#define ksb_MODULE_PREFIX ksb_MODULE_NAME ": "
+#define ksb_MODULE_DESCR "KStreamer softswitch microbenchmark"
+
+/* Number of frames pushed by each run when not otherwise specified */
+#define KSB_DEFAULT_FRAMES	1000000
+
+/*
+ * A node with a "tx" chan towards the softswitch and a "rx" chan coming
+ * back from it. Connect them in a pipeline, bring it to FLOWING and write
+ * the number of frames to the "run" attribute to measure the cost of
+ * a push through the softswitch.
+ */
+struct ksb_bench
+{
+	struct ks_node ks_node;
+
+	struct ks_chan tx_chan;
+	struct ks_chan rx_chan;
+
+	struct rw_semaphore sem;
+
+	unsigned long received;
+
+	int frames;
+	u64 walk_ns;
+	u64 cached_ns;
+};
+
+#if defined(DEBUG_CODE) && defined(DEBUG_DEFAULTS)
+#define ksb_debug(dbglevel, format, arg...)			\
+	if (debug_level >= dbglevel)				\
+		printk(KERN_DEBUG ksb_MODULE_PREFIX		\
+			format,					\
+			## arg)
+#else
+#define ksb_debug(format, arg...) do {} while (0)
+#endif
+
+#define ksb_msg(level, format, arg...)				\
+	printk(level ksb_MODULE_PREFIX				\
+		format,						\
+		## arg)
+
+#endif
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * KStreamer softswitch microbenchmark
+ *
+ * Copyright (C) 2006-2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/list.h>
+#include <linux/rwsem.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <asm/div64.h>
+
+#include <linux/kstreamer/kstreamer.h>
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+#include <linux/kstreamer/pipeline.h>
+#include <linux/kstreamer/streamframe.h>
+#include <linux/kstreamer/softswitch.h>
+
+#include "ksbench.h"
+
+#ifdef DEBUG_CODE
+#ifdef DEBUG_DEFAULTS
+int debug_level = 3;
+#else
+int debug_level = 0;
+#endif
+#endif
+
+static int frame_len = 8;
+
+static struct ksb_bench *bench;
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Next hop resolution as done by the softswitch before next hops were
+ * cached on the chans, kept here as the reference to compare against.
+ */
+static int ksb_push_raw_walk(
+	struct ks_chan *chan,
+	struct ks_streamframe *sf)
+{
+	struct ks_chan *to_chan;
+	int res;
+
+	rcu_read_lock();
+	if (!chan->pipeline ||
+	    chan->pipeline_entry.next == &chan->pipeline->entries) {
+		rcu_read_unlock();
+		return -ENOTCONN;
+	}
+
+	to_chan = list_entry(chan->pipeline_entry.next, struct ks_chan,
+							pipeline_entry);
+
+	if (!((struct kss_chan_from_ops *)to_chan->from_ops)->push_raw) {
+		rcu_read_unlock();
+		return -EOPNOTSUPP;
+	}
+
+	res = ((struct kss_chan_from_ops *)to_chan->from_ops)->
+			push_raw(to_chan, sf);
+
+	rcu_read_unlock();
+
+	return res;
+}
+
+static int ksb_run(
+	struct ksb_bench *bench,
+	int (*push_raw)(struct ks_chan *chan, struct ks_streamframe *sf),
+	int frames,
+	u64 *ns)
+{
+	struct ks_streamframe *sf;
+	ktime_t start;
+	int err = 0;
+	int i;
+
+	sf = ks_sf_alloc(frame_len);
+	if (!sf)
+		return -ENOMEM;
+
+	memset(ks_sf_append(sf, min(frame_len, (int)sf->size)), 0, sf->len);
+
+	bench->received = 0;
+
+	start = ktime_get();
+
+	for (i=0; i<frames; i++) {
+		err = push_raw(&bench->tx_chan, sf);
+		if (err < 0)
+			break;
+	}
+
+	*ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	ks_sf_put(sf);
+
+	if (err < 0)
+		return err;
+
+	if (bench->received != frames)
+		return -EIO;
+
+	return 0;
+}
+
+static ssize_t ksb_run_show(
+	struct ks_node *node,
+	struct ks_node_attribute *attr,
+	char *buf)
+{
+	struct ksb_bench *bench =
+			container_of(node, struct ksb_bench, ks_node);
+	u64 walk;
+	u64 cached;
+	int frames;
+
+	down_read(&bench->sem);
+	frames = bench->frames;
+	walk = bench->walk_ns;
+	cached = bench->cached_ns;
+	up_read(&bench->sem);
+
+	if (!frames)
+		return snprintf(buf, PAGE_SIZE, "0\n");
+
+	/* Tenths of nanosecond per frame */
+	walk *= 10;
+	cached *= 10;
+	do_div(walk, frames);
+	do_div(cached, frames);
+
+	return snprintf(buf, PAGE_SIZE,
+		"frames: %d\n"
+		"walk: %llu.%llu ns/frame\n"
+		"cached: %llu.%llu ns/frame\n",
+		frames,
+		(unsigned long long)walk / 10,
+		(unsigned long long)walk % 10,
+		(unsigned long long)cached / 10,
+		(unsigned long long)cached % 10);
+}
+
+static ssize_t ksb_run_store(
+	struct ks_node *node,
+	struct ks_node_attribute *attr,
+	const char *buf,
+	size_t count)
+{
+	struct ksb_bench *bench =
+			container_of(node, struct ksb_bench, ks_node);
+	int frames;
+	int err;
+
+	if (sscanf(buf, "%d", &frames) < 1)
+		return -EINVAL;
+
+	if (frames <= 0)
+		frames = KSB_DEFAULT_FRAMES;
+
+	down_write(&bench->sem);
+
+	err = ksb_run(bench, ksb_push_raw_walk, frames, &bench->walk_ns);
+	if (err < 0)
+		goto err_run;
+
+	err = ksb_run(bench, kss_chan_push_raw, frames, &bench->cached_ns);
+	if (err < 0)
+		goto err_run;
+
+	bench->frames = frames;
+
+	up_write(&bench->sem);
+
+	return count;
+
+err_run:
+	bench->frames = 0;
+	up_write(&bench->sem);
+
+	return err;
+}
+
+static KS_NODE_ATTR(run, S_IRUGO | S_IWUSR,
+		ksb_run_show,
+		ksb_run_store);
+
+/*---------------------------------------------------------------------------*/
+
+static void ksb_node_release(struct ks_node *ks_node)
+{
+	struct ksb_bench *bench = container_of(ks_node,
+					struct ksb_bench, ks_node);
+
+	ksb_debug(3, "ksb_node_release()\n");
+
+	kfree(bench);
+}
+
+static struct ks_node_ops ksb_node_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksb_node_release,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void ksb_chan_release(struct ks_chan *ks_chan)
+{
+	ksb_debug(3, "ksb_chan_release()\n");
+}
+
+static struct ks_chan_ops ksb_chan_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= ksb_chan_release,
+};
+
+static int ksb_rx_chan_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct ksb_bench *bench = ks_chan->driver_data;
+
+	bench->received++;
+
+	return 0;
+}
+
+static struct kss_chan_from_ops ksb_rx_chan_node_ops =
+{
+	.push_raw	= ksb_rx_chan_push_raw,
+};
+
+/*---------------------------------------------------------------------------*/
+
+static void ksb_create(struct ksb_bench *bench)
+{
+	memset(bench, 0, sizeof(*bench));
+
+	init_rwsem(&bench->sem);
+
+	ks_node_create(&bench->ks_node, &ksb_node_ops, "bench",
+			&ks_system_device.kobj);
+
+	ks_chan_create(&bench->tx_chan, &ksb_chan_ops, "tx", NULL,
+			&bench->ks_node.kobj,
+			&bench->ks_node,
+			&kss_softswitch.ks_node);
+	bench->tx_chan.driver_data = bench;
+
+	ks_chan_create(&bench->rx_chan, &ksb_chan_ops, "rx", NULL,
+			&bench->ks_node.kobj,
+			&kss_softswitch.ks_node,
+			&bench->ks_node);
+	bench->rx_chan.from_ops = &ksb_rx_chan_node_ops;
+	bench->rx_chan.driver_data = bench;
+}
+
+static int ksb_register(struct ksb_bench *bench)
+{
+	int err;
+
+	err = ks_node_register(&bench->ks_node);
+	if (err < 0)
+		goto err_node_register;
+
+	err = ks_node_create_file(&bench->ks_node, &ks_node_attr_run);
+	if (err < 0)
+		goto err_create_file_run;
+
+	err = ks_chan_register(&bench->tx_chan);
+	if (err < 0)
+		goto err_tx_chan_register;
+
+	err = ks_chan_register(&bench->rx_chan);
+	if (err < 0)
+		goto err_rx_chan_register;
+
+	return 0;
+
+	ks_chan_unregister(&bench->rx_chan);
+err_rx_chan_register:
+	ks_chan_unregister(&bench->tx_chan);
+err_tx_chan_register:
+	ks_node_remove_file(&bench->ks_node, &ks_node_attr_run);
+err_create_file_run:
+	ks_node_unregister(&bench->ks_node);
+err_node_register:
+
+	return err;
+}
+
+static void ksb_unregister(struct ksb_bench *bench)
+{
+	ks_chan_unregister(&bench->rx_chan);
+	ks_chan_unregister(&bench->tx_chan);
+	ks_node_remove_file(&bench->ks_node, &ks_node_attr_run);
+	ks_node_unregister(&bench->ks_node);
+}
+
+/******************************************
+ * Module stuff
+ ******************************************/
+
+static int __init ksb_init_module(void)
+{
+	int err;
+
+	ksb_msg(KERN_INFO, ksb_MODULE_DESCR " loading\n");
+
+	bench = kmalloc(sizeof(*bench), GFP_KERNEL);
+	if (!bench) {
+		err = -ENOMEM;
+		goto err_alloc_bench;
+	}
+
+	ksb_create(bench);
+
+	err = ksb_register(bench);
+	if (err < 0)
+		goto err_register;
+
+	return 0;
+
+	ksb_unregister(bench);
+err_register:
+	ks_chan_put(&bench->rx_chan);
+	ks_chan_put(&bench->tx_chan);
+	ks_node_put(&bench->ks_node);
+err_alloc_bench:
+
+	return err;
+}
+
+module_init(ksb_init_module);
+
+static void __exit ksb_module_exit(void)
+{
+	ksb_unregister(bench);
+
+	ks_chan_put(&bench->rx_chan);
+	ks_chan_put(&bench->tx_chan);
+	ks_node_put(&bench->ks_node);
+
+	ksb_msg(KERN_INFO, ksb_MODULE_DESCR " unloaded\n");
+}
+
+module_exit(ksb_module_exit);
+
+MODULE_DESCRIPTION(ksb_MODULE_DESCR);
+MODULE_AUTHOR("Daniele (Vihai) Orlandi <daniele@orlandi.com>");
+MODULE_LICENSE("GPL");
+
+module_param(frame_len, int, 0644);
+MODULE_PARM_DESC(frame_len, "Payload length of benchmark frames");
+
+#ifdef DEBUG_CODE
+module_param(debug_level, int, 0444);
+MODULE_PARM_DESC(debug_level, "Initial debug level");
+#endif
@@ -17,6 +17,10 @@
 #include <linux/kobject.h>
 #include <linux/cdev.h>
 #include <linux/kdev_t.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <asm/div64.h>
 
 #include <kernel_config.h>
 
@@ -31,13 +35,37 @@
 
 struct kset *ks_chans_kset;
 
+#define KS_CHAN_HASHBITS	10
+#define KS_CHAN_HASHSIZE	(1 << KS_CHAN_HASHBITS)
+
+/* The list keeps registration order for dumps, lookups go through the hash.
+ * Both are modified under ks_chans_list_lock, the hash is also walked
+ * under RCU so the list reference is dropped only after a grace period.
+ */
 static struct list_head ks_chans_list = LIST_HEAD_INIT(ks_chans_list);
+static struct hlist_head ks_chans_hash[KS_CHAN_HASHSIZE];
 static rwlock_t ks_chans_list_lock = RW_LOCK_UNLOCKED;
 
+static inline struct hlist_head *ks_chans_get_hash(int id)
+{
+	return &ks_chans_hash[id & (KS_CHAN_HASHSIZE - 1)];
+}
+
+/*
+ * The list reference is dropped only after a grace period, lookups under
+ * rcu_read_lock() may still take a reference meanwhile.
+ */
+static void ks_chan_put_rcu(struct rcu_head *head)
+{
+	ks_chan_put(container_of(head, struct ks_chan, rcu));
+}
+
 struct ks_chan *_ks_chan_search_by_id(int id)
 {
 	struct ks_chan *chan;
-	list_for_each_entry(chan, &ks_chans_list, node) {
+	struct hlist_node *t;
+
+	hlist_for_each_entry_rcu(chan, t, ks_chans_get_hash(id), hash_node) {
 		if (chan->id == id)
 			return chan;
 	}
@@ -49,9 +77,9 @@ struct ks_chan *ks_chan_get_by_id(int id)
 {
 	struct ks_chan *chan;
 
-	read_lock(&ks_chans_list_lock);
+	rcu_read_lock();
 	chan = ks_chan_get(_ks_chan_search_by_id(id));
-	read_unlock(&ks_chans_list_lock);
+	rcu_read_unlock();
 
 	return chan;
 }
@@ -101,8 +129,160 @@ int sanprintf(char *buf, int bufsize, const char *fmt, ...)
 
 //----------------------------------------------------------------------------
 
+/*
+ * Accounts a frame of 'len' octets pushed through 'chan', 'res' is 0 if
+ * it was delivered, -ENOTCONN or -ENOSPC if it was dropped for lack of a
+ * next hop or of room in it, any other error otherwise.
+ */
+void ks_chan_stats_push(struct ks_chan *chan, int len, int res)
+{
+	struct ks_chan_stats *stats;
+	unsigned long flags;
+	u64 latency = 0;
+
+	if (!chan->stats)
+		return;
+
+	if (!res && chan->stimulus_time)
+		latency = ktime_to_ns(ktime_get()) - chan->stimulus_time;
+
+	local_irq_save(flags);
+	stats = per_cpu_ptr(chan->stats, smp_processor_id());
+
+	if (!res) {
+		stats->frames++;
+		stats->bytes += len;
+
+		if (chan->stimulus_time) {
+			int bucket = 0;
+
+			do_div(latency, 1000);
+
+			while (latency &&
+			       bucket < KS_CHAN_STATS_LATENCY_BUCKETS - 1) {
+				latency >>= 1;
+				bucket++;
+			}
+
+			stats->latency[bucket]++;
+		}
+	} else if (res == -ENOTCONN || res == -ENOSPC)
+		stats->drops++;
+	else
+		stats->push_errors++;
+
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(ks_chan_stats_push);
+
+void ks_chan_stats_pressure(struct ks_chan *chan, int pressure)
+{
+	struct ks_chan_stats *stats;
+	unsigned long flags;
+
+	if (!chan->stats)
+		return;
+
+	local_irq_save(flags);
+	stats = per_cpu_ptr(chan->stats, smp_processor_id());
+
+	if (!stats->pressure_samples || pressure < stats->pressure_min)
+		stats->pressure_min = pressure;
+
+	if (!stats->pressure_samples || pressure > stats->pressure_max)
+		stats->pressure_max = pressure;
+
+	stats->pressure_samples++;
+
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(ks_chan_stats_pressure);
+
+/* Sums the per-CPU counters, the result is not an atomic snapshot */
+void ks_chan_stats_read(struct ks_chan *chan, struct ks_chan_stats *stats)
+{
+	int cpu;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (!chan->stats)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct ks_chan_stats *cs = per_cpu_ptr(chan->stats, cpu);
+
+		stats->frames += cs->frames;
+		stats->bytes += cs->bytes;
+		stats->drops += cs->drops;
+		stats->push_errors += cs->push_errors;
+
+		if (cs->pressure_samples) {
+			if (!stats->pressure_samples ||
+			    cs->pressure_min < stats->pressure_min)
+				stats->pressure_min = cs->pressure_min;
+
+			if (!stats->pressure_samples ||
+			    cs->pressure_max > stats->pressure_max)
+				stats->pressure_max = cs->pressure_max;
+
+			stats->pressure_samples += cs->pressure_samples;
+		}
+
+		for (i=0; i<KS_CHAN_STATS_LATENCY_BUCKETS; i++)
+			stats->latency[i] += cs->latency[i];
+	}
+}
+EXPORT_SYMBOL(ks_chan_stats_read);
+
+static ssize_t ks_chan_show_stats(
+	struct ks_chan *chan,
+	struct ks_chan_attribute *attr,
+	char *buf)
+{
+	struct ks_chan_stats stats;
+	int len = 0;
+	int i;
+
+	ks_chan_stats_read(chan, &stats);
+
+	len += snprintf(buf + len, PAGE_SIZE - len,
+		"frames %llu\n"
+		"bytes %llu\n"
+		"drops %llu\n"
+		"push_errors %llu\n",
+		(unsigned long long)stats.frames,
+		(unsigned long long)stats.bytes,
+		(unsigned long long)stats.drops,
+		(unsigned long long)stats.push_errors);
+
+	if (stats.pressure_samples)
+		len += snprintf(buf + len, PAGE_SIZE - len,
+			"pressure_min %d\n"
+			"pressure_max %d\n",
+			stats.pressure_min,
+			stats.pressure_max);
+
+	len += snprintf(buf + len, PAGE_SIZE - len, "latency_us");
+
+	for (i=0; i<KS_CHAN_STATS_LATENCY_BUCKETS; i++)
+		len += snprintf(buf + len, PAGE_SIZE - len, " %u",
+				stats.latency[i]);
+
+	len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+
+	return len;
+}
+
+static KS_CHAN_ATTR(stats, S_IRUGO,
+		ks_chan_show_stats,
+		NULL);
+
+//----------------------------------------------------------------------------
+
 static struct attribute *ks_chan_default_attrs[] =
 {
+	&ks_chan_attr_stats.attr,
 	NULL,
 };
 
@@ -161,6 +341,9 @@ static void ks_chan_release(struct kobject *kobj)
 	ks_node_put(chan->from);
 	ks_node_put(chan->to);
 
+	if (chan->stats)
+		free_percpu(chan->stats);
+
 	if (chan->ops->release)
 		chan->ops->release(chan);
 	else
@@ -262,6 +445,17 @@ int ks_chan_write_to_nlmsg(
 		if (err < 0)
 			goto err_put_attr;
 
+		if (message_type == KS_NETLINK_CHAN_GET) {
+			struct ks_chan_stats stats;
+
+			ks_chan_stats_read(chan, &stats);
+
+			err = ks_netlink_put_attr(skb, KS_CHANATTR_STATS,
+						&stats, sizeof(stats));
+			if (err < 0)
+				goto err_put_attr;
+		}
+
 		if (chan->ops->get_attr_count &&
 		    chan->ops->get_attr) {
 			int i;
@@ -302,10 +496,22 @@ nlmsg_failure:
 	return err;
 }
 
+/* Passes a driver specific attribute (e.g. a feature value) to the chan */
+int ks_chan_set_attr(struct ks_chan *chan, struct ks_attr *attr)
+{
+	if (!chan->ops->set_attr)
+		return 0;
+
+	return chan->ops->set_attr(chan, attr->type,
+				KS_ATTR_DATA(attr),
+				KS_ATTR_PAYLOAD(attr));
+}
+
 static int ks_chan_update_from_nlmsg(struct ks_chan *chan, struct nlmsghdr *nlh)
 {
 	struct ks_attr *attr;
 	int attrs_len = KS_PAYLOAD(nlh);
+	int err;
 
 	for (attr = KS_ATTRS(nlh);
 	     KS_ATTR_OK(attr, attrs_len);
@@ -320,16 +526,9 @@ static int ks_chan_update_from_nlmsg(struct ks_chan *chan, struct nlmsghdr *nlh)
 		break;
 
 		default:
-			if (chan->ops->set_attr) {
-				int err;
-
-				err = chan->ops->set_attr(chan, attr->type,
-							KS_ATTR_DATA(attr),
-							KS_ATTR_PAYLOAD(attr));
-
-				if (err < 0)
-					return err;
-			}
+			err = ks_chan_set_attr(chan, attr);
+			if (err < 0)
+				return err;
 		}
 	}
 
@@ -341,43 +540,57 @@ static int ks_chan_mcast_send(
 	struct ks_netlink_state *state,
 	enum ks_netlink_message_type message_type)
 {
+	struct sk_buff *skb;
+	int size = KS_NETLINK_MCAST_MSGSIZE;
 	int err;
 
 retry:
-	err = ks_netlink_mcast_need_skb(state);
-	if (err < 0)
-		return err;
+	skb = alloc_skb(size, GFP_KERNEL);
+	if (!skb) {
+		err = -ENOMEM;
+		goto err_alloc_skb;
+	}
 
-	err = ks_chan_write_to_nlmsg(chan, state->mcast_skb, message_type,
-						0, state->mcast_seqnum++, 0);
+	err = ks_chan_write_to_nlmsg(chan, skb, message_type, 0, 0, 0);
 	if (err < 0) {
-		ks_netlink_mcast_need_another_skb(state);
-		goto retry;
+		kfree_skb(skb);
+
+		if (size < NLMSG_GOODSIZE) {
+			size = NLMSG_GOODSIZE;
+			goto retry;
+		}
+
+		goto err_write_to_nlmsg;
 	}
 
-	return 0;
+	return ks_netlink_mcast_queue(state, message_type, chan->id, skb);
+
+err_write_to_nlmsg:
+err_alloc_skb:
+
+	return err;
 }
 
 static int ks_chan_netlink_respond(
 	struct ks_chan *chan,
-	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct nlmsghdr *req_nlh,
 	enum ks_netlink_message_type message_type)
 {
 	int err;
 
 retry:
-	ks_netlink_need_skb(state);
-	if (!state->out_skb)
+	ks_netlink_need_skb(reply);
+	if (!reply->out_skb)
 		return -ENOMEM;
 
-	err = ks_chan_write_to_nlmsg(chan, state->out_skb,
+	err = ks_chan_write_to_nlmsg(chan, reply->out_skb,
 				message_type,
 				req_nlh->nlmsg_pid,
 				req_nlh->nlmsg_seq,
 				NLM_F_ACK);
 	if (err < 0) {
-		ks_netlink_flush(state);
+		ks_netlink_flush(reply);
 		goto retry;
 	}
 
@@ -386,14 +599,26 @@ retry:
 
 int ks_chan_cmd_get(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
 	int err;
 	struct ks_chan *chan;
 	int cnt = 1;
-  
-	ks_netlink_send_ack(state, nlh, NLM_F_MULTI);
+
+	/* A request naming a chan gets only that one, with its stats */
+	chan = ks_chan_get_by_nlid(nlh);
+	if (chan) {
+		err = ks_chan_netlink_respond(chan, reply, nlh,
+						KS_NETLINK_CHAN_GET);
+
+		ks_chan_put(chan);
+
+		return err;
+	}
+
+	ks_netlink_send_ack(reply, nlh, NLM_F_MULTI);
 
 	/* No need to read_lock(&ks_chans_list_lock); because we are also
 	 * protected by ks_topology_lock semaphore.
@@ -402,31 +627,32 @@ int ks_chan_cmd_get(
 	list_for_each_entry(chan, &ks_chans_list, node) {
 
 retry:
-		ks_netlink_need_skb(state);
-		if (!state->out_skb)
+		ks_netlink_need_skb(reply);
+		if (!reply->out_skb)
 			return -ENOMEM;
 
 		err = ks_chan_write_to_nlmsg(chan,
-					state->out_skb,
+					reply->out_skb,
 					KS_NETLINK_CHAN_NEW,
 					nlh->nlmsg_pid,
 					nlh->nlmsg_seq + cnt,
 					NLM_F_MULTI);
 		if (err < 0) {
-			ks_netlink_flush(state);
+			ks_netlink_flush(reply);
 			goto retry;
 		}
 
 		cnt++;
 	}
 
-	ks_netlink_send_done(state, nlh, cnt);
+	ks_netlink_send_done(reply, nlh, cnt);
 
 	return 0;
 }
 
 int ks_chan_cmd_set(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -444,7 +670,7 @@ int ks_chan_cmd_set(
 	if (err < 0)
 		goto err_chan_update;
 
-	ks_chan_netlink_respond(chan, state, nlh, KS_NETLINK_CHAN_SET);
+	ks_chan_netlink_respond(chan, reply, nlh, KS_NETLINK_CHAN_SET);
 
 	ks_chan_put(chan);
 
@@ -463,9 +689,14 @@ int ks_chan_register_no_topology_lock(struct ks_chan *chan)
 
 	BUG_ON(!chan);
 
+	chan->stats = alloc_percpu(struct ks_chan_stats);
+	if (!chan->stats)
+		return -ENOMEM;
+
 	write_lock(&ks_chans_list_lock);
 	chan->id = _ks_chan_new_id();
 	list_add_tail(&ks_chan_get(chan)->node, &ks_chans_list);
+	hlist_add_head_rcu(&chan->hash_node, ks_chans_get_hash(chan->id));
 	write_unlock(&ks_chans_list_lock);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,25)
@@ -529,8 +760,9 @@ err_create_chan_duplex:
 err_kobject_add:
 	write_lock(&ks_chans_list_lock);
 	list_del(&chan->node);
+	hlist_del_rcu(&chan->hash_node);
 	write_unlock(&ks_chans_list_lock);
-	ks_chan_put(chan);
+	call_rcu(&chan->rcu, ks_chan_put_rcu);
 
 	return err;
 }
@@ -570,8 +802,9 @@ void ks_chan_unregister_no_topology_lock(struct ks_chan *chan)
 
 	write_lock(&ks_chans_list_lock);
 	list_del(&chan->node);
+	hlist_del_rcu(&chan->hash_node);
 	write_unlock(&ks_chans_list_lock);
-	ks_chan_put(chan);
+	call_rcu(&chan->rcu, ks_chan_put_rcu);
 
 	ks_chan_mcast_send(chan, &ks_netlink_state, KS_NETLINK_CHAN_DEL);
 }
@@ -13,12 +13,42 @@
 #ifndef _KS_CHANNEL_H
 #define _KS_CHANNEL_H
 
+#include <linux/types.h>
+
 enum ks_chan_attribute_type
 {
 	KS_CHANATTR_ID = 1,
 	KS_CHANATTR_PATH,
 	KS_CHANATTR_FROM,
 	KS_CHANATTR_TO,
+	KS_CHANATTR_STATS,
+};
+
+/* Bucket i counts latencies shorter than 2^i microseconds, the last one
+ * everything longer.
+ */
+#define KS_CHAN_STATS_LATENCY_BUCKETS 16
+
+/*
+ * Data path counters of a chan, kept per-CPU by the kernel and summed in
+ * KS_CHANATTR_STATS, which is only present in replies to a CHAN_GET
+ * naming a single chan.
+ */
+struct ks_chan_stats
+{
+	__u64 frames;
+	__u64 bytes;
+
+	/* Frames lost because the next hop was missing or full */
+	__u64 drops;
+	__u64 push_errors;
+
+	__u32 pressure_samples;
+	__s32 pressure_min;
+	__s32 pressure_max;
+	__u32 pad;
+
+	__u32 latency[KS_CHAN_STATS_LATENCY_BUCKETS];
 };
 
 #ifdef __KERNEL__
@@ -62,6 +92,8 @@ struct ks_chan
 {
 	struct kobject kobj;
 	struct list_head node;
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
 
 	int id;
 
@@ -81,6 +113,27 @@ struct ks_chan
 
 	struct list_head pipeline_entry;
 
+	/* Pipeline neighbours and their ops, published with RCU only while
+	 * the pipeline is FLOWING, NULL otherwise.
+	 */
+	struct ks_chan *next_hop;
+	void *next_hop_ops;
+	struct ks_chan *prev_hop;
+	void *prev_hop_ops;
+
+	/* Per-CPU, allocated at registration */
+	struct ks_chan_stats *stats;
+
+	/* Time of the last stimulus, in ns, 0 if the pipeline is not
+	 * stimulated.
+	 */
+	u64 stimulus_time;
+
+	/* Set by the driver of a chan whose stimulus moves data, its
+	 * pipeline is stimulated by the tick engine while FLOWING
+	 */
+	int needs_tick;
+
 	void *driver_data;
 };
 
@@ -129,12 +182,20 @@ extern void ks_chan_unregister(struct ks_chan *chan);
 struct ks_chan *ks_chan_get_by_id(int id);
 struct ks_chan *ks_chan_get_by_nlid(struct nlmsghdr *nlh);
 
+int ks_chan_set_attr(struct ks_chan *chan, struct ks_attr *attr);
+
+void ks_chan_stats_push(struct ks_chan *chan, int len, int res);
+void ks_chan_stats_pressure(struct ks_chan *chan, int pressure);
+void ks_chan_stats_read(struct ks_chan *chan, struct ks_chan_stats *stats);
+
 int ks_chan_cmd_get(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh);
 int ks_chan_cmd_set(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh);
 
@@ -78,8 +78,8 @@ static int _ks_feature_new_id(void)
 	for (;;) {
 		cur_id++;
 
-		if (cur_id < 0x0100 || cur_id > 0xffff)
-			cur_id = 0x0100;
+		if (cur_id < KS_FEATURE_ID_MIN || cur_id > KS_FEATURE_ID_MAX)
+			cur_id = KS_FEATURE_ID_MIN;
 
 		if (!_ks_feature_search_by_id(cur_id))
 			return cur_id;
@@ -137,25 +137,40 @@ static int ks_feature_mcast_send(
 	struct ks_netlink_state *state,
 	enum ks_netlink_message_type message_type)
 {
+	struct sk_buff *skb;
+	int size = KS_NETLINK_MCAST_MSGSIZE;
 	int err;
 
 retry:
-	err = ks_netlink_mcast_need_skb(state);
-	if (err < 0)
-		return err;
+	skb = alloc_skb(size, GFP_KERNEL);
+	if (!skb) {
+		err = -ENOMEM;
+		goto err_alloc_skb;
+	}
 
-	err = ks_feature_write_to_nlmsg(feature, state->mcast_skb, message_type,
-						0, state->mcast_seqnum++, 0);
+	err = ks_feature_write_to_nlmsg(feature, skb, message_type, 0, 0, 0);
 	if (err < 0) {
-		ks_netlink_mcast_need_another_skb(state);
-		goto retry;
+		kfree_skb(skb);
+
+		if (size < NLMSG_GOODSIZE) {
+			size = NLMSG_GOODSIZE;
+			goto retry;
+		}
+
+		goto err_write_to_nlmsg;
 	}
 
-	return 0;
+	return ks_netlink_mcast_queue(state, message_type, feature->id, skb);
+
+err_write_to_nlmsg:
+err_alloc_skb:
+
+	return err;
 }
 
 int ks_feature_cmd_get(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -163,7 +178,7 @@ int ks_feature_cmd_get(
 	int i;
 	int cnt = 1;
   
-	ks_netlink_send_ack(state, nlh, NLM_F_MULTI);
+	ks_netlink_send_ack(reply, nlh, NLM_F_MULTI);
 
 	/* No need to read_lock(&ks_features_list_lock); because we are also
 	 * protected by ks_topology_lock semaphore.
@@ -176,18 +191,18 @@ int ks_feature_cmd_get(
 		hlist_for_each_entry(feature, t, &ks_features_hash[i], node) {
 
 retry:
-			ks_netlink_need_skb(state);
-			if (!state->out_skb)
+			ks_netlink_need_skb(reply);
+			if (!reply->out_skb)
 				return -ENOMEM;
 
 			err = ks_feature_write_to_nlmsg(feature,
-						state->out_skb,
+						reply->out_skb,
 						KS_NETLINK_FEATURE_NEW,
 						nlh->nlmsg_pid,
 						nlh->nlmsg_seq + cnt,
 						NLM_F_MULTI);
 			if (err < 0) {
-				ks_netlink_flush(state);
+				ks_netlink_flush(reply);
 				goto retry;
 			}
 
@@ -195,7 +210,7 @@ retry:
 		}
 	}
 
-	ks_netlink_send_done(state, nlh, cnt);
+	ks_netlink_send_done(reply, nlh, cnt);
 
 	return 0;
 }
@@ -21,6 +21,10 @@ enum ks_feature_attribute_type
 	KS_FEATURE_NAME,
 };
 
+/* Feature ids are used as attribute types, below are core attributes */
+#define KS_FEATURE_ID_MIN 0x0100
+#define KS_FEATURE_ID_MAX 0xffff
+
 #ifdef __KERNEL__
 
 #include <linux/skbuff.h>
@@ -48,6 +52,7 @@ struct ks_feature_value
 
 int ks_feature_cmd_get(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh);
 
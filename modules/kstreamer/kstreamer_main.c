@@ -12,6 +12,7 @@
 
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/rcupdate.h>
 #include <linux/delay.h>
 #include <linux/fs.h>
 #include <linux/cdev.h>
@@ -29,7 +30,9 @@
 #include "channel.h"
 #include "duplex.h"
 #include "pipeline.h"
+#include "streamframe.h"
 #include "netlink.h"
+#include "tick.h"
 
 #ifdef DEBUG_CODE
 #ifdef DEBUG_DEFAULTS
@@ -182,6 +185,10 @@ static int __init ks_init_module(void)
 	if (err < 0)
 		goto err_system_device_register;
 
+	err = ks_sf_modinit();
+	if (err < 0)
+		goto err_sf_modinit;
+
 	err = ks_node_modinit();
 	if (err < 0)
 		goto err_node_modinit;
@@ -198,6 +205,10 @@ static int __init ks_init_module(void)
 	if (err < 0)
 		goto err_duplex_modinit;
 
+	err = ks_tick_modinit();
+	if (err < 0)
+		goto err_tick_modinit;
+
 	err = ks_netlink_modinit();
 	if (err < 0)
 		goto err_netlink_modinit;
@@ -206,6 +217,8 @@ static int __init ks_init_module(void)
 
 	ks_netlink_modexit();
 err_netlink_modinit:
+	ks_tick_modexit();
+err_tick_modinit:
 	ks_duplex_modexit();
 err_duplex_modinit:
 	ks_pipeline_modexit();
@@ -214,6 +227,8 @@ err_pipeline_modinit:
 err_chan_modinit:
 	ks_node_modexit();
 err_node_modinit:
+	ks_sf_modexit();
+err_sf_modinit:
 	device_unregister(&ks_system_device);
 err_system_device_register:
 	kobject_del(&kstreamer_kobj);
@@ -229,10 +244,16 @@ module_init(ks_init_module);
 static void __exit ks_module_exit(void)
 {
 	ks_netlink_modexit();
+	ks_tick_modexit();
 	ks_duplex_modexit();
+
+	/* Deferred puts of unregistered objects */
+	rcu_barrier();
+
 	ks_pipeline_modexit();
 	ks_chan_modexit();
 	ks_node_modexit();
+	ks_sf_modexit();
 
 	device_unregister(&ks_system_device);
 
@@ -11,10 +11,14 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/delay.h>
 #include <linux/fs.h>
 #include <linux/kobject.h>
 #include <linux/netlink.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/notifier.h>
 
 #include <kernel_config.h>
 
@@ -28,6 +32,14 @@
 
 #define KS_TOPOLOGY_LOCK_TIMER 5
 
+/* Seconds a transaction may stay idle holding the topology lock */
+static int topology_lock_timeout = KS_TOPOLOGY_LOCK_TIMER;
+
+/* Milliseconds topology notifications are held to be coalesced, 0 sends
+ * them at the end of each command.
+ */
+static int mcast_flush_interval = 20;
+
 struct sock *ksnl;
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
@@ -108,13 +120,13 @@ int ks_netlink_put_attr(
 	return 0;
 }
 
-int ks_netlink_need_skb(struct ks_netlink_state *state)
+int ks_netlink_need_skb(struct ks_netlink_reply *reply)
 {
-	if (!state->out_skb) {
-		state->out_skb = alloc_skb(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (!reply->out_skb) {
+		reply->out_skb = alloc_skb(NLMSG_GOODSIZE, GFP_KERNEL);
 	}
 
-	if (!state->out_skb) {
+	if (!reply->out_skb) {
 		ks_msg(KERN_WARNING,
 			"Cannot allocate skb in need_skb\n");
 		ksnl->sk_err = ENOBUFS;
@@ -125,106 +137,285 @@ int ks_netlink_need_skb(struct ks_netlink_state *state)
 	return 0;
 }
 
-void ks_netlink_flush(struct ks_netlink_state *state)
+void ks_netlink_flush(struct ks_netlink_reply *reply)
 {
-	if (state->out_skb) {
-		if (state->out_skb->len) {
+	if (reply->out_skb) {
+		if (reply->out_skb->len) {
 			int err;
 
-			err = netlink_unicast(ksnl, state->out_skb,
-							state->cur_pid, 0);
+			err = netlink_unicast(ksnl, reply->out_skb,
+							reply->cur_pid, 0);
 			if (err < 0) {
 				ks_msg(KERN_WARNING,
 					"Netlink overflow detected at"
 					" netlink_flush\n");
 			}
 		} else
-			kfree_skb(state->out_skb);
+			kfree_skb(reply->out_skb);
 
-		state->out_skb = NULL;
+		reply->out_skb = NULL;
 	}
 }
 
-int ks_netlink_mcast_need_skb(struct ks_netlink_state *state)
+static void ks_netlink_mcast_lock(struct ks_netlink_state *state)
 {
-	if (!state->mcast_skb) {
-		state->mcast_skb = alloc_skb(NLMSG_GOODSIZE, GFP_KERNEL);
+	down_write(&state->mcast_sem);
+}
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
-		NETLINK_CB(state->mcast_skb).dst_pid = 0;
-#endif
+static void ks_netlink_mcast_unlock(struct ks_netlink_state *state)
+{
+	up_write(&state->mcast_sem);
+}
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,14)
-		NETLINK_CB(state->mcast_skb).dst_groups =
-					(1 << KS_NETLINK_GROUP_TOPOLOGY);
-#else
-		NETLINK_CB(state->mcast_skb).dst_group =
-					KS_NETLINK_GROUP_TOPOLOGY;
-#endif
+/* Object messages come in groups of four: NEW, DEL, GET, SET. The only
+ * exception is PIPELINE_SETUP, after the groups, which is a pipeline NEW.
+ */
+#define KS_NETLINK_OBJ_TYPE(type)				\
+	((type) == KS_NETLINK_PIPELINE_SETUP ?			\
+		KS_NETLINK_PIPELINE_NEW : (type))
+#define KS_NETLINK_OBJ_CLASS(type) \
+	((KS_NETLINK_OBJ_TYPE(type) - KS_NETLINK_OBJS) / 4)
+#define KS_NETLINK_OBJ_OP(type) \
+	((KS_NETLINK_OBJ_TYPE(type) - KS_NETLINK_OBJS) % 4)
+
+#define ks_netlink_msg_is_new(type) \
+	(KS_NETLINK_OBJ_OP(type) == KS_NETLINK_OBJ_OP(KS_NETLINK_NODE_NEW))
+#define ks_netlink_msg_is_del(type) \
+	(KS_NETLINK_OBJ_OP(type) == KS_NETLINK_OBJ_OP(KS_NETLINK_NODE_DEL))
+
+static struct hlist_head *ks_netlink_mcast_get_hash(
+	struct ks_netlink_state *state,
+	int class, int id)
+{
+	return &state->mcast_pending_hash[
+			(id ^ (class << 4)) & (KS_NETLINK_MCAST_HASHSIZE - 1)];
+}
+
+static void ks_netlink_mcast_drop(struct ks_netlink_mcast_entry *entry)
+{
+	list_del(&entry->node);
+	hlist_del(&entry->hash_node);
+
+	kfree_skb(entry->skb);
+	kfree(entry);
+}
+
+static void ks_netlink_mcast_flush(struct ks_netlink_state *state);
+
+/*
+ * Sends the pending notifications right away unless a transaction is open,
+ * its unlock calls us again. Flushes closer than mcast_flush_interval to
+ * the previous one are deferred to the delayed work, so that bursts are
+ * coalesced while isolated notifications are not delayed.
+ */
+void ks_netlink_mcast_schedule(struct ks_netlink_state *state)
+{
+	unsigned long next;
+
+	if (state->lock_owner)
+		return;
+
+	next = state->mcast_last_flush +
+			msecs_to_jiffies(mcast_flush_interval);
+
+	if (mcast_flush_interval && time_before(jiffies, next))
+		schedule_delayed_work(&state->mcast_work, next - jiffies);
+	else
+		ks_netlink_mcast_flush(state);
+}
+
+/*
+ * Queues the notification in 'skb', a single message about object 'id',
+ * for the next flush. Only the latest state of every object is kept in
+ * the window: an object created and destroyed before the flush is never
+ * announced and a NEW followed by updates is sent as a NEW carrying the
+ * latest state.
+ *
+ * Must be called holding the topology lock, ks_topology_unlock() or the end
+ * of the command sends the window.
+ *
+ * The reference to 'skb' is consumed.
+ */
+int ks_netlink_mcast_queue(
+	struct ks_netlink_state *state,
+	enum ks_netlink_message_type message_type,
+	int id,
+	struct sk_buff *skb)
+{
+	struct ks_netlink_mcast_entry *entry;
+	struct hlist_head *head;
+	struct hlist_node *t;
+	int class = KS_NETLINK_OBJ_CLASS(message_type);
+
+	ks_netlink_mcast_lock(state);
+
+	head = ks_netlink_mcast_get_hash(state, class, id);
+
+	hlist_for_each_entry(entry, t, head, hash_node) {
+		if (entry->class == class && entry->id == id)
+			goto found;
 	}
 
-	if (!state->mcast_skb) {
-		ks_msg(KERN_WARNING,
-			"Cannot allocate skb in mcast_need_skb\n");
-		ksnl->sk_err = ENOBUFS;
-		ksnl->sk_error_report(ksnl);
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry) {
+		/* Subscribers will notice the gap in sequence numbers */
+		state->mcast_seqnum++;
+
+		ks_netlink_mcast_unlock(state);
+		kfree_skb(skb);
+
 		return -ENOMEM;
 	}
 
+	entry->class = class;
+	entry->id = id;
+	entry->first_type = message_type;
+	entry->skb = skb;
+
+	list_add_tail(&entry->node, &state->mcast_pending);
+	hlist_add_head(&entry->hash_node, head);
+
+	ks_netlink_mcast_unlock(state);
+
 	return 0;
-}
 
-void ks_netlink_mcast_need_another_skb(struct ks_netlink_state *state)
-{
-	if (state->mcast_skb) {
-		skb_queue_tail(&state->mcast_queue,
-				state->mcast_skb);
-		state->mcast_skb = NULL;
+found:
+	if (ks_netlink_msg_is_new(entry->first_type)) {
+		if (ks_netlink_msg_is_del(message_type)) {
+			ks_netlink_mcast_drop(entry);
+			ks_netlink_mcast_unlock(state);
+			kfree_skb(skb);
+
+			return 0;
+		}
 
+		((struct nlmsghdr *)skb->data)->nlmsg_type =
+						entry->first_type;
 	}
 
-	ks_netlink_mcast_need_skb(state);
+	kfree_skb(entry->skb);
+	entry->skb = skb;
+
+	ks_netlink_mcast_unlock(state);
+
+	return 0;
 }
 
-static void ks_netlink_mcast_flush(struct ks_netlink_state *state)
+static struct sk_buff *ks_netlink_mcast_alloc_skb(void)
 {
 	struct sk_buff *skb;
+
+	skb = alloc_skb(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+	NETLINK_CB(skb).dst_pid = 0;
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,14)
+	NETLINK_CB(skb).dst_groups = (1 << KS_NETLINK_GROUP_TOPOLOGY);
+#else
+	NETLINK_CB(skb).dst_group = KS_NETLINK_GROUP_TOPOLOGY;
+#endif
+
+	return skb;
+}
+
+static void ks_netlink_mcast_broadcast(struct sk_buff *skb)
+{
 	int err;
 
+	err = netlink_broadcast(ksnl, skb,
+			0, KS_NETLINK_GROUP_TOPOLOGY,
+			GFP_KERNEL | __GFP_WAIT);
+	if (err == -ENOBUFS) {
+		ks_msg(KERN_WARNING,
+			"Netlink overflow detected at mcast_flush\n");
+	}
+}
+
+/*
+ * Sends every pending notification, packing as many messages as possible
+ * in each skb. Sequence numbers are assigned here so that they are
+ * contiguous in the order subscribers receive them, messages which could
+ * not be sent still consume their number so that the gap is detectable.
+ */
+static void ks_netlink_mcast_flush(struct ks_netlink_state *state)
+{
+	struct ks_netlink_mcast_entry *entry, *t;
+	struct sk_buff *skb = NULL;
+
 	if (state->lock_owner)
 		return;
 
-	while ((skb = skb_dequeue(&state->mcast_queue))) {
-		err = netlink_broadcast(ksnl, skb,
-				0, KS_NETLINK_GROUP_TOPOLOGY,
-				GFP_KERNEL | __GFP_WAIT);
-		if (err < 0) {
-			ks_msg(KERN_WARNING,
-				"Netlink overflow detected at mcast_flush\n");
-		}
-	}
+	ks_netlink_mcast_lock(state);
+
+	list_for_each_entry_safe(entry, t, &state->mcast_pending, node) {
+		struct nlmsghdr *nlh = (struct nlmsghdr *)entry->skb->data;
 
-	if (state->mcast_skb) {
-		if (state->mcast_skb->len) {
+		nlh->nlmsg_seq = state->mcast_seqnum++;
 
-			err = netlink_broadcast(ksnl, state->mcast_skb,
-					0, KS_NETLINK_GROUP_TOPOLOGY,
-					GFP_KERNEL | __GFP_WAIT);
-			if (err == -ENOBUFS) {
+		if (skb && skb_tailroom(skb) < entry->skb->len) {
+			ks_netlink_mcast_broadcast(skb);
+			skb = NULL;
+		}
+
+		if (!skb) {
+			skb = ks_netlink_mcast_alloc_skb();
+			if (!skb) {
 				ks_msg(KERN_WARNING,
-					"Netlink overflow detected at"
-					" mcast_flush2: %d\n", err);
+					"Cannot allocate skb in mcast_flush\n");
+
+				ks_netlink_mcast_drop(entry);
+				continue;
 			}
+		}
 
-		} else
-			kfree_skb(state->mcast_skb);
+		memcpy(skb_put(skb, entry->skb->len),
+			entry->skb->data, entry->skb->len);
+
+		ks_netlink_mcast_drop(entry);
+	}
 
-		state->mcast_skb = NULL;
+	if (skb) {
+		ks_netlink_mcast_broadcast(skb);
+		state->mcast_last_flush = jiffies;
 	}
+
+	ks_netlink_mcast_unlock(state);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+static void ks_netlink_mcast_work_func(void *data)
+{
+	struct ks_netlink_state *state = data;
+#else
+static void ks_netlink_mcast_work_func(struct work_struct *work)
+{
+	struct ks_netlink_state *state =
+		container_of(work, struct ks_netlink_state, mcast_work.work);
+#endif
+
+	/* If a transaction is open its unlock reschedules the flush */
+	ks_netlink_mcast_flush(state);
+}
+
+static void ks_netlink_mcast_purge(struct ks_netlink_state *state)
+{
+	struct ks_netlink_mcast_entry *entry, *t;
+
+	ks_netlink_mcast_lock(state);
+
+	list_for_each_entry_safe(entry, t, &state->mcast_pending, node)
+		ks_netlink_mcast_drop(entry);
+
+	ks_netlink_mcast_unlock(state);
 }
 
 int ks_cmd_done(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -239,13 +430,17 @@ static void ks_do_lock(
 	if (!state->lock_owner) {
 		BUG_ON(state->lock_depth);
 
+		/* Whatever happened before the lock is sent before the ack */
+		ks_netlink_mcast_flush(state);
+
 		state->lock_owner = nlh->nlmsg_pid;
 		state->lock_depth++;
 
-		ks_netlink_mcast_flush(state);
+		if (state->lock_aborted == nlh->nlmsg_pid)
+			state->lock_aborted = 0;
 
 		state->lock_timer.expires = jiffies +
-					KS_TOPOLOGY_LOCK_TIMER * HZ;
+					topology_lock_timeout * HZ;
 		add_timer(&state->lock_timer);
 	} else
 		state->lock_depth++;
@@ -253,6 +448,7 @@ static void ks_do_lock(
 
 int ks_cmd_topology_lock(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -261,13 +457,14 @@ int ks_cmd_topology_lock(
 
 	ks_do_lock(state, cmd, nlh);
 
-	ks_netlink_send_ack(state, nlh, 0);
+	ks_netlink_send_ack(reply, nlh, 0);
 
 	return 0;
 }
 
 int ks_cmd_topology_trylock(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -279,13 +476,14 @@ int ks_cmd_topology_trylock(
 
 	ks_do_lock(state, cmd, nlh);
 
-	ks_netlink_send_ack(state, nlh, 0);
+	ks_netlink_send_ack(reply, nlh, 0);
 
 	return 0;
 }
 
 int ks_cmd_topology_unlock(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -305,29 +503,31 @@ int ks_cmd_topology_unlock(
 		state->lock_owner = 0;
 		del_timer(&state->lock_timer);
 
-		ks_netlink_send_ack(state, nlh, 0);
+		ks_netlink_send_ack(reply, nlh, 0);
 
-		ks_netlink_mcast_flush(state);
+		ks_netlink_mcast_schedule(state);
 
 		wake_up(&state->lock_sleep);
 	} else
-		ks_netlink_send_ack(state, nlh, 0);
+		ks_netlink_send_ack(reply, nlh, 0);
 
 	return 0;
 }
 
 int ks_cmd_noop(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
-	ks_netlink_send_ack(state, nlh, 0);
+	ks_netlink_send_ack(reply, nlh, 0);
 
 	return 0;
 }
 
 int ks_cmd_version_request(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *req_nlh)
 {
@@ -336,11 +536,11 @@ int ks_cmd_version_request(
 
 retry:
 
-	ks_netlink_need_skb(state);
-	if (!state->out_skb)
+	ks_netlink_need_skb(reply);
+	if (!reply->out_skb)
 		return -ENOMEM;
 
-	nlh = NLMSG_PUT(state->out_skb, state->cur_pid, state->cur_seq,
+	nlh = NLMSG_PUT(reply->out_skb, reply->cur_pid, reply->cur_seq,
 			KS_NETLINK_VERSION,
 			sizeof(*vr));
 	nlh->nlmsg_flags = NLM_F_ACK;
@@ -354,12 +554,13 @@ retry:
 	return 0;
 
 nlmsg_failure:
-	ks_netlink_flush(state);
+	ks_netlink_flush(reply);
 	goto retry;
 }
 
 int ks_cmd_not_implemented(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -395,25 +596,30 @@ struct ks_command ks_commands[] =
 	{ KS_NETLINK_CHAN_GET, ks_chan_cmd_get, KS_CMD_RD },
 	{ KS_NETLINK_CHAN_SET, ks_chan_cmd_set, KS_CMD_WR },
 
-	{ KS_NETLINK_PIPELINE_NEW, ks_pipeline_cmd_new, KS_CMD_WR },
-	{ KS_NETLINK_PIPELINE_DEL, ks_pipeline_cmd_del, KS_CMD_WR },
+	{ KS_NETLINK_PIPELINE_NEW, ks_pipeline_cmd_new,
+						KS_CMD_WR | KS_CMD_SHARED },
+	{ KS_NETLINK_PIPELINE_DEL, ks_pipeline_cmd_del,
+						KS_CMD_WR | KS_CMD_SHARED },
 	{ KS_NETLINK_PIPELINE_GET, ks_pipeline_cmd_get, KS_CMD_RD },
-	{ KS_NETLINK_PIPELINE_SET, ks_pipeline_cmd_set, KS_CMD_WR },
+	{ KS_NETLINK_PIPELINE_SET, ks_pipeline_cmd_set,
+						KS_CMD_WR | KS_CMD_SHARED },
+	{ KS_NETLINK_PIPELINE_SETUP, ks_pipeline_cmd_new,
+						KS_CMD_WR | KS_CMD_SHARED },
 };
 
 int ks_netlink_send_done(
-	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct nlmsghdr *req_nlh,
 	u16 seq)
 {
 	struct nlmsghdr *nlh;
 
 retry:
-	ks_netlink_need_skb(state);
-	if (!state->out_skb)
+	ks_netlink_need_skb(reply);
+	if (!reply->out_skb)
 		return -ENOMEM;
 
-	nlh = NLMSG_PUT(state->out_skb,
+	nlh = NLMSG_PUT(reply->out_skb,
 			req_nlh->nlmsg_pid,
 			req_nlh->nlmsg_seq + seq,
 			NLMSG_DONE, 0);
@@ -422,23 +628,23 @@ retry:
 	return 0;
 
 nlmsg_failure:
-	ks_netlink_flush(state);
+	ks_netlink_flush(reply);
 	goto retry;
 }
 
 int ks_netlink_send_ack(
-	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct nlmsghdr *req_nlh,
 	int flags)
 {
 	struct nlmsghdr *nlh;
 
 retry:
-	ks_netlink_need_skb(state);
-	if (!state->out_skb)
+	ks_netlink_need_skb(reply);
+	if (!reply->out_skb)
 		return -ENOMEM;
 
-	nlh = NLMSG_PUT(state->out_skb,
+	nlh = NLMSG_PUT(reply->out_skb,
 			req_nlh->nlmsg_pid,
 			req_nlh->nlmsg_seq,
 			req_nlh->nlmsg_type, 0);
@@ -447,23 +653,23 @@ retry:
 	return 0;
 
 nlmsg_failure:
-	ks_netlink_flush(state);
+	ks_netlink_flush(reply);
 	goto retry;
 }
 
 int ks_netlink_send_error(
-	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct nlmsghdr *req_nlh,
 	int error)
 {
 	struct nlmsghdr *nlh;
 
 retry:
-	ks_netlink_need_skb(state);
-	if (!state->out_skb)
+	ks_netlink_need_skb(reply);
+	if (!reply->out_skb)
 		return -ENOMEM;
 
-	nlh = NLMSG_PUT(state->out_skb, req_nlh->nlmsg_pid, req_nlh->nlmsg_seq,
+	nlh = NLMSG_PUT(reply->out_skb, req_nlh->nlmsg_pid, req_nlh->nlmsg_seq,
 						NLMSG_ERROR, sizeof(int));
 	nlh->nlmsg_flags = NLM_F_ACK;
 
@@ -472,7 +678,7 @@ retry:
 	return 0;
 
 nlmsg_failure:
-	ks_netlink_flush(state);
+	ks_netlink_flush(reply);
 	goto retry;
 }
 
@@ -502,17 +708,62 @@ void ks_topology_lock(void)
 
 void ks_topology_unlock(void)
 {
-	ks_netlink_mcast_flush(&ks_netlink_state);
+	ks_netlink_mcast_schedule(&ks_netlink_state);
 
 	up_write(&ks_netlink_state.topology_lock);
 }
 
+static void ks_netlink_cmd_lock(struct ks_command *cmd)
+{
+	if (cmd->flags & KS_CMD_SHARED)
+		down_read(&ks_netlink_state.topology_lock);
+	else
+		down_write(&ks_netlink_state.topology_lock);
+}
+
+static void ks_netlink_cmd_unlock(struct ks_command *cmd)
+{
+	if (cmd->flags & KS_CMD_SHARED)
+		up_read(&ks_netlink_state.topology_lock);
+	else
+		up_write(&ks_netlink_state.topology_lock);
+}
+
+/*
+ * Commands from the owner of a transaction aborted by the lock timer are
+ * refused up to and including its unlock, so that it does not go on
+ * believing its view of the topology is still consistent.
+ */
+static int ks_netlink_check_aborted(
+	struct ks_netlink_state *state,
+	struct ks_command *cmd,
+	struct nlmsghdr *nlh)
+{
+	if (!state->lock_aborted ||
+	    state->lock_aborted != nlh->nlmsg_pid)
+		return 0;
+
+	switch(cmd->message_type) {
+	case KS_NETLINK_TOPOLOGY_LOCK:
+	case KS_NETLINK_TOPOLOGY_TRYLOCK:
+		return 0;
+
+	case KS_NETLINK_TOPOLOGY_UNLOCK:
+		state->lock_aborted = 0;
+		return -ETIMEDOUT;
+
+	default:
+		return -ETIMEDOUT;
+	}
+}
+
 static int ks_netlink_rcv_msg(
 	struct ks_netlink_state *state,
 	struct sk_buff *skb,
 	struct nlmsghdr *nlh)
 {
 	struct ks_command *cmd = NULL;
+	struct ks_netlink_reply reply;
 	int i;
 	int err;
 
@@ -535,30 +786,40 @@ static int ks_netlink_rcv_msg(
 		goto err_invalid_command;
 	}
 
-	down_write(&ks_netlink_state.topology_lock);
+	ks_netlink_cmd_lock(cmd);
 
 	if (state->lock_owner &&
 	    state->lock_owner != nlh->nlmsg_pid) {
-		up_write(&ks_netlink_state.topology_lock);
+		ks_netlink_cmd_unlock(cmd);
 		err = -EAGAIN;
 		goto err_lock_failed;
 	}
 
-	state->cur_pid = nlh->nlmsg_pid;
-	state->cur_seq = nlh->nlmsg_seq;
+	/* The lock timer only fires on idle transactions */
+	if (state->lock_owner)
+		mod_timer(&state->lock_timer,
+				jiffies + topology_lock_timeout * HZ);
+
+	/* Shared commands run concurrently, each has its own reply */
+	reply.out_skb = NULL;
+	reply.cur_pid = nlh->nlmsg_pid;
+	reply.cur_seq = nlh->nlmsg_seq;
+
+	err = ks_netlink_check_aborted(state, cmd, nlh);
+	if (err >= 0)
+		err = cmd->handler(state, &reply, cmd, nlh);
 
-	err = cmd->handler(state, cmd, nlh);
 	if (err < 0)
-		ks_netlink_send_error(state, nlh, err);
+		ks_netlink_send_error(&reply, nlh, err);
 
-	ks_netlink_flush(state);
-	ks_netlink_mcast_flush(&ks_netlink_state);
+	ks_netlink_flush(&reply);
+	ks_netlink_mcast_schedule(&ks_netlink_state);
 
-	up_write(&ks_netlink_state.topology_lock);
+	ks_netlink_cmd_unlock(cmd);
 
 	return 0;
 
-	up_write(&ks_netlink_state.topology_lock);
+	ks_netlink_cmd_unlock(cmd);
 err_lock_failed:
 err_not_request:
 err_invalid_command:
@@ -590,8 +851,15 @@ static int ks_netlink_rcv_skb(
 		err = ks_netlink_rcv_msg(state, skb, nlh);
 		if (err == -EAGAIN)
 			return err;
-		else if (err < 0)
-			ks_netlink_send_error(state, nlh, err);
+		else if (err < 0) {
+			struct ks_netlink_reply reply = {
+				.cur_pid = nlh->nlmsg_pid,
+				.cur_seq = nlh->nlmsg_seq,
+			};
+
+			ks_netlink_send_error(&reply, nlh, err);
+			ks_netlink_flush(&reply);
+		}
 
 		skb_pull(skb, rlen);
 	}
@@ -658,17 +926,75 @@ static DECLARE_WORK(ks_netlink_rcv_work, ks_netlink_rcv_work_func);
 #else
 #endif
 
+/*
+ * Breaks the transaction of 'pid', whose socket has been released, if it
+ * holds the topology lock. Must be called holding topology_lock for
+ * writing.
+ */
+void ks_netlink_abort_transaction(struct ks_netlink_state *state, u32 pid)
+{
+	if (state->lock_aborted == pid)
+		state->lock_aborted = 0;
+
+	if (state->lock_owner != pid)
+		return;
+
+	ks_msg(KERN_WARNING,
+		"Topology lock holder %d went away, aborting transaction\n",
+		pid);
+
+	del_timer(&state->lock_timer);
+
+	state->lock_depth = 0;
+	state->lock_owner = 0;
+
+	wake_up(&state->lock_sleep);
+}
+
+static int ks_netlink_notify(
+	struct notifier_block *nb,
+	unsigned long event,
+	void *ptr)
+{
+	struct netlink_notify *n = ptr;
+
+	if (event != NETLINK_URELEASE || n->protocol != NETLINK_KSTREAMER)
+		return NOTIFY_DONE;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,24)
+	if (n->net != &init_net)
+		return NOTIFY_DONE;
+#endif
+
+	if (n->pid)
+		ks_pipeline_reclaim_owner(n->pid);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ks_netlink_notifier = {
+	.notifier_call = ks_netlink_notify,
+};
+
 void ks_lock_timeout(unsigned long data)
 {
 //	struct ks_netlink_state *state = (void *)data;
 
 	ks_msg(KERN_WARNING,
 		"Topology lock held for more that %d seconds,"
-		" forcibly breaking lock\n", KS_TOPOLOGY_LOCK_TIMER);
+		" aborting transaction of pid %d\n",
+		topology_lock_timeout,
+		ks_netlink_state.lock_owner);
 
+	ks_netlink_state.lock_aborted = ks_netlink_state.lock_owner;
 	ks_netlink_state.lock_depth = 0;
 	ks_netlink_state.lock_owner = 0;
 
+	/* The unlock which would have flushed the notifications queued in
+	 * the transaction will never come, we cannot flush from here.
+	 */
+	schedule_delayed_work(&ks_netlink_state.mcast_work, 0);
+
 	wake_up(&ks_netlink_state.lock_sleep);
 }
 
@@ -727,6 +1053,8 @@ int ks_netlink_modinit(void)
 	netlink_set_nonroot(NETLINK_KSTREAMER, NL_NONROOT_RECV);
 
 	ks_netlink_state.mcast_seqnum = 0xBEEF;
+	ks_netlink_state.mcast_last_flush = jiffies -
+				msecs_to_jiffies(mcast_flush_interval);
 
 	init_rwsem(&ks_netlink_state.topology_lock);
 	init_timer(&ks_netlink_state.lock_timer);
@@ -735,22 +1063,43 @@ int ks_netlink_modinit(void)
 
 	init_waitqueue_head(&ks_netlink_state.lock_sleep);
 
-	skb_queue_head_init(&ks_netlink_state.mcast_queue);
+	init_rwsem(&ks_netlink_state.mcast_sem);
+	INIT_LIST_HEAD(&ks_netlink_state.mcast_pending);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+	INIT_WORK(&ks_netlink_state.mcast_work, ks_netlink_mcast_work_func,
+							&ks_netlink_state);
+#else
+	INIT_DELAYED_WORK(&ks_netlink_state.mcast_work,
+					ks_netlink_mcast_work_func);
+#endif
+
+	err = netlink_register_notifier(&ks_netlink_notifier);
+	if (err < 0)
+		goto err_register_notifier;
 
 	return 0;
 
+	netlink_unregister_notifier(&ks_netlink_notifier);
+err_register_notifier:
+	sock_release(ksnl->sk_socket);
+err_netlink_kernel_create:
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
 	destroy_workqueue(ks_netlink_rcv_wq);
 err_create_workqueue:
 #endif
-	sock_release(ksnl->sk_socket);
-err_netlink_kernel_create:
 
 	return err;
 }
 
 void ks_netlink_modexit(void)
 {
+	netlink_unregister_notifier(&ks_netlink_notifier);
+
+	cancel_delayed_work(&ks_netlink_state.mcast_work);
+	flush_scheduled_work();
+	ks_netlink_mcast_purge(&ks_netlink_state);
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
 	destroy_workqueue(ks_netlink_rcv_wq);
 #endif
@@ -758,3 +1107,10 @@ void ks_netlink_modexit(void)
 	sock_release(ksnl->sk_socket);
 }
 
+module_param(topology_lock_timeout, int, 0644);
+MODULE_PARM_DESC(topology_lock_timeout,
+	"Seconds after which an idle topology lock is forcibly broken");
+
+module_param(mcast_flush_interval, int, 0644);
+MODULE_PARM_DESC(mcast_flush_interval,
+	"Minimum milliseconds between topology notification flushes");
@@ -55,6 +55,15 @@ enum ks_netlink_message_type
 	KS_NETLINK_PIPELINE_DEL,
 	KS_NETLINK_PIPELINE_GET,
 	KS_NETLINK_PIPELINE_SET,
+
+	/* Like PIPELINE_NEW but feature values following each CHAN_ID are
+	 * set on that chan once CONNECTED, before going to the requested
+	 * status. Saves a round trip per chan and per status change.
+	 *
+	 * Outside of the NEW/DEL/GET/SET groups above, new messages go
+	 * after it.
+	 */
+	KS_NETLINK_PIPELINE_SETUP,
 };
 
 enum ks_netlink_groups
@@ -112,6 +121,8 @@ struct ks_attr
 #include <asm/atomic.h>
 #include <linux/types.h>
 #include <linux/version.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
 #include <net/sock.h>
 
 extern struct sock *ksnl;
@@ -126,34 +137,81 @@ struct ks_sock
 	struct sock sk;
 };
 
-struct ks_netlink_state
+#define KS_NETLINK_MCAST_HASHSIZE 64
+
+/* Initial room for a single notification, enough for most objects */
+#define KS_NETLINK_MCAST_MSGSIZE 512
+
+struct ks_netlink_mcast_entry
+{
+	struct list_head node;
+	struct hlist_node hash_node;
+
+	int class;
+	int id;
+
+	/* Type of the first notification in the window */
+	enum ks_netlink_message_type first_type;
+
+	/* Latest notification, a single message */
+	struct sk_buff *skb;
+};
+
+/* Reply to the request being processed, shared commands run concurrently
+ * thus each request has its own.
+ */
+struct ks_netlink_reply
 {
-	/* These not need locking as they are accessed only by ksnl thread */
 	struct sk_buff *out_skb;
 
 	int cur_pid;
 	u32 cur_seq;
+};
 
+struct ks_netlink_state
+{
 	struct rw_semaphore topology_lock;
 	wait_queue_head_t lock_sleep;
 	int lock_owner;
 	int lock_depth;
 	struct timer_list lock_timer;
 
+	/* Owner of a transaction broken by the lock timer, its commands are
+	 * refused until it unlocks or locks again.
+	 */
+	int lock_aborted;
+
+	/* Notifications waiting for the next flush, in order of first
+	 * occurrence and hashed by object.
+	 */
+	struct rw_semaphore mcast_sem;
 	int mcast_seqnum;
-	struct sk_buff *mcast_skb;
-	struct sk_buff_head mcast_queue;
+	unsigned long mcast_last_flush;
+	struct list_head mcast_pending;
+	struct hlist_head mcast_pending_hash[KS_NETLINK_MCAST_HASHSIZE];
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+	struct work_struct mcast_work;
+#else
+	struct delayed_work mcast_work;
+#endif
 };
 
 #define KS_CMD_RD		(1 << 0)
 #define KS_CMD_WR		(1 << 1)
 
+/* The handler runs holding the topology lock for reading, concurrently with
+ * other shared commands, and must lock the objects it touches by itself.
+ */
+#define KS_CMD_SHARED		(1 << 2)
+
 struct ks_command
 {
 	enum ks_netlink_message_type message_type;
 
 	int (*handler)(
 		struct ks_netlink_state *state,
+		struct ks_netlink_reply *reply,
 		struct ks_command *cmd,
 		struct nlmsghdr *nlh);
 
@@ -189,24 +247,31 @@ int ks_netlink_put_attr(
 	void *data,
 	int data_len);
 
-int ks_netlink_need_skb(struct ks_netlink_state *state);
-int ks_netlink_mcast_need_skb(struct ks_netlink_state *state);
-void ks_netlink_flush(struct ks_netlink_state *state);
-void ks_netlink_mcast_need_another_skb(struct ks_netlink_state *state);
+int ks_netlink_need_skb(struct ks_netlink_reply *reply);
+void ks_netlink_flush(struct ks_netlink_reply *reply);
+
+void ks_netlink_mcast_schedule(struct ks_netlink_state *state);
+int ks_netlink_mcast_queue(
+	struct ks_netlink_state *state,
+	enum ks_netlink_message_type message_type,
+	int id,
+	struct sk_buff *skb);
 
 void ks_topology_lock(void);
 void ks_topology_unlock(void);
+void ks_netlink_abort_transaction(struct ks_netlink_state *state, u32 pid);
+
 
 int ks_netlink_send_done(
-	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct nlmsghdr *req_nlh,
 	u16 seq);
 int ks_netlink_send_ack(
-	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct nlmsghdr *req_nlh,
 	int flags);
 int ks_netlink_send_error(
-	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct nlmsghdr *req_nlh,
 	int error);
 
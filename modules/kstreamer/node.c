@@ -16,6 +16,7 @@
 #include <linux/fs.h>
 #include <linux/namei.h>
 #include <linux/netlink.h>
+#include <linux/rcupdate.h>
 
 #include "kstreamer.h"
 #include "kstreamer_priv.h"
@@ -27,13 +28,37 @@
 struct kset *ks_nodes_kset;
 EXPORT_SYMBOL(ks_nodes_kset);
 
+#define KS_NODE_HASHBITS	10
+#define KS_NODE_HASHSIZE	(1 << KS_NODE_HASHBITS)
+
+/* The list keeps registration order for dumps, lookups go through the hash.
+ * Both are modified under ks_nodes_list_lock, the hash is also walked
+ * under RCU so the list reference is dropped only after a grace period.
+ */
 static struct list_head ks_nodes_list = LIST_HEAD_INIT(ks_nodes_list);
+static struct hlist_head ks_nodes_hash[KS_NODE_HASHSIZE];
 static rwlock_t ks_nodes_list_lock = RW_LOCK_UNLOCKED;
 
+static inline struct hlist_head *ks_nodes_get_hash(int id)
+{
+	return &ks_nodes_hash[id & (KS_NODE_HASHSIZE - 1)];
+}
+
+/*
+ * The list reference is dropped only after a grace period, lookups under
+ * rcu_read_lock() may still take a reference meanwhile.
+ */
+static void ks_node_put_rcu(struct rcu_head *head)
+{
+	ks_node_put(container_of(head, struct ks_node, rcu));
+}
+
 struct ks_node *_ks_node_search_by_id(int id)
 {
 	struct ks_node *node;
-	list_for_each_entry(node, &ks_nodes_list, node) {
+	struct hlist_node *t;
+
+	hlist_for_each_entry_rcu(node, t, ks_nodes_get_hash(id), hash_node) {
 		if (node->id == id)
 			return node;
 	}
@@ -45,9 +70,9 @@ struct ks_node *ks_node_get_by_id(int id)
 {
 	struct ks_node *node;
 
-	read_lock(&ks_nodes_list_lock);
+	rcu_read_lock();
 	node = ks_node_get(_ks_node_search_by_id(id));
-	read_unlock(&ks_nodes_list_lock);
+	rcu_read_unlock();
 
 	return node;
 }
@@ -222,25 +247,40 @@ static int ks_node_mcast_send(
 	struct ks_netlink_state *state,
 	enum ks_netlink_message_type message_type)
 {
+	struct sk_buff *skb;
+	int size = KS_NETLINK_MCAST_MSGSIZE;
 	int err;
 
-	err = ks_netlink_mcast_need_skb(state);
-	if (err < 0)
-		return err;
-
 retry:
-	err = ks_node_write_to_nlmsg(node, state->mcast_skb, message_type,
-					0,  state->mcast_seqnum++, 0);
+	skb = alloc_skb(size, GFP_KERNEL);
+	if (!skb) {
+		err = -ENOMEM;
+		goto err_alloc_skb;
+	}
+
+	err = ks_node_write_to_nlmsg(node, skb, message_type, 0, 0, 0);
 	if (err < 0) {
-		ks_netlink_mcast_need_another_skb(state);
-		goto retry;
+		kfree_skb(skb);
+
+		if (size < NLMSG_GOODSIZE) {
+			size = NLMSG_GOODSIZE;
+			goto retry;
+		}
+
+		goto err_write_to_nlmsg;
 	}
 
-	return 0;
+	return ks_netlink_mcast_queue(state, message_type, node->id, skb);
+
+err_write_to_nlmsg:
+err_alloc_skb:
+
+	return err;
 }
 
 int ks_node_cmd_get(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -248,7 +288,7 @@ int ks_node_cmd_get(
 	struct ks_node *node;
 	int cnt = 1;
 
-	ks_netlink_send_ack(state, nlh, NLM_F_MULTI);
+	ks_netlink_send_ack(reply, nlh, NLM_F_MULTI);
   
 	/* No need to read_lock(&ks_nodes_list_lock); because we are also
 	 * protected by ks_topology_lock semaphore.
@@ -257,25 +297,25 @@ int ks_node_cmd_get(
 	list_for_each_entry(node, &ks_nodes_list, node) {
 
 retry:
-		ks_netlink_need_skb(state);
-		if (!state->out_skb)
+		ks_netlink_need_skb(reply);
+		if (!reply->out_skb)
 			return -ENOMEM;
 
 		err = ks_node_write_to_nlmsg(node,
-					state->out_skb,
+					reply->out_skb,
 					KS_NETLINK_NODE_NEW,
 					nlh->nlmsg_pid,
 					nlh->nlmsg_seq + cnt,
 					NLM_F_MULTI);
 		if (err < 0) {
-			ks_netlink_flush(state);
+			ks_netlink_flush(reply);
 			goto retry;
 		}
 
 		cnt++;
 	}
 
-	ks_netlink_send_done(state, nlh, cnt);
+	ks_netlink_send_done(reply, nlh, cnt);
 
 	return 0;
 }
@@ -289,6 +329,7 @@ int ks_node_register_no_topology_lock(struct ks_node *node)
 	write_lock(&ks_nodes_list_lock);
 	node->id = _ks_node_new_id();
 	list_add_tail(&ks_node_get(node)->node, &ks_nodes_list);
+	hlist_add_head_rcu(&node->hash_node, ks_nodes_get_hash(node->id));
 	write_unlock(&ks_nodes_list_lock);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,25)
@@ -326,8 +367,9 @@ int ks_node_register_no_topology_lock(struct ks_node *node)
 err_kobject_add:
 	write_lock(&ks_nodes_list_lock);
 	list_del(&node->node);
+	hlist_del_rcu(&node->hash_node);
 	write_unlock(&ks_nodes_list_lock);
-	ks_node_put(node);
+	call_rcu(&node->rcu, ks_node_put_rcu);
 
 	return err;
 }
@@ -350,8 +392,9 @@ void ks_node_unregister_no_topology_lock(struct ks_node *node)
 
 	write_lock(&ks_nodes_list_lock);
 	list_del(&node->node);
+	hlist_del_rcu(&node->hash_node);
 	write_unlock(&ks_nodes_list_lock);
-	ks_node_put(node);
+	call_rcu(&node->rcu, ks_node_put_rcu);
 
 	ks_node_mcast_send(node, &ks_netlink_state, KS_NETLINK_NODE_DEL);
 }
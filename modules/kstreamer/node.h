@@ -79,6 +79,8 @@ struct ks_node
 {
 	struct kobject kobj;
 	struct list_head node;
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
 
 	int id;
 
@@ -117,6 +119,7 @@ extern void ks_node_destroy(struct ks_node *node);
 
 int ks_node_cmd_get(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh);
 
@@ -14,24 +14,54 @@
 #include <linux/module.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 
 #include "kstreamer.h"
 #include "kstreamer_priv.h"
 #include "node.h"
 #include "channel.h"
 #include "pipeline.h"
+#include "feature.h"
+#include "tick.h"
 
 rwlock_t ks_connection_lock = RW_LOCK_UNLOCKED;
 
 struct kset *ks_pipelines_kset;
 
+#define KS_PIPELINE_HASHBITS	10
+#define KS_PIPELINE_HASHSIZE	(1 << KS_PIPELINE_HASHBITS)
+
+/* The list keeps registration order for dumps, lookups go through the hash.
+ * Both are modified under ks_pipelines_list_lock, the hash is also walked
+ * under RCU so the list reference is dropped only after a grace period.
+ */
 static struct list_head ks_pipelines_list = LIST_HEAD_INIT(ks_pipelines_list);
+static struct hlist_head ks_pipelines_hash[KS_PIPELINE_HASHSIZE];
 static rwlock_t ks_pipelines_list_lock = RW_LOCK_UNLOCKED;
 
+static inline struct hlist_head *ks_pipelines_get_hash(int id)
+{
+	return &ks_pipelines_hash[id & (KS_PIPELINE_HASHSIZE - 1)];
+}
+
+/*
+ * The list reference is dropped only after a grace period, lookups under
+ * rcu_read_lock() may still take a reference meanwhile.
+ */
+static void ks_pipeline_put_rcu(struct rcu_head *head)
+{
+	ks_pipeline_put(container_of(head, struct ks_pipeline, rcu));
+}
+
 struct ks_pipeline *_ks_pipeline_search_by_id(int id)
 {
 	struct ks_pipeline *pipeline;
-	list_for_each_entry(pipeline, &ks_pipelines_list, node) {
+	struct hlist_node *t;
+
+	hlist_for_each_entry_rcu(pipeline, t, ks_pipelines_get_hash(id),
+								hash_node) {
 		if (pipeline->id == id)
 			return pipeline;
 	}
@@ -43,9 +73,9 @@ struct ks_pipeline *ks_pipeline_get_by_id(int id)
 {
 	struct ks_pipeline *pipeline;
 
-	read_lock(&ks_pipelines_list_lock);
+	rcu_read_lock();
 	pipeline = ks_pipeline_get(_ks_pipeline_search_by_id(id));
-	read_unlock(&ks_pipelines_list_lock);
+	rcu_read_unlock();
 
 	return pipeline;
 }
@@ -146,6 +176,17 @@ int ks_pipeline_write_to_nlmsg(
 		if (err < 0)
 			goto err_put_attr;
 
+		if (pipeline->owner) {
+			u32 non_persistent = 1;
+
+			err = ks_netlink_put_attr(skb,
+					KS_PIPELINEATTR_NON_PERSISTENT,
+					&non_persistent,
+					sizeof(non_persistent));
+			if (err < 0)
+				goto err_put_attr;
+		}
+
 		err = ks_netlink_put_attr_path(skb, KS_PIPELINEATTR_PATH,
 						&pipeline->kobj);
 		if (err < 0)
@@ -185,49 +226,109 @@ static int ks_pipeline_mcast_send(
 	struct ks_netlink_state *state,
 	enum ks_netlink_message_type message_type)
 {
+	struct sk_buff *skb;
+	int size = KS_NETLINK_MCAST_MSGSIZE;
 	int err;
 
-	err = ks_netlink_mcast_need_skb(state);
-	if (err < 0)
-		return err;
-
 retry:
-	err = ks_pipeline_write_to_nlmsg(pipeline, state->mcast_skb,
-			message_type, 0, state->mcast_seqnum++, 0);
+	skb = alloc_skb(size, GFP_KERNEL);
+	if (!skb) {
+		err = -ENOMEM;
+		goto err_alloc_skb;
+	}
+
+	err = ks_pipeline_write_to_nlmsg(pipeline, skb, message_type, 0, 0, 0);
 	if (err < 0) {
-		ks_netlink_mcast_need_another_skb(state);
-		goto retry;
+		kfree_skb(skb);
+
+		if (size < NLMSG_GOODSIZE) {
+			size = NLMSG_GOODSIZE;
+			goto retry;
+		}
+
+		goto err_write_to_nlmsg;
 	}
 
-	return 0;
+	return ks_netlink_mcast_queue(state, message_type, pipeline->id, skb);
+
+err_write_to_nlmsg:
+err_alloc_skb:
+
+	return err;
 }
 
 static int ks_pipeline_netlink_respond(
 	struct ks_pipeline *pipeline,
-	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct nlmsghdr *req_nlh,
 	enum ks_netlink_message_type message_type)
 {
 	int err;
 
 retry:
-	ks_netlink_need_skb(state);
-	if (!state->out_skb)
+	ks_netlink_need_skb(reply);
+	if (!reply->out_skb)
 		return -ENOMEM;
 
-	err = ks_pipeline_write_to_nlmsg(pipeline, state->out_skb,
+	err = ks_pipeline_write_to_nlmsg(pipeline, reply->out_skb,
 				message_type,
 				req_nlh->nlmsg_pid,
 				req_nlh->nlmsg_seq,
 				NLM_F_ACK);
 	if (err < 0) {
-		ks_netlink_flush(state);
+		ks_netlink_flush(reply);
 		goto retry;
 	}
 
 	return 0;
 }
 
+/*
+ * Sets the feature values carried by a PIPELINE_SETUP message on the
+ * chans, each applies to the chan whose CHAN_ID precedes it. Chans are in
+ * the pipeline in the same order as in the message. Pipeline attributes
+ * are skipped, they have been parsed by ks_pipeline_create_from_nlmsg().
+ */
+static int ks_pipeline_set_chan_attrs_from_nlmsg(
+	struct ks_pipeline *pipeline,
+	struct nlmsghdr *nlh)
+{
+	struct ks_attr *attr;
+	int attrs_len = KS_PAYLOAD(nlh);
+	struct list_head *pos = &pipeline->entries;
+	int err;
+
+	for (attr = KS_ATTRS(nlh);
+	     KS_ATTR_OK(attr, attrs_len);
+	     attr = KS_ATTR_NEXT(attr, attrs_len)) {
+		switch(attr->type) {
+		case KS_PIPELINEATTR_ID:
+		case KS_PIPELINEATTR_PATH:
+		case KS_PIPELINEATTR_STATUS:
+		case KS_PIPELINEATTR_NON_PERSISTENT:
+		break;
+
+		case KS_PIPELINEATTR_CHAN_ID:
+			pos = pos->next;
+		break;
+
+		default:
+			if (attr->type < KS_FEATURE_ID_MIN ||
+			    pos == &pipeline->entries)
+				return -EINVAL;
+
+			err = ks_chan_set_attr(
+				list_entry(pos, struct ks_chan, pipeline_entry),
+				attr);
+			if (err < 0)
+				return err;
+		break;
+		}
+	}
+
+	return 0;
+}
+
 struct ks_pipeline *ks_pipeline_create_from_nlmsg(
 	struct nlmsghdr *nlh, int *errp)
 {
@@ -235,6 +336,7 @@ struct ks_pipeline *ks_pipeline_create_from_nlmsg(
 	struct ks_attr *attr;
 	int attrs_len = KS_PAYLOAD(nlh);
 	enum ks_pipeline_status status = KS_PIPELINE_STATUS_NULL;
+	int setup = (nlh->nlmsg_type == KS_NETLINK_PIPELINE_SETUP);
 	int err;
 
 	pipeline = ks_pipeline_create(NULL);
@@ -251,6 +353,11 @@ struct ks_pipeline *ks_pipeline_create_from_nlmsg(
 			status = *(__u32 *)KS_ATTR_DATA(attr);
 		break;
 
+		case KS_PIPELINEATTR_NON_PERSISTENT:
+			if (*(__u32 *)KS_ATTR_DATA(attr))
+				pipeline->owner = nlh->nlmsg_pid;
+		break;
+
 		case KS_PIPELINEATTR_CHAN_ID: {
 			struct ks_chan *chan;
 
@@ -266,13 +373,15 @@ struct ks_pipeline *ks_pipeline_create_from_nlmsg(
 				goto err_chan_not_found;
 			}
 
+			/* Concurrent creations may race for the same chan */
+			write_lock_bh(&ks_connection_lock);
 			if (chan->pipeline) {
+				write_unlock_bh(&ks_connection_lock);
 				err = -EBUSY;
 				ks_chan_put(chan);
 				goto err_chan_is_busy;
 			}
 
-			write_lock_bh(&ks_connection_lock);
 			chan->pipeline = ks_pipeline_get(pipeline);
 
 			list_add_tail(
@@ -285,6 +394,10 @@ struct ks_pipeline *ks_pipeline_create_from_nlmsg(
 		break;
 
 		default:
+			/* Feature value for the preceding chan */
+			if (setup && !list_empty(&pipeline->entries))
+				break;
+
 			ks_msg(KERN_WARNING, "Unexpected attribute %d\n",
 					attr->type);
 
@@ -297,12 +410,26 @@ struct ks_pipeline *ks_pipeline_create_from_nlmsg(
 	if (status == KS_PIPELINE_STATUS_NULL)
 		status = KS_PIPELINE_STATUS_CONNECTED;
 
+	if (setup) {
+		err = ks_pipeline_change_status(pipeline,
+					KS_PIPELINE_STATUS_CONNECTED);
+		if (err < 0)
+			goto err_invalid_status;
+
+		err = ks_pipeline_set_chan_attrs_from_nlmsg(pipeline, nlh);
+		if (err < 0)
+			goto err_change_status;
+	}
+
 	err = ks_pipeline_change_status(pipeline, status);
 	if (err < 0)
-		goto err_invalid_status;
+		goto err_change_status;
 
 	return pipeline;
 
+err_change_status:
+	/* Properly disconnect whatever has been connected */
+	ks_pipeline_change_status(pipeline, KS_PIPELINE_STATUS_NULL);
 err_unexpected_attribute:
 err_chan_is_busy:
 err_chan_not_found:
@@ -354,6 +481,11 @@ int ks_pipeline_update_from_nlsmsg(
 			status = *(__u32 *)KS_ATTR_DATA(attr);
 		break;
 
+		case KS_PIPELINEATTR_NON_PERSISTENT:
+			if (*(__u32 *)KS_ATTR_DATA(attr))
+				pipeline->owner = nlh->nlmsg_pid;
+		break;
+
 		default:
 			ks_msg(KERN_WARNING, "Unexpected attribute %d\n",
 					attr->type);
@@ -380,6 +512,7 @@ static int ks_pipeline_register_no_topology_lock(struct ks_pipeline *pipeline);
 
 int ks_pipeline_cmd_new(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -397,7 +530,7 @@ int ks_pipeline_cmd_new(
 	if (err < 0)
 		goto err_pipeline_register;
 
-	ks_pipeline_netlink_respond(pipeline, state, nlh,
+	ks_pipeline_netlink_respond(pipeline, reply, nlh,
 					KS_NETLINK_PIPELINE_NEW);
 
 	ks_pipeline_put(pipeline);
@@ -417,6 +550,7 @@ err_pipeline_create:
 
 int ks_pipeline_cmd_del(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -434,7 +568,7 @@ int ks_pipeline_cmd_del(
 
 	ks_pipeline_unregister_no_topology_lock(pipeline);
 
-	ks_pipeline_netlink_respond(pipeline, state, nlh,
+	ks_pipeline_netlink_respond(pipeline, reply, nlh,
 					KS_NETLINK_PIPELINE_DEL);
 
 	ks_pipeline_put(pipeline);
@@ -449,6 +583,7 @@ err_pipeline_get:
 
 int ks_pipeline_cmd_set(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -465,7 +600,7 @@ int ks_pipeline_cmd_set(
 	if (err < 0)
 		goto err_pipeline_update;
 
-	ks_pipeline_netlink_respond(pipeline, state, nlh,
+	ks_pipeline_netlink_respond(pipeline, reply, nlh,
 					KS_NETLINK_PIPELINE_SET);
 
 	ks_pipeline_put(pipeline);
@@ -481,6 +616,7 @@ err_pipeline_get:
 
 int ks_pipeline_cmd_get(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh)
 {
@@ -488,7 +624,7 @@ int ks_pipeline_cmd_get(
 	struct ks_pipeline *pipeline;
 	int cnt = 1;
   
-	ks_netlink_send_ack(state, nlh, NLM_F_MULTI);
+	ks_netlink_send_ack(reply, nlh, NLM_F_MULTI);
 
 	/* No need to read_lock(&ks_pipelines_list_lock); because we are also
 	 * protected by ks_topology_lock semaphore.
@@ -497,24 +633,24 @@ int ks_pipeline_cmd_get(
 	list_for_each_entry(pipeline, &ks_pipelines_list, node) {
 
 retry:
-		ks_netlink_need_skb(state);
-		if (!state->out_skb)
+		ks_netlink_need_skb(reply);
+		if (!reply->out_skb)
 			return -ENOMEM;
 
-		err = ks_pipeline_write_to_nlmsg(pipeline, state->out_skb,
+		err = ks_pipeline_write_to_nlmsg(pipeline, reply->out_skb,
 					KS_NETLINK_PIPELINE_NEW,
 					nlh->nlmsg_pid,
 					nlh->nlmsg_seq + cnt,
 					NLM_F_MULTI);
 		if (err < 0) {
-			ks_netlink_flush(state);
+			ks_netlink_flush(reply);
 			goto retry;
 		}
 
 		cnt++;
 	}
 
-	ks_netlink_send_done(state, nlh, cnt);
+	ks_netlink_send_done(reply, nlh, cnt);
 
 	return 0;
 }
@@ -651,8 +787,11 @@ struct ks_pipeline *ks_pipeline_create(struct ks_pipeline *pipeline)
 
 	pipeline->kobj.kset = kset_get(ks_pipelines_kset);
 
+	INIT_LIST_HEAD(&pipeline->node);
 	INIT_LIST_HEAD(&pipeline->entries);
 
+	mutex_init(&pipeline->status_mutex);
+
 	pipeline->status = KS_PIPELINE_STATUS_NULL;
 
 	return pipeline;
@@ -667,6 +806,8 @@ static int ks_pipeline_register_no_topology_lock(struct ks_pipeline *pipeline)
 	write_lock(&ks_pipelines_list_lock);
 	pipeline->id = _ks_pipeline_new_id();
 	list_add_tail(&ks_pipeline_get(pipeline)->node, &ks_pipelines_list);
+	hlist_add_head_rcu(&pipeline->hash_node,
+			ks_pipelines_get_hash(pipeline->id));
 	write_unlock(&ks_pipelines_list_lock);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,25)
@@ -689,9 +830,10 @@ static int ks_pipeline_register_no_topology_lock(struct ks_pipeline *pipeline)
 	kobject_del(&pipeline->kobj);
 err_kobject_add:
 	write_lock(&ks_pipelines_list_lock);
-	list_del(&pipeline->node);
+	list_del_init(&pipeline->node);
+	hlist_del_rcu(&pipeline->hash_node);
 	write_unlock(&ks_pipelines_list_lock);
-	ks_pipeline_put(pipeline);
+	call_rcu(&pipeline->rcu, ks_pipeline_put_rcu);
 
 	return err;
 }
@@ -711,14 +853,22 @@ int ks_pipeline_register(struct ks_pipeline *pipeline)
 
 void ks_pipeline_unregister_no_topology_lock(struct ks_pipeline *pipeline)
 {
+	/* Only the first of concurrent unregistrations goes on */
+	write_lock(&ks_pipelines_list_lock);
+	if (list_empty(&pipeline->node)) {
+		write_unlock(&ks_pipelines_list_lock);
+		return;
+	}
+
+	list_del_init(&pipeline->node);
+	hlist_del_rcu(&pipeline->hash_node);
+	write_unlock(&ks_pipelines_list_lock);
+
 	ks_pipeline_change_status(pipeline, KS_PIPELINE_STATUS_NULL);
 
 	kobject_del(&pipeline->kobj);
 
-	write_lock(&ks_pipelines_list_lock);
-	list_del(&pipeline->node);
-	write_unlock(&ks_pipelines_list_lock);
-	ks_pipeline_put(pipeline);
+	call_rcu(&pipeline->rcu, ks_pipeline_put_rcu);
 
 	ks_pipeline_mcast_send(pipeline, &ks_netlink_state,
 					KS_NETLINK_PIPELINE_DEL);
@@ -732,6 +882,165 @@ void ks_pipeline_unregister(struct ks_pipeline *pipeline)
 }
 //EXPORT_SYMBOL(ks_pipeline_unregister);
 
+/*
+ * Non-persistent pipelines of released netlink ports are reclaimed
+ * asynchronously in batches: a single grace period covers all the
+ * pipelines of a batch and the topology lock is held for writing only
+ * while they are unhashed.
+ */
+
+#define KS_PIPELINE_RECLAIM_BATCH 32
+
+static int ks_pipeline_clear_hops(struct ks_pipeline *pipeline);
+
+struct ks_pipeline_released_owner
+{
+	struct list_head node;
+	u32 owner;
+};
+
+static LIST_HEAD(ks_pipeline_released_owners);
+static DEFINE_SPINLOCK(ks_pipeline_released_owners_lock);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+static void ks_pipeline_reclaim_work_func(void *data);
+static DECLARE_WORK(ks_pipeline_reclaim_work,
+			ks_pipeline_reclaim_work_func, NULL);
+#else
+static void ks_pipeline_reclaim_work_func(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ks_pipeline_reclaim_work,
+			ks_pipeline_reclaim_work_func);
+#endif
+
+static int ks_pipeline_owner_released(
+	struct list_head *owners,
+	u32 owner)
+{
+	struct ks_pipeline_released_owner *ro;
+
+	list_for_each_entry(ro, owners, node) {
+		if (ro->owner == owner)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+static void ks_pipeline_reclaim_work_func(void *data)
+#else
+static void ks_pipeline_reclaim_work_func(struct work_struct *work)
+#endif
+{
+	struct ks_pipeline *batch[KS_PIPELINE_RECLAIM_BATCH];
+	struct ks_pipeline_released_owner *ro, *t;
+	struct ks_pipeline *pipeline, *t2;
+	LIST_HEAD(owners);
+	int more = FALSE;
+	int n = 0;
+	int i;
+
+	down_write(&ks_netlink_state.topology_lock);
+
+	spin_lock_bh(&ks_pipeline_released_owners_lock);
+	list_splice_init(&ks_pipeline_released_owners, &owners);
+	spin_unlock_bh(&ks_pipeline_released_owners_lock);
+
+	/* A dead owner will never end its transaction */
+	list_for_each_entry(ro, &owners, node)
+		ks_netlink_abort_transaction(&ks_netlink_state, ro->owner);
+
+	/* Do not change the topology under a live transaction */
+	if (ks_netlink_state.lock_owner) {
+		up_write(&ks_netlink_state.topology_lock);
+		goto requeue;
+	}
+
+	write_lock(&ks_pipelines_list_lock);
+	list_for_each_entry_safe(pipeline, t2, &ks_pipelines_list, node) {
+		if (!pipeline->owner ||
+		    !ks_pipeline_owner_released(&owners, pipeline->owner))
+			continue;
+
+		if (n == KS_PIPELINE_RECLAIM_BATCH) {
+			more = TRUE;
+			break;
+		}
+
+		/* The list reference passes to the batch */
+		list_del_init(&pipeline->node);
+		hlist_del_rcu(&pipeline->hash_node);
+		batch[n++] = pipeline;
+	}
+	write_unlock(&ks_pipelines_list_lock);
+
+	for (i=0; i<n; i++)
+		ks_pipeline_clear_hops(batch[i]);
+
+	/* Concurrent commands may proceed, chans cannot go away */
+	downgrade_write(&ks_netlink_state.topology_lock);
+
+	/* Covers both the hash removal and the hops */
+	if (n)
+		synchronize_rcu();
+
+	for (i=0; i<n; i++) {
+		ks_pipeline_change_status(batch[i], KS_PIPELINE_STATUS_NULL);
+
+		kobject_del(&batch[i]->kobj);
+
+		ks_pipeline_mcast_send(batch[i], &ks_netlink_state,
+						KS_NETLINK_PIPELINE_DEL);
+
+		ks_pipeline_put(batch[i]);
+	}
+
+	up_read(&ks_netlink_state.topology_lock);
+
+	ks_netlink_mcast_schedule(&ks_netlink_state);
+
+	if (n)
+		ks_debug(1, "Reclaimed %d non-persistent pipelines\n", n);
+
+	if (more)
+		goto requeue;
+
+	list_for_each_entry_safe(ro, t, &owners, node) {
+		list_del(&ro->node);
+		kfree(ro);
+	}
+
+	return;
+
+requeue:
+	spin_lock_bh(&ks_pipeline_released_owners_lock);
+	list_splice(&owners, &ks_pipeline_released_owners);
+	spin_unlock_bh(&ks_pipeline_released_owners_lock);
+
+	schedule_delayed_work(&ks_pipeline_reclaim_work, more ? 0 : HZ / 10);
+}
+
+/* May be called in atomic context */
+void ks_pipeline_reclaim_owner(u32 owner)
+{
+	struct ks_pipeline_released_owner *ro;
+
+	ro = kmalloc(sizeof(*ro), GFP_ATOMIC);
+	if (!ro) {
+		ks_msg(KERN_ERR,
+			"Cannot reclaim pipelines of port %u\n", owner);
+		return;
+	}
+
+	ro->owner = owner;
+
+	spin_lock_bh(&ks_pipeline_released_owners_lock);
+	list_add_tail(&ro->node, &ks_pipeline_released_owners);
+	spin_unlock_bh(&ks_pipeline_released_owners_lock);
+
+	schedule_delayed_work(&ks_pipeline_reclaim_work, 0);
+}
+
 void ks_pipeline_destroy(struct ks_pipeline *pipeline)
 {
 	ks_kobj_waitref(&pipeline->kobj);
@@ -979,6 +1288,63 @@ failed:
 
 /* -------------------------- OPEN <=> FLOWING -----------------------------*/
 
+/*
+ * Caches each chan's neighbours so that the data path does not need to
+ * walk the pipeline entries. The ops pointers are written before the
+ * chan pointers are published and are never cleared, so a reader seeing
+ * a non-NULL hop always finds valid ops.
+ */
+static void ks_pipeline_publish_hops(struct ks_pipeline *pipeline)
+{
+	struct ks_chan *chan;
+	struct ks_chan *prev_chan = NULL;
+
+	read_lock_bh(&ks_connection_lock);
+	list_for_each_entry(chan, &pipeline->entries, pipeline_entry) {
+
+		if (prev_chan) {
+			prev_chan->next_hop_ops = chan->from_ops;
+			rcu_assign_pointer(prev_chan->next_hop, chan);
+
+			chan->prev_hop_ops = prev_chan->to_ops;
+			rcu_assign_pointer(chan->prev_hop, prev_chan);
+		}
+
+		prev_chan = chan;
+	}
+	read_unlock_bh(&ks_connection_lock);
+}
+
+/* Returns nonzero if any hop was published */
+static int ks_pipeline_clear_hops(struct ks_pipeline *pipeline)
+{
+	struct ks_chan *chan;
+	int published = FALSE;
+
+	read_lock_bh(&ks_connection_lock);
+	list_for_each_entry(chan, &pipeline->entries, pipeline_entry) {
+		if (chan->next_hop || chan->prev_hop)
+			published = TRUE;
+
+		rcu_assign_pointer(chan->next_hop, NULL);
+		rcu_assign_pointer(chan->prev_hop, NULL);
+
+		chan->stimulus_time = 0;
+	}
+	read_unlock_bh(&ks_connection_lock);
+
+	return published;
+}
+
+static void ks_pipeline_unpublish_hops(struct ks_pipeline *pipeline)
+{
+	/* Nobody must be pushing through the old hops when we stop chans,
+	 * the grace period may have been waited already by the reclaimer.
+	 */
+	if (ks_pipeline_clear_hops(pipeline))
+		synchronize_rcu();
+}
+
 static void ks_pipeline_flowing_to_open(
 	struct ks_pipeline *pipeline,
 	struct ks_chan *stop_at)
@@ -986,6 +1352,10 @@ static void ks_pipeline_flowing_to_open(
 	struct ks_chan *chan;
 	struct ks_chan *prev_chan = NULL;
 
+	ks_tick_del(pipeline);
+
+	ks_pipeline_unpublish_hops(pipeline);
+
 	read_lock_bh(&ks_connection_lock);
 	list_for_each_entry(chan, &pipeline->entries, pipeline_entry) {
 
@@ -1014,6 +1384,26 @@ done:
 	ks_pipeline_set_status(pipeline, KS_PIPELINE_STATUS_OPEN);
 }
 
+/* Only pipelines with a chan asking for it are ticked, the others are
+ * driven by their hardware.
+ */
+static int ks_pipeline_needs_tick(struct ks_pipeline *pipeline)
+{
+	struct ks_chan *chan;
+	int needs_tick = FALSE;
+
+	read_lock_bh(&ks_connection_lock);
+	list_for_each_entry(chan, &pipeline->entries, pipeline_entry) {
+		if (chan->needs_tick) {
+			needs_tick = TRUE;
+			break;
+		}
+	}
+	read_unlock_bh(&ks_connection_lock);
+
+	return needs_tick;
+}
+
 static int ks_pipeline_open_to_flowing(struct ks_pipeline *pipeline)
 {
 	struct ks_chan *chan;
@@ -1052,8 +1442,13 @@ static int ks_pipeline_open_to_flowing(struct ks_pipeline *pipeline)
 		prev_chan->to->ops->start(
 			prev_chan->to, NULL, chan);
 
+	ks_pipeline_publish_hops(pipeline);
+
 	ks_pipeline_set_status(pipeline, KS_PIPELINE_STATUS_FLOWING);
 
+	if (ks_pipeline_needs_tick(pipeline))
+		ks_tick_add(pipeline);
+
 	return 0;
 
 failed:
@@ -1063,7 +1458,7 @@ failed:
 	return err;
 }
 
-int ks_pipeline_change_status(
+static int __ks_pipeline_change_status(
 	struct ks_pipeline *pipeline,
 	enum ks_pipeline_status status)
 {
@@ -1185,16 +1580,35 @@ failed:
 
 	return err;
 }
+
+int ks_pipeline_change_status(
+	struct ks_pipeline *pipeline,
+	enum ks_pipeline_status status)
+{
+	int err;
+
+	mutex_lock(&pipeline->status_mutex);
+	err = __ks_pipeline_change_status(pipeline, status);
+	mutex_unlock(&pipeline->status_mutex);
+
+	return err;
+}
 EXPORT_SYMBOL(ks_pipeline_change_status);
 
 void ks_pipeline_stimulate(struct ks_pipeline *pipeline)
 {
 	struct ks_chan *chan;
 	struct ks_chan *prev_chan = NULL;
+	u64 now = ktime_to_ns(ktime_get());
 
 	read_lock_bh(&ks_connection_lock);
 	list_for_each_entry(chan, &pipeline->entries, pipeline_entry) {
 
+		/* Latency is only measured on stimulated pipelines, frames
+		 * of event driven chans have no reference to compare with.
+		 */
+		chan->stimulus_time = now;
+
 		if (chan->ops->stimulus)
 			chan->ops->stimulus(chan);
 
@@ -1299,5 +1713,15 @@ err_kset_register:
 
 void ks_pipeline_modexit()
 {
+	struct ks_pipeline_released_owner *ro, *t;
+
+	cancel_delayed_work(&ks_pipeline_reclaim_work);
+	flush_scheduled_work();
+
+	list_for_each_entry_safe(ro, t, &ks_pipeline_released_owners, node) {
+		list_del(&ro->node);
+		kfree(ro);
+	}
+
 	kset_unregister(ks_pipelines_kset);
 }
@@ -21,6 +21,7 @@ enum ks_pipeline_attribute_type
 	KS_PIPELINEATTR_PATH,
 	KS_PIPELINEATTR_STATUS,
 	KS_PIPELINEATTR_CHAN_ID,
+	KS_PIPELINEATTR_NON_PERSISTENT,
 };
 
 enum ks_pipeline_status
@@ -36,7 +37,7 @@ enum ks_pipeline_status
 #include <linux/kobject.h>
 #include <linux/list.h>
 #include <linux/rcupdate.h>
-#include <linux/rwsem.h>
+#include <linux/mutex.h>
 
 extern rwlock_t ks_connection_lock;
 
@@ -44,14 +45,27 @@ struct ks_pipeline
 {
 	struct kobject kobj;
 	struct list_head node;
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
 
 	int id;
 
+	/* Serializes status changes, netlink commands on different
+	 * pipelines run concurrently
+	 */
+	struct mutex status_mutex;
 	enum ks_pipeline_status status;
 
 	struct list_head entries;
 
-	struct file *file;
+	/* Entry in the tick engine while FLOWING, if an endpoint needs it */
+	struct list_head tick_node;
+	int ticked;
+
+	/* Netlink port of the creator of a non-persistent pipeline, which is
+	 * reclaimed when the port is released. 0 for persistent pipelines.
+	 */
+	u32 owner;
 
 	int mtu;
 
@@ -84,6 +98,7 @@ extern void ks_pipeline_destroy(struct ks_pipeline *pipeline);
 
 void ks_pipeline_unregister_no_topology_lock(struct ks_pipeline *pipeline);
 void ks_pipeline_unregister(struct ks_pipeline *pipeline);
+void ks_pipeline_reclaim_owner(u32 owner);
 
 struct ks_pipeline *ks_pipeline_get_by_id(int id);
 
@@ -105,18 +120,22 @@ void ks_pipeline_dump(struct ks_pipeline *pipeline);
 
 int ks_pipeline_cmd_new(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh);
 int ks_pipeline_cmd_del(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh);
 int ks_pipeline_cmd_set(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh);
 int ks_pipeline_cmd_get(
 	struct ks_netlink_state *state,
+	struct ks_netlink_reply *reply,
 	struct ks_command *cmd,
 	struct nlmsghdr *nlh);
 
@@ -12,21 +12,361 @@
 
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/device.h>
 
+#include <kernel_config.h>
+
+#include "kstreamer.h"
+#include "kstreamer_priv.h"
 #include "streamframe.h"
 
-struct ks_streamframe *ks_sf_alloc(void)
+/* Number of free frames kept on each CPU for each size class */
+#define KS_SF_POOL_DEPTH	32
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+typedef kmem_cache_t ks_sf_cache_t;
+#else
+typedef struct kmem_cache ks_sf_cache_t;
+#endif
+
+struct ks_sf_class
 {
-	struct ks_streamframe *sf;
+	const char *name;
+	int size;
 
-	sf = kmalloc(1024, GFP_ATOMIC);
-	if (!sf)
-		return NULL;
+	ks_sf_cache_t *cache;
+};
+
+#define KS_SF_NCLASSES 3
+
+static struct ks_sf_class ks_sf_classes[KS_SF_NCLASSES] =
+{
+	{ "ks_streamframe_64", 64 },
+	{ "ks_streamframe_256", 256 },
+	{ "ks_streamframe_1024", 1024 },
+};
+
+/* Clones only need the header, they are not pooled */
+#define KS_SF_POOL_CLONE	0xff
+
+static ks_sf_cache_t *ks_sf_clone_cache;
+
+struct ks_sf_pool
+{
+	struct ks_streamframe *frames[KS_SF_POOL_DEPTH];
+	int count;
+
+	unsigned long hits;
+	unsigned long misses;
+};
+
+static DEFINE_PER_CPU(struct ks_sf_pool, ks_sf_pools[KS_SF_NCLASSES]);
+
+static int ks_sf_class_by_size(int size)
+{
+	int i;
+
+	for (i=0; i<KS_SF_NCLASSES - 1; i++) {
+		if (size <= ks_sf_classes[i].size)
+			return i;
+	}
+
+	return KS_SF_NCLASSES - 1;
+}
+
+/*
+ * Allocates a streamframe with at least 'size' octets of payload if
+ * possible. The biggest class is returned when 'size' exceeds it, so the
+ * caller must always respect sf->size.
+ */
+struct ks_streamframe *ks_sf_alloc(int size)
+{
+	struct ks_streamframe *sf = NULL;
+	struct ks_sf_pool *pool;
+	unsigned long flags;
+	int cls;
+
+	cls = ks_sf_class_by_size(size);
+
+	local_irq_save(flags);
+	pool = &per_cpu(ks_sf_pools, smp_processor_id())[cls];
+
+	if (pool->count) {
+		sf = pool->frames[--pool->count];
+		pool->hits++;
+	} else
+		pool->misses++;
+	local_irq_restore(flags);
+
+	if (!sf) {
+		sf = kmem_cache_alloc(ks_sf_classes[cls].cache, GFP_ATOMIC);
+		if (!sf)
+			return NULL;
+	}
 
 	atomic_set(&sf->refcnt, 1);
-	sf->size = 1024 - sizeof(*sf);
+	sf->pool = cls;
+	sf->shared = NULL;
+	sf->head = sf->buf;
+	sf->data = sf->buf + KS_SF_HEADROOM;
+	sf->size = ks_sf_classes[cls].size;
 	sf->len = 0;
 
 	return sf;
 }
 EXPORT_SYMBOL(ks_sf_alloc);
+
+void ks_sf_free(struct ks_streamframe *sf)
+{
+	struct ks_sf_pool *pool;
+	unsigned long flags;
+
+	if (sf->pool == KS_SF_POOL_CLONE) {
+		ks_sf_put(sf->shared);
+		kmem_cache_free(ks_sf_clone_cache, sf);
+
+		return;
+	}
+
+	BUG_ON(sf->pool >= KS_SF_NCLASSES);
+
+	local_irq_save(flags);
+	pool = &per_cpu(ks_sf_pools, smp_processor_id())[sf->pool];
+
+	if (pool->count < KS_SF_POOL_DEPTH) {
+		pool->frames[pool->count++] = sf;
+		sf = NULL;
+	}
+	local_irq_restore(flags);
+
+	if (sf)
+		kmem_cache_free(ks_sf_classes[sf->pool].cache, sf);
+}
+EXPORT_SYMBOL(ks_sf_free);
+
+/*
+ * Returns a new frame sharing the payload of 'sf'. The clone has its own
+ * data/len so it may be pulled or trimmed independently, e.g. to fan the
+ * same audio out to several consumers.
+ */
+struct ks_streamframe *ks_sf_clone(struct ks_streamframe *sf)
+{
+	struct ks_streamframe *clone;
+
+	clone = kmem_cache_alloc(ks_sf_clone_cache, GFP_ATOMIC);
+	if (!clone)
+		return NULL;
+
+	atomic_set(&clone->refcnt, 1);
+	clone->pool = KS_SF_POOL_CLONE;
+	clone->shared = ks_sf_get(sf->shared ? sf->shared : sf);
+	clone->head = sf->head;
+	clone->data = sf->data;
+	clone->size = sf->size;
+	clone->len = sf->len;
+
+	return clone;
+}
+EXPORT_SYMBOL(ks_sf_clone);
+
+/* Returns a private copy of 'sf' with at least 'headroom' octets free */
+struct ks_streamframe *ks_sf_copy(struct ks_streamframe *sf, int headroom)
+{
+	struct ks_streamframe *copy;
+
+	if (headroom < KS_SF_HEADROOM)
+		headroom = KS_SF_HEADROOM;
+
+	copy = ks_sf_alloc(sf->len + headroom - KS_SF_HEADROOM);
+	if (!copy)
+		return NULL;
+
+	if (copy->size < sf->len + headroom - KS_SF_HEADROOM) {
+		ks_sf_put(copy);
+		return NULL;
+	}
+
+	ks_sf_reserve(copy, headroom - KS_SF_HEADROOM);
+	memcpy(ks_sf_append(copy, sf->len), sf->data, sf->len);
+
+	return copy;
+}
+EXPORT_SYMBOL(ks_sf_copy);
+
+/*
+ * Makes sure the caller may modify the frame in place. The reference to
+ * 'sf' is consumed, a private copy is returned if it was shared.
+ */
+struct ks_streamframe *ks_sf_unshare(struct ks_streamframe *sf)
+{
+	struct ks_streamframe *copy;
+
+	if (!ks_sf_shared(sf))
+		return sf;
+
+	copy = ks_sf_copy(sf, ks_sf_headroom(sf));
+
+	ks_sf_put(sf);
+
+	return copy;
+}
+EXPORT_SYMBOL(ks_sf_unshare);
+
+//----------------------------------------------------------------------------
+
+static ssize_t ks_sf_show_pool_hits(
+	struct device *device,
+	DEVICE_ATTR_COMPAT
+	char *buf)
+{
+	int len = 0;
+	int i;
+
+	for (i=0; i<KS_SF_NCLASSES; i++) {
+		unsigned long hits = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			hits += per_cpu(ks_sf_pools, cpu)[i].hits;
+
+		len += snprintf(buf + len, PAGE_SIZE - len, "%d %lu\n",
+				ks_sf_classes[i].size, hits);
+	}
+
+	return len;
+}
+
+static DEVICE_ATTR(sf_pool_hits, S_IRUGO,
+		ks_sf_show_pool_hits,
+		NULL);
+
+//----------------------------------------------------------------------------
+
+static ssize_t ks_sf_show_pool_misses(
+	struct device *device,
+	DEVICE_ATTR_COMPAT
+	char *buf)
+{
+	int len = 0;
+	int i;
+
+	for (i=0; i<KS_SF_NCLASSES; i++) {
+		unsigned long misses = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			misses += per_cpu(ks_sf_pools, cpu)[i].misses;
+
+		len += snprintf(buf + len, PAGE_SIZE - len, "%d %lu\n",
+				ks_sf_classes[i].size, misses);
+	}
+
+	return len;
+}
+
+static DEVICE_ATTR(sf_pool_misses, S_IRUGO,
+		ks_sf_show_pool_misses,
+		NULL);
+
+//----------------------------------------------------------------------------
+
+static void ks_sf_pools_drain(void)
+{
+	int cpu;
+	int i;
+
+	for_each_possible_cpu(cpu) {
+		for (i=0; i<KS_SF_NCLASSES; i++) {
+			struct ks_sf_pool *pool = &per_cpu(ks_sf_pools, cpu)[i];
+
+			while(pool->count)
+				kmem_cache_free(ks_sf_classes[i].cache,
+					pool->frames[--pool->count]);
+		}
+	}
+}
+
+int ks_sf_modinit(void)
+{
+	int err;
+	int i;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,23)
+	ks_sf_clone_cache = kmem_cache_create("ks_streamframe_clone",
+				sizeof(struct ks_streamframe), 0,
+				SLAB_HWCACHE_ALIGN, NULL, NULL);
+#else
+	ks_sf_clone_cache = kmem_cache_create("ks_streamframe_clone",
+				sizeof(struct ks_streamframe), 0,
+				SLAB_HWCACHE_ALIGN, NULL);
+#endif
+	if (!ks_sf_clone_cache) {
+		ks_msg(KERN_CRIT, "Can't create streamframe SLAB caches!\n");
+
+		err = -ENOMEM;
+		goto err_clone_cache_create;
+	}
+
+	for (i=0; i<KS_SF_NCLASSES; i++) {
+		int objsize = sizeof(struct ks_streamframe) + KS_SF_HEADROOM +
+				ks_sf_classes[i].size;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,23)
+		ks_sf_classes[i].cache = kmem_cache_create(
+					ks_sf_classes[i].name,
+					objsize, 0,
+					SLAB_HWCACHE_ALIGN, NULL, NULL);
+#else
+		ks_sf_classes[i].cache = kmem_cache_create(
+					ks_sf_classes[i].name,
+					objsize, 0,
+					SLAB_HWCACHE_ALIGN, NULL);
+#endif
+		if (!ks_sf_classes[i].cache) {
+			ks_msg(KERN_CRIT,
+				"Can't create streamframe SLAB caches!\n");
+
+			err = -ENOMEM;
+			goto err_kmem_cache_create;
+		}
+	}
+
+	err = device_create_file(&ks_system_device, &dev_attr_sf_pool_hits);
+	if (err < 0)
+		goto err_create_file_hits;
+
+	err = device_create_file(&ks_system_device, &dev_attr_sf_pool_misses);
+	if (err < 0)
+		goto err_create_file_misses;
+
+	return 0;
+
+	device_remove_file(&ks_system_device, &dev_attr_sf_pool_misses);
+err_create_file_misses:
+	device_remove_file(&ks_system_device, &dev_attr_sf_pool_hits);
+err_create_file_hits:
+err_kmem_cache_create:
+	while(--i >= 0)
+		kmem_cache_destroy(ks_sf_classes[i].cache);
+	kmem_cache_destroy(ks_sf_clone_cache);
+err_clone_cache_create:
+
+	return err;
+}
+
+void ks_sf_modexit(void)
+{
+	int i;
+
+	device_remove_file(&ks_system_device, &dev_attr_sf_pool_misses);
+	device_remove_file(&ks_system_device, &dev_attr_sf_pool_hits);
+
+	ks_sf_pools_drain();
+
+	for (i=0; i<KS_SF_NCLASSES; i++)
+		kmem_cache_destroy(ks_sf_classes[i].cache);
+
+	kmem_cache_destroy(ks_sf_clone_cache);
+}
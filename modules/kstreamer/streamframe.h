@@ -18,16 +18,45 @@
 #include <linux/slab.h>
 #include <asm/atomic.h>
 
+/* Size hint for callers which have no idea of how much data they will put
+ * in the frame, it selects the biggest size class.
+ */
+#define KS_SF_SIZE_DEFAULT	1024
+
+/* Room reserved in front of the data of every new frame, so that pipeline
+ * stages may prepend octets without copying.
+ */
+#define KS_SF_HEADROOM		16
+
+/*
+ * The payload buffer starts at 'head', valid data is 'len' octets starting
+ * at 'data' and 'size' is the room from 'data' to the end of the buffer.
+ *
+ * A clone has no payload of its own, it holds a reference to the frame
+ * owning the buffer in 'shared' and must be considered read-only.
+ */
 struct ks_streamframe
 {
 	atomic_t refcnt;
 	u16 size;
 	u16 len;
 
-	u8 data[0];
+	u8 pool;
+
+	struct ks_streamframe *shared;
+
+	u8 *head;
+	u8 *data;
+
+	u8 buf[0];
 };
 
-struct ks_streamframe *ks_sf_alloc(void);
+struct ks_streamframe *ks_sf_alloc(int size);
+void ks_sf_free(struct ks_streamframe *sf);
+
+struct ks_streamframe *ks_sf_clone(struct ks_streamframe *sf);
+struct ks_streamframe *ks_sf_copy(struct ks_streamframe *sf, int headroom);
+struct ks_streamframe *ks_sf_unshare(struct ks_streamframe *sf);
 
 static inline struct ks_streamframe *ks_sf_get(
 		struct ks_streamframe *sf)
@@ -40,8 +69,80 @@ static inline struct ks_streamframe *ks_sf_get(
 static inline void ks_sf_put(struct ks_streamframe *sf)
 {
 	if (atomic_dec_and_test(&sf->refcnt))
-		kfree(sf);
+		ks_sf_free(sf);
+}
+
+static inline int ks_sf_headroom(const struct ks_streamframe *sf)
+{
+	return sf->data - sf->head;
+}
+
+static inline int ks_sf_tailroom(const struct ks_streamframe *sf)
+{
+	return sf->size - sf->len;
+}
+
+/* The payload may be seen by someone else, do not modify it in place */
+static inline int ks_sf_shared(const struct ks_streamframe *sf)
+{
+	return sf->shared || atomic_read(&sf->refcnt) > 1;
+}
+
+/* Only valid on an empty frame, moves the start of data forward */
+static inline void ks_sf_reserve(struct ks_streamframe *sf, int len)
+{
+	BUG_ON(sf->len);
+	BUG_ON(len > sf->size);
+
+	sf->data += len;
+	sf->size -= len;
+}
+
+/* Extends the data at the end, returns a pointer to the added area */
+static inline u8 *ks_sf_append(struct ks_streamframe *sf, int len)
+{
+	u8 *tail = sf->data + sf->len;
+
+	BUG_ON(len > ks_sf_tailroom(sf));
+
+	sf->len += len;
+
+	return tail;
+}
+
+/* Extends the data at the beginning, using the headroom */
+static inline u8 *ks_sf_push(struct ks_streamframe *sf, int len)
+{
+	BUG_ON(len > ks_sf_headroom(sf));
+
+	sf->data -= len;
+	sf->size += len;
+	sf->len += len;
+
+	return sf->data;
 }
 
+/* Removes data from the beginning, returns the new start of data */
+static inline u8 *ks_sf_pull(struct ks_streamframe *sf, int len)
+{
+	BUG_ON(len > sf->len);
+
+	sf->data += len;
+	sf->size -= len;
+	sf->len -= len;
+
+	return sf->data;
+}
+
+/* Removes data from the end */
+static inline void ks_sf_trim(struct ks_streamframe *sf, int len)
+{
+	if (sf->len > len)
+		sf->len = len;
+}
+
+int ks_sf_modinit(void);
+void ks_sf_modexit(void);
+
 #endif
 #endif
@@ -0,0 +1,204 @@
+/*
+ * Kstreamer kernel infrastructure core
+ *
+ * Copyright (C) 2004-2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+/* The tick engine stimulates the FLOWING pipelines which asked for it once
+ * per tick.
+ *
+ * Ticked pipelines are walked by a tasklet, scheduled by an hrtimer while
+ * no hardware tick source is registered, otherwise by the source's
+ * interrupt every time enough of its periods have accumulated.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+
+#include <kernel_config.h>
+
+#include "kstreamer.h"
+#include "kstreamer_priv.h"
+#include "pipeline.h"
+#include "tick.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,21)
+#define KS_TICK_HRTIMER_MODE HRTIMER_REL
+#define ks_tick_hrtimer_restart_t int
+#else
+#define KS_TICK_HRTIMER_MODE HRTIMER_MODE_REL
+#define ks_tick_hrtimer_restart_t enum hrtimer_restart
+#endif
+
+/* Protects the ticked pipelines and ks_tick_source */
+static DEFINE_SPINLOCK(ks_tick_lock);
+static LIST_HEAD(ks_tick_pipelines);
+static int ks_tick_count;
+
+static struct hrtimer ks_tick_timer;
+static struct tasklet_struct ks_tick_tasklet;
+
+static struct ks_tick_source *ks_tick_source;
+
+static int tick_period = KS_TICK_DEFAULT_PERIOD;
+
+static inline ktime_t ks_tick_interval(void)
+{
+	return ktime_set(0, tick_period * NSEC_PER_USEC);
+}
+
+static void ks_tick_run(unsigned long data)
+{
+	struct ks_pipeline *pipeline;
+
+	spin_lock(&ks_tick_lock);
+	list_for_each_entry(pipeline, &ks_tick_pipelines, tick_node)
+		ks_pipeline_stimulate(pipeline);
+	spin_unlock(&ks_tick_lock);
+}
+
+static ks_tick_hrtimer_restart_t ks_tick_timer_func(struct hrtimer *timer)
+{
+	tasklet_schedule(&ks_tick_tasklet);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,25)
+	hrtimer_forward(timer, timer->base->get_time(), ks_tick_interval());
+#else
+	hrtimer_forward_now(timer, ks_tick_interval());
+#endif
+
+	return HRTIMER_RESTART;
+}
+
+void ks_tick_add(struct ks_pipeline *pipeline)
+{
+	spin_lock_bh(&ks_tick_lock);
+
+	if (!pipeline->ticked) {
+		list_add_tail(&pipeline->tick_node, &ks_tick_pipelines);
+		pipeline->ticked = TRUE;
+
+		if (!ks_tick_count++ && !ks_tick_source)
+			hrtimer_start(&ks_tick_timer, ks_tick_interval(),
+						KS_TICK_HRTIMER_MODE);
+	}
+
+	spin_unlock_bh(&ks_tick_lock);
+}
+EXPORT_SYMBOL(ks_tick_add);
+
+void ks_tick_del(struct ks_pipeline *pipeline)
+{
+	/* The tasklet holds the lock while walking, once we get it the
+	 * pipeline is not being stimulated anymore
+	 */
+	spin_lock_bh(&ks_tick_lock);
+
+	if (pipeline->ticked) {
+		list_del(&pipeline->tick_node);
+		pipeline->ticked = FALSE;
+
+		if (!--ks_tick_count)
+			hrtimer_cancel(&ks_tick_timer);
+	}
+
+	spin_unlock_bh(&ks_tick_lock);
+}
+EXPORT_SYMBOL(ks_tick_del);
+
+int ks_tick_source_register(struct ks_tick_source *src)
+{
+	spin_lock_bh(&ks_tick_lock);
+
+	if (ks_tick_source) {
+		spin_unlock_bh(&ks_tick_lock);
+
+		ks_msg(KERN_WARNING,
+			"Tick source '%s' not registered, '%s' is in use\n",
+			src->name, ks_tick_source->name);
+
+		return -EBUSY;
+	}
+
+	src->elapsed = 0;
+	ks_tick_source = src;
+
+	hrtimer_cancel(&ks_tick_timer);
+
+	spin_unlock_bh(&ks_tick_lock);
+
+	ks_msg(KERN_INFO, "Tick source '%s' registered, period %d us\n",
+		src->name, src->period);
+
+	return 0;
+}
+EXPORT_SYMBOL(ks_tick_source_register);
+
+void ks_tick_source_unregister(struct ks_tick_source *src)
+{
+	spin_lock_bh(&ks_tick_lock);
+
+	if (ks_tick_source != src) {
+		spin_unlock_bh(&ks_tick_lock);
+		return;
+	}
+
+	ks_tick_source = NULL;
+
+	if (ks_tick_count)
+		hrtimer_start(&ks_tick_timer, ks_tick_interval(),
+					KS_TICK_HRTIMER_MODE);
+
+	spin_unlock_bh(&ks_tick_lock);
+
+	ks_msg(KERN_INFO, "Tick source '%s' unregistered\n", src->name);
+}
+EXPORT_SYMBOL(ks_tick_source_unregister);
+
+/* Called from the source's interrupt handler */
+void ks_tick_source_fire(struct ks_tick_source *src)
+{
+	src->elapsed += src->period;
+	if (src->elapsed < tick_period)
+		return;
+
+	src->elapsed -= tick_period;
+
+	tasklet_schedule(&ks_tick_tasklet);
+}
+EXPORT_SYMBOL(ks_tick_source_fire);
+
+int ks_tick_modinit(void)
+{
+	if (tick_period <= 0)
+		tick_period = KS_TICK_DEFAULT_PERIOD;
+
+	hrtimer_init(&ks_tick_timer, CLOCK_MONOTONIC, KS_TICK_HRTIMER_MODE);
+	ks_tick_timer.function = ks_tick_timer_func;
+
+	tasklet_init(&ks_tick_tasklet, ks_tick_run, 0);
+
+	return 0;
+}
+
+void ks_tick_modexit(void)
+{
+	WARN_ON(ks_tick_count);
+
+	hrtimer_cancel(&ks_tick_timer);
+	tasklet_kill(&ks_tick_tasklet);
+}
+
+module_param(tick_period, int, 0444);
+MODULE_PARM_DESC(tick_period,
+	"Interval between two ticks of the pipelines, in usecs");
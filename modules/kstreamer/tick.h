@@ -0,0 +1,47 @@
+/*
+ * Kstreamer kernel infrastructure core
+ *
+ * Copyright (C) 2004-2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#ifndef _KS_TICK_H
+#define _KS_TICK_H
+
+#ifdef __KERNEL__
+
+#define KS_TICK_DEFAULT_PERIOD 20000
+
+/* A hardware clock (card timer interrupt, E1 frame sync, ...) driving the
+ * tick engine in place of the hrtimer fallback.
+ */
+struct ks_tick_source
+{
+	const char *name;
+
+	/* Interval between two ks_tick_source_fire() calls, in usecs */
+	int period;
+
+	int elapsed;
+};
+
+struct ks_pipeline;
+
+void ks_tick_add(struct ks_pipeline *pipeline);
+void ks_tick_del(struct ks_pipeline *pipeline);
+
+extern int ks_tick_source_register(struct ks_tick_source *src);
+extern void ks_tick_source_unregister(struct ks_tick_source *src);
+extern void ks_tick_source_fire(struct ks_tick_source *src);
+
+int ks_tick_modinit(void);
+void ks_tick_modexit(void);
+
+#endif
+
+#endif
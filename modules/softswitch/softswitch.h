@@ -61,12 +61,29 @@ struct kss_softswitch
 //
 };
 
+/*
+ * One element of a kss_chan_push_raw_batch() request. The caller fills
+ * chan and sf, the softswitch fills to_chan with the resolved next hop and
+ * res with the return value of the destination's push_raw.
+ */
+struct kss_push_req
+{
+	struct ks_chan *chan;
+	struct ks_streamframe *sf;
+
+	struct ks_chan *to_chan;
+	int res;
+};
+
 struct kss_chan_from_ops
 {
 	int (*push_frame)(struct ks_chan *chan, struct sk_buff *skb);
 	int (*push_raw)(struct ks_chan *chan,
 			struct ks_streamframe *sb);
 	int (*get_pressure)(struct ks_chan *chan);
+
+	/* Optional, all the requests have to_chan with these from_ops */
+	void (*push_raw_batch)(struct kss_push_req *reqs, int count);
 /*
 
 	void (*rx_error)(struct visdn_leg *leg,
@@ -94,6 +111,9 @@ extern int kss_chan_push_frame(struct ks_chan *chan, struct sk_buff *skb);
 extern int kss_chan_push_raw(
 		struct ks_chan *chan,
 		struct ks_streamframe *sf);
+extern int kss_chan_push_raw_batch(
+		struct kss_push_req *reqs,
+		int count);
 extern int kss_chan_get_pressure(struct ks_chan *chan);
 
 extern void kss_chan_wake_queue(struct ks_chan *chan);
@@ -24,34 +24,71 @@
 
 #include "softswitch.h"
 
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
 struct kss_softswitch kss_softswitch;
 EXPORT_SYMBOL(kss_softswitch);
 
 #define to_kss_softswitch(ks_node)	\
 		container_of((ks_node), struct kss_softswitch, ks_node)
 
+/*
+ * Accounts the outcome 'res' of pushing 'len' octets on 'chan'. Frames
+ * refused with KSS_TX_BUSY, KSS_TX_FULL or KSS_TX_LOCKED are still owned
+ * by the caller, which retries them, so they are not accounted until
+ * delivered. push_raw returns the octets taken or a negative error, only
+ * the latter is a drop.
+ */
+static void kss_chan_stats_push(
+	struct ks_chan *chan,
+	int len,
+	int res,
+	int is_frame)
+{
+	if (!is_frame) {
+		ks_chan_stats_push(chan, len, res < 0 ? res : 0);
+		return;
+	}
+
+	switch(res) {
+	case KSS_TX_OK:
+		ks_chan_stats_push(chan, len, 0);
+	break;
+
+	case KSS_TX_BUSY:
+	case KSS_TX_FULL:
+	case KSS_TX_LOCKED:
+	break;
+
+	default:
+		ks_chan_stats_push(chan, len, res);
+	break;
+	}
+}
+
 void kss_chan_wake_queue(struct ks_chan *chan)
 {
 	struct ks_chan *from_chan;
+	struct kss_chan_to_ops *ops;
 
 	BUG_ON(chan->from != &kss_softswitch.ks_node);
 
 	rcu_read_lock();
-	if (!chan->pipeline ||
-	    chan->pipeline_entry.prev == &chan->pipeline->entries) {
-		rcu_read_unlock();
-		return;
-	}
-
-	from_chan = list_entry(chan->pipeline_entry.prev, struct ks_chan,
-							pipeline_entry);
-
-	if (!((struct kss_chan_to_ops *)from_chan->to_ops)->wake_queue) {
+	from_chan = rcu_dereference(chan->prev_hop);
+	if (!from_chan) {
 		rcu_read_unlock();
 		return;
 	}
 
-	((struct kss_chan_to_ops *)from_chan->to_ops)->wake_queue(from_chan);
+	ops = chan->prev_hop_ops;
+	if (ops->wake_queue)
+		ops->wake_queue(from_chan);
 
 	rcu_read_unlock();
 }
@@ -60,27 +97,28 @@ EXPORT_SYMBOL(kss_chan_wake_queue);
 int kss_chan_push_frame(struct ks_chan *chan, struct sk_buff *skb)
 {
 	struct ks_chan *to_chan;
+	struct kss_chan_from_ops *ops;
 	int res;
 
 	BUG_ON(chan->to != &kss_softswitch.ks_node);
 
 	rcu_read_lock();
-	if (!chan->pipeline ||
-	    chan->pipeline_entry.next == &chan->pipeline->entries) {
+	to_chan = rcu_dereference(chan->next_hop);
+	if (!to_chan) {
 		rcu_read_unlock();
+		ks_chan_stats_push(chan, skb->len, -ENOTCONN);
 		return -ENOTCONN;
 	}
 
-	to_chan = list_entry(chan->pipeline_entry.next, struct ks_chan,
-							pipeline_entry);
+	ops = chan->next_hop_ops;
+	if (ops->push_frame) {
+		int len = skb->len;
 
-	if (!((struct kss_chan_from_ops *)to_chan->from_ops)->push_frame) {
-		rcu_read_unlock();
-		return -EOPNOTSUPP;
-	}
+		res = ops->push_frame(to_chan, skb);
 
-	res = ((struct kss_chan_from_ops *)to_chan->from_ops)->
-			push_frame(to_chan, skb);
+		kss_chan_stats_push(chan, len, res, TRUE);
+	} else
+		res = -EOPNOTSUPP;
 
 	rcu_read_unlock();
 
@@ -93,61 +131,142 @@ int kss_chan_push_raw(
 	struct ks_streamframe *sf)
 {
 	struct ks_chan *to_chan;
+	struct kss_chan_from_ops *ops;
 	int res;
 
 	BUG_ON(chan->to != &kss_softswitch.ks_node);
 
 	rcu_read_lock();
-	if (!chan->pipeline ||
-	    chan->pipeline_entry.next == &chan->pipeline->entries) {
+	to_chan = rcu_dereference(chan->next_hop);
+	if (!to_chan) {
 		rcu_read_unlock();
+		ks_chan_stats_push(chan, sf->len, -ENOTCONN);
 		return -ENOTCONN;
 	}
 
-	to_chan = list_entry(chan->pipeline_entry.next, struct ks_chan,
-							pipeline_entry);
+	ops = chan->next_hop_ops;
+	if (ops->push_raw)
+		res = ops->push_raw(to_chan, sf);
+	else
+		res = -EOPNOTSUPP;
 
-	if (!((struct kss_chan_from_ops *)to_chan->from_ops)->push_raw) {
-		rcu_read_unlock();
-		return -EOPNOTSUPP;
+	rcu_read_unlock();
+
+	kss_chan_stats_push(chan, sf->len, res, FALSE);
+
+	return res;
+}
+EXPORT_SYMBOL(kss_chan_push_raw);
+
+/*
+ * Pushes many streamframes, possibly on different channels, in one call.
+ * Next hops are resolved once and requests for the same kind of
+ * destination are delivered together to its push_raw_batch, if
+ * implemented, letting it amortize locking over the whole batch.
+ *
+ * The requests array may be reordered. Returns the number of requests
+ * successfully delivered, per-request results are in reqs[i].res.
+ */
+int kss_chan_push_raw_batch(
+	struct kss_push_req *reqs,
+	int count)
+{
+	int delivered = 0;
+	int i;
+
+	rcu_read_lock();
+
+	for (i=0; i<count; i++) {
+		struct kss_push_req *req = &reqs[i];
+		struct ks_chan *chan = req->chan;
+
+		BUG_ON(chan->to != &kss_softswitch.ks_node);
+
+		req->to_chan = rcu_dereference(chan->next_hop);
+		req->res = req->to_chan ? 0 : -ENOTCONN;
 	}
 
-	res = ((struct kss_chan_from_ops *)to_chan->from_ops)->
-			push_raw(to_chan, sf);
+	for (i=0; i<count; i++) {
+		struct kss_chan_from_ops *ops;
+		int n = 1;
+		int j;
+
+		if (!reqs[i].to_chan)
+			continue;
+
+		ops = reqs[i].chan->next_hop_ops;
+
+		/* Group requests for the same destination after reqs[i] */
+		for (j=i+1; j<count; j++) {
+			if (reqs[j].to_chan &&
+			    reqs[j].chan->next_hop_ops == ops) {
+
+				if (j != i + n) {
+					struct kss_push_req tmp = reqs[i + n];
+					reqs[i + n] = reqs[j];
+					reqs[j] = tmp;
+				}
+
+				n++;
+			}
+		}
+
+		if (ops->push_raw_batch)
+			ops->push_raw_batch(&reqs[i], n);
+		else {
+			for (j=i; j<i+n; j++) {
+				if (ops->push_raw)
+					reqs[j].res = ops->push_raw(
+						reqs[j].to_chan, reqs[j].sf);
+				else
+					reqs[j].res = -EOPNOTSUPP;
+			}
+		}
+
+		i += n - 1;
+	}
 
 	rcu_read_unlock();
 
-	return res;
+	for (i=0; i<count; i++) {
+		kss_chan_stats_push(reqs[i].chan, reqs[i].sf->len,
+						reqs[i].res, FALSE);
+
+		if (reqs[i].res >= 0)
+			delivered++;
+	}
+
+
+	return delivered;
 }
-EXPORT_SYMBOL(kss_chan_push_raw);
+EXPORT_SYMBOL(kss_chan_push_raw_batch);
 
 int kss_chan_get_pressure(struct ks_chan *chan)
 {
 	struct ks_chan *to_chan;
+	struct kss_chan_from_ops *ops;
 	int res;
 
 	BUG_ON(chan->to != &kss_softswitch.ks_node);
 
 	rcu_read_lock();
-	if (!chan->pipeline ||
-	    chan->pipeline_entry.next == &chan->pipeline->entries) {
+	to_chan = rcu_dereference(chan->next_hop);
+	if (!to_chan) {
 		rcu_read_unlock();
 		return -ENOTCONN;
 	}
 
-	to_chan = list_entry(chan->pipeline_entry.next, struct ks_chan,
-							pipeline_entry);
-
-	if (!((struct kss_chan_from_ops *)to_chan->from_ops)->get_pressure) {
-		rcu_read_unlock();
-		return -EOPNOTSUPP;
-	}
-
-	res = ((struct kss_chan_from_ops *)to_chan->from_ops)->
-			get_pressure(to_chan);
+	ops = chan->next_hop_ops;
+	if (ops->get_pressure)
+		res = ops->get_pressure(to_chan);
+	else
+		res = -EOPNOTSUPP;
 
 	rcu_read_unlock();
 
+	if (res >= 0)
+		ks_chan_stats_pressure(chan, res);
+
 	return res;
 }
 EXPORT_SYMBOL(kss_chan_get_pressure);
@@ -17,12 +17,64 @@
 #define KS_UP_GET_NODEID	_IOR(0xd0, 0x20, unsigned int)
 #define KS_UP_GET_PRESSURE	_IOR(0xd0, 0x21, unsigned int)
 #define KS_UP_SET_FRAME_MODE	_IOR(0xd0, 0x22, unsigned int)
+#define KS_UP_SET_MMAP_MODE	_IOWR(0xd0, 0x23, struct ksup_mmap_req)
+#define KS_UP_MUX_ADD		_IOR(0xd0, 0x24, unsigned int)
+#define KS_UP_MUX_DEL		_IO(0xd0, 0x25)
+#define KS_UP_SET_RX_WATERMARK	_IO(0xd0, 0x26)
+#define KS_UP_GET_MUX_OVERRUNS	_IOR(0xd0, 0x27, unsigned int)
 
 struct ksup_ctl
 {
 	__u32 node_id;
 };
 
+/* In mmap mode the mapping starts with a page holding struct ksup_mmap_ctl,
+ * followed by the RX and TX rings at the reported offsets.
+ *
+ * Indexes are free running and sizes are powers of 2. The producer only
+ * writes head and the consumer only writes tail: the kernel produces RX
+ * and consumes TX once per tick, poll() reports POLLIN when RX is not
+ * empty and POLLOUT when TX is not full.
+ */
+struct ksup_ring
+{
+	__u32 head;
+	__u32 tail;
+	__u32 size;
+	__u32 offset;
+};
+
+struct ksup_mmap_ctl
+{
+	struct ksup_ring rx;
+	struct ksup_ring tx;
+
+	/* Written by the kernel, streamframes not entirely fitting in RX */
+	__u32 rx_overruns;
+};
+
+struct ksup_mmap_req
+{
+	__u32 rx_size;
+	__u32 tx_size;
+
+	/* Returned, length to be passed to mmap() */
+	__u32 map_size;
+};
+
+/* KS_UP_MUX_ADD binds a new stream node to the fd and returns its id,
+ * KS_UP_MUX_DEL takes the id as argument and removes it.
+ * From then on read() returns and write() accepts back-to-back records
+ * made of a header followed by len octets, the fd's own node included.
+ * read() only returns whole records. KS_UP_GET_MUX_OVERRUNS returns how
+ * many records were dropped because the ring was full.
+ */
+struct ksup_mux_hdr
+{
+	__u32 node_id;
+	__u32 len;
+};
+
 #ifdef __KERNEL__
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,9)
@@ -31,6 +83,12 @@ struct ksup_ctl
 #include <linux/kfifo.h>
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,26)
+#include <asm/semaphore.h>
+#else
+#include <linux/semaphore.h>
+#endif
+
 #include <linux/kstreamer/node.h>
 #include <linux/kstreamer/channel.h>
 
@@ -38,6 +96,8 @@ struct ksup_ctl
 #define ksup_MODULE_PREFIX ksup_MODULE_NAME ": "
 #define ksup_MODULE_DESCR "kstreamer userport module"
 
+#define KSUP_MUX_RING_SIZE 16384
+
 #define SB_CHAN_HASHBITS 8
 #define SB_CHAN_HASHSIZE (1 << SB_CHAN_HASHBITS)
 
@@ -64,14 +124,43 @@ struct ksup_chan
 
 	int framed;
 
-	struct timer_list stimulus_timer;
-	int stimulus_frequency;
+	/* Serializes read() and write() with switching to mux or mmap mode */
+	struct semaphore sem;
+
+	/* Octets to be available before blocked readers and poll are woken */
+	int rx_watermark;
+
+	/* Set when the RX pipeline stops or the chan goes away, before
+	 * waking readers, the pipeline status is updated only later.
+	 */
+	int rx_stopped;
 
 	struct kfifo *read_fifo;
 	spinlock_t read_fifo_lock;
 	wait_queue_head_t read_wait_queue;
 	struct sk_buff_head read_queue;
 
+	/* Shared rings, in mmap mode */
+	void *mmap_area;
+	unsigned long mmap_size;
+	struct ksup_mmap_ctl *mmap_ctl;
+	u8 *mmap_rx_buf;
+	u8 *mmap_tx_buf;
+	u32 mmap_rx_size;
+	u32 mmap_tx_size;
+
+	/* Multiplexed mode, the fd's chan owns the members and queues the
+	 * records received by all of them
+	 */
+	struct ksup_chan *mux_owner;
+	struct list_head mux_members;
+	struct list_head mux_node;
+	spinlock_t mux_lock;
+	u8 *mux_buf;
+	u32 mux_head;
+	u32 mux_tail;
+	u32 mux_overruns;
+
 	enum ksup_h223_rx_state h223_rx_state;
 };
 
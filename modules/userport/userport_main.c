@@ -18,6 +18,8 @@
 #include <linux/device.h>
 #include <linux/list.h>
 #include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 
 #include <linux/kstreamer/kstreamer.h>
 #include <linux/kstreamer/node.h>
@@ -114,6 +116,10 @@ static void ksup_node_release(struct ks_node *ks_node)
 
 	kfifo_free(chan->read_fifo);
 
+	if (chan->mmap_area)
+		vfree(chan->mmap_area);
+
+	kfree(chan->mux_buf);
 	kfree(chan);
 }
 
@@ -125,6 +131,74 @@ static struct ks_node_ops ksup_chan_node_ops = {
 
 /*---------------------------------------------------------------------------*/
 
+/* The control page is writable by userspace, so the ring size and position
+ * are taken from our own copy and a bogus index only results in an empty
+ * or full ring.
+ */
+static int ksup_ring_put(
+	struct ksup_ring *ring,
+	u8 *buf,
+	u32 size,
+	const u8 *data,
+	int len)
+{
+	u32 head = ring->head;
+	u32 used;
+	int l;
+
+	/* Do not overwrite what the consumer is still reading */
+	smp_mb();
+
+	used = head - ring->tail;
+	if (used > size)
+		return 0;
+
+	len = min_t(u32, len, size - used);
+
+	l = min_t(u32, len, size - (head & (size - 1)));
+	memcpy(buf + (head & (size - 1)), data, l);
+	memcpy(buf, data + l, len - l);
+
+	smp_wmb();
+
+	ring->head = head + len;
+
+	return len;
+}
+
+static int ksup_ring_get(
+	struct ksup_ring *ring,
+	u8 *buf,
+	u32 size,
+	u8 *data,
+	int len)
+{
+	u32 tail = ring->tail;
+	u32 used;
+	int l;
+
+	used = ring->head - tail;
+	if (used > size)
+		return 0;
+
+	/* Do not read data older than the head */
+	smp_rmb();
+
+	len = min_t(u32, len, used);
+
+	l = min_t(u32, len, size - (tail & (size - 1)));
+	memcpy(data, buf + (tail & (size - 1)), l);
+	memcpy(data + l, buf, len - l);
+
+	smp_mb();
+
+	ring->tail = tail + len;
+
+	return len;
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void ksup_chan_rx_chan_release(struct ks_chan *ks_chan)
 {
 	ksup_debug(3, "ksup_chan_rx_chan_release()\n");
@@ -156,28 +230,15 @@ static void ksup_chan_rx_chan_close(struct ks_chan *ks_chan)
 	ksup_debug(3, "ksup_chan_rx_chan_close()\n");
 }
 
-static void ksup_timer_func(unsigned long data)
-{
-	struct ksup_chan *chan = (struct ksup_chan *)data;
-
-	chan->stimulus_timer.expires += HZ / chan->stimulus_frequency;
-
-	ks_pipeline_stimulate(chan->ks_chan_rx->pipeline);
-
-	add_timer(&chan->stimulus_timer);
-}
-
 static int ksup_chan_rx_chan_start(struct ks_chan *ks_chan)
 {
 	struct ksup_chan *chan = ks_chan->driver_data;
 
-	ksup_debug(3, "ksup_chan_rx_chan_start()\n");
+	/* The pipeline is stimulated by the tick engine while FLOWING */
 
-	chan->stimulus_timer.expires = jiffies;
-	chan->stimulus_timer.function = ksup_timer_func;
-	chan->stimulus_timer.data = (unsigned long)chan;
+	ksup_debug(3, "ksup_chan_rx_chan_start()\n");
 
-	add_timer(&chan->stimulus_timer);
+	chan->rx_stopped = FALSE;
 
 	return 0;
 }
@@ -188,7 +249,10 @@ static void ksup_chan_rx_chan_stop(struct ks_chan *ks_chan)
 
 	ksup_debug(3, "ksup_chan_rx_chan_stop()\n");
 
-	del_timer_sync(&chan->stimulus_timer);
+	/* Blocked readers return -ENOTCONN */
+	chan->rx_stopped = TRUE;
+	smp_wmb();
+	wake_up(&chan->read_wait_queue);
 }
 
 struct ks_chan_ops ksup_chan_rx_chan_ops = {
@@ -248,6 +312,32 @@ static void ksup_chan_tx_chan_stop(struct ks_chan *ks_chan)
 	ksup_debug(3, "ksup_chan_tx_chan_stop()\n");
 }
 
+static void ksup_chan_tx_chan_stimulus(struct ks_chan *ks_chan)
+{
+	struct ksup_chan *chan = ks_chan->driver_data;
+	struct ks_streamframe *sf;
+
+	/* Only the shared TX ring needs to be drained */
+	if (!chan->mmap_ctl)
+		return;
+
+	if (chan->mmap_ctl->tx.head == chan->mmap_ctl->tx.tail)
+		return;
+
+	sf = ks_sf_alloc(KS_SF_SIZE_DEFAULT);
+	if (!sf)
+		return;
+
+	sf->len = ksup_ring_get(&chan->mmap_ctl->tx, chan->mmap_tx_buf,
+			chan->mmap_tx_size, sf->data, sf->size);
+	if (sf->len) {
+		kss_chan_push_raw(ks_chan, sf);
+		wake_up(&chan->read_wait_queue);
+	}
+
+	ks_sf_put(sf);
+}
+
 struct ks_chan_ops ksup_chan_tx_chan_ops = {
 	.owner		= THIS_MODULE,
 
@@ -258,22 +348,150 @@ struct ks_chan_ops ksup_chan_tx_chan_ops = {
 	.close		= ksup_chan_tx_chan_close,
 	.start		= ksup_chan_tx_chan_start,
 	.stop		= ksup_chan_tx_chan_stop,
+	.stimulus	= ksup_chan_tx_chan_stimulus,
 };
 
 /*---------------------------------------------------------------------------*/
 
+static void ksup_mux_copy_in(
+	struct ksup_chan *owner,
+	u32 pos,
+	const void *data,
+	int len)
+{
+	u32 off = pos & (KSUP_MUX_RING_SIZE - 1);
+	int l = min_t(u32, len, KSUP_MUX_RING_SIZE - off);
+
+	memcpy(owner->mux_buf + off, data, l);
+	memcpy(owner->mux_buf, data + l, len - l);
+}
+
+/* Records are published at once, the reader never sees a header without
+ * its data. A record not fitting is dropped and counted as an overrun.
+ */
+static int ksup_mux_put(
+	struct ksup_chan *owner,
+	struct ksup_chan *chan,
+	struct ks_streamframe *sf)
+{
+	struct ksup_mux_hdr hdr;
+	u32 head;
+
+	hdr.node_id = chan->ks_node.id;
+	hdr.len = sf->len;
+
+	spin_lock_bh(&owner->mux_lock);
+	head = owner->mux_head;
+
+	/* Do not overwrite what the reader is still copying */
+	smp_mb();
+
+	if (KSUP_MUX_RING_SIZE - (head - owner->mux_tail) <
+						sizeof(hdr) + sf->len) {
+		owner->mux_overruns++;
+		spin_unlock_bh(&owner->mux_lock);
+		return -ENOSPC;
+	}
+
+	ksup_mux_copy_in(owner, head, &hdr, sizeof(hdr));
+	ksup_mux_copy_in(owner, head + sizeof(hdr), sf->data, sf->len);
+
+	smp_wmb();
+
+	owner->mux_head = head + sizeof(hdr) + sf->len;
+	spin_unlock_bh(&owner->mux_lock);
+
+	return sf->len;
+}
+
+static u32 ksup_chan_rx_avail(struct ksup_chan *chan)
+{
+	if (chan->mux_buf)
+		return chan->mux_head - chan->mux_tail;
+	else if (chan->mmap_ctl)
+		return chan->mmap_ctl->rx.head - chan->mmap_ctl->rx.tail;
+	else if (chan->framed)
+		return skb_queue_len(&chan->read_queue);
+	else
+		return kfifo_len(chan->read_fifo);
+}
+
+/* Readers are only woken once rx_watermark octets are available, or a
+ * whole frame in framed mode
+ */
+static int ksup_chan_rx_ready(struct ksup_chan *chan)
+{
+	u32 size;
+
+	if (chan->mux_buf)
+		size = KSUP_MUX_RING_SIZE;
+	else if (chan->mmap_ctl)
+		size = chan->mmap_rx_size;
+	else if (chan->framed)
+		size = 1;
+	else
+		size = 1024;
+
+	return ksup_chan_rx_avail(chan) >=
+			min_t(u32, chan->rx_watermark, size);
+}
+
+static int ksup_chan_rx_flowing(struct ksup_chan *chan)
+{
+	return !chan->rx_stopped &&
+		chan->ks_chan_rx->pipeline &&
+		chan->ks_chan_rx->pipeline->status ==
+					KS_PIPELINE_STATUS_FLOWING;
+}
+
 static int ksup_chan_rx_chan_push_raw(
 	struct ks_chan *ks_chan,
 	struct ks_streamframe *sf)
 {
 	struct ksup_chan *chan = ks_chan->driver_data;
 
+	if (chan->mux_owner) {
+		int err;
+
+		/* A record without data would only waste ring space */
+		if (!sf->len)
+			return 0;
+
+		err = ksup_mux_put(chan->mux_owner, chan, sf);
+		if (err < 0)
+			return err;
+
+		if (ksup_chan_rx_ready(chan->mux_owner))
+			wake_up(&chan->mux_owner->read_wait_queue);
+
+		return 0;
+	}
+
+	if (chan->mmap_ctl) {
+		int len;
+
+		len = ksup_ring_put(&chan->mmap_ctl->rx, chan->mmap_rx_buf,
+				chan->mmap_rx_size, sf->data, sf->len);
+		if (len && ksup_chan_rx_ready(chan))
+			wake_up(&chan->read_wait_queue);
+
+		/* The reader is not keeping up, what did not fit is lost */
+		if (len < sf->len) {
+			chan->mmap_ctl->rx_overruns++;
+			return -ENOSPC;
+		}
+
+		return 0;
+	}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
-	if (__kfifo_put(chan->read_fifo, sf->data, sf->len))
+	if (__kfifo_put(chan->read_fifo, sf->data, sf->len) &&
+	    ksup_chan_rx_ready(chan))
 		wake_up(&chan->read_wait_queue);
 
 #else
-	if (kfifo_in(chan->read_fifo, sf->data, sf->len))
+	if (kfifo_in(chan->read_fifo, sf->data, sf->len) &&
+	    ksup_chan_rx_ready(chan))
 		wake_up(&chan->read_wait_queue);
 #endif
 	return 0;
@@ -316,9 +534,8 @@ static struct ksup_chan *ksup_chan_create(
 
 	memset(chan, 0, sizeof(*chan));
 
-	init_timer(&chan->stimulus_timer);
-	chan->stimulus_frequency = 50;
 	chan->framed = framed;
+	chan->rx_watermark = 1;
 
 	spin_lock_init(&chan->read_fifo_lock);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
@@ -337,6 +554,10 @@ static struct ksup_chan *ksup_chan_create(
         skb_queue_head_init(&chan->read_queue);
 	init_waitqueue_head(&chan->read_wait_queue);
 
+	INIT_LIST_HEAD(&chan->mux_members);
+	spin_lock_init(&chan->mux_lock);
+	sema_init(&chan->sem, 1);
+
 	ks_node_create(&chan->ks_node, &ksup_chan_node_ops, "",
 			framed ? &ksup_frame_device.kobj :
 				&ksup_stream_device.kobj);
@@ -402,9 +623,15 @@ static void ksup_chan_unregister(struct ksup_chan *chan)
 	if (chan->ks_chan_tx)
 		ks_chan_unregister(chan->ks_chan_tx);
 
-	if (chan->ks_chan_rx)
+	if (chan->ks_chan_rx) {
 		ks_chan_unregister(chan->ks_chan_rx);
 
+		/* Nothing will be received anymore */
+		chan->rx_stopped = TRUE;
+		smp_wmb();
+		wake_up(&chan->read_wait_queue);
+	}
+
 	ks_node_unregister(&chan->ks_node);
 
 	write_lock(&ksup_chans_list_lock);
@@ -415,23 +642,22 @@ static void ksup_chan_unregister(struct ksup_chan *chan)
 
 /*---------------------------------------------------------------------------*/
 
-static int ksup_cdev_open(
-	struct inode *inode,
-	struct file *file)
+static int ksup_chan_open(
+	struct ksup_chan **chanp,
+	int framed,
+	int rx,
+	int tx)
 {
 	int err;
 	struct ksup_chan *chan;
 
-	nonseekable_open(inode, file);
-
-	chan = ksup_chan_create(NULL, inode->i_rdev - ksup_first_dev == 1);
+	chan = ksup_chan_create(NULL, framed);
 	if (!chan) {
 		err = -ENOMEM;
 		goto err_chan_create;
 	}
 
-	if ((file->f_flags & O_ACCMODE) == O_RDONLY ||
-	    (file->f_flags & O_ACCMODE) == O_RDWR) {
+	if (rx) {
 		chan->ks_chan_rx = ks_chan_create(NULL, &ksup_chan_rx_chan_ops,
 				"rx", NULL,
 				&chan->ks_node.kobj,
@@ -444,10 +670,10 @@ static int ksup_cdev_open(
 
 		chan->ks_chan_rx->driver_data = chan;
 		chan->ks_chan_rx->from_ops = &ksup_chan_rx_chan_node_ops;
+		chan->ks_chan_rx->needs_tick = TRUE;
 	}
 
-	if ((file->f_flags & O_ACCMODE) == O_WRONLY ||
-	    (file->f_flags & O_ACCMODE) == O_RDWR) {
+	if (tx) {
 		chan->ks_chan_tx = ks_chan_create(NULL, &ksup_chan_tx_chan_ops,
 				"tx", NULL,
 				&chan->ks_node.kobj,
@@ -459,17 +685,15 @@ static int ksup_cdev_open(
 		}
 
 		chan->ks_chan_tx->driver_data = chan;
+		/* Drains the TX ring in mmap mode, which may be set later */
+		chan->ks_chan_tx->needs_tick = TRUE;
 	}
 
 	err = ksup_chan_register(chan);
 	if (err < 0)
 		goto err_chan_register;
 
-	file->private_data = ksup_chan_get(chan);
-
-	ksup_debug(2, "Userport %06d opened\n", chan->id);
-
-	ksup_chan_put(chan);
+	*chanp = chan;
 
 	return 0;
 
@@ -487,13 +711,8 @@ err_chan_create:
 	return err;
 }
 
-static int ksup_cdev_release(
-	struct inode *inode, struct file *file)
+static void ksup_chan_close(struct ksup_chan *chan)
 {
-	struct ksup_chan *chan = file->private_data;
-
-	ksup_debug(3, "ksup_cdev_release()\n");
-
 	ksup_chan_unregister(chan);
 
 	if (chan->ks_chan_tx) {
@@ -507,6 +726,202 @@ static int ksup_cdev_release(
 	}
 
 	ksup_chan_put(chan);
+}
+
+static int ksup_mux_enable(struct ksup_chan *owner)
+{
+	u8 *buf;
+	int err;
+
+	if (down_interruptible(&owner->sem))
+		return -ERESTARTSYS;
+
+	if (owner->mux_buf) {
+		up(&owner->sem);
+		return 0;
+	}
+
+	if (owner->framed || owner->mmap_area) {
+		err = -EINVAL;
+		goto err_invalid;
+	}
+
+	buf = kmalloc(KSUP_MUX_RING_SIZE, GFP_KERNEL);
+	if (!buf) {
+		err = -ENOMEM;
+		goto err_kmalloc;
+	}
+
+	owner->mux_buf = buf;
+
+	/* The data path only looks at mux_owner */
+	smp_wmb();
+	owner->mux_owner = owner;
+
+	up(&owner->sem);
+
+	return 0;
+
+err_kmalloc:
+err_invalid:
+	up(&owner->sem);
+
+	return err;
+}
+
+static struct ksup_chan *ksup_mux_get_member(
+	struct ksup_chan *owner,
+	int node_id)
+{
+	struct ksup_chan *chan;
+	struct ksup_chan *found = NULL;
+
+	if (owner->ks_node.id == node_id)
+		return ksup_chan_get(owner);
+
+	spin_lock_bh(&owner->mux_lock);
+	list_for_each_entry(chan, &owner->mux_members, mux_node) {
+		if (chan->ks_node.id == node_id) {
+			found = ksup_chan_get(chan);
+			break;
+		}
+	}
+	spin_unlock_bh(&owner->mux_lock);
+
+	return found;
+}
+
+static void ksup_mux_member_close(struct ksup_chan *chan)
+{
+	struct ksup_chan *owner = chan->mux_owner;
+
+	ksup_chan_close(chan);
+	ksup_chan_put(owner);
+}
+
+static int ksup_mux_add(
+	struct ksup_chan *owner,
+	unsigned int __user *node_id)
+{
+	struct ksup_chan *chan;
+	int err;
+
+	err = ksup_mux_enable(owner);
+	if (err < 0)
+		goto err_mux_enable;
+
+	err = ksup_chan_open(&chan, FALSE,
+			owner->ks_chan_rx != NULL,
+			owner->ks_chan_tx != NULL);
+	if (err < 0)
+		goto err_chan_open;
+
+	chan->mux_owner = ksup_chan_get(owner);
+
+	spin_lock_bh(&owner->mux_lock);
+	list_add_tail(&chan->mux_node, &owner->mux_members);
+	spin_unlock_bh(&owner->mux_lock);
+
+	err = put_user(chan->ks_node.id, node_id);
+	if (err < 0)
+		goto err_put_user;
+
+	ksup_debug(2, "Userport %06d multiplexed on %06d\n",
+		chan->id, owner->id);
+
+	return 0;
+
+err_put_user:
+	spin_lock_bh(&owner->mux_lock);
+	list_del(&chan->mux_node);
+	spin_unlock_bh(&owner->mux_lock);
+
+	ksup_mux_member_close(chan);
+err_chan_open:
+err_mux_enable:
+
+	return err;
+}
+
+static int ksup_mux_del(
+	struct ksup_chan *owner,
+	int node_id)
+{
+	struct ksup_chan *chan;
+	struct ksup_chan *found = NULL;
+
+	spin_lock_bh(&owner->mux_lock);
+	list_for_each_entry(chan, &owner->mux_members, mux_node) {
+		if (chan->ks_node.id == node_id) {
+			list_del(&chan->mux_node);
+			found = chan;
+			break;
+		}
+	}
+	spin_unlock_bh(&owner->mux_lock);
+
+	if (!found)
+		return -ENOENT;
+
+	ksup_mux_member_close(found);
+
+	return 0;
+}
+
+static void ksup_mux_close(struct ksup_chan *owner)
+{
+	struct ksup_chan *chan;
+
+	for (;;) {
+		spin_lock_bh(&owner->mux_lock);
+		if (list_empty(&owner->mux_members)) {
+			spin_unlock_bh(&owner->mux_lock);
+			break;
+		}
+
+		chan = list_entry(owner->mux_members.next,
+				struct ksup_chan, mux_node);
+		list_del(&chan->mux_node);
+		spin_unlock_bh(&owner->mux_lock);
+
+		ksup_mux_member_close(chan);
+	}
+}
+
+static int ksup_cdev_open(
+	struct inode *inode,
+	struct file *file)
+{
+	int err;
+	struct ksup_chan *chan;
+
+	nonseekable_open(inode, file);
+
+	err = ksup_chan_open(&chan,
+		inode->i_rdev - ksup_first_dev == 1,
+		(file->f_flags & O_ACCMODE) == O_RDONLY ||
+		(file->f_flags & O_ACCMODE) == O_RDWR,
+		(file->f_flags & O_ACCMODE) == O_WRONLY ||
+		(file->f_flags & O_ACCMODE) == O_RDWR);
+	if (err < 0)
+		return err;
+
+	file->private_data = chan;
+
+	ksup_debug(2, "Userport %06d opened\n", chan->id);
+
+	return 0;
+}
+
+static int ksup_cdev_release(
+	struct inode *inode, struct file *file)
+{
+	struct ksup_chan *chan = file->private_data;
+
+	ksup_debug(3, "ksup_cdev_release()\n");
+
+	ksup_mux_close(chan);
+	ksup_chan_close(chan);
 	file->private_data = NULL;
 
 	return 0;
@@ -536,6 +951,58 @@ ssize_t __kfifo_get_user(
 	return len;
 }
 
+static ssize_t ksup_mux_read(
+	struct ksup_chan *owner,
+	char __user *buf,
+	size_t count)
+{
+	struct ksup_mux_hdr hdr;
+	size_t copied = 0;
+	ssize_t err = 0;
+	u32 tail;
+
+	tail = owner->mux_tail;
+
+	while(owner->mux_head != tail) {
+		u32 off = tail & (KSUP_MUX_RING_SIZE - 1);
+		int reclen;
+		int l;
+
+		/* Do not read data older than the head */
+		smp_rmb();
+
+		l = min_t(u32, sizeof(hdr), KSUP_MUX_RING_SIZE - off);
+		memcpy(&hdr, owner->mux_buf + off, l);
+		memcpy((u8 *)&hdr + l, owner->mux_buf, sizeof(hdr) - l);
+
+		reclen = sizeof(hdr) + hdr.len;
+
+		if (copied + reclen > count) {
+			if (!copied)
+				err = -EMSGSIZE;
+
+			break;
+		}
+
+		l = min_t(u32, reclen, KSUP_MUX_RING_SIZE - off);
+		if (copy_to_user(buf + copied, owner->mux_buf + off, l) ||
+		    copy_to_user(buf + copied + l, owner->mux_buf,
+							reclen - l)) {
+			err = -EFAULT;
+			break;
+		}
+
+		copied += reclen;
+		tail += reclen;
+
+		smp_mb();
+
+		owner->mux_tail = tail;
+	}
+
+	return copied ? copied : err;
+}
+
 static ssize_t ksup_cdev_read(
 	struct file *file,
 	char __user *buf,
@@ -544,33 +1011,66 @@ static ssize_t ksup_cdev_read(
 {
 	struct ksup_chan *chan = file->private_data;
 	int copied;
+	int err;
 
 	if (!chan->ks_chan_rx)
 		return -EBADF;
 
-	if (!chan->ks_chan_rx->pipeline ||
-	     chan->ks_chan_rx->pipeline->status != KS_PIPELINE_STATUS_FLOWING)
-		return -ENOTCONN;
+	if (chan->mmap_ctl)
+		return -EINVAL;
+
+	for (;;) {
+		/* Multiplexed fds do not depend on their own pipeline */
+		if (!chan->mux_buf && !ksup_chan_rx_flowing(chan))
+			return -ENOTCONN;
+
+		if (ksup_chan_rx_ready(chan))
+			break;
+
+		/* Non-blocking readers get whatever is available */
+		if (file->f_flags & O_NONBLOCK) {
+			if (ksup_chan_rx_avail(chan))
+				break;
+
+			return -EAGAIN;
+		}
 
-	if (chan->framed) {
+		err = wait_event_interruptible(chan->read_wait_queue,
+			ksup_chan_rx_ready(chan) ||
+			(!chan->mux_buf && !ksup_chan_rx_flowing(chan)));
+		if (err < 0)
+			return err;
+	}
+
+	if (down_interruptible(&chan->sem))
+		return -ERESTARTSYS;
+
+	/* The mode may have changed while we were waiting */
+	if (chan->mmap_ctl)
+		copied = -EINVAL;
+	else if (chan->mux_buf)
+		copied = ksup_mux_read(chan, buf, count);
+	else if (chan->framed) {
 		struct sk_buff *skb;
 
 		skb = skb_dequeue(&chan->read_queue);
-		if (!skb)
-			return 0;
+		if (skb) {
+			copied = min((unsigned int)count, skb->len);
 
-		copied = min((unsigned int)count, skb->len);
+			if (copy_to_user(buf, skb->data, copied))
+				copied = -EFAULT;
 
-		if (copy_to_user(buf, skb->data, copied)) {
 			kfree_skb(skb);
-			return -EFAULT;
-		}
+		} else
+			copied = -EAGAIN;
 	} else {
 		copied = __kfifo_get_user(chan->read_fifo, buf, count);
 		if (copied < 0)
-			return -EFAULT;
+			copied = -EFAULT;
 	}
 
+	up(&chan->sem);
+
 	return copied;
 }
 
@@ -598,13 +1098,11 @@ ssize_t __kfifo_put_user(
 	return len;
 }
 
-static ssize_t ksup_cdev_write_stream(
-	struct file *file,
+static ssize_t ksup_chan_write_stream(
+	struct ksup_chan *chan,
 	const char __user *buf,
-	size_t count,
-	loff_t *offp)
+	size_t count)
 {
-	struct ksup_chan *chan = file->private_data;
 	struct ks_streamframe *sf;
 	ssize_t copied_bytes;
 	int err;
@@ -614,7 +1112,7 @@ static ssize_t ksup_cdev_write_stream(
 		goto err_no_write;
 	}
 
-	sf = ks_sf_alloc();
+	sf = ks_sf_alloc(count);
 	if (!sf) {
 		err = -ENOMEM;
 		goto err_sf_alloc;
@@ -693,6 +1191,53 @@ err_no_write:
 	return err;
 }
 
+static ssize_t ksup_mux_write(
+	struct ksup_chan *owner,
+	const char __user *buf,
+	size_t count)
+{
+	struct ksup_mux_hdr hdr;
+	struct ksup_chan *chan;
+	size_t done = 0;
+	ssize_t err = 0;
+
+	while(count - done >= sizeof(hdr)) {
+		if (copy_from_user(&hdr, buf + done, sizeof(hdr))) {
+			err = -EFAULT;
+			break;
+		}
+
+		if (hdr.len > count - done - sizeof(hdr)) {
+			err = -EINVAL;
+			break;
+		}
+
+		/* Records for nodes just removed are dropped, a record
+		 * which cannot be pushed stops the write and its error is
+		 * returned if nothing was written before it.
+		 */
+		chan = ksup_mux_get_member(owner, hdr.node_id);
+		if (chan) {
+			ssize_t res;
+
+			res = ksup_chan_write_stream(chan,
+					buf + done + sizeof(hdr),
+					hdr.len);
+
+			ksup_chan_put(chan);
+
+			if (res < 0) {
+				err = res;
+				break;
+			}
+		}
+
+		done += sizeof(hdr) + hdr.len;
+	}
+
+	return done ? done : err;
+}
+
 static ssize_t ksup_cdev_write(
 	struct file *file,
 	const char __user *buf,
@@ -700,18 +1245,143 @@ static ssize_t ksup_cdev_write(
 	loff_t *offp)
 {
 	struct ksup_chan *chan = file->private_data;
+	ssize_t res;
 
 	if (!chan->ks_chan_tx)
 		return -EBADF;
 
-	if (!chan->ks_chan_tx->pipeline ||
-	     chan->ks_chan_tx->pipeline->status != KS_PIPELINE_STATUS_FLOWING)
-		return -ENOTCONN;
-
-	if (chan->framed)
-		return ksup_cdev_write_frame(file, buf, count, offp);
+	if (down_interruptible(&chan->sem))
+		return -ERESTARTSYS;
+
+	if (chan->mmap_ctl)
+		res = -EINVAL;
+	else if (chan->mux_buf)
+		res = ksup_mux_write(chan, buf, count);
+	else if (!chan->ks_chan_tx->pipeline ||
+	    chan->ks_chan_tx->pipeline->status != KS_PIPELINE_STATUS_FLOWING)
+		res = -ENOTCONN;
+	else if (chan->framed)
+		res = ksup_cdev_write_frame(file, buf, count, offp);
 	else
-		return ksup_cdev_write_stream(file, buf, count, offp);
+		res = ksup_chan_write_stream(chan, buf, count);
+
+	up(&chan->sem);
+
+	return res;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,18)
+static int ksup_cdev_set_mmap_mode(
+	struct ksup_chan *chan,
+	struct ksup_mmap_req __user *ureq)
+{
+	return -EOPNOTSUPP;
+}
+#else
+static u32 ksup_ring_size(u32 size)
+{
+	if (size < 256)
+		size = 256;
+
+	if (size > 65536)
+		size = 65536;
+
+	return roundup_pow_of_two(size);
+}
+
+static int ksup_cdev_set_mmap_mode(
+	struct ksup_chan *chan,
+	struct ksup_mmap_req __user *ureq)
+{
+	struct ksup_mmap_req req;
+	struct ksup_mmap_ctl *ctl;
+	void *area;
+	int err;
+
+	if (copy_from_user(&req, ureq, sizeof(req))) {
+		err = -EFAULT;
+		goto err_copy_from_user;
+	}
+
+	if (down_interruptible(&chan->sem)) {
+		err = -ERESTARTSYS;
+		goto err_down;
+	}
+
+	if (chan->framed || chan->mmap_area || chan->mux_buf) {
+		err = -EINVAL;
+		goto err_invalid;
+	}
+
+	chan->mmap_rx_size = chan->ks_chan_rx ? ksup_ring_size(req.rx_size) : 0;
+	chan->mmap_tx_size = chan->ks_chan_tx ? ksup_ring_size(req.tx_size) : 0;
+	chan->mmap_size = PAGE_SIZE +
+		PAGE_ALIGN(chan->mmap_rx_size) +
+		PAGE_ALIGN(chan->mmap_tx_size);
+
+	area = vmalloc_user(chan->mmap_size);
+	if (!area) {
+		err = -ENOMEM;
+		goto err_vmalloc;
+	}
+
+	ctl = area;
+	ctl->rx.size = chan->mmap_rx_size;
+	ctl->rx.offset = PAGE_SIZE;
+	ctl->tx.size = chan->mmap_tx_size;
+	ctl->tx.offset = PAGE_SIZE + PAGE_ALIGN(chan->mmap_rx_size);
+
+	req.map_size = chan->mmap_size;
+	if (copy_to_user(ureq, &req, sizeof(req))) {
+		err = -EFAULT;
+		goto err_copy_to_user;
+	}
+
+	chan->mmap_area = area;
+	chan->mmap_rx_buf = area + ctl->rx.offset;
+	chan->mmap_tx_buf = area + ctl->tx.offset;
+
+	/* The data path only looks at mmap_ctl */
+	smp_wmb();
+	chan->mmap_ctl = ctl;
+
+	up(&chan->sem);
+
+	ksup_debug(2, "Userport %06d in mmap mode, rx=%d tx=%d\n",
+		chan->id, chan->mmap_rx_size, chan->mmap_tx_size);
+
+	return 0;
+
+err_copy_to_user:
+	vfree(area);
+err_vmalloc:
+err_invalid:
+	up(&chan->sem);
+err_down:
+err_copy_from_user:
+
+	return err;
+}
+#endif
+
+static int ksup_cdev_mmap(
+	struct file *file,
+	struct vm_area_struct *vma)
+{
+	struct ksup_chan *chan = file->private_data;
+
+	if (!chan->mmap_area)
+		return -ENODEV;
+
+	if (vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start > chan->mmap_size)
+		return -EINVAL;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,18)
+	return -EOPNOTSUPP;
+#else
+	return remap_vmalloc_range(vma, chan->mmap_area, 0);
+#endif
 }
 
 static int ksup_cdev_ioctl(
@@ -740,6 +1410,30 @@ static int ksup_cdev_ioctl(
 	}
 	break;
 
+	case KS_UP_GET_MUX_OVERRUNS:
+		return put_user(chan->mux_overruns, (unsigned int __user *)arg);
+	break;
+
+	case KS_UP_SET_RX_WATERMARK:
+		if ((int)arg <= 0)
+			return -EINVAL;
+
+		chan->rx_watermark = arg;
+	break;
+
+	case KS_UP_MUX_ADD:
+		return ksup_mux_add(chan, (unsigned int __user *)arg);
+	break;
+
+	case KS_UP_MUX_DEL:
+		return ksup_mux_del(chan, arg);
+	break;
+
+	case KS_UP_SET_MMAP_MODE:
+		return ksup_cdev_set_mmap_mode(chan,
+				(struct ksup_mmap_req __user *)arg);
+	break;
+
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -763,16 +1457,43 @@ static unsigned int ksup_cdev_poll(
 
 	poll_wait(file, &chan->read_wait_queue, wait);
 
-	if (chan->ks_chan_rx) {
-		if (chan->framed) {
-			if (!skb_queue_empty(&chan->read_queue))
-				return POLLIN | POLLRDNORM;
-		} else {
-			if (kfifo_len(chan->read_fifo))
-				return POLLIN | POLLRDNORM;
-		}
+	if (chan->mux_buf) {
+		unsigned int mask = 0;
+
+		if (chan->ks_chan_rx && ksup_chan_rx_ready(chan))
+			mask |= POLLIN | POLLRDNORM;
+
+		/* Records are pushed right away, writes never block */
+		if (chan->ks_chan_tx)
+			mask |= POLLOUT | POLLWRNORM;
+
+		return mask;
+	}
+
+	if (chan->mmap_ctl) {
+		struct ksup_mmap_ctl *ctl = chan->mmap_ctl;
+		unsigned int mask = 0;
+
+		if (chan->ks_chan_rx && ksup_chan_rx_ready(chan))
+			mask |= POLLIN | POLLRDNORM;
+
+		if (chan->ks_chan_rx && chan->rx_stopped)
+			mask |= POLLHUP;
+
+		if (chan->ks_chan_tx &&
+		    ctl->tx.head - ctl->tx.tail < chan->mmap_tx_size)
+			mask |= POLLOUT | POLLWRNORM;
+
+		return mask;
 	}
 
+	if (chan->ks_chan_rx && ksup_chan_rx_ready(chan))
+		return POLLIN | POLLRDNORM;
+
+	/* Readers would get -ENOTCONN */
+	if (chan->ks_chan_rx && chan->rx_stopped)
+		return POLLHUP;
+
 	// TODO FIXME XXX XXX Implement outbound waiting!!!!!!!!!!!!!!
 
 	return 0;
@@ -788,6 +1509,7 @@ static struct file_operations ksup_fops =
 	.release	= ksup_cdev_release,
 	.llseek		= no_llseek,
 	.poll		= ksup_cdev_poll,
+	.mmap		= ksup_cdev_mmap,
 };
 
 #ifndef HAVE_CLASS_DEV_DEVT
@@ -270,21 +270,29 @@ static void vgsm_me_rx_chan_stimulus(
 	struct vgsm_card *card = me->card;
 	size_t copied_octets = 0;
 	int inpos;
+	int avail;
 	u8 *bufp;
 
 	struct ks_streamframe *sf;
 
-	sf = ks_sf_alloc();
-	if (!sf)
-		return;
-
-	bufp = sf->data;
-
 	vgsm_card_lock(card);
 
 	inpos = (le32_to_cpu(vgsm_inl(card, VGSM_DMA_RD_CUR)) -
 				card->readdma_bus_mem) / 4;
 
+	if (inpos >= me_rx->fifo_pos)
+		avail = inpos - me_rx->fifo_pos;
+	else
+		avail = inpos + me_rx->fifo_size - me_rx->fifo_pos;
+
+	sf = ks_sf_alloc(avail);
+	if (!sf) {
+		vgsm_card_unlock(card);
+		return;
+	}
+
+	bufp = sf->data;
+
 	while(me_rx->fifo_pos != inpos && copied_octets < sf->size) {
 
 		*bufp++ = *(u8 *)(card->readdma_mem +
@@ -231,18 +231,13 @@ static void vgsm_me_rx_chan_stimulus(
 	struct vgsm_me *me = me_rx->me;
 	struct vgsm_card *card = me->card;
 	int inpos;
+	int avail;
 	u8 *bufp;
 	int sample_size = me_rx->compander_enabled ?
 				sizeof(s8) : sizeof(u16);
 
 	struct ks_streamframe *sf;
 
-	sf = ks_sf_alloc();
-	if (!sf)
-		return;
-
-	bufp = sf->data;
-
 	vgsm_card_lock(card);
 
 	inpos = vgsm_inl(card, VGSM_R_ME_FIFO_RX_IN(me->id));
@@ -253,6 +248,19 @@ static void vgsm_me_rx_chan_stimulus(
 		me_rx->fifo_out &= ~1;
 	}
 
+	if (inpos >= me_rx->fifo_out)
+		avail = inpos - me_rx->fifo_out;
+	else
+		avail = inpos + me_rx->fifo_size - me_rx->fifo_out;
+
+	sf = ks_sf_alloc(avail);
+	if (!sf) {
+		vgsm_card_unlock(card);
+		return;
+	}
+
+	bufp = sf->data;
+
 	while(me_rx->fifo_out != inpos && sf->len < sf->size) {
 
 		if (sf->size - sf->len < sample_size)
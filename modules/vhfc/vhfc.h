@@ -0,0 +1,185 @@
+/*
+ * vISDN virtual HFC loopback card
+ *
+ * Copyright (C) 2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+#ifndef _VHFC_H
+#define _VHFC_H
+
+#ifdef __KERNEL__
+
+#include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/skbuff.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+#include <linux/kstreamer/duplex.h>
+#include <linux/kstreamer/tick.h>
+#include <linux/visdn/port.h>
+
+#define vhfc_MODULE_NAME "vhfc"
+#define vhfc_MODULE_PREFIX vhfc_MODULE_NAME ": "
+#define vhfc_MODULE_DESCR "vISDN virtual HFC loopback card"
+
+#define VHFC_DEFAULT_PORTS 4
+#define VHFC_MAX_PORTS 32
+
+/* Period of the card's clock, in usecs, as the HFC timer interrupt */
+#define VHFC_DEFAULT_CLOCK_PERIOD 1000
+
+#define VHFC_DEFAULT_FIFO_SIZE 2048
+#define VHFC_DEFAULT_FIFO_FRAMES 16
+
+/* A BRI port has D, B1 and B2, a PRI port D and 30 B channels */
+#define VHFC_BRI_CHANS 3
+#define VHFC_PRI_CHANS 31
+#define VHFC_MAX_CHANS VHFC_PRI_CHANS
+
+#define VHFC_CHAN_D 0
+
+#define to_vhfc_chan_rx(chan) \
+		container_of(chan, struct vhfc_chan_rx, ks_chan)
+#define to_vhfc_chan_tx(chan) \
+		container_of(chan, struct vhfc_chan_tx, ks_chan)
+#define to_vhfc_port(port) \
+		container_of(port, struct vhfc_port, visdn_port)
+
+/* RAM replacement of an HFC FIFO, a ring of octets for transparent data
+ * and a queue of frames for HDLC data.
+ */
+struct vhfc_fifo
+{
+	u8 *data;
+	int size;
+	int head;
+	int tail;
+
+	struct sk_buff_head frames;
+	int frames_max;
+
+	int enabled;
+	int framer_enabled;
+};
+
+struct vhfc_chan;
+
+struct vhfc_chan_rx
+{
+	struct ks_chan ks_chan;
+
+	struct vhfc_chan *chan;
+
+	struct vhfc_fifo fifo;
+};
+
+#define VHFC_CHAN_TX_STATUS_STOPPED 0
+
+struct vhfc_chan_tx
+{
+	struct ks_chan ks_chan;
+
+	struct vhfc_chan *chan;
+
+	struct vhfc_fifo fifo;
+
+	unsigned long status;
+
+	/* Bits the line may carry and have not been sent yet */
+	int credit;
+	/* Fraction of a bit left over by the last period, in millionths */
+	u32 credit_frac;
+};
+
+struct vhfc_port;
+struct vhfc_chan
+{
+	struct vhfc_port *port;
+
+	int id;
+	int bitrate;
+
+	struct ks_duplex ks_duplex;
+
+	struct vhfc_chan_rx rx;
+	struct vhfc_chan_tx tx;
+};
+
+struct vhfc_card;
+struct vhfc_port
+{
+	struct vhfc_card *card;
+
+	int id;
+
+	int nt_mode;
+	int enabled;
+	int activated;
+
+	/* The port at the other end of the virtual line */
+	struct vhfc_port *peer;
+
+	int num_chans;
+	struct vhfc_chan chans[VHFC_MAX_CHANS];
+
+	struct visdn_port visdn_port;
+};
+
+struct vhfc_card
+{
+	struct list_head node;
+
+	struct ks_node ks_node;
+
+	int id;
+
+	/* Protects all the FIFOs and the ports state */
+	spinlock_t lock;
+
+	/* The card's "timer interrupt", moves data along the lines */
+	struct hrtimer clock;
+	struct tasklet_struct clock_tasklet;
+	int clock_running;
+
+	struct ks_tick_source ks_tick_source;
+	int tick_source_registered;
+
+	int num_ports;
+	struct vhfc_port *ports;
+};
+
+#if defined(DEBUG_CODE) && defined(DEBUG_DEFAULTS)
+#define vhfc_debug(dbglevel, format, arg...)			\
+	if (debug_level >= dbglevel)				\
+		printk(KERN_DEBUG vhfc_MODULE_PREFIX		\
+			format,					\
+			## arg)
+#else
+#define vhfc_debug(format, arg...) do {} while (0)
+#endif
+
+#define vhfc_msg(level, format, arg...)				\
+	printk(level vhfc_MODULE_PREFIX				\
+		format,						\
+		## arg)
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#endif
+
+#endif
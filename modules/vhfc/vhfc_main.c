@@ -0,0 +1,1299 @@
+/*
+ * vISDN virtual HFC loopback card
+ *
+ * Copyright (C) 2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+/* Each virtual card has a number of BRI or PRI ports, wired in pairs:
+ * even ports are NT and their TX lines are the RX lines of the following
+ * TE port and vice versa. Every port channel is a duplex with an RX and
+ * a TX chan to and from the softswitch, as the HFC's sys chans, backed by
+ * FIFOs in RAM.
+ *
+ * The card's clock plays the role of the HFC timer interrupt: at every
+ * period each line carries as many bits as its bitrate allows from the
+ * TX FIFO to the peer's RX FIFO. Frames are then pushed to the softswitch
+ * while transparent data is read by the RX chans' stimulus, optionally
+ * clocked by the card itself when used as tick source.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/rwsem.h>
+#include <asm/div64.h>
+
+#include <linux/kstreamer/kstreamer.h>
+#include <linux/kstreamer/node.h>
+#include <linux/kstreamer/channel.h>
+#include <linux/kstreamer/duplex.h>
+#include <linux/kstreamer/pipeline.h>
+#include <linux/kstreamer/streamframe.h>
+#include <linux/kstreamer/softswitch.h>
+#include <linux/kstreamer/feature.h>
+#include <linux/kstreamer/hdlc_framer.h>
+
+#include "vhfc.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,21)
+#define VHFC_HRTIMER_MODE HRTIMER_REL
+#define vhfc_hrtimer_restart_t int
+#else
+#define VHFC_HRTIMER_MODE HRTIMER_MODE_REL
+#define vhfc_hrtimer_restart_t enum hrtimer_restart
+#endif
+
+#ifdef DEBUG_CODE
+#ifdef DEBUG_DEFAULTS
+int debug_level = 3;
+#else
+int debug_level = 0;
+#endif
+#endif
+
+static int cards = 1;
+static int ports = VHFC_DEFAULT_PORTS;
+static int pri = 0;
+static int clock_period = VHFC_DEFAULT_CLOCK_PERIOD;
+static int fifo_size = VHFC_DEFAULT_FIFO_SIZE;
+static int fifo_frames = VHFC_DEFAULT_FIFO_FRAMES;
+static int tick_source = 0;
+
+static struct list_head vhfc_cards_list = LIST_HEAD_INIT(vhfc_cards_list);
+static DECLARE_RWSEM(vhfc_cards_list_sem);
+
+static struct ks_feature *vhfc_hdlc_framer_class;
+static struct ks_feature *vhfc_hdlc_deframer_class;
+
+static struct vhfc_card *vhfc_card_get(struct vhfc_card *card)
+{
+	if (ks_node_get(&card->ks_node))
+		return card;
+	else
+		return NULL;
+}
+
+static void vhfc_card_put(struct vhfc_card *card)
+{
+	ks_node_put(&card->ks_node);
+}
+
+static inline void vhfc_card_lock(struct vhfc_card *card)
+{
+	spin_lock_bh(&card->lock);
+}
+
+static inline void vhfc_card_unlock(struct vhfc_card *card)
+{
+	spin_unlock_bh(&card->lock);
+}
+
+/*------------------------------- FIFOs -------------------------------------*/
+
+static int vhfc_fifo_init(struct vhfc_fifo *fifo)
+{
+	fifo->data = kmalloc(fifo_size, GFP_KERNEL);
+	if (!fifo->data)
+		return -ENOMEM;
+
+	fifo->size = fifo_size;
+	fifo->head = 0;
+	fifo->tail = 0;
+
+	skb_queue_head_init(&fifo->frames);
+	fifo->frames_max = fifo_frames;
+
+	return 0;
+}
+
+static void vhfc_fifo_free(struct vhfc_fifo *fifo)
+{
+	skb_queue_purge(&fifo->frames);
+
+	kfree(fifo->data);
+	fifo->data = NULL;
+}
+
+/* Must be called with card lock held */
+static void vhfc_fifo_reset(struct vhfc_fifo *fifo)
+{
+	fifo->head = 0;
+	fifo->tail = 0;
+
+	skb_queue_purge(&fifo->frames);
+}
+
+static inline int vhfc_fifo_used(struct vhfc_fifo *fifo)
+{
+	return (fifo->head - fifo->tail + fifo->size) % fifo->size;
+}
+
+static inline int vhfc_fifo_free_space(struct vhfc_fifo *fifo)
+{
+	return fifo->size - vhfc_fifo_used(fifo) - 1;
+}
+
+/* Must be called with card lock held */
+static int vhfc_fifo_write(
+	struct vhfc_fifo *fifo,
+	const u8 *data, int len)
+{
+	int copied = min(len, vhfc_fifo_free_space(fifo));
+	int chunk = min(copied, fifo->size - fifo->head);
+
+	memcpy(fifo->data + fifo->head, data, chunk);
+	memcpy(fifo->data, data + chunk, copied - chunk);
+
+	fifo->head = (fifo->head + copied) % fifo->size;
+
+	return copied;
+}
+
+/* Must be called with card lock held */
+static int vhfc_fifo_read(
+	struct vhfc_fifo *fifo,
+	u8 *data, int len)
+{
+	int copied = min(len, vhfc_fifo_used(fifo));
+	int chunk = min(copied, fifo->size - fifo->tail);
+
+	memcpy(data, fifo->data + fifo->tail, chunk);
+	memcpy(data + chunk, fifo->data, copied - chunk);
+
+	fifo->tail = (fifo->tail + copied) % fifo->size;
+
+	return copied;
+}
+
+/*------------------------------- Lines -------------------------------------*/
+
+/*
+ * Must be called with card lock held. Moves what the line can carry in
+ * a clock period from chan_tx to the RX FIFO at the other end, dst is
+ * NULL if nobody is listening and data is lost as on a real line.
+ */
+static void vhfc_line_transfer(
+	struct vhfc_chan_tx *chan_tx,
+	struct vhfc_fifo *dst)
+{
+	struct vhfc_fifo *src = &chan_tx->fifo;
+	struct sk_buff *skb;
+	u8 buf[64];
+	u64 bits;
+	int octets;
+
+	if (dst && !dst->enabled)
+		dst = NULL;
+
+	bits = (u64)chan_tx->chan->bitrate * clock_period +
+						chan_tx->credit_frac;
+	chan_tx->credit_frac = do_div(bits, USEC_PER_SEC);
+	chan_tx->credit += bits;
+
+	while((skb = skb_peek(&src->frames)) &&
+	      chan_tx->credit >= skb->len * 8) {
+		skb_unlink(skb, &src->frames);
+
+		chan_tx->credit -= skb->len * 8;
+
+		if (dst && skb_queue_len(&dst->frames) < dst->frames_max)
+			skb_queue_tail(&dst->frames, skb);
+		else
+			kfree_skb(skb);
+	}
+
+	octets = min(chan_tx->credit / 8, vhfc_fifo_used(src));
+	chan_tx->credit -= octets * 8;
+
+	while(octets > 0) {
+		int len = vhfc_fifo_read(src, buf, min(octets, (int)sizeof(buf)));
+
+		if (dst)
+			vhfc_fifo_write(dst, buf, len);
+
+		octets -= len;
+	}
+
+	/* An idle line transmits fill, credit is not saved */
+	if (skb_queue_empty(&src->frames) && !vhfc_fifo_used(src))
+		chan_tx->credit = 0;
+}
+
+/* Must be called with card lock held */
+static void vhfc_port_transfer(struct vhfc_port *port)
+{
+	struct vhfc_port *peer = port->activated ? port->peer : NULL;
+	int i;
+
+	for (i=0; i<port->num_chans; i++)
+		vhfc_line_transfer(&port->chans[i].tx,
+			peer ? &peer->chans[i].rx.fifo : NULL);
+}
+
+static void vhfc_card_clock_tasklet(unsigned long data)
+{
+	struct vhfc_card *card = (struct vhfc_card *)data;
+	int i;
+	int j;
+
+	vhfc_card_lock(card);
+
+	for (i=0; i<card->num_ports; i++)
+		vhfc_port_transfer(&card->ports[i]);
+
+	vhfc_card_unlock(card);
+
+	for (i=0; i<card->num_ports; i++) {
+		struct vhfc_port *port = &card->ports[i];
+
+		for (j=0; j<port->num_chans; j++) {
+			struct vhfc_chan *chan = &port->chans[j];
+			struct sk_buff *skb;
+
+			while((skb = skb_dequeue(&chan->rx.fifo.frames))) {
+				if (kss_chan_push_frame(&chan->rx.ks_chan,
+							skb) != KSS_TX_OK)
+					kfree_skb(skb);
+			}
+
+			if (test_bit(VHFC_CHAN_TX_STATUS_STOPPED,
+						&chan->tx.status) &&
+			    skb_queue_len(&chan->tx.fifo.frames) <
+						chan->tx.fifo.frames_max &&
+			    test_and_clear_bit(VHFC_CHAN_TX_STATUS_STOPPED,
+						&chan->tx.status))
+				kss_chan_wake_queue(&chan->tx.ks_chan);
+		}
+	}
+}
+
+static inline ktime_t vhfc_clock_interval(void)
+{
+	return ktime_set(0, clock_period * NSEC_PER_USEC);
+}
+
+static vhfc_hrtimer_restart_t vhfc_card_clock_func(struct hrtimer *timer)
+{
+	struct vhfc_card *card = container_of(timer, struct vhfc_card, clock);
+
+	tasklet_schedule(&card->clock_tasklet);
+
+	if (card->tick_source_registered)
+		ks_tick_source_fire(&card->ks_tick_source);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,25)
+	hrtimer_forward(timer, timer->base->get_time(), vhfc_clock_interval());
+#else
+	hrtimer_forward_now(timer, vhfc_clock_interval());
+#endif
+
+	return HRTIMER_RESTART;
+}
+
+/*------------------------------- Duplex ------------------------------------*/
+
+static void vhfc_chan_duplex_release(struct ks_duplex *duplex)
+{
+	struct vhfc_chan *chan =
+		container_of(duplex, struct vhfc_chan, ks_duplex);
+
+	vhfc_debug(3, "vhfc_chan_duplex_release()\n");
+
+	vhfc_card_put(chan->port->card);
+}
+
+static struct ks_duplex_ops vhfc_chan_duplex_ops =
+{
+	.owner		= THIS_MODULE,
+
+	.release	= vhfc_chan_duplex_release,
+};
+
+/*------------------------------- RX Link -----------------------------------*/
+
+static void vhfc_chan_rx_chan_release(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_rx *chan_rx = to_vhfc_chan_rx(ks_chan);
+
+	vhfc_debug(3, "vhfc_chan_rx_chan_release()\n");
+
+	vhfc_card_put(chan_rx->chan->port->card);
+}
+
+static int vhfc_chan_rx_chan_connect(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_rx *chan_rx = to_vhfc_chan_rx(ks_chan);
+
+	chan_rx->fifo.framer_enabled = FALSE;
+
+	return 0;
+}
+
+static void vhfc_chan_rx_chan_disconnect(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_rx *chan_rx = to_vhfc_chan_rx(ks_chan);
+
+	chan_rx->fifo.framer_enabled = FALSE;
+}
+
+static int vhfc_chan_rx_chan_open(struct ks_chan *ks_chan)
+{
+	return 0;
+}
+
+static void vhfc_chan_rx_chan_close(struct ks_chan *ks_chan)
+{
+}
+
+static int vhfc_chan_rx_chan_start(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_rx *chan_rx = to_vhfc_chan_rx(ks_chan);
+	struct vhfc_card *card = chan_rx->chan->port->card;
+
+	vhfc_card_lock(card);
+	vhfc_fifo_reset(&chan_rx->fifo);
+	chan_rx->fifo.enabled = TRUE;
+	vhfc_card_unlock(card);
+
+	return 0;
+}
+
+static void vhfc_chan_rx_chan_stop(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_rx *chan_rx = to_vhfc_chan_rx(ks_chan);
+	struct vhfc_card *card = chan_rx->chan->port->card;
+
+	vhfc_card_lock(card);
+	chan_rx->fifo.enabled = FALSE;
+	vhfc_fifo_reset(&chan_rx->fifo);
+	vhfc_card_unlock(card);
+}
+
+static void vhfc_chan_rx_chan_stimulus(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_rx *chan_rx = to_vhfc_chan_rx(ks_chan);
+	struct vhfc_card *card = chan_rx->chan->port->card;
+	struct ks_streamframe *sf;
+
+	vhfc_card_lock(card);
+
+	/* Framed data is pushed by the clock as frames complete */
+	if (chan_rx->fifo.framer_enabled && !vhfc_fifo_used(&chan_rx->fifo)) {
+		vhfc_card_unlock(card);
+		return;
+	}
+
+	sf = ks_sf_alloc(vhfc_fifo_used(&chan_rx->fifo));
+	if (!sf) {
+		vhfc_card_unlock(card);
+		return;
+	}
+
+	sf->len = vhfc_fifo_read(&chan_rx->fifo, sf->data, sf->size);
+
+	vhfc_card_unlock(card);
+
+	kss_chan_push_raw(ks_chan, sf);
+
+	ks_sf_put(sf);
+}
+
+static int vhfc_chan_rx_chan_get_attr_count(struct ks_chan *ks_chan)
+{
+	return 1;
+}
+
+static int vhfc_chan_rx_chan_get_attr(
+	struct ks_chan *ks_chan,
+	int index,
+	__u16 *type,
+	void *buf,
+	int *len)
+{
+	struct vhfc_chan_rx *chan_rx = to_vhfc_chan_rx(ks_chan);
+	struct ks_hdlc_deframer_descr *descr = buf;
+
+	if (index != 0)
+		return -EINVAL;
+
+	if (*len < sizeof(struct ks_hdlc_deframer_descr))
+		return -ENOSPC;
+
+	*type = vhfc_hdlc_deframer_class->id;
+	*len = sizeof(struct ks_hdlc_deframer_descr);
+
+	memset(descr, 0, sizeof(*descr));
+	descr->hardware = 1;
+	descr->enabled = chan_rx->fifo.framer_enabled ? 1 : 0;
+
+	return 0;
+}
+
+static int vhfc_chan_rx_chan_set_attr(
+	struct ks_chan *ks_chan,
+	__u16 type,
+	void *buf,
+	int len)
+{
+	struct vhfc_chan_rx *chan_rx = to_vhfc_chan_rx(ks_chan);
+	struct ks_hdlc_deframer_descr *descr = buf;
+
+	if (type != vhfc_hdlc_deframer_class->id)
+		return -ENOENT;
+
+	if (len < sizeof(struct ks_hdlc_deframer_descr))
+		return -EINVAL;
+
+	chan_rx->fifo.framer_enabled = descr->enabled;
+
+	return 0;
+}
+
+static struct ks_chan_ops vhfc_chan_rx_chan_ops =
+{
+	.owner		= THIS_MODULE,
+
+	.release	= vhfc_chan_rx_chan_release,
+	.connect	= vhfc_chan_rx_chan_connect,
+	.disconnect	= vhfc_chan_rx_chan_disconnect,
+	.open		= vhfc_chan_rx_chan_open,
+	.close		= vhfc_chan_rx_chan_close,
+	.start		= vhfc_chan_rx_chan_start,
+	.stop		= vhfc_chan_rx_chan_stop,
+	.stimulus	= vhfc_chan_rx_chan_stimulus,
+	.get_attr_count	= vhfc_chan_rx_chan_get_attr_count,
+	.get_attr	= vhfc_chan_rx_chan_get_attr,
+	.set_attr	= vhfc_chan_rx_chan_set_attr,
+};
+
+/*------------------------------- TX Link -----------------------------------*/
+
+static void vhfc_chan_tx_chan_release(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+
+	vhfc_debug(3, "vhfc_chan_tx_chan_release()\n");
+
+	vhfc_card_put(chan_tx->chan->port->card);
+}
+
+static int vhfc_chan_tx_chan_connect(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+
+	chan_tx->fifo.framer_enabled = FALSE;
+
+	return 0;
+}
+
+static void vhfc_chan_tx_chan_disconnect(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+
+	chan_tx->fifo.framer_enabled = FALSE;
+}
+
+static int vhfc_chan_tx_chan_open(struct ks_chan *ks_chan)
+{
+	return 0;
+}
+
+static void vhfc_chan_tx_chan_close(struct ks_chan *ks_chan)
+{
+}
+
+static int vhfc_chan_tx_chan_start(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+	struct vhfc_card *card = chan_tx->chan->port->card;
+
+	vhfc_card_lock(card);
+	vhfc_fifo_reset(&chan_tx->fifo);
+	chan_tx->credit = 0;
+	chan_tx->credit_frac = 0;
+	chan_tx->fifo.enabled = TRUE;
+	vhfc_card_unlock(card);
+
+	return 0;
+}
+
+static void vhfc_chan_tx_chan_stop(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+	struct vhfc_card *card = chan_tx->chan->port->card;
+
+	vhfc_card_lock(card);
+	chan_tx->fifo.enabled = FALSE;
+	vhfc_fifo_reset(&chan_tx->fifo);
+	vhfc_card_unlock(card);
+}
+
+static int vhfc_chan_tx_chan_get_attr_count(struct ks_chan *ks_chan)
+{
+	return 1;
+}
+
+static int vhfc_chan_tx_chan_get_attr(
+	struct ks_chan *ks_chan,
+	int index,
+	__u16 *type,
+	void *buf,
+	int *len)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+	struct ks_hdlc_framer_descr *descr = buf;
+
+	if (index != 0)
+		return -EINVAL;
+
+	if (*len < sizeof(struct ks_hdlc_framer_descr))
+		return -ENOSPC;
+
+	*type = vhfc_hdlc_framer_class->id;
+	*len = sizeof(struct ks_hdlc_framer_descr);
+
+	memset(descr, 0, sizeof(*descr));
+	descr->hardware = 1;
+	descr->enabled = chan_tx->fifo.framer_enabled ? 1 : 0;
+
+	return 0;
+}
+
+static int vhfc_chan_tx_chan_set_attr(
+	struct ks_chan *ks_chan,
+	__u16 type,
+	void *buf,
+	int len)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+	struct ks_hdlc_framer_descr *descr = buf;
+
+	if (type != vhfc_hdlc_framer_class->id)
+		return -ENOENT;
+
+	if (len < sizeof(struct ks_hdlc_framer_descr))
+		return -EINVAL;
+
+	chan_tx->fifo.framer_enabled = descr->enabled;
+
+	return 0;
+}
+
+static struct ks_chan_ops vhfc_chan_tx_chan_ops =
+{
+	.owner		= THIS_MODULE,
+
+	.release	= vhfc_chan_tx_chan_release,
+	.connect	= vhfc_chan_tx_chan_connect,
+	.disconnect	= vhfc_chan_tx_chan_disconnect,
+	.open		= vhfc_chan_tx_chan_open,
+	.close		= vhfc_chan_tx_chan_close,
+	.start		= vhfc_chan_tx_chan_start,
+	.stop		= vhfc_chan_tx_chan_stop,
+	.get_attr_count	= vhfc_chan_tx_chan_get_attr_count,
+	.get_attr	= vhfc_chan_tx_chan_get_attr,
+	.set_attr	= vhfc_chan_tx_chan_set_attr,
+};
+
+static int vhfc_chan_tx_push_frame(
+	struct ks_chan *ks_chan,
+	struct sk_buff *skb)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+	struct vhfc_card *card = chan_tx->chan->port->card;
+
+	vhfc_card_lock(card);
+
+	if (skb_queue_len(&chan_tx->fifo.frames) >= chan_tx->fifo.frames_max) {
+		set_bit(VHFC_CHAN_TX_STATUS_STOPPED, &chan_tx->status);
+		vhfc_card_unlock(card);
+
+		return KSS_TX_FULL;
+	}
+
+	skb_queue_tail(&chan_tx->fifo.frames, skb);
+
+	vhfc_card_unlock(card);
+
+	return KSS_TX_OK;
+}
+
+static int vhfc_chan_tx_push_raw(
+	struct ks_chan *ks_chan,
+	struct ks_streamframe *sf)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+	struct vhfc_card *card = chan_tx->chan->port->card;
+	int copied_octets;
+
+	vhfc_card_lock(card);
+	copied_octets = vhfc_fifo_write(&chan_tx->fifo, sf->data, sf->len);
+	vhfc_card_unlock(card);
+
+	return copied_octets;
+}
+
+static int vhfc_chan_tx_get_pressure(struct ks_chan *ks_chan)
+{
+	struct vhfc_chan_tx *chan_tx = to_vhfc_chan_tx(ks_chan);
+	struct vhfc_card *card = chan_tx->chan->port->card;
+	int pressure;
+
+	vhfc_card_lock(card);
+	pressure = vhfc_fifo_used(&chan_tx->fifo);
+	vhfc_card_unlock(card);
+
+	return pressure;
+}
+
+static struct kss_chan_from_ops vhfc_chan_tx_node_ops =
+{
+	.push_frame	= vhfc_chan_tx_push_frame,
+	.push_raw	= vhfc_chan_tx_push_raw,
+	.get_pressure	= vhfc_chan_tx_get_pressure,
+};
+
+/*------------------------------- Chans -------------------------------------*/
+
+static int vhfc_chan_create(
+	struct vhfc_chan *chan,
+	struct vhfc_port *port,
+	const char *name,
+	int id,
+	int bitrate)
+{
+	struct vhfc_card *card = port->card;
+	int err;
+
+	chan->port = port;
+	chan->id = id;
+	chan->bitrate = bitrate;
+
+	chan->rx.chan = chan;
+	chan->tx.chan = chan;
+
+	err = vhfc_fifo_init(&chan->rx.fifo);
+	if (err < 0)
+		goto err_rx_fifo_init;
+
+	err = vhfc_fifo_init(&chan->tx.fifo);
+	if (err < 0)
+		goto err_tx_fifo_init;
+
+	vhfc_card_get(card);
+	ks_duplex_create(&chan->ks_duplex, &vhfc_chan_duplex_ops, name,
+			&port->visdn_port.kobj);
+
+	vhfc_card_get(card);
+	ks_chan_create(&chan->rx.ks_chan,
+			&vhfc_chan_rx_chan_ops, "rx",
+			&chan->ks_duplex,
+			&chan->ks_duplex.kobj,
+			&card->ks_node,
+			&kss_softswitch.ks_node);
+
+	chan->rx.ks_chan.mtu = -1;
+	chan->rx.ks_chan.needs_tick = TRUE;
+
+	vhfc_card_get(card);
+	ks_chan_create(&chan->tx.ks_chan,
+			&vhfc_chan_tx_chan_ops, "tx",
+			&chan->ks_duplex,
+			&chan->ks_duplex.kobj,
+			&kss_softswitch.ks_node,
+			&card->ks_node);
+
+	chan->tx.ks_chan.from_ops = &vhfc_chan_tx_node_ops;
+	chan->tx.ks_chan.mtu = fifo_size;
+
+	return 0;
+
+	vhfc_fifo_free(&chan->tx.fifo);
+err_tx_fifo_init:
+	vhfc_fifo_free(&chan->rx.fifo);
+err_rx_fifo_init:
+
+	return err;
+}
+
+static void vhfc_chan_destroy(struct vhfc_chan *chan)
+{
+	ks_chan_destroy(&chan->tx.ks_chan);
+	ks_chan_destroy(&chan->rx.ks_chan);
+	ks_duplex_destroy(&chan->ks_duplex);
+
+	vhfc_fifo_free(&chan->tx.fifo);
+	vhfc_fifo_free(&chan->rx.fifo);
+}
+
+static int vhfc_chan_register(struct vhfc_chan *chan)
+{
+	int err;
+
+	err = ks_duplex_register(&chan->ks_duplex);
+	if (err < 0)
+		goto err_duplex_register;
+
+	err = ks_chan_register(&chan->rx.ks_chan);
+	if (err < 0)
+		goto err_chan_rx_register;
+
+	err = ks_chan_register(&chan->tx.ks_chan);
+	if (err < 0)
+		goto err_chan_tx_register;
+
+	return 0;
+
+	ks_chan_unregister(&chan->tx.ks_chan);
+err_chan_tx_register:
+	ks_chan_unregister(&chan->rx.ks_chan);
+err_chan_rx_register:
+	ks_duplex_unregister(&chan->ks_duplex);
+err_duplex_register:
+
+	return err;
+}
+
+static void vhfc_chan_unregister(struct vhfc_chan *chan)
+{
+	ks_chan_unregister(&chan->tx.ks_chan);
+	ks_chan_unregister(&chan->rx.ks_chan);
+	ks_duplex_unregister(&chan->ks_duplex);
+}
+
+/*------------------------------- Ports -------------------------------------*/
+
+static ssize_t vhfc_show_role(
+	struct visdn_port *visdn_port,
+	struct visdn_port_attribute *attr,
+	char *buf)
+{
+	struct vhfc_port *port = to_vhfc_port(visdn_port);
+
+	return snprintf(buf, PAGE_SIZE, "%s\n",
+		port->nt_mode ? "NT" : "TE");
+}
+
+static VISDN_PORT_ATTR(role, S_IRUGO,
+		vhfc_show_role,
+		NULL);
+
+static ssize_t vhfc_show_l1_state(
+	struct visdn_port *visdn_port,
+	struct visdn_port_attribute *attr,
+	char *buf)
+{
+	struct vhfc_port *port = to_vhfc_port(visdn_port);
+
+	if (port->nt_mode)
+		return snprintf(buf, PAGE_SIZE, "G%d\n",
+			port->activated ? 3 : 1);
+	else
+		return snprintf(buf, PAGE_SIZE, "F%d\n",
+			port->activated ? 7 : 3);
+}
+
+static VISDN_PORT_ATTR(l1_state, S_IRUGO,
+		vhfc_show_l1_state,
+		NULL);
+
+static struct visdn_port_attribute *vhfc_port_attributes[] =
+{
+	&visdn_port_attr_role,
+	&visdn_port_attr_l1_state,
+	NULL
+};
+
+static void vhfc_port_release(struct visdn_port *visdn_port)
+{
+	struct vhfc_port *port = to_vhfc_port(visdn_port);
+
+	vhfc_debug(3, "vhfc_port_release()\n");
+
+	vhfc_card_put(port->card);
+}
+
+static int vhfc_port_enable(struct visdn_port *visdn_port)
+{
+	struct vhfc_port *port = to_vhfc_port(visdn_port);
+
+	vhfc_card_lock(port->card);
+	port->enabled = TRUE;
+	vhfc_card_unlock(port->card);
+
+	return 0;
+}
+
+static int vhfc_port_deactivate(struct visdn_port *visdn_port)
+{
+	struct vhfc_port *port = to_vhfc_port(visdn_port);
+	struct vhfc_port *peer = port->peer;
+	int was_activated;
+
+	vhfc_card_lock(port->card);
+	was_activated = port->activated;
+	port->activated = FALSE;
+	if (peer)
+		peer->activated = FALSE;
+	vhfc_card_unlock(port->card);
+
+	if (was_activated) {
+		visdn_port_deactivated(&port->visdn_port);
+
+		if (peer)
+			visdn_port_deactivated(&peer->visdn_port);
+	}
+
+	return 0;
+}
+
+static int vhfc_port_disable(struct visdn_port *visdn_port)
+{
+	struct vhfc_port *port = to_vhfc_port(visdn_port);
+
+	vhfc_port_deactivate(visdn_port);
+
+	vhfc_card_lock(port->card);
+	port->enabled = FALSE;
+	vhfc_card_unlock(port->card);
+
+	return 0;
+}
+
+/* The line comes up as soon as both ends are enabled */
+static int vhfc_port_activate(struct visdn_port *visdn_port)
+{
+	struct vhfc_port *port = to_vhfc_port(visdn_port);
+	struct vhfc_port *peer = port->peer;
+	int activated = FALSE;
+
+	if (!peer)
+		return -ENOTCONN;
+
+	vhfc_card_lock(port->card);
+	if (port->enabled && peer->enabled && !port->activated) {
+		port->activated = TRUE;
+		peer->activated = TRUE;
+		activated = TRUE;
+	}
+	vhfc_card_unlock(port->card);
+
+	if (activated) {
+		visdn_port_activated(&port->visdn_port);
+		visdn_port_activated(&peer->visdn_port);
+	}
+
+	return 0;
+}
+
+static struct visdn_port_ops vhfc_port_ops =
+{
+	.owner		= THIS_MODULE,
+	.release	= vhfc_port_release,
+
+	.enable		= vhfc_port_enable,
+	.disable	= vhfc_port_disable,
+
+	.activate	= vhfc_port_activate,
+	.deactivate	= vhfc_port_deactivate,
+};
+
+static int vhfc_port_create(
+	struct vhfc_port *port,
+	struct vhfc_card *card,
+	int id)
+{
+	char name[16];
+	int err;
+	int i;
+
+	port->card = card;
+	port->id = id;
+	port->nt_mode = !(id & 1);
+
+	snprintf(name, sizeof(name), "%s%d", pri ? "e1" : "st", id);
+
+	vhfc_card_get(card);
+	visdn_port_create(&port->visdn_port, &vhfc_port_ops, name,
+			&card->ks_node.kobj);
+	port->visdn_port.type = pri ? "PRI" : "BRI";
+	port->visdn_port.driver_data = port;
+
+	port->num_chans = pri ? VHFC_PRI_CHANS : VHFC_BRI_CHANS;
+
+	for (i=0; i<port->num_chans; i++) {
+		if (i == VHFC_CHAN_D)
+			snprintf(name, sizeof(name), "D");
+		else
+			snprintf(name, sizeof(name), "B%d", i);
+
+		err = vhfc_chan_create(&port->chans[i], port, name, i,
+			i == VHFC_CHAN_D && !pri ? 16000 : 64000);
+		if (err < 0)
+			goto err_chan_create;
+	}
+
+	return 0;
+
+err_chan_create:
+	while(--i >= 0)
+		vhfc_chan_destroy(&port->chans[i]);
+
+	port->num_chans = 0;
+
+	visdn_port_destroy(&port->visdn_port);
+
+	return err;
+}
+
+static void vhfc_port_destroy(struct vhfc_port *port)
+{
+	int i;
+
+	for (i=0; i<port->num_chans; i++)
+		vhfc_chan_destroy(&port->chans[i]);
+
+	visdn_port_destroy(&port->visdn_port);
+}
+
+static int vhfc_port_register(struct vhfc_port *port)
+{
+	struct visdn_port_attribute **attr;
+	int err;
+	int i;
+
+	err = visdn_port_register(&port->visdn_port);
+	if (err < 0)
+		goto err_port_register;
+
+	for (i=0; i<port->num_chans; i++) {
+		err = vhfc_chan_register(&port->chans[i]);
+		if (err < 0)
+			goto err_chan_register;
+	}
+
+	for (attr = vhfc_port_attributes; *attr; attr++)
+		visdn_port_create_file(&port->visdn_port, *attr);
+
+	return 0;
+
+err_chan_register:
+	while(--i >= 0)
+		vhfc_chan_unregister(&port->chans[i]);
+
+	visdn_port_unregister(&port->visdn_port);
+err_port_register:
+
+	return err;
+}
+
+static void vhfc_port_unregister(struct vhfc_port *port)
+{
+	struct visdn_port_attribute **attr;
+	int i;
+
+	for (attr = vhfc_port_attributes; *attr; attr++)
+		visdn_port_remove_file(&port->visdn_port, *attr);
+
+	for (i=port->num_chans - 1; i>=0; i--)
+		vhfc_chan_unregister(&port->chans[i]);
+
+	visdn_port_unregister(&port->visdn_port);
+}
+
+/*------------------------------- Cards -------------------------------------*/
+
+static void vhfc_node_release(struct ks_node *ks_node)
+{
+	struct vhfc_card *card = container_of(ks_node, struct vhfc_card,
+								ks_node);
+
+	vhfc_debug(3, "vhfc_node_release()\n");
+
+	kfree(card->ports);
+	kfree(card);
+}
+
+static struct ks_node_ops vhfc_node_ops = {
+	.owner		= THIS_MODULE,
+
+	.release	= vhfc_node_release,
+};
+
+static void vhfc_card_destroy(struct vhfc_card *card)
+{
+	int i;
+
+	for (i=0; i<card->num_ports; i++)
+		vhfc_port_destroy(&card->ports[i]);
+
+	vhfc_card_put(card);
+}
+
+static struct vhfc_card *vhfc_card_create(int id)
+{
+	struct vhfc_card *card;
+	char name[16];
+	int err;
+	int i;
+
+	card = kmalloc(sizeof(*card), GFP_KERNEL);
+	if (!card)
+		goto err_alloc_card;
+
+	memset(card, 0, sizeof(*card));
+
+	card->ports = kmalloc(sizeof(*card->ports) * ports, GFP_KERNEL);
+	if (!card->ports)
+		goto err_alloc_ports;
+
+	memset(card->ports, 0, sizeof(*card->ports) * ports);
+
+	card->id = id;
+
+	spin_lock_init(&card->lock);
+
+	hrtimer_init(&card->clock, CLOCK_MONOTONIC, VHFC_HRTIMER_MODE);
+	card->clock.function = vhfc_card_clock_func;
+
+	tasklet_init(&card->clock_tasklet,
+		vhfc_card_clock_tasklet,
+		(unsigned long)card);
+
+	snprintf(name, sizeof(name), "vhfc%d", id);
+
+	ks_node_create(&card->ks_node, &vhfc_node_ops, name,
+			&ks_system_device.kobj);
+
+	for (i=0; i<ports; i++) {
+		err = vhfc_port_create(&card->ports[i], card, i);
+		if (err < 0)
+			break;
+
+		card->num_ports++;
+	}
+
+	if (card->num_ports < ports) {
+		vhfc_card_destroy(card);
+		return NULL;
+	}
+
+	/* NT ports are wired to the following TE port */
+	for (i=0; i + 1<card->num_ports; i += 2) {
+		card->ports[i].peer = &card->ports[i + 1];
+		card->ports[i + 1].peer = &card->ports[i];
+	}
+
+	return card;
+
+err_alloc_ports:
+	kfree(card);
+err_alloc_card:
+
+	return NULL;
+}
+
+static int vhfc_card_register(struct vhfc_card *card)
+{
+	int err;
+	int i;
+
+	err = ks_node_register(&card->ks_node);
+	if (err < 0)
+		goto err_node_register;
+
+	for (i=0; i<card->num_ports; i++) {
+		err = vhfc_port_register(&card->ports[i]);
+		if (err < 0)
+			goto err_port_register;
+	}
+
+	if (tick_source && card->id == 0) {
+		card->ks_tick_source.name = vhfc_MODULE_NAME;
+		card->ks_tick_source.period = clock_period;
+
+		if (ks_tick_source_register(&card->ks_tick_source) >= 0)
+			card->tick_source_registered = TRUE;
+	}
+
+	hrtimer_start(&card->clock, vhfc_clock_interval(), VHFC_HRTIMER_MODE);
+	card->clock_running = TRUE;
+
+	down_write(&vhfc_cards_list_sem);
+	list_add_tail(&vhfc_card_get(card)->node, &vhfc_cards_list);
+	up_write(&vhfc_cards_list_sem);
+
+	return 0;
+
+err_port_register:
+	while(--i >= 0)
+		vhfc_port_unregister(&card->ports[i]);
+
+	ks_node_unregister(&card->ks_node);
+err_node_register:
+
+	return err;
+}
+
+static void vhfc_card_unregister(struct vhfc_card *card)
+{
+	int i;
+
+	down_write(&vhfc_cards_list_sem);
+	list_del(&card->node);
+	up_write(&vhfc_cards_list_sem);
+	vhfc_card_put(card);
+
+	if (card->tick_source_registered) {
+		ks_tick_source_unregister(&card->ks_tick_source);
+		card->tick_source_registered = FALSE;
+	}
+
+	if (card->clock_running) {
+		hrtimer_cancel(&card->clock);
+		card->clock_running = FALSE;
+	}
+
+	tasklet_kill(&card->clock_tasklet);
+
+	for (i=card->num_ports - 1; i>=0; i--)
+		vhfc_port_unregister(&card->ports[i]);
+
+	ks_node_unregister(&card->ks_node);
+}
+
+static void vhfc_cards_destroy(void)
+{
+	struct vhfc_card *card;
+
+	for (;;) {
+		down_read(&vhfc_cards_list_sem);
+		if (list_empty(&vhfc_cards_list)) {
+			up_read(&vhfc_cards_list_sem);
+			break;
+		}
+
+		card = list_entry(vhfc_cards_list.next,
+					struct vhfc_card, node);
+		up_read(&vhfc_cards_list_sem);
+
+		vhfc_card_unregister(card);
+		vhfc_card_destroy(card);
+	}
+}
+
+/******************************************
+ * Module stuff
+ ******************************************/
+
+static int __init vhfc_init_module(void)
+{
+	struct vhfc_card *card;
+	int err;
+	int i;
+
+	vhfc_msg(KERN_INFO, vhfc_MODULE_DESCR " loading\n");
+
+	if (ports <= 0 || ports > VHFC_MAX_PORTS)
+		ports = VHFC_DEFAULT_PORTS;
+
+	if (clock_period <= 0)
+		clock_period = VHFC_DEFAULT_CLOCK_PERIOD;
+
+	if (fifo_size < 64)
+		fifo_size = VHFC_DEFAULT_FIFO_SIZE;
+
+	if (fifo_frames <= 0)
+		fifo_frames = VHFC_DEFAULT_FIFO_FRAMES;
+
+	vhfc_hdlc_framer_class = ks_feature_register("hdlc_framer");
+	if (!vhfc_hdlc_framer_class) {
+		err = -ENOMEM;
+		goto err_register_hdlc_framer;
+	}
+
+	vhfc_hdlc_deframer_class = ks_feature_register("hdlc_deframer");
+	if (!vhfc_hdlc_deframer_class) {
+		err = -ENOMEM;
+		goto err_register_hdlc_deframer;
+	}
+
+	for (i=0; i<cards; i++) {
+		card = vhfc_card_create(i);
+		if (!card) {
+			err = -ENOMEM;
+			goto err_card_create;
+		}
+
+		err = vhfc_card_register(card);
+		if (err < 0) {
+			vhfc_card_destroy(card);
+			goto err_card_register;
+		}
+	}
+
+	vhfc_msg(KERN_INFO, vhfc_MODULE_DESCR " loaded successfully\n");
+
+	return 0;
+
+err_card_register:
+err_card_create:
+	vhfc_cards_destroy();
+	ks_feature_unregister(vhfc_hdlc_deframer_class);
+err_register_hdlc_deframer:
+	ks_feature_unregister(vhfc_hdlc_framer_class);
+err_register_hdlc_framer:
+
+	return err;
+}
+
+module_init(vhfc_init_module);
+
+static void __exit vhfc_module_exit(void)
+{
+	vhfc_cards_destroy();
+
+	ks_feature_unregister(vhfc_hdlc_deframer_class);
+	ks_feature_unregister(vhfc_hdlc_framer_class);
+
+	vhfc_msg(KERN_INFO, vhfc_MODULE_DESCR " unloaded\n");
+}
+
+module_exit(vhfc_module_exit);
+
+MODULE_DESCRIPTION(vhfc_MODULE_DESCR);
+MODULE_AUTHOR("Daniele (Vihai) Orlandi <daniele@orlandi.com>");
+MODULE_LICENSE("GPL");
+
+module_param(cards, int, 0444);
+MODULE_PARM_DESC(cards, "Number of virtual cards");
+
+module_param(ports, int, 0444);
+MODULE_PARM_DESC(ports, "Ports per card, NT ports are wired to the next one");
+
+module_param(pri, int, 0444);
+MODULE_PARM_DESC(pri, "Create E1 PRI ports instead of S/T BRI ports");
+
+module_param(clock_period, int, 0444);
+MODULE_PARM_DESC(clock_period, "Period of the cards' clock in usecs");
+
+module_param(fifo_size, int, 0444);
+MODULE_PARM_DESC(fifo_size, "Size of each transparent FIFO in octets");
+
+module_param(fifo_frames, int, 0444);
+MODULE_PARM_DESC(fifo_frames, "Frames each HDLC FIFO may hold");
+
+module_param(tick_source, int, 0444);
+MODULE_PARM_DESC(tick_source,
+	"Clock the kstreamer tick engine from the first card's clock");
+
+#ifdef DEBUG_CODE
+module_param(debug_level, int, 0444);
+MODULE_PARM_DESC(debug_level, "Initial debug level");
+#endif
@@ -0,0 +1,510 @@
+/*
+ * Echo canceller test harness and benchmark
+ *
+ * Copyright (C) 2007 Daniele Orlandi
+ *
+ * Authors: Daniele "Vihai" Orlandi <daniele@orlandi.com>
+ *
+ * This program is free software and may be modified and distributed
+ * under the terms and conditions of the GNU General Public License.
+ *
+ */
+
+/*
+ * The algorithm is chosen at build time, the headers all define the same
+ * symbols: ECBENCH_KB1EC, ECBENCH_MEC2 or ECBENCH_MG2EC.
+ *
+ * Far-end and near-end are either synthesized, the echo being the far-end
+ * convolved with a decaying impulse response, or read from raw A-law
+ * files. Both go through A-law as they would on the line.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+
+#if defined(ECBENCH_KB1EC)
+#include "kb1ec.h"
+#define ECBENCH_ALGO "kb1ec"
+#elif defined(ECBENCH_MEC2)
+#include "mec2.h"
+#define ECBENCH_ALGO "mec2"
+#elif defined(ECBENCH_MG2EC)
+#include "mg2ec.h"
+#define ECBENCH_ALGO "mg2ec"
+#else
+#error "Define one of ECBENCH_KB1EC, ECBENCH_MEC2, ECBENCH_MG2EC"
+#endif
+
+#define SAMPLE_RATE 8000
+
+struct opts
+{
+	int taps;
+	int seconds;
+	int frame;
+	int delay;
+	double erl;
+	double noise;
+	int doubletalk;
+	double threshold;
+	int window;
+	unsigned int seed;
+	int verbose;
+
+	const char *farend_filename;
+	const char *nearend_filename;
+	const char *output_filename;
+};
+
+/*---------------------------------------------------------------------------*/
+
+static unsigned char linear_to_alaw(int linear)
+{
+	int mask;
+	int seg;
+	int pcm_val = linear;
+	unsigned char aval;
+	static const int seg_end[8] = {
+		0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF, 0x3FFF, 0x7FFF };
+
+	if (pcm_val >= 0) {
+		mask = 0x55 | 0x80;
+	} else {
+		mask = 0x55;
+		pcm_val = -pcm_val - 8;
+		if (pcm_val < 0)
+			pcm_val = 0;
+	}
+
+	for (seg=0; seg<8; seg++) {
+		if (pcm_val <= seg_end[seg])
+			break;
+	}
+
+	if (seg >= 8)
+		return 0x7F ^ mask;
+
+	aval = seg << 4;
+	if (seg < 2)
+		aval |= (pcm_val >> 4) & 0x0f;
+	else
+		aval |= (pcm_val >> (seg + 3)) & 0x0f;
+
+	return aval ^ mask;
+}
+
+static short alaw_to_linear(unsigned char alaw)
+{
+	int i;
+	int seg;
+
+	alaw ^= 0x55;
+	i = ((alaw & 0x0f) << 4) + 8;
+	seg = (alaw & 0x70) >> 4;
+	if (seg)
+		i = (i + 0x100) << (seg - 1);
+
+	return (alaw & 0x80) ? i : -i;
+}
+
+static short alaw_round_trip(double val)
+{
+	if (val > 32767)
+		val = 32767;
+	else if (val < -32768)
+		val = -32768;
+
+	return alaw_to_linear(linear_to_alaw((int)val));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Deterministic, so runs can be compared across builds */
+static unsigned int rnd_state;
+
+static double rnd_uniform(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+
+	return ((rnd_state >> 8) & 0xffff) / 32768.0 - 1.0;
+}
+
+/* Low-passed noise with a syllabic envelope, roughly speech shaped */
+static void synth_speech(short *out, int len, double level, double phase)
+{
+	double lp = 0;
+	int i;
+
+	for (i=0; i<len; i++) {
+		double env = 0.5 + 0.5 * sin(2 * M_PI * 3.0 * i / SAMPLE_RATE +
+									phase);
+
+		lp = 0.7 * lp + 0.3 * rnd_uniform();
+
+		out[i] = alaw_round_trip(level * env * lp * 4);
+	}
+}
+
+static void synth_echo(
+	const short *farend,
+	short *nearend,
+	int len,
+	struct opts *opts)
+{
+	double h[64];
+	double gain = pow(10, -opts->erl / 20);
+	double norm = 0;
+	int i;
+	int k;
+
+	/* Scaled so that the echo is erl dB below the far-end */
+	for (k=0; k<64; k++) {
+		h[k] = pow(0.7, k) * ((k & 1) ? -0.5 : 1.0);
+		norm += h[k] * h[k];
+	}
+
+	for (k=0; k<64; k++)
+		h[k] *= gain / sqrt(norm);
+
+	for (i=0; i<len; i++) {
+		double acc = opts->noise * rnd_uniform();
+
+		for (k=0; k<64; k++) {
+			int pos = i - opts->delay - k;
+
+			if (pos >= 0)
+				acc += h[k] * farend[pos];
+		}
+
+		nearend[i] = alaw_round_trip(acc);
+	}
+}
+
+static int read_alaw_file(const char *filename, short **samples)
+{
+	unsigned char *buf;
+	FILE *f;
+	long size;
+	int i;
+
+	f = fopen(filename, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot open %s: %s\n",
+			filename, strerror(errno));
+		exit(1);
+	}
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	buf = malloc(size);
+	*samples = malloc(size * sizeof(short));
+	if (!buf || !*samples) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		exit(1);
+	}
+
+	if (fread(buf, 1, size, f) != size) {
+		fprintf(stderr, "Cannot read %s: %s\n",
+			filename, strerror(errno));
+		exit(1);
+	}
+
+	fclose(f);
+
+	for (i=0; i<size; i++)
+		(*samples)[i] = alaw_to_linear(buf[i]);
+
+	free(buf);
+
+	return size;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void run_ec(
+	echo_can_state_t *ec,
+	const short *ref,
+	short *sig,
+	int len)
+{
+#ifdef ECBENCH_MG2EC
+	echo_can_update_frame(ec, ref, sig, len);
+#else
+	int i;
+
+	for (i=0; i<len; i++)
+		sig[i] = echo_can_update(ec, ref[i], sig[i]);
+#endif
+}
+
+static double energy(const short *buf, int len)
+{
+	double acc = 0;
+	int i;
+
+	for (i=0; i<len; i++)
+		acc += (double)buf[i] * buf[i];
+
+	return acc;
+}
+
+static double erle_db(double ne, double out)
+{
+	return 10 * log10((ne + 1) / (out + 1));
+}
+
+static void report(
+	const short *nearend,
+	const short *output,
+	int len,
+	double elapsed,
+	struct opts *opts)
+{
+	double ne_steady = 0;
+	double out_steady = 0;
+	int converged_at = 0;
+	int i;
+
+	/* Convergence is the end of the last window below threshold,
+	 * windows without echo do not count
+	 */
+	for (i=0; i + opts->window <= len; i += opts->window) {
+		double ne = energy(nearend + i, opts->window);
+		double out = energy(output + i, opts->window);
+		double erle = erle_db(ne, out);
+
+		if (opts->verbose)
+			printf("%8.3f %6.1f\n", (double)i / SAMPLE_RATE, erle);
+
+		if (ne / opts->window < 100)
+			continue;
+
+		if (erle < opts->threshold)
+			converged_at = i + opts->window;
+
+		if (i >= len / 2) {
+			ne_steady += ne;
+			out_steady += out;
+		}
+	}
+
+	printf("algorithm    %s\n", ECBENCH_ALGO);
+	printf("taps         %d\n", opts->taps);
+	printf("samples      %d (%.1f s)\n", len, (double)len / SAMPLE_RATE);
+	printf("ERLE         %.1f dB (second half)\n",
+		erle_db(ne_steady, out_steady));
+
+	if (converged_at + opts->window > len)
+		printf("convergence  not reached (%.0f dB)\n", opts->threshold);
+	else
+		printf("convergence  %.3f s (%.0f dB)\n",
+			(double)converged_at / SAMPLE_RATE, opts->threshold);
+
+	printf("throughput   %.0f samples/s (%.0f channels/core)\n",
+		len / elapsed, len / elapsed / SAMPLE_RATE);
+}
+
+static void print_usage(const char *progname)
+{
+	fprintf(stderr,
+"%s: [options]\n"
+"	[-t|--taps <taps>]              Echo canceller length (128)\n"
+"	[-s|--seconds <s>]              Synthetic signal length (10)\n"
+"	[-f|--frame <samples>]          Samples per call (160)\n"
+"	[-d|--delay <samples>]          Synthetic echo delay (40)\n"
+"	[-e|--erl <dB>]                 Synthetic echo return loss (10)\n"
+"	[-n|--noise <level>]            Near-end noise amplitude (0)\n"
+"	[-D|--doubletalk]               Near-end speech in the third quarter\n"
+"	[-T|--threshold <dB>]           ERLE defining convergence (20)\n"
+"	[-w|--window <ms>]              ERLE window (100)\n"
+"	[-S|--seed <n>]                 Synthetic signal seed (1)\n"
+"	[-F|--farend <file>]            Raw A-law far-end\n"
+"	[-N|--nearend <file>]           Raw A-law near-end\n"
+"	[-o|--output <file>]            Write cancelled near-end, A-law\n"
+"	[-v|--verbose]                  Print ERLE for every window\n",
+		progname);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct opts opts;
+	struct timespec start, end;
+	echo_can_state_t *ec;
+	short *farend;
+	short *nearend;
+	short *output;
+	double elapsed;
+	int len;
+	int i;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.taps = 128;
+	opts.seconds = 10;
+	opts.frame = 160;
+	opts.delay = 40;
+	opts.erl = 10;
+	opts.threshold = 20;
+	opts.window = 100;
+	opts.seed = 1;
+
+	struct option options[] = {
+		{ "taps", required_argument, 0, 't' },
+		{ "seconds", required_argument, 0, 's' },
+		{ "frame", required_argument, 0, 'f' },
+		{ "delay", required_argument, 0, 'd' },
+		{ "erl", required_argument, 0, 'e' },
+		{ "noise", required_argument, 0, 'n' },
+		{ "doubletalk", no_argument, 0, 'D' },
+		{ "threshold", required_argument, 0, 'T' },
+		{ "window", required_argument, 0, 'w' },
+		{ "seed", required_argument, 0, 'S' },
+		{ "farend", required_argument, 0, 'F' },
+		{ "nearend", required_argument, 0, 'N' },
+		{ "output", required_argument, 0, 'o' },
+		{ "verbose", no_argument, 0, 'v' },
+		{ }
+	};
+
+	int c;
+	int optidx;
+
+	for(;;) {
+		c = getopt_long(argc, argv, "t:s:f:d:e:n:DT:w:S:F:N:o:v",
+			options, &optidx);
+
+		if (c == -1)
+			break;
+
+		switch(c) {
+		case 't': opts.taps = atoi(optarg); break;
+		case 's': opts.seconds = atoi(optarg); break;
+		case 'f': opts.frame = atoi(optarg); break;
+		case 'd': opts.delay = atoi(optarg); break;
+		case 'e': opts.erl = atof(optarg); break;
+		case 'n': opts.noise = atof(optarg); break;
+		case 'D': opts.doubletalk = 1; break;
+		case 'T': opts.threshold = atof(optarg); break;
+		case 'w': opts.window = atoi(optarg); break;
+		case 'S': opts.seed = atoi(optarg); break;
+		case 'F': opts.farend_filename = optarg; break;
+		case 'N': opts.nearend_filename = optarg; break;
+		case 'o': opts.output_filename = optarg; break;
+		case 'v': opts.verbose = 1; break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	if (opts.taps <= 0 || opts.frame <= 0 || opts.window <= 0 ||
+	    opts.seconds <= 0)
+		print_usage(argv[0]);
+
+	if (!opts.farend_filename != !opts.nearend_filename) {
+		fprintf(stderr, "Far-end and near-end go together\n");
+		print_usage(argv[0]);
+	}
+
+	opts.window = opts.window * SAMPLE_RATE / 1000;
+
+	if (opts.farend_filename) {
+		int ne_len;
+
+		len = read_alaw_file(opts.farend_filename, &farend);
+		ne_len = read_alaw_file(opts.nearend_filename, &nearend);
+
+		if (ne_len < len)
+			len = ne_len;
+	} else {
+		len = opts.seconds * SAMPLE_RATE;
+		rnd_state = opts.seed;
+
+		farend = malloc(len * sizeof(short));
+		nearend = malloc(len * sizeof(short));
+		if (!farend || !nearend) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return 1;
+		}
+
+		synth_speech(farend, len, 8000, 0);
+		synth_echo(farend, nearend, len, &opts);
+
+		if (opts.doubletalk) {
+			int from = len / 2;
+			int dt_len = len / 4;
+			short *dt = malloc(dt_len * sizeof(short));
+
+			synth_speech(dt, dt_len, 4000, M_PI / 2);
+
+			for (i=0; i<dt_len; i++)
+				nearend[from + i] = alaw_round_trip(
+					nearend[from + i] + dt[i]);
+
+			free(dt);
+		}
+	}
+
+	output = malloc(len * sizeof(short));
+	if (!output) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 1;
+	}
+
+	memcpy(output, nearend, len * sizeof(short));
+
+	ec = echo_can_create(opts.taps, 0);
+	if (!ec) {
+		fprintf(stderr, "Cannot create echo canceller\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i=0; i<len; i += opts.frame) {
+		int l = len - i < opts.frame ? len - i : opts.frame;
+
+		run_ec(ec, farend + i, output + i, l);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	echo_can_free(ec);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	/* A-law out, as the line would see it */
+	for (i=0; i<len; i++)
+		output[i] = alaw_round_trip(output[i]);
+
+	if (opts.output_filename) {
+		FILE *f = fopen(opts.output_filename, "wb");
+
+		if (!f) {
+			fprintf(stderr, "Cannot open %s: %s\n",
+				opts.output_filename, strerror(errno));
+			return 1;
+		}
+
+		for (i=0; i<len; i++)
+			fputc(linear_to_alaw(output[i]), f);
+
+		fclose(f);
+	}
+
+	report(nearend, output, len, elapsed, &opts);
+
+	free(output);
+	free(nearend);
+	free(farend);
+
+	return 0;
+}